@@ -33,9 +33,16 @@
 #include <array>
 #include <assert.h>
 #include <bitset>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
 #include <memory>
 #include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
 #include <type_traits>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -178,6 +185,171 @@ public:
     }
 };
 
+/**
+ * @brief Precomputed unit conversion for a fixed set of real variables
+ *
+ * All conversions are affine, `out[i] = factor[i] * in[i] + offset[i]`,
+ * with one factor/offset array per direction so that whole frames are
+ * converted by a single loop the compiler vectorizes. For variables whose
+ * type is a relative quantity all offsets are zero.
+ *
+ * Use `fmi2_t::unit_conversion` to build an instance.
+ */
+class unit_conversion_t
+{
+private:
+    std::vector<fmi2_value_reference_t> _vrs;
+    /** @brief unit -> SI base unit */
+    std::vector<fmi2_real_t> _to_SI_factor, _to_SI_offset;
+    /** @brief SI base unit -> unit */
+    std::vector<fmi2_real_t> _from_SI_factor, _from_SI_offset;
+    /** @brief unit -> display unit */
+    std::vector<fmi2_real_t> _to_display_factor, _to_display_offset;
+    /** @brief display unit -> unit */
+    std::vector<fmi2_real_t> _from_display_factor, _from_display_offset;
+    /** @brief buffer used by the fused set functions */
+    std::vector<fmi2_real_t> _buffer;
+
+    static void _affine(const fmi2_real_t in[], fmi2_real_t out[], size_t n,
+                        const fmi2_real_t factor[],
+                        const fmi2_real_t offset[]) noexcept
+    {
+        for (size_t i = 0; i < n; ++i) {
+            out[i] = factor[i] * in[i] + offset[i];
+        }
+    }
+
+public:
+    /**
+     * @brief Add a variable to the conversion table
+     *
+     * @param[in] vr value reference
+     * @param[in] unit_factor, unit_offset `value_SI = factor * value + offset`
+     * @param[in] display_factor, display_offset
+     *     `value_display = factor * value + offset`
+     * @param[in] relative_quantity ignore the offsets
+     */
+    void push_back(fmi2_value_reference_t vr, fmi2_real_t unit_factor,
+                   fmi2_real_t unit_offset, fmi2_real_t display_factor,
+                   fmi2_real_t display_offset, bool relative_quantity)
+    {
+        if (relative_quantity) {
+            unit_offset = 0.0;
+            display_offset = 0.0;
+        }
+        _vrs.push_back(vr);
+        _to_SI_factor.push_back(unit_factor);
+        _to_SI_offset.push_back(unit_offset);
+        _from_SI_factor.push_back(1.0 / unit_factor);
+        _from_SI_offset.push_back(-unit_offset / unit_factor);
+        _to_display_factor.push_back(display_factor);
+        _to_display_offset.push_back(display_offset);
+        _from_display_factor.push_back(1.0 / display_factor);
+        _from_display_offset.push_back(-display_offset / display_factor);
+        _buffer.push_back(0.0);
+    }
+
+    size_t size() const noexcept
+    {
+        return _vrs.size();
+    }
+
+    const std::vector<fmi2_value_reference_t> &vrs() const noexcept
+    {
+        return _vrs;
+    }
+
+    /**
+     * @brief Convert a frame from "units" to "display units"
+     *
+     * `in` and `out` hold `size()` values and may be the same array.
+     */
+    void to_display_unit(const fmi2_real_t in[], fmi2_real_t out[]) const
+        noexcept
+    {
+        _affine(in, out, _vrs.size(), _to_display_factor.data(),
+                _to_display_offset.data());
+    }
+
+    /**
+     * @brief Convert a frame from "display units" to "units"
+     */
+    void from_display_unit(const fmi2_real_t in[], fmi2_real_t out[]) const
+        noexcept
+    {
+        _affine(in, out, _vrs.size(), _from_display_factor.data(),
+                _from_display_offset.data());
+    }
+
+    /**
+     * @brief Convert a frame from "units" to SI base units
+     */
+    void to_SI_base_unit(const fmi2_real_t in[], fmi2_real_t out[]) const
+        noexcept
+    {
+        _affine(in, out, _vrs.size(), _to_SI_factor.data(),
+                _to_SI_offset.data());
+    }
+
+    /**
+     * @brief Convert a frame from SI base units to "units"
+     */
+    void from_SI_base_unit(const fmi2_real_t in[], fmi2_real_t out[]) const
+        noexcept
+    {
+        _affine(in, out, _vrs.size(), _from_SI_factor.data(),
+                _from_SI_offset.data());
+    }
+
+    /**
+     * @brief Get all variables from `fmu` converted to display units
+     *
+     * `out` is left as the FMU wrote it if `get_real` fails.
+     */
+    template <typename fmu_t>
+    fmi2_status_t get_display_unit(const fmu_t &fmu, fmi2_real_t out[]) const
+    {
+        auto status = fmu.get_real(_vrs.data(), _vrs.size(), out);
+        if (status == fmi2_status_ok || status == fmi2_status_warning) {
+            to_display_unit(out, out);
+        }
+        return status;
+    }
+
+    /**
+     * @brief Set all variables of `fmu` from values given in display units
+     */
+    template <typename fmu_t>
+    fmi2_status_t set_display_unit(fmu_t &fmu, const fmi2_real_t in[])
+    {
+        from_display_unit(in, _buffer.data());
+        return fmu.set_real(_vrs.data(), _vrs.size(), _buffer.data());
+    }
+
+    /**
+     * @brief Get all variables from `fmu` converted to SI base units
+     */
+    template <typename fmu_t>
+    fmi2_status_t get_SI_base_unit(const fmu_t &fmu, fmi2_real_t out[]) const
+    {
+        auto status = fmu.get_real(_vrs.data(), _vrs.size(), out);
+        if (status == fmi2_status_ok || status == fmi2_status_warning) {
+            to_SI_base_unit(out, out);
+        }
+        return status;
+    }
+
+    /**
+     * @brief Set all variables of `fmu` from values given in SI base units
+     */
+    template <typename fmu_t>
+    fmi2_status_t set_SI_base_unit(fmu_t &fmu, const fmi2_real_t in[])
+    {
+        from_SI_base_unit(in, _buffer.data());
+        return fmu.set_real(_vrs.data(), _vrs.size(), _buffer.data());
+    }
+};
+
 class variable_t
 {
 private:
@@ -592,52 +764,1545 @@ public:
         return variable_list_t{vl};
     }
 
-    template <typename T = variable_list_t>
-    void concatenate(T &&other) noexcept
+    template <typename T = variable_list_t>
+    void concatenate(T &&other) noexcept
+    {
+        auto vl = fmi2_import_join_var_list(_vl.get(),
+                                            std::forward<T>(other)._vl.get());
+        if (!vl) {
+            throw std::runtime_error(
+                "Memory allocation failed for new variable list");
+        }
+        this->_vl.reset(vl);
+    }
+
+    template <typename T = variable_t>
+    void append(T &&v)
+    {
+        auto vl = fmi2_import_append_to_var_list(_vl.get(),
+                                                 std::forward<T>(v).c_ptr());
+        if (!vl) {
+            throw std::runtime_error(
+                "Memory allocation failed for new variable list");
+        }
+
+        this->_vl.reset(vl);
+    }
+
+    template <typename T = variable_t>
+    void prepend(T &&v)
+    {
+        auto vl = fmi2_import_prepend_to_var_list(_vl.get(),
+                                                  std::forward<T>(v).c_ptr());
+        if (!vl) {
+            throw std::runtime_error(
+                "Memory allocation failed for new variable list");
+        }
+        this->_vl.reset(vl);
+    }
+
+    template <typename T = variable_t>
+    jm_status_enu_t push_back(T &&v)
+    {
+        return fmi2_import_var_list_push_back(_vl.get(),
+                                              std::forward<T>(v).c_ptr());
+    }
+};
+
+/**
+ * @brief Bump arena holding copies of strings returned by the FMU
+ *
+ * Strings returned by `fmi2GetString` are only valid until the next call
+ * into the FMU. The arena copies a whole batch of them into large blocks,
+ * de-duplicates repeated values and hands out `std::string_view`s that stay
+ * valid until `clear()` is called. Blocks and the intern table are kept
+ * across `clear()`, so a steady-state frame does not allocate at all.
+ */
+class string_arena_t
+{
+private:
+    struct block_t
+    {
+        std::unique_ptr<char[]> data;
+        size_t size;
+    };
+
+    /** @brief memory blocks, `_blocks[_current]` is the one being filled */
+    std::vector<block_t> _blocks;
+    size_t _current = 0;
+    size_t _used = 0;
+    size_t _block_size;
+
+    /** @brief open addressing intern table, empty slots have null data */
+    std::vector<std::string_view> _table;
+    size_t _count = 0;
+
+    /** @brief scratch buffer for the raw pointers returned by the FMU */
+    std::vector<fmi2_string_t> _raw;
+
+    static size_t _hash(std::string_view s) noexcept
+    {
+        // FNV-1a
+        uint64_t h = 14695981039346656037ull;
+        for (unsigned char c : s) {
+            h = (h ^ c) * 1099511628211ull;
+        }
+        return static_cast<size_t>(h);
+    }
+
+    char *_allocate(size_t n)
+    {
+        while (_current < _blocks.size()) {
+            auto &b = _blocks[_current];
+            if (b.size - _used >= n) {
+                auto p = b.data.get() + _used;
+                _used += n;
+                return p;
+            }
+            ++_current;
+            _used = 0;
+        }
+        auto sz = std::max(n, _block_size);
+        _blocks.push_back(block_t{std::make_unique<char[]>(sz), sz});
+        _current = _blocks.size() - 1;
+        _used = n;
+        return _blocks.back().data.get();
+    }
+
+    void _rehash(size_t capacity)
+    {
+        std::vector<std::string_view> table(capacity);
+        for (auto &s : _table) {
+            if (s.data() == nullptr) {
+                continue;
+            }
+            auto i = _hash(s) & (capacity - 1);
+            while (table[i].data() != nullptr) {
+                i = (i + 1) & (capacity - 1);
+            }
+            table[i] = s;
+        }
+        _table.swap(table);
+    }
+
+public:
+    /**
+     * @brief string_arena_t constructor
+     *
+     * @param[in] block_size size of a single memory block in bytes
+     */
+    explicit string_arena_t(size_t block_size = 4096)
+        : _block_size{block_size > 0 ? block_size : 1}, _table(64)
+    {
+    }
+
+    string_arena_t(string_arena_t const &) = delete;
+    string_arena_t &operator=(string_arena_t const &) = delete;
+    string_arena_t(string_arena_t &&) = default;
+    string_arena_t &operator=(string_arena_t &&) = default;
+
+    /**
+     * @brief Copy a string into the arena, or return the copy already made
+     * for an equal string since the last `clear()`.
+     *
+     * A null pointer results in an empty view.
+     */
+    std::string_view intern(fmi2_string_t s)
+    {
+        if (s == nullptr) {
+            return {};
+        }
+        std::string_view key{s};
+        if ((_count + 1) * 2 > _table.size()) {
+            _rehash(_table.size() * 2);
+        }
+        auto mask = _table.size() - 1;
+        auto i = _hash(key) & mask;
+        while (_table[i].data() != nullptr) {
+            if (_table[i] == key) {
+                return _table[i];
+            }
+            i = (i + 1) & mask;
+        }
+        // keep the terminating zero so that views can be passed back as
+        // fmi2_string_t
+        auto p = _allocate(key.size() + 1);
+        std::memcpy(p, key.data(), key.size());
+        p[key.size()] = '\0';
+        _table[i] = std::string_view{p, key.size()};
+        ++_count;
+        return _table[i];
+    }
+
+    /**
+     * @brief Intern a batch of strings
+     *
+     * @param[in] values strings returned by the FMU
+     * @param[in] n number of strings
+     * @param[out] out stable views, valid until `clear()`
+     */
+    void capture(const fmi2_string_t values[], size_t n, std::string_view out[])
+    {
+        for (size_t i = 0; i < n; ++i) {
+            out[i] = intern(values[i]);
+        }
+    }
+
+    /**
+     * @brief Scratch buffer for `n` raw string pointers, reused across calls
+     */
+    fmi2_string_t *raw_buffer(size_t n)
+    {
+        if (_raw.size() < n) {
+            _raw.resize(n);
+        }
+        return _raw.data();
+    }
+
+    /**
+     * @brief Invalidate all views and start a new frame. Memory is kept.
+     */
+    void clear() noexcept
+    {
+        if (_count > 0) {
+            std::fill(_table.begin(), _table.end(), std::string_view{});
+        }
+        _count = 0;
+        _current = 0;
+        _used = 0;
+    }
+
+    /**
+     * @brief Release all memory held by the arena
+     */
+    void shrink_to_fit()
+    {
+        clear();
+        _blocks.clear();
+        _table.assign(64, std::string_view{});
+        _raw.clear();
+        _raw.shrink_to_fit();
+    }
+
+    /**
+     * @brief Number of distinct strings stored since the last `clear()`
+     */
+    size_t size() const noexcept
+    {
+        return _count;
+    }
+
+    /**
+     * @brief Total bytes reserved by the arena blocks
+     */
+    size_t capacity() const noexcept
+    {
+        size_t c = 0;
+        for (auto &b : _blocks) {
+            c += b.size;
+        }
+        return c;
+    }
+};
+
+/**
+ * @brief Instance-level FMI functions, used to identify calls in policies
+ */
+enum class fmi2_call_t : size_t {
+    instantiate,
+    free_instance,
+    set_debug_logging,
+    setup_experiment,
+    enter_initialization_mode,
+    exit_initialization_mode,
+    terminate,
+    reset,
+    get_real,
+    get_integer,
+    get_boolean,
+    get_string,
+    set_real,
+    set_integer,
+    set_boolean,
+    set_string,
+    get_fmu_state,
+    set_fmu_state,
+    free_fmu_state,
+    serialized_fmu_state_size,
+    serialize_fmu_state,
+    de_serialize_fmu_state,
+    get_directional_derivative,
+    enter_event_mode,
+    new_discrete_states,
+    enter_continuous_time_mode,
+    completed_integrator_step,
+    set_time,
+    set_continuous_states,
+    get_derivatives,
+    get_event_indicators,
+    get_continuous_states,
+    get_nominals_of_continuous_states,
+    set_real_input_derivatives,
+    get_real_output_derivatives,
+    do_step,
+    cancel_step,
+    get_status,
+    get_real_status,
+    get_integer_status,
+    get_boolean_status,
+    get_string_status,
+    count_
+};
+
+/**
+ * @brief FMI function name of a call, e.g. "fmi2GetReal"
+ */
+inline const char *fmi2_call_name(fmi2_call_t id) noexcept
+{
+    static const char *names[] = {"fmi2Instantiate",
+                                  "fmi2FreeInstance",
+                                  "fmi2SetDebugLogging",
+                                  "fmi2SetupExperiment",
+                                  "fmi2EnterInitializationMode",
+                                  "fmi2ExitInitializationMode",
+                                  "fmi2Terminate",
+                                  "fmi2Reset",
+                                  "fmi2GetReal",
+                                  "fmi2GetInteger",
+                                  "fmi2GetBoolean",
+                                  "fmi2GetString",
+                                  "fmi2SetReal",
+                                  "fmi2SetInteger",
+                                  "fmi2SetBoolean",
+                                  "fmi2SetString",
+                                  "fmi2GetFMUstate",
+                                  "fmi2SetFMUstate",
+                                  "fmi2FreeFMUstate",
+                                  "fmi2SerializedFMUstateSize",
+                                  "fmi2SerializeFMUstate",
+                                  "fmi2DeSerializeFMUstate",
+                                  "fmi2GetDirectionalDerivative",
+                                  "fmi2EnterEventMode",
+                                  "fmi2NewDiscreteStates",
+                                  "fmi2EnterContinuousTimeMode",
+                                  "fmi2CompletedIntegratorStep",
+                                  "fmi2SetTime",
+                                  "fmi2SetContinuousStates",
+                                  "fmi2GetDerivatives",
+                                  "fmi2GetEventIndicators",
+                                  "fmi2GetContinuousStates",
+                                  "fmi2GetNominalsOfContinuousStates",
+                                  "fmi2SetRealInputDerivatives",
+                                  "fmi2GetRealOutputDerivatives",
+                                  "fmi2DoStep",
+                                  "fmi2CancelStep",
+                                  "fmi2GetStatus",
+                                  "fmi2GetRealStatus",
+                                  "fmi2GetIntegerStatus",
+                                  "fmi2GetBooleanStatus",
+                                  "fmi2GetStringStatus"};
+    static_assert(sizeof(names) / sizeof(names[0])
+                  == static_cast<size_t>(fmi2_call_t::count_));
+    auto i = static_cast<size_t>(id);
+    return i < static_cast<size_t>(fmi2_call_t::count_) ? names[i] : "";
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//  fmi2_t policies
+//
+//  fmi2_t is parameterized on five orthogonal policies. The defaults compile
+//  down to the plain FMILibrary call, exactly like the unparameterized
+//  class did.
+///////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Argument checking: no checks at all
+ */
+struct no_check_t
+{
+    static constexpr bool pedantic = false;
+
+    template <typename F> static bool check(F &&) noexcept
+    {
+        return true;
+    }
+};
+
+/**
+ * @brief Argument checking: `assert` the argument sizes (default)
+ */
+struct assert_check_t
+{
+    static constexpr bool pedantic = false;
+
+    template <typename F> static bool check(F &&f) noexcept
+    {
+        assert(f());
+        (void)f;
+        return true;
+    }
+};
+
+/**
+ * @brief Argument checking: validate at runtime and fail the call
+ *
+ * Name based access also defaults to pedantic lookup.
+ */
+struct strict_check_t
+{
+    static constexpr bool pedantic = true;
+
+    template <typename F> static bool check(F &&f) noexcept
+    {
+        return f();
+    }
+};
+
+/**
+ * @brief Call tracing: nothing
+ */
+struct no_trace_t
+{
+    void trace_begin(fmi2_call_t) const noexcept
+    {
+    }
+    void trace_end(fmi2_call_t, fmi2_status_t) const noexcept
+    {
+    }
+};
+
+/**
+ * @brief Call tracing: print every call and its status to a stream
+ */
+class stream_trace_t
+{
+private:
+    std::ostream *_os = &std::clog;
+
+public:
+    void trace_stream(std::ostream &os) noexcept
+    {
+        _os = &os;
+    }
+
+    void trace_begin(fmi2_call_t) const noexcept
+    {
+    }
+
+    void trace_end(fmi2_call_t id, fmi2_status_t status) const noexcept
+    {
+        *_os << fmi2_call_name(id) << ": " << fmi2_status_to_string(status)
+             << '\n';
+    }
+};
+
+/**
+ * @brief Call tracing: count calls and accumulate wall time per function
+ */
+class count_trace_t
+{
+private:
+    using clock_t = std::chrono::steady_clock;
+    static constexpr size_t _n = static_cast<size_t>(fmi2_call_t::count_);
+
+    mutable std::array<size_t, _n> _calls{};
+    mutable std::array<clock_t::duration, _n> _time{};
+    mutable clock_t::time_point _start;
+
+public:
+    void trace_begin(fmi2_call_t) const noexcept
+    {
+        _start = clock_t::now();
+    }
+
+    void trace_end(fmi2_call_t id, fmi2_status_t) const noexcept
+    {
+        auto i = static_cast<size_t>(id);
+        _time[i] += clock_t::now() - _start;
+        ++_calls[i];
+    }
+
+    size_t calls(fmi2_call_t id) const noexcept
+    {
+        return _calls[static_cast<size_t>(id)];
+    }
+
+    /**
+     * @brief Accumulated time spent in the FMU, in seconds
+     */
+    double seconds(fmi2_call_t id) const noexcept
+    {
+        return std::chrono::duration<double>(_time[static_cast<size_t>(id)])
+            .count();
+    }
+
+    void reset_trace() noexcept
+    {
+        _calls.fill(0);
+        _time.fill(clock_t::duration::zero());
+    }
+};
+
+/**
+ * @brief Name lookup caching: none, every lookup walks the model description
+ */
+struct no_cache_t
+{
+    static constexpr bool cached = false;
+
+    bool find_vr(const char *, fmi2_value_reference_t &) const noexcept
+    {
+        return false;
+    }
+    void store_vr(const char *, fmi2_value_reference_t) const noexcept
+    {
+    }
+};
+
+/**
+ * @brief Name lookup caching: remember the value reference of every name
+ */
+class name_cache_t
+{
+private:
+    mutable std::unordered_map<std::string, fmi2_value_reference_t> _vrs;
+
+public:
+    static constexpr bool cached = true;
+
+    bool find_vr(const char *name, fmi2_value_reference_t &vr) const noexcept
+    {
+        // a failed allocation only costs the cache hit
+        try {
+            auto it = _vrs.find(name);
+            if (it == _vrs.end()) {
+                return false;
+            }
+            vr = it->second;
+            return true;
+        } catch (...) {
+            return false;
+        }
+    }
+
+    void store_vr(const char *name, fmi2_value_reference_t vr) const noexcept
+    {
+        try {
+            _vrs.emplace(name, vr);
+        } catch (...) {
+        }
+    }
+};
+
+/**
+ * @brief Error raised by `throw_on_error_t`
+ */
+class fmi2_error_t : public std::runtime_error
+{
+private:
+    fmi2_call_t _call;
+    fmi2_status_t _status;
+
+public:
+    fmi2_error_t(fmi2_call_t call, fmi2_status_t status)
+        : std::runtime_error(std::string(fmi2_call_name(call)) + " returned "
+                             + fmi2_status_to_string(status)),
+          _call{call}, _status{status}
+    {
+    }
+
+    fmi2_call_t call() const noexcept
+    {
+        return _call;
+    }
+
+    fmi2_status_t status() const noexcept
+    {
+        return _status;
+    }
+};
+
+/**
+ * @brief Error handling: return the status (default)
+ */
+struct return_status_t
+{
+    static constexpr bool nothrow = true;
+
+    static fmi2_status_t handle(fmi2_call_t, fmi2_status_t status) noexcept
+    {
+        return status;
+    }
+};
+
+/**
+ * @brief Error handling: throw `fmi2_error_t` on error and fatal
+ */
+struct throw_on_error_t
+{
+    static constexpr bool nothrow = false;
+
+    static fmi2_status_t handle(fmi2_call_t id, fmi2_status_t status)
+    {
+        if (status == fmi2_status_error || status == fmi2_status_fatal) {
+            throw fmi2_error_t(id, status);
+        }
+        return status;
+    }
+};
+
+/**
+ * @brief Raw FMI 2.0 functions resolved from the FMU shared library
+ */
+struct fmi2_functions_t
+{
+    fmi2_component_t (*instantiate)(fmi2_string_t, fmi2_type_t, fmi2_string_t,
+                                    fmi2_string_t,
+                                    const fmi2_callback_functions_t *,
+                                    fmi2_boolean_t, fmi2_boolean_t)
+        = nullptr;
+    void (*free_instance)(fmi2_component_t) = nullptr;
+    fmi2_status_t (*set_debug_logging)(fmi2_component_t, fmi2_boolean_t,
+                                       size_t, const fmi2_string_t[])
+        = nullptr;
+    fmi2_status_t (*setup_experiment)(fmi2_component_t, fmi2_boolean_t,
+                                      fmi2_real_t, fmi2_real_t, fmi2_boolean_t,
+                                      fmi2_real_t)
+        = nullptr;
+    fmi2_status_t (*enter_initialization_mode)(fmi2_component_t) = nullptr;
+    fmi2_status_t (*exit_initialization_mode)(fmi2_component_t) = nullptr;
+    fmi2_status_t (*terminate)(fmi2_component_t) = nullptr;
+    fmi2_status_t (*reset)(fmi2_component_t) = nullptr;
+    fmi2_status_t (*get_real)(fmi2_component_t, const fmi2_value_reference_t[],
+                              size_t, fmi2_real_t[])
+        = nullptr;
+    fmi2_status_t (*get_integer)(fmi2_component_t,
+                                 const fmi2_value_reference_t[], size_t,
+                                 fmi2_integer_t[])
+        = nullptr;
+    fmi2_status_t (*get_boolean)(fmi2_component_t,
+                                 const fmi2_value_reference_t[], size_t,
+                                 fmi2_boolean_t[])
+        = nullptr;
+    fmi2_status_t (*get_string)(fmi2_component_t,
+                                const fmi2_value_reference_t[], size_t,
+                                fmi2_string_t[])
+        = nullptr;
+    fmi2_status_t (*set_real)(fmi2_component_t, const fmi2_value_reference_t[],
+                              size_t, const fmi2_real_t[])
+        = nullptr;
+    fmi2_status_t (*set_integer)(fmi2_component_t,
+                                 const fmi2_value_reference_t[], size_t,
+                                 const fmi2_integer_t[])
+        = nullptr;
+    fmi2_status_t (*set_boolean)(fmi2_component_t,
+                                 const fmi2_value_reference_t[], size_t,
+                                 const fmi2_boolean_t[])
+        = nullptr;
+    fmi2_status_t (*set_string)(fmi2_component_t,
+                                const fmi2_value_reference_t[], size_t,
+                                const fmi2_string_t[])
+        = nullptr;
+    fmi2_status_t (*get_fmu_state)(fmi2_component_t, fmi2_FMU_state_t *)
+        = nullptr;
+    fmi2_status_t (*set_fmu_state)(fmi2_component_t, fmi2_FMU_state_t)
+        = nullptr;
+    fmi2_status_t (*free_fmu_state)(fmi2_component_t, fmi2_FMU_state_t *)
+        = nullptr;
+    fmi2_status_t (*serialized_fmu_state_size)(fmi2_component_t,
+                                               fmi2_FMU_state_t, size_t *)
+        = nullptr;
+    fmi2_status_t (*serialize_fmu_state)(fmi2_component_t, fmi2_FMU_state_t,
+                                         fmi2_byte_t[], size_t)
+        = nullptr;
+    fmi2_status_t (*de_serialize_fmu_state)(fmi2_component_t,
+                                            const fmi2_byte_t[], size_t,
+                                            fmi2_FMU_state_t *)
+        = nullptr;
+    /** @note unknowns come first in the raw FMI signature */
+    fmi2_status_t (*get_directional_derivative)(
+        fmi2_component_t, const fmi2_value_reference_t[], size_t,
+        const fmi2_value_reference_t[], size_t, const fmi2_real_t[],
+        fmi2_real_t[])
+        = nullptr;
+
+    /* Model Exchange */
+    fmi2_status_t (*enter_event_mode)(fmi2_component_t) = nullptr;
+    fmi2_status_t (*new_discrete_states)(fmi2_component_t,
+                                         fmi2_event_info_t *)
+        = nullptr;
+    fmi2_status_t (*enter_continuous_time_mode)(fmi2_component_t) = nullptr;
+    fmi2_status_t (*completed_integrator_step)(fmi2_component_t,
+                                               fmi2_boolean_t,
+                                               fmi2_boolean_t *,
+                                               fmi2_boolean_t *)
+        = nullptr;
+    fmi2_status_t (*set_time)(fmi2_component_t, fmi2_real_t) = nullptr;
+    fmi2_status_t (*set_continuous_states)(fmi2_component_t,
+                                           const fmi2_real_t[], size_t)
+        = nullptr;
+    fmi2_status_t (*get_derivatives)(fmi2_component_t, fmi2_real_t[], size_t)
+        = nullptr;
+    fmi2_status_t (*get_event_indicators)(fmi2_component_t, fmi2_real_t[],
+                                          size_t)
+        = nullptr;
+    fmi2_status_t (*get_continuous_states)(fmi2_component_t, fmi2_real_t[],
+                                           size_t)
+        = nullptr;
+    fmi2_status_t (*get_nominals_of_continuous_states)(fmi2_component_t,
+                                                       fmi2_real_t[], size_t)
+        = nullptr;
+
+    /* Co-Simulation */
+    fmi2_status_t (*set_real_input_derivatives)(fmi2_component_t,
+                                                const fmi2_value_reference_t[],
+                                                size_t, const fmi2_integer_t[],
+                                                const fmi2_real_t[])
+        = nullptr;
+    fmi2_status_t (*get_real_output_derivatives)(
+        fmi2_component_t, const fmi2_value_reference_t[], size_t,
+        const fmi2_integer_t[], fmi2_real_t[])
+        = nullptr;
+    fmi2_status_t (*do_step)(fmi2_component_t, fmi2_real_t, fmi2_real_t,
+                             fmi2_boolean_t)
+        = nullptr;
+    fmi2_status_t (*cancel_step)(fmi2_component_t) = nullptr;
+    fmi2_status_t (*get_status)(fmi2_component_t, const fmi2_status_kind_t,
+                                fmi2_status_t *)
+        = nullptr;
+    fmi2_status_t (*get_real_status)(fmi2_component_t,
+                                     const fmi2_status_kind_t, fmi2_real_t *)
+        = nullptr;
+    fmi2_status_t (*get_integer_status)(fmi2_component_t,
+                                        const fmi2_status_kind_t,
+                                        fmi2_integer_t *)
+        = nullptr;
+    fmi2_status_t (*get_boolean_status)(fmi2_component_t,
+                                        const fmi2_status_kind_t,
+                                        fmi2_boolean_t *)
+        = nullptr;
+    fmi2_status_t (*get_string_status)(fmi2_component_t,
+                                       const fmi2_status_kind_t,
+                                       fmi2_string_t *)
+        = nullptr;
+
+    /**
+     * @brief Resolve all functions of the given FMU kind
+     *
+     * @retval true every function required by the FMI 2.0 standard for
+     * the kind was found
+     */
+    bool load(DLL_HANDLE dll, bool is_model_exchange) noexcept
+    {
+        bool ok = true;
+        auto f = [dll, &ok](auto &fp, const char *name) {
+            jm_dll_function_ptr p = nullptr;
+            if (jm_portability_load_dll_function(dll, const_cast<char *>(name),
+                                                 &p)
+                    != jm_status_success
+                || p == nullptr) {
+                ok = false;
+                return;
+            }
+            fp = reinterpret_cast<std::remove_reference_t<decltype(fp)>>(p);
+        };
+        f(instantiate, "fmi2Instantiate");
+        f(free_instance, "fmi2FreeInstance");
+        f(set_debug_logging, "fmi2SetDebugLogging");
+        f(setup_experiment, "fmi2SetupExperiment");
+        f(enter_initialization_mode, "fmi2EnterInitializationMode");
+        f(exit_initialization_mode, "fmi2ExitInitializationMode");
+        f(terminate, "fmi2Terminate");
+        f(reset, "fmi2Reset");
+        f(get_real, "fmi2GetReal");
+        f(get_integer, "fmi2GetInteger");
+        f(get_boolean, "fmi2GetBoolean");
+        f(get_string, "fmi2GetString");
+        f(set_real, "fmi2SetReal");
+        f(set_integer, "fmi2SetInteger");
+        f(set_boolean, "fmi2SetBoolean");
+        f(set_string, "fmi2SetString");
+        f(get_fmu_state, "fmi2GetFMUstate");
+        f(set_fmu_state, "fmi2SetFMUstate");
+        f(free_fmu_state, "fmi2FreeFMUstate");
+        f(serialized_fmu_state_size, "fmi2SerializedFMUstateSize");
+        f(serialize_fmu_state, "fmi2SerializeFMUstate");
+        f(de_serialize_fmu_state, "fmi2DeSerializeFMUstate");
+        f(get_directional_derivative, "fmi2GetDirectionalDerivative");
+        if (is_model_exchange) {
+            f(enter_event_mode, "fmi2EnterEventMode");
+            f(new_discrete_states, "fmi2NewDiscreteStates");
+            f(enter_continuous_time_mode, "fmi2EnterContinuousTimeMode");
+            f(completed_integrator_step, "fmi2CompletedIntegratorStep");
+            f(set_time, "fmi2SetTime");
+            f(set_continuous_states, "fmi2SetContinuousStates");
+            f(get_derivatives, "fmi2GetDerivatives");
+            f(get_event_indicators, "fmi2GetEventIndicators");
+            f(get_continuous_states, "fmi2GetContinuousStates");
+            f(get_nominals_of_continuous_states,
+              "fmi2GetNominalsOfContinuousStates");
+        } else {
+            f(set_real_input_derivatives, "fmi2SetRealInputDerivatives");
+            f(get_real_output_derivatives, "fmi2GetRealOutputDerivatives");
+            f(do_step, "fmi2DoStep");
+            f(cancel_step, "fmi2CancelStep");
+            f(get_status, "fmi2GetStatus");
+            f(get_real_status, "fmi2GetRealStatus");
+            f(get_integer_status, "fmi2GetIntegerStatus");
+            f(get_boolean_status, "fmi2GetBooleanStatus");
+            f(get_string_status, "fmi2GetStringStatus");
+        }
+        return ok;
+    }
+};
+
+/**
+ * @brief Instance calls: through FMILibrary's call wrappers (default)
+ */
+struct fmilibrary_call_t
+{
+    static void open(fmi2_import_t *, const char *,
+                     const fmi2_callback_functions_t &, const jm_callbacks &,
+                     bool) noexcept
+    {
+    }
+
+    static jm_status_enu_t instantiate(fmi2_import_t *fmu,
+                                       fmi2_string_t instance_name,
+                                       fmi2_type_t fmu_type,
+                                       fmi2_string_t resource_location,
+                                       fmi2_boolean_t visible) noexcept
+    {
+        return fmi2_import_instantiate(fmu, instance_name, fmu_type,
+                                       resource_location, visible);
+    }
+
+    static void free_instance(fmi2_import_t *fmu) noexcept
+    {
+        fmi2_import_free_instance(fmu);
+    }
+
+    static fmi2_status_t set_debug_logging(fmi2_import_t *fmu,
+                                           fmi2_boolean_t logging_on,
+                                           size_t n_categories,
+                                           fmi2_string_t categories[]) noexcept
+    {
+        return fmi2_import_set_debug_logging(fmu, logging_on, n_categories,
+                                             categories);
+    }
+
+    static fmi2_status_t setup_experiment(fmi2_import_t *fmu,
+                                          fmi2_boolean_t tolerance_defined,
+                                          fmi2_real_t tolerance,
+                                          fmi2_real_t start_time,
+                                          fmi2_boolean_t stop_time_defined,
+                                          fmi2_real_t stop_time) noexcept
+    {
+        return fmi2_import_setup_experiment(fmu, tolerance_defined, tolerance,
+                                            start_time, stop_time_defined,
+                                            stop_time);
+    }
+
+    static fmi2_status_t enter_initialization_mode(fmi2_import_t *fmu) noexcept
+    {
+        return fmi2_import_enter_initialization_mode(fmu);
+    }
+
+    static fmi2_status_t exit_initialization_mode(fmi2_import_t *fmu) noexcept
+    {
+        return fmi2_import_exit_initialization_mode(fmu);
+    }
+
+    static fmi2_status_t terminate(fmi2_import_t *fmu) noexcept
+    {
+        return fmi2_import_terminate(fmu);
+    }
+
+    static fmi2_status_t reset(fmi2_import_t *fmu) noexcept
+    {
+        return fmi2_import_reset(fmu);
+    }
+
+    static fmi2_status_t set_real(fmi2_import_t *fmu,
+                                  const fmi2_value_reference_t vr[], size_t nvr,
+                                  const fmi2_real_t value[]) noexcept
+    {
+        return fmi2_import_set_real(fmu, vr, nvr, value);
+    }
+
+    static fmi2_status_t set_integer(fmi2_import_t *fmu,
+                                     const fmi2_value_reference_t vr[],
+                                     size_t nvr,
+                                     const fmi2_integer_t value[]) noexcept
+    {
+        return fmi2_import_set_integer(fmu, vr, nvr, value);
+    }
+
+    static fmi2_status_t set_boolean(fmi2_import_t *fmu,
+                                     const fmi2_value_reference_t vr[],
+                                     size_t nvr,
+                                     const fmi2_boolean_t value[]) noexcept
+    {
+        return fmi2_import_set_boolean(fmu, vr, nvr, value);
+    }
+
+    static fmi2_status_t set_string(fmi2_import_t *fmu,
+                                    const fmi2_value_reference_t vr[],
+                                    size_t nvr,
+                                    const fmi2_string_t value[]) noexcept
+    {
+        return fmi2_import_set_string(fmu, vr, nvr, value);
+    }
+
+    static fmi2_status_t get_real(fmi2_import_t *fmu,
+                                  const fmi2_value_reference_t vr[], size_t nvr,
+                                  fmi2_real_t value[]) noexcept
+    {
+        return fmi2_import_get_real(fmu, vr, nvr, value);
+    }
+
+    static fmi2_status_t get_integer(fmi2_import_t *fmu,
+                                     const fmi2_value_reference_t vr[],
+                                     size_t nvr,
+                                     fmi2_integer_t value[]) noexcept
+    {
+        return fmi2_import_get_integer(fmu, vr, nvr, value);
+    }
+
+    static fmi2_status_t get_boolean(fmi2_import_t *fmu,
+                                     const fmi2_value_reference_t vr[],
+                                     size_t nvr,
+                                     fmi2_boolean_t value[]) noexcept
+    {
+        return fmi2_import_get_boolean(fmu, vr, nvr, value);
+    }
+
+    static fmi2_status_t get_string(fmi2_import_t *fmu,
+                                    const fmi2_value_reference_t vr[],
+                                    size_t nvr, fmi2_string_t value[]) noexcept
+    {
+        return fmi2_import_get_string(fmu, vr, nvr, value);
+    }
+
+    static fmi2_status_t get_fmu_state(fmi2_import_t *fmu,
+                                       fmi2_FMU_state_t *s) noexcept
+    {
+        return fmi2_import_get_fmu_state(fmu, s);
+    }
+
+    static fmi2_status_t set_fmu_state(fmi2_import_t *fmu,
+                                       fmi2_FMU_state_t s) noexcept
+    {
+        return fmi2_import_set_fmu_state(fmu, s);
+    }
+
+    static fmi2_status_t free_fmu_state(fmi2_import_t *fmu,
+                                        fmi2_FMU_state_t *s) noexcept
+    {
+        return fmi2_import_free_fmu_state(fmu, s);
+    }
+
+    static fmi2_status_t serialized_fmu_state_size(fmi2_import_t *fmu,
+                                                   fmi2_FMU_state_t s,
+                                                   size_t *sz) noexcept
+    {
+        return fmi2_import_serialized_fmu_state_size(fmu, s, sz);
+    }
+
+    static fmi2_status_t serialize_fmu_state(fmi2_import_t *fmu,
+                                             fmi2_FMU_state_t s,
+                                             fmi2_byte_t data[],
+                                             size_t sz) noexcept
+    {
+        return fmi2_import_serialize_fmu_state(fmu, s, data, sz);
+    }
+
+    static fmi2_status_t de_serialize_fmu_state(fmi2_import_t *fmu,
+                                                const fmi2_byte_t data[],
+                                                size_t sz,
+                                                fmi2_FMU_state_t *s) noexcept
+    {
+        return fmi2_import_de_serialize_fmu_state(fmu, data, sz, s);
+    }
+
+    static fmi2_status_t get_directional_derivative(
+        fmi2_import_t *fmu, const fmi2_value_reference_t v_ref[], size_t nv,
+        const fmi2_value_reference_t z_ref[], size_t nz, const fmi2_real_t dv[],
+        fmi2_real_t dz[]) noexcept
+    {
+        return fmi2_import_get_directional_derivative(fmu, v_ref, nv, z_ref, nz,
+                                                      dv, dz);
+    }
+
+    /* Model Exchange */
+    static fmi2_status_t enter_event_mode(fmi2_import_t *fmu) noexcept
+    {
+        return fmi2_import_enter_event_mode(fmu);
+    }
+
+    static fmi2_status_t new_discrete_states(
+        fmi2_import_t *fmu, fmi2_event_info_t *event_info) noexcept
+    {
+        return fmi2_import_new_discrete_states(fmu, event_info);
+    }
+
+    static fmi2_status_t enter_continuous_time_mode(fmi2_import_t *fmu) noexcept
+    {
+        return fmi2_import_enter_continuous_time_mode(fmu);
+    }
+
+    static fmi2_status_t set_time(fmi2_import_t *fmu, fmi2_real_t time) noexcept
+    {
+        return fmi2_import_set_time(fmu, time);
+    }
+
+    static fmi2_status_t set_continuous_states(fmi2_import_t *fmu,
+                                               const fmi2_real_t x[],
+                                               size_t nx) noexcept
+    {
+        return fmi2_import_set_continuous_states(fmu, x, nx);
+    }
+
+    static fmi2_status_t completed_integrator_step(
+        fmi2_import_t *fmu, fmi2_boolean_t no_set_fmu_state_prior,
+        fmi2_boolean_t *enter_event,
+        fmi2_boolean_t *terminate_simulation) noexcept
+    {
+        return fmi2_import_completed_integrator_step(fmu,
+                                                     no_set_fmu_state_prior,
+                                                     enter_event,
+                                                     terminate_simulation);
+    }
+
+    static fmi2_status_t get_derivatives(fmi2_import_t *fmu,
+                                         fmi2_real_t derivatives[],
+                                         size_t nx) noexcept
+    {
+        return fmi2_import_get_derivatives(fmu, derivatives, nx);
+    }
+
+    static fmi2_status_t get_event_indicators(fmi2_import_t *fmu,
+                                              fmi2_real_t event_indicators[],
+                                              size_t ni) noexcept
+    {
+        return fmi2_import_get_event_indicators(fmu, event_indicators, ni);
+    }
+
+    static fmi2_status_t get_continuous_states(fmi2_import_t *fmu,
+                                               fmi2_real_t x[],
+                                               size_t nx) noexcept
+    {
+        return fmi2_import_get_continuous_states(fmu, x, nx);
+    }
+
+    static fmi2_status_t get_nominals_of_continuous_states(
+        fmi2_import_t *fmu, fmi2_real_t x_nominal[], size_t nx) noexcept
+    {
+        return fmi2_import_get_nominals_of_continuous_states(fmu, x_nominal,
+                                                             nx);
+    }
+
+    /* Co-Simulation */
+    static fmi2_status_t set_real_input_derivatives(
+        fmi2_import_t *fmu, const fmi2_value_reference_t vr[], size_t nvr,
+        const fmi2_integer_t order[], const fmi2_real_t value[]) noexcept
+    {
+        return fmi2_import_set_real_input_derivatives(fmu, vr, nvr, order,
+                                                      value);
+    }
+
+    static fmi2_status_t get_real_output_derivatives(
+        fmi2_import_t *fmu, const fmi2_value_reference_t vr[], size_t nvr,
+        const fmi2_integer_t order[], fmi2_real_t value[]) noexcept
+    {
+        return fmi2_import_get_real_output_derivatives(fmu, vr, nvr, order,
+                                                       value);
+    }
+
+    static fmi2_status_t do_step(fmi2_import_t *fmu,
+                                 fmi2_real_t current_communication_point,
+                                 fmi2_real_t communication_step_size,
+                                 fmi2_boolean_t new_step) noexcept
+    {
+        return fmi2_import_do_step(fmu, current_communication_point,
+                                   communication_step_size, new_step);
+    }
+
+    static fmi2_status_t cancel_step(fmi2_import_t *fmu) noexcept
+    {
+        return fmi2_import_cancel_step(fmu);
+    }
+
+    static fmi2_status_t get_status(fmi2_import_t *fmu,
+                                    const fmi2_status_kind_t s,
+                                    fmi2_status_t *value) noexcept
+    {
+        return fmi2_import_get_status(fmu, s, value);
+    }
+
+    static fmi2_status_t get_real_status(fmi2_import_t *fmu,
+                                         const fmi2_status_kind_t s,
+                                         fmi2_real_t *value) noexcept
+    {
+        return fmi2_import_get_real_status(fmu, s, value);
+    }
+
+    static fmi2_status_t get_integer_status(fmi2_import_t *fmu,
+                                            const fmi2_status_kind_t s,
+                                            fmi2_integer_t *value) noexcept
+    {
+        return fmi2_import_get_integer_status(fmu, s, value);
+    }
+
+    static fmi2_status_t get_boolean_status(fmi2_import_t *fmu,
+                                            const fmi2_status_kind_t s,
+                                            fmi2_boolean_t *value) noexcept
+    {
+        return fmi2_import_get_boolean_status(fmu, s, value);
+    }
+
+    static fmi2_status_t get_string_status(fmi2_import_t *fmu,
+                                           const fmi2_status_kind_t s,
+                                           fmi2_string_t *value) noexcept
+    {
+        return fmi2_import_get_string_status(fmu, s, value);
+    }
+};
+
+/**
+ * @brief Instance calls: straight to the raw FMI functions
+ *
+ * This is an opt-in fast path for very cheap models where the checks in
+ * FMILibrary's call wrappers show up in profiles. The calls go to the FMU
+ * binary with the cached `fmi2Component`, without FMILibrary's state
+ * checking.
+ *
+ * FMILibrary does not expose the component it creates, so the FMU is
+ * instantiated here and FMILibrary's own instance is never created.
+ */
+class direct_call_t
+{
+private:
+    std::string _ext_dir;
+    jm_callbacks _jm_cb{};
+    DLL_HANDLE _dll = nullptr;
+    fmi2_functions_t _fn;
+    fmi2_component_t _c = nullptr;
+    /** @brief callbacks must stay at a fixed address for the instance */
+    std::unique_ptr<fmi2_callback_functions_t> _cb;
+
+    void _close() noexcept
+    {
+        if (_c) {
+            _fn.free_instance(_c);
+            _c = nullptr;
+        }
+        if (_dll) {
+            jm_portability_free_dll_handle(_dll);
+            _dll = nullptr;
+        }
+    }
+
+public:
+    direct_call_t() = default;
+    direct_call_t(direct_call_t const &) = delete;
+    direct_call_t &operator=(direct_call_t const &) = delete;
+
+    direct_call_t(direct_call_t &&m) noexcept
+        : _ext_dir{std::move(m._ext_dir)}, _jm_cb{m._jm_cb}, _fn{m._fn},
+          _cb{std::move(m._cb)}
+    {
+        std::swap(_dll, m._dll);
+        std::swap(_c, m._c);
+    }
+
+    direct_call_t &operator=(direct_call_t &&m) noexcept
+    {
+        if (this != &m) {
+            _close();
+            _ext_dir = std::move(m._ext_dir);
+            _jm_cb = m._jm_cb;
+            _fn = m._fn;
+            _cb = std::move(m._cb);
+            std::swap(_dll, m._dll);
+            std::swap(_c, m._c);
+        }
+        return *this;
+    }
+
+    ~direct_call_t()
+    {
+        _close();
+    }
+
+    /**
+     * @brief Resolve the raw functions from the binary FMILibrary loaded
+     */
+    void open(fmi2_import_t *fmu, const char *ext_dir,
+              const fmi2_callback_functions_t &fmu_cb,
+              const jm_callbacks &jm_cb, bool is_model_exchange)
+    {
+        _ext_dir = ext_dir;
+        _jm_cb = jm_cb;
+        _cb = std::make_unique<fmi2_callback_functions_t>(fmu_cb);
+        auto identifier = is_model_exchange
+                              ? fmi2_import_get_model_identifier_ME(fmu)
+                              : fmi2_import_get_model_identifier_CS(fmu);
+        auto dll_path = fmi_import_get_dll_path(ext_dir, identifier, &_jm_cb);
+        if (!dll_path) {
+            throw std::runtime_error("Failed to get FMU binary path");
+        }
+        // The binary is already loaded by FMILibrary, this only takes
+        // another reference to it.
+        _dll = jm_portability_load_dll_handle(dll_path);
+        _jm_cb.free(dll_path);
+        if (!_dll) {
+            throw std::runtime_error("Failed to load FMU binary");
+        }
+        if (!_fn.load(_dll, is_model_exchange)) {
+            jm_portability_free_dll_handle(_dll);
+            _dll = nullptr;
+            throw std::runtime_error("Failed to load FMI functions");
+        }
+    }
+
+    /**
+     * @brief Instantiate the FMU through `fmi2Instantiate`
+     *
+     * If `resource_location` is null the resources directory of the
+     * extracted FMU is used.
+     */
+    jm_status_enu_t instantiate(fmi2_import_t *fmu,
+                                fmi2_string_t instance_name,
+                                fmi2_type_t fmu_type,
+                                fmi2_string_t resource_location,
+                                fmi2_boolean_t visible)
+    {
+        if (_c) {
+            return jm_status_error;
+        }
+        char *url = nullptr;
+        if (resource_location == nullptr) {
+            auto dir = _ext_dir + "/resources";
+            url = fmi_import_create_URL_from_abs_path(&_jm_cb, dir.c_str());
+            resource_location = url;
+        }
+        fmi2_boolean_t logging_on
+            = _jm_cb.log_level > jm_log_level_nothing ? fmi2_true : fmi2_false;
+        _c = _fn.instantiate(instance_name, fmu_type, fmi2_import_get_GUID(fmu),
+                             resource_location, _cb.get(), visible,
+                             logging_on);
+        if (url) {
+            _jm_cb.free(url);
+        }
+        return _c ? jm_status_success : jm_status_error;
+    }
+
+    void free_instance(fmi2_import_t *) noexcept
+    {
+        if (_c) {
+            _fn.free_instance(_c);
+            _c = nullptr;
+        }
+    }
+
+    /**
+     * @brief Raw functions, valid after construction
+     */
+    const fmi2_functions_t &functions() const noexcept
+    {
+        return _fn;
+    }
+
+    /**
+     * @brief Raw component, valid after `instantiate`
+     */
+    fmi2_component_t component() const noexcept
+    {
+        return _c;
+    }
+
+    fmi2_status_t set_debug_logging(fmi2_import_t *, fmi2_boolean_t logging_on,
+                                    size_t n_categories,
+                                    fmi2_string_t categories[]) const noexcept
+    {
+        return _fn.set_debug_logging(_c, logging_on, n_categories, categories);
+    }
+
+    fmi2_status_t setup_experiment(fmi2_import_t *,
+                                   fmi2_boolean_t tolerance_defined,
+                                   fmi2_real_t tolerance,
+                                   fmi2_real_t start_time,
+                                   fmi2_boolean_t stop_time_defined,
+                                   fmi2_real_t stop_time) const noexcept
+    {
+        return _fn.setup_experiment(_c, tolerance_defined, tolerance,
+                                    start_time, stop_time_defined, stop_time);
+    }
+
+    fmi2_status_t enter_initialization_mode(fmi2_import_t *) const noexcept
+    {
+        return _fn.enter_initialization_mode(_c);
+    }
+
+    fmi2_status_t exit_initialization_mode(fmi2_import_t *) const noexcept
+    {
+        return _fn.exit_initialization_mode(_c);
+    }
+
+    fmi2_status_t terminate(fmi2_import_t *) const noexcept
+    {
+        return _fn.terminate(_c);
+    }
+
+    fmi2_status_t reset(fmi2_import_t *) const noexcept
+    {
+        return _fn.reset(_c);
+    }
+
+    fmi2_status_t set_real(fmi2_import_t *, const fmi2_value_reference_t vr[],
+                           size_t nvr, const fmi2_real_t value[]) const noexcept
+    {
+        return _fn.set_real(_c, vr, nvr, value);
+    }
+
+    fmi2_status_t set_integer(fmi2_import_t *,
+                              const fmi2_value_reference_t vr[], size_t nvr,
+                              const fmi2_integer_t value[]) const noexcept
+    {
+        return _fn.set_integer(_c, vr, nvr, value);
+    }
+
+    fmi2_status_t set_boolean(fmi2_import_t *,
+                              const fmi2_value_reference_t vr[], size_t nvr,
+                              const fmi2_boolean_t value[]) const noexcept
+    {
+        return _fn.set_boolean(_c, vr, nvr, value);
+    }
+
+    fmi2_status_t set_string(fmi2_import_t *, const fmi2_value_reference_t vr[],
+                             size_t nvr,
+                             const fmi2_string_t value[]) const noexcept
+    {
+        return _fn.set_string(_c, vr, nvr, value);
+    }
+
+    fmi2_status_t get_real(fmi2_import_t *, const fmi2_value_reference_t vr[],
+                           size_t nvr, fmi2_real_t value[]) const noexcept
+    {
+        return _fn.get_real(_c, vr, nvr, value);
+    }
+
+    fmi2_status_t get_integer(fmi2_import_t *,
+                              const fmi2_value_reference_t vr[], size_t nvr,
+                              fmi2_integer_t value[]) const noexcept
+    {
+        return _fn.get_integer(_c, vr, nvr, value);
+    }
+
+    fmi2_status_t get_boolean(fmi2_import_t *,
+                              const fmi2_value_reference_t vr[], size_t nvr,
+                              fmi2_boolean_t value[]) const noexcept
+    {
+        return _fn.get_boolean(_c, vr, nvr, value);
+    }
+
+    fmi2_status_t get_string(fmi2_import_t *, const fmi2_value_reference_t vr[],
+                             size_t nvr, fmi2_string_t value[]) const noexcept
+    {
+        return _fn.get_string(_c, vr, nvr, value);
+    }
+
+    fmi2_status_t get_fmu_state(fmi2_import_t *,
+                                fmi2_FMU_state_t *s) const noexcept
+    {
+        return _fn.get_fmu_state(_c, s);
+    }
+
+    fmi2_status_t set_fmu_state(fmi2_import_t *,
+                                fmi2_FMU_state_t s) const noexcept
+    {
+        return _fn.set_fmu_state(_c, s);
+    }
+
+    fmi2_status_t free_fmu_state(fmi2_import_t *,
+                                 fmi2_FMU_state_t *s) const noexcept
+    {
+        return _fn.free_fmu_state(_c, s);
+    }
+
+    fmi2_status_t serialized_fmu_state_size(fmi2_import_t *, fmi2_FMU_state_t s,
+                                            size_t *sz) const noexcept
+    {
+        return _fn.serialized_fmu_state_size(_c, s, sz);
+    }
+
+    fmi2_status_t serialize_fmu_state(fmi2_import_t *, fmi2_FMU_state_t s,
+                                      fmi2_byte_t data[],
+                                      size_t sz) const noexcept
+    {
+        return _fn.serialize_fmu_state(_c, s, data, sz);
+    }
+
+    fmi2_status_t de_serialize_fmu_state(fmi2_import_t *,
+                                         const fmi2_byte_t data[], size_t sz,
+                                         fmi2_FMU_state_t *s) const noexcept
+    {
+        return _fn.de_serialize_fmu_state(_c, data, sz, s);
+    }
+
+    fmi2_status_t get_directional_derivative(
+        fmi2_import_t *, const fmi2_value_reference_t v_ref[], size_t nv,
+        const fmi2_value_reference_t z_ref[], size_t nz, const fmi2_real_t dv[],
+        fmi2_real_t dz[]) const noexcept
+    {
+        return _fn.get_directional_derivative(_c, z_ref, nz, v_ref, nv, dv, dz);
+    }
+
+    /* Model Exchange */
+    fmi2_status_t enter_event_mode(fmi2_import_t *) const noexcept
+    {
+        return _fn.enter_event_mode(_c);
+    }
+
+    fmi2_status_t new_discrete_states(
+        fmi2_import_t *, fmi2_event_info_t *event_info) const noexcept
+    {
+        return _fn.new_discrete_states(_c, event_info);
+    }
+
+    fmi2_status_t enter_continuous_time_mode(fmi2_import_t *) const noexcept
+    {
+        return _fn.enter_continuous_time_mode(_c);
+    }
+
+    fmi2_status_t set_time(fmi2_import_t *, fmi2_real_t time) const noexcept
+    {
+        return _fn.set_time(_c, time);
+    }
+
+    fmi2_status_t set_continuous_states(fmi2_import_t *, const fmi2_real_t x[],
+                                        size_t nx) const noexcept
+    {
+        return _fn.set_continuous_states(_c, x, nx);
+    }
+
+    fmi2_status_t completed_integrator_step(
+        fmi2_import_t *, fmi2_boolean_t no_set_fmu_state_prior,
+        fmi2_boolean_t *enter_event,
+        fmi2_boolean_t *terminate_simulation) const noexcept
+    {
+        return _fn.completed_integrator_step(_c, no_set_fmu_state_prior,
+                                             enter_event, terminate_simulation);
+    }
+
+    fmi2_status_t get_derivatives(fmi2_import_t *, fmi2_real_t derivatives[],
+                                  size_t nx) const noexcept
+    {
+        return _fn.get_derivatives(_c, derivatives, nx);
+    }
+
+    fmi2_status_t get_event_indicators(fmi2_import_t *,
+                                       fmi2_real_t event_indicators[],
+                                       size_t ni) const noexcept
+    {
+        return _fn.get_event_indicators(_c, event_indicators, ni);
+    }
+
+    fmi2_status_t get_continuous_states(fmi2_import_t *, fmi2_real_t x[],
+                                        size_t nx) const noexcept
+    {
+        return _fn.get_continuous_states(_c, x, nx);
+    }
+
+    fmi2_status_t get_nominals_of_continuous_states(fmi2_import_t *,
+                                                    fmi2_real_t x_nominal[],
+                                                    size_t nx) const noexcept
+    {
+        return _fn.get_nominals_of_continuous_states(_c, x_nominal, nx);
+    }
+
+    /* Co-Simulation */
+    fmi2_status_t set_real_input_derivatives(
+        fmi2_import_t *, const fmi2_value_reference_t vr[], size_t nvr,
+        const fmi2_integer_t order[], const fmi2_real_t value[]) const noexcept
+    {
+        return _fn.set_real_input_derivatives(_c, vr, nvr, order, value);
+    }
+
+    fmi2_status_t get_real_output_derivatives(
+        fmi2_import_t *, const fmi2_value_reference_t vr[], size_t nvr,
+        const fmi2_integer_t order[], fmi2_real_t value[]) const noexcept
+    {
+        return _fn.get_real_output_derivatives(_c, vr, nvr, order, value);
+    }
+
+    fmi2_status_t do_step(fmi2_import_t *,
+                          fmi2_real_t current_communication_point,
+                          fmi2_real_t communication_step_size,
+                          fmi2_boolean_t new_step) const noexcept
+    {
+        return _fn.do_step(_c, current_communication_point,
+                           communication_step_size, new_step);
+    }
+
+    fmi2_status_t cancel_step(fmi2_import_t *) const noexcept
+    {
+        return _fn.cancel_step(_c);
+    }
+
+    fmi2_status_t get_status(fmi2_import_t *, const fmi2_status_kind_t s,
+                             fmi2_status_t *value) const noexcept
     {
-        auto vl = fmi2_import_join_var_list(_vl.get(),
-                                            std::forward<T>(other)._vl.get());
-        if (!vl) {
-            throw std::runtime_error(
-                "Memory allocation failed for new variable list");
-        }
-        this->_vl.reset(vl);
+        return _fn.get_status(_c, s, value);
     }
 
-    template <typename T = variable_t>
-    void append(T &&v)
+    fmi2_status_t get_real_status(fmi2_import_t *, const fmi2_status_kind_t s,
+                                  fmi2_real_t *value) const noexcept
     {
-        auto vl = fmi2_import_append_to_var_list(_vl.get(),
-                                                 std::forward<T>(v).c_ptr());
-        if (!vl) {
-            throw std::runtime_error(
-                "Memory allocation failed for new variable list");
-        }
+        return _fn.get_real_status(_c, s, value);
+    }
 
-        this->_vl.reset(vl);
+    fmi2_status_t get_integer_status(fmi2_import_t *,
+                                     const fmi2_status_kind_t s,
+                                     fmi2_integer_t *value) const noexcept
+    {
+        return _fn.get_integer_status(_c, s, value);
     }
 
-    template <typename T = variable_t>
-    void prepend(T &&v)
+    fmi2_status_t get_boolean_status(fmi2_import_t *,
+                                     const fmi2_status_kind_t s,
+                                     fmi2_boolean_t *value) const noexcept
     {
-        auto vl = fmi2_import_prepend_to_var_list(_vl.get(),
-                                                  std::forward<T>(v).c_ptr());
-        if (!vl) {
-            throw std::runtime_error(
-                "Memory allocation failed for new variable list");
-        }
-        this->_vl.reset(vl);
+        return _fn.get_boolean_status(_c, s, value);
     }
 
-    template <typename T = variable_t>
-    jm_status_enu_t push_back(T &&v)
+    fmi2_status_t get_string_status(fmi2_import_t *, const fmi2_status_kind_t s,
+                                    fmi2_string_t *value) const noexcept
     {
-        return fmi2_import_var_list_push_back(_vl.get(),
-                                              std::forward<T>(v).c_ptr());
+        return _fn.get_string_status(_c, s, value);
     }
 };
 
-template <bool is_model_exchange = true>
+/**
+ * @brief FMI 2.0 model
+ *
+ * @tparam is_model_exchange ModelExchange or CoSimulation
+ * @tparam check_policy argument checking, `no_check_t`, `assert_check_t` or
+ * `strict_check_t`
+ * @tparam trace_policy call tracing, `no_trace_t`, `stream_trace_t` or
+ * `count_trace_t`
+ * @tparam cache_policy name lookup caching, `no_cache_t` or `name_cache_t`
+ * @tparam error_policy `return_status_t` or `throw_on_error_t`
+ * @tparam call_policy how instance functions reach the FMU,
+ * `fmilibrary_call_t` or `direct_call_t`
+ */
+template <bool is_model_exchange = true,
+          typename check_policy = assert_check_t,
+          typename trace_policy = no_trace_t,
+          typename cache_policy = no_cache_t,
+          typename error_policy = return_status_t,
+          typename call_policy = fmilibrary_call_t>
 class fmi2_t
 {
 private:
@@ -657,6 +2322,60 @@ protected:
     std::unique_ptr<fmi2_import_t, decltype(&fmi2_import_free)> _fmu;
     /** @brief fmu callback functions */
     fmi2_callback_functions_t _fmu_cb;
+    trace_policy _trace;
+    cache_policy _cache;
+    /** @brief instance calls, declared last so it is released first */
+    call_policy _call;
+
+    static constexpr bool _nothrow = error_policy::nothrow;
+
+    /**
+     * @brief Run one FMI call through the trace and error policies
+     */
+    template <typename F>
+    fmi2_status_t _invoke(fmi2_call_t id, F &&f) const noexcept(_nothrow)
+    {
+        _trace.trace_begin(id);
+        auto status = f();
+        _trace.trace_end(id, status);
+        return error_policy::handle(id, status);
+    }
+
+    /**
+     * @brief Report a call rejected by argument checking
+     */
+    fmi2_status_t _fail(fmi2_call_t id) const noexcept(_nothrow)
+    {
+        return error_policy::handle(id, fmi2_status_error);
+    }
+
+    template <typename F> static bool _check(F &&f) noexcept
+    {
+        return check_policy::check(std::forward<F>(f));
+    }
+
+    template <bool pedantic>
+    bool _vr_by_name(const char *name, fmi2_value_reference_t &vr) const
+    {
+        if constexpr (cache_policy::cached) {
+            if (_cache.find_vr(name, vr)) {
+                return true;
+            }
+        }
+        if constexpr (pedantic) {
+            auto v = get_variable_by_name(name);
+            if (!v) {
+                return false;
+            }
+            vr = v.value().vr();
+        } else {
+            vr = get_variable_by_name(name).value().vr();
+        }
+        if constexpr (cache_policy::cached) {
+            _cache.store_vr(name, vr);
+        }
+        return true;
+    }
 
 public:
     fmi2_t()
@@ -757,6 +2476,7 @@ public:
             fmi2_import_destroy_dllfmu(_fmu.get());
             throw std::runtime_error("Failed to load FMU binary");
         }
+        _call.open(_fmu.get(), ext_dir, _fmu_cb, _jm_cb, is_model_exchange);
     }
     /**
      * @brief Delete copy constructor
@@ -775,7 +2495,23 @@ public:
      */
     fmi2_t(fmi2_t &&m) = default;
 
-    virtual ~fmi2_t() = default;
+    /**
+     * @brief Non-virtual, fmi2_t is not meant to be deleted through a base
+     */
+    ~fmi2_t() = default;
+
+    /**
+     * @brief Trace policy instance, e.g. to read `count_trace_t` counters
+     */
+    trace_policy &trace() noexcept
+    {
+        return _trace;
+    }
+
+    const trace_policy &trace() const noexcept
+    {
+        return _trace;
+    }
 
     fmi2_string_t model_name() const noexcept
     {
@@ -1011,6 +2747,43 @@ public:
         return variable_t{v};
     }
 
+    /**
+     * @brief Build the unit conversion table for the given real variables
+     *
+     * Variables without unit or display unit convert with factor 1 and
+     * offset 0. Returns nothing if a value reference is not a real variable.
+     */
+    std::optional<unit_conversion_t>
+    unit_conversion(const std::vector<fmi2_value_reference_t> &vrs) const
+    {
+        unit_conversion_t conv;
+        for (auto vr : vrs) {
+            auto v = fmi2_import_get_variable_by_vr(_fmu.get(),
+                                                    fmi2_base_type_real, vr);
+            if (!v) {
+                return {};
+            }
+            auto rv = fmi2_import_get_variable_as_real(v);
+            fmi2_real_t uf = 1.0, uo = 0.0, df = 1.0, dof = 0.0;
+            if (auto u = fmi2_import_get_real_variable_unit(rv); u) {
+                uf = fmi2_import_get_SI_unit_factor(u);
+                uo = fmi2_import_get_SI_unit_offset(u);
+            }
+            if (auto du = fmi2_import_get_real_variable_display_unit(rv); du) {
+                df = fmi2_import_get_display_unit_factor(du);
+                dof = fmi2_import_get_display_unit_offset(du);
+            }
+            bool relative = false;
+            if (auto t = fmi2_import_get_variable_declared_type(v); t) {
+                relative = fmi2_import_get_real_type_is_relative_quantity(
+                               fmi2_import_get_type_as_real(t))
+                           != 0;
+            }
+            conv.push_back(vr, uf, uo, df, dof, relative);
+        }
+        return conv;
+    }
+
     std::optional<std::vector<fmi2_value_reference_t>>
     get_vrs_by_names(const std::vector<std::string> &names) const
     {
@@ -1253,15 +3026,23 @@ public:
     jm_status_enu_t instantiate(fmi2_string_t instance_name,
                                 fmi2_type_t fmu_type,
                                 fmi2_string_t resource_location,
-                                fmi2_boolean_t visible) noexcept
+                                fmi2_boolean_t visible) noexcept(_nothrow)
     {
-        return fmi2_import_instantiate(_fmu.get(), instance_name, fmu_type,
-                                       resource_location, visible);
+        _trace.trace_begin(fmi2_call_t::instantiate);
+        auto status = this->_call.instantiate(
+            _fmu.get(), instance_name, fmu_type, resource_location, visible);
+        auto s = status == jm_status_success ? fmi2_status_ok
+                                             : fmi2_status_error;
+        _trace.trace_end(fmi2_call_t::instantiate, s);
+        error_policy::handle(fmi2_call_t::instantiate, s);
+        return status;
     }
 
     void free_instance() noexcept
     {
-        fmi2_import_free_instance(_fmu.get());
+        _trace.trace_begin(fmi2_call_t::free_instance);
+        this->_call.free_instance(_fmu.get());
+        _trace.trace_end(fmi2_call_t::free_instance, fmi2_status_ok);
     }
 
     fmi2_string_t get_version() const noexcept
@@ -1271,299 +3052,386 @@ public:
 
     fmi2_status_t set_debug_logging(fmi2_boolean_t logging_on,
                                     size_t n_categories,
-                                    fmi2_string_t categories[]) noexcept
+                                    fmi2_string_t categories[])
+        noexcept(_nothrow)
     {
-        return fmi2_import_set_debug_logging(_fmu.get(), logging_on,
-                                             n_categories, categories);
+        return this->_invoke(fmi2_call_t::set_debug_logging, [&] {
+            return this->_call.set_debug_logging(_fmu.get(), logging_on,
+                                                 n_categories, categories);
+        });
     }
 
     fmi2_status_t setup_experiment(fmi2_boolean_t tolerance_defined,
                                    fmi2_real_t tolerance,
                                    fmi2_real_t start_time,
                                    fmi2_boolean_t stop_time_defined,
-                                   fmi2_real_t stop_time) noexcept
+                                   fmi2_real_t stop_time) noexcept(_nothrow)
     {
-        return fmi2_import_setup_experiment(_fmu.get(), tolerance_defined,
-                                            tolerance, start_time,
-                                            stop_time_defined, stop_time);
+        return this->_invoke(fmi2_call_t::setup_experiment, [&] {
+            return this->_call.setup_experiment(_fmu.get(), tolerance_defined,
+                                                tolerance, start_time,
+                                                stop_time_defined, stop_time);
+        });
     }
 
-    fmi2_status_t enter_initialization_mode() noexcept
+    fmi2_status_t enter_initialization_mode() noexcept(_nothrow)
     {
-        return fmi2_import_enter_initialization_mode(_fmu.get());
+        return this->_invoke(fmi2_call_t::enter_initialization_mode, [&] {
+            return this->_call.enter_initialization_mode(_fmu.get());
+        });
     }
 
-    fmi2_status_t exit_initialization_mode() noexcept
+    fmi2_status_t exit_initialization_mode() noexcept(_nothrow)
     {
-        return fmi2_import_exit_initialization_mode(_fmu.get());
+        return this->_invoke(fmi2_call_t::exit_initialization_mode, [&] {
+            return this->_call.exit_initialization_mode(_fmu.get());
+        });
     }
 
-    fmi2_status_t terminate() noexcept
+    fmi2_status_t terminate() noexcept(_nothrow)
     {
-        return fmi2_import_terminate(_fmu.get());
+        return this->_invoke(fmi2_call_t::terminate, [&] {
+            return this->_call.terminate(_fmu.get());
+        });
     }
 
-    fmi2_status_t reset() noexcept
+    fmi2_status_t reset() noexcept(_nothrow)
     {
-        return fmi2_import_reset(_fmu.get());
+        return this->_invoke(fmi2_call_t::reset, [&] {
+            return this->_call.reset(_fmu.get());
+        });
     }
 
     /**
      * @brief Set single real value through variable name
      *
      */
-    template <bool pedantic = false>
-    fmi2_status_t set_real(const char *name, const fmi2_real_t &value) noexcept
+    template <bool pedantic = check_policy::pedantic>
+    fmi2_status_t set_real(const char *name,
+                           const fmi2_real_t &value) noexcept(_nothrow)
     {
         fmi2_value_reference_t vr = 0;
-        if constexpr (pedantic) {
-            auto v = get_variable_by_name(name);
-            if (!v) {
-                return fmi2_status_error;
-            }
-            vr = v.value().vr();
-        } else {
-            vr = get_variable_by_name(name).value().vr();
+        if (!this->template _vr_by_name<pedantic>(name, vr)) {
+            return this->_fail(fmi2_call_t::set_real);
         }
-        return fmi2_import_set_real(_fmu.get(), &vr, 1, &value);
+        return this->_invoke(fmi2_call_t::set_real, [&] {
+            return this->_call.set_real(_fmu.get(), &vr, 1, &value);
+        });
     }
 
     fmi2_status_t set_real(const fmi2_value_reference_t vrs[], size_t nvr,
-                           const fmi2_real_t value[]) noexcept
+                           const fmi2_real_t values[]) noexcept(_nothrow)
     {
-        return fmi2_import_set_real(_fmu.get(), vrs, nvr, value);
+        if (!this->_check([&] { return nvr == 0 || (vrs && values); })) {
+            return this->_fail(fmi2_call_t::set_real);
+        }
+        return this->_invoke(fmi2_call_t::set_real, [&] {
+            return this->_call.set_real(_fmu.get(), vrs, nvr, values);
+        });
     }
 
-    fmi2_status_t set_real(const std::vector<fmi2_value_reference_t> &vrs,
-                           const std::vector<double> &values) noexcept
+    fmi2_status_t
+    set_real(const std::vector<fmi2_value_reference_t> &vrs,
+             const std::vector<double> &values) noexcept(_nothrow)
     {
-        assert(vrs.size() == values.size());
-        return fmi2_import_set_real(_fmu.get(), vrs.data(), vrs.size(),
-                                    values.data());
+        if (!this->_check([&] { return vrs.size() == values.size(); })) {
+            return this->_fail(fmi2_call_t::set_real);
+        }
+        return this->_invoke(fmi2_call_t::set_real, [&] {
+            return this->_call.set_real(_fmu.get(), vrs.data(), vrs.size(),
+                                        values.data());
+        });
     }
 
-    template <bool pedantic = false>
+    template <bool pedantic = check_policy::pedantic>
     fmi2_status_t set_integer(const char *name,
-                              const fmi2_integer_t &value) noexcept
+                              const fmi2_integer_t &value) noexcept(_nothrow)
     {
         fmi2_value_reference_t vr = 0;
-        if constexpr (pedantic) {
-            auto v = get_variable_by_name(name);
-            if (!v) {
-                return fmi2_status_error;
-            }
-            vr = v.value().vr();
-        } else {
-            vr = get_variable_by_name(name).value().vr();
+        if (!this->template _vr_by_name<pedantic>(name, vr)) {
+            return this->_fail(fmi2_call_t::set_integer);
         }
-        return fmi2_import_set_integer(_fmu.get(), &vr, 1, &value);
+        return this->_invoke(fmi2_call_t::set_integer, [&] {
+            return this->_call.set_integer(_fmu.get(), &vr, 1, &value);
+        });
     }
 
     fmi2_status_t set_integer(const fmi2_value_reference_t vrs[], size_t nvr,
-                              const fmi2_integer_t values[]) noexcept
+                              const fmi2_integer_t values[]) noexcept(_nothrow)
     {
-        return fmi2_import_set_integer(_fmu.get(), vrs, nvr, values);
+        if (!this->_check([&] { return nvr == 0 || (vrs && values); })) {
+            return this->_fail(fmi2_call_t::set_integer);
+        }
+        return this->_invoke(fmi2_call_t::set_integer, [&] {
+            return this->_call.set_integer(_fmu.get(), vrs, nvr, values);
+        });
     }
 
     fmi2_status_t
     set_integer(const std::vector<fmi2_value_reference_t> &vrs,
-                const std::vector<fmi2_integer_t> &values) noexcept
+                const std::vector<fmi2_integer_t> &values) noexcept(_nothrow)
     {
-        assert(vrs.size() == values.size());
-        return fmi2_import_set_integer(_fmu.get(), vrs.data(), vrs.size(),
-                                       values.data());
+        if (!this->_check([&] { return vrs.size() == values.size(); })) {
+            return this->_fail(fmi2_call_t::set_integer);
+        }
+        return this->_invoke(fmi2_call_t::set_integer, [&] {
+            return this->_call.set_integer(_fmu.get(), vrs.data(), vrs.size(),
+                                           values.data());
+        });
     }
 
-    template <bool pedantic = false>
+    template <bool pedantic = check_policy::pedantic>
     fmi2_status_t set_boolean(const char *name,
-                              const fmi2_boolean_t &value) noexcept
+                              const fmi2_boolean_t &value) noexcept(_nothrow)
     {
         fmi2_value_reference_t vr = 0;
-        if constexpr (pedantic) {
-            auto v = get_variable_by_name(name);
-            if (!v) {
-                return fmi2_status_error;
-            }
-            vr = v.value().vr();
-        } else {
-            vr = get_variable_by_name(name).value().vr();
+        if (!this->template _vr_by_name<pedantic>(name, vr)) {
+            return this->_fail(fmi2_call_t::set_boolean);
         }
-        return fmi2_import_set_boolean(_fmu.get(), &vr, 1, &value);
+        return this->_invoke(fmi2_call_t::set_boolean, [&] {
+            return this->_call.set_boolean(_fmu.get(), &vr, 1, &value);
+        });
     }
 
     fmi2_status_t set_boolean(const fmi2_value_reference_t vrs[], size_t nvr,
-                              const fmi2_boolean_t values[]) noexcept
+                              const fmi2_boolean_t values[]) noexcept(_nothrow)
     {
-        return fmi2_import_set_boolean(_fmu.get(), vrs, nvr, values);
+        if (!this->_check([&] { return nvr == 0 || (vrs && values); })) {
+            return this->_fail(fmi2_call_t::set_boolean);
+        }
+        return this->_invoke(fmi2_call_t::set_boolean, [&] {
+            return this->_call.set_boolean(_fmu.get(), vrs, nvr, values);
+        });
     }
 
     fmi2_status_t
     set_boolean(const std::vector<fmi2_value_reference_t> &vrs,
-                const std::vector<fmi2_boolean_t> &values) noexcept
+                const std::vector<fmi2_boolean_t> &values) noexcept(_nothrow)
     {
-        assert(vrs.size() == values.size());
-        return fmi2_import_set_boolean(_fmu.get(), vrs.data(), vrs.size(),
-                                       values.data());
+        if (!this->_check([&] { return vrs.size() == values.size(); })) {
+            return this->_fail(fmi2_call_t::set_boolean);
+        }
+        return this->_invoke(fmi2_call_t::set_boolean, [&] {
+            return this->_call.set_boolean(_fmu.get(), vrs.data(), vrs.size(),
+                                           values.data());
+        });
     }
 
-    template <bool pedantic = false>
+    template <bool pedantic = check_policy::pedantic>
     fmi2_status_t set_string(const char *name,
-                             const fmi2_string_t &value) noexcept
+                             const fmi2_string_t &value) noexcept(_nothrow)
     {
         fmi2_value_reference_t vr = 0;
-        if constexpr (pedantic) {
-            auto v = get_variable_by_name(name);
-            if (!v) {
-                return fmi2_status_error;
-            }
-            vr = v.value().vr();
-        } else {
-            vr = get_variable_by_name(name).value().vr();
+        if (!this->template _vr_by_name<pedantic>(name, vr)) {
+            return this->_fail(fmi2_call_t::set_string);
         }
-        return fmi2_import_set_string(_fmu.get(), &vr, 1, &value);
+        return this->_invoke(fmi2_call_t::set_string, [&] {
+            return this->_call.set_string(_fmu.get(), &vr, 1, &value);
+        });
     }
 
     fmi2_status_t set_string(const fmi2_value_reference_t vrs[], size_t nvr,
-                             const fmi2_string_t values[]) noexcept
+                             const fmi2_string_t values[]) noexcept(_nothrow)
     {
-        return fmi2_import_set_string(_fmu.get(), vrs, nvr, values);
+        if (!this->_check([&] { return nvr == 0 || (vrs && values); })) {
+            return this->_fail(fmi2_call_t::set_string);
+        }
+        return this->_invoke(fmi2_call_t::set_string, [&] {
+            return this->_call.set_string(_fmu.get(), vrs, nvr, values);
+        });
     }
 
-    fmi2_status_t set_string(const std::vector<fmi2_value_reference_t> &vrs,
-                             const std::vector<fmi2_string_t> &values) noexcept
+    fmi2_status_t
+    set_string(const std::vector<fmi2_value_reference_t> &vrs,
+               const std::vector<fmi2_string_t> &values) noexcept(_nothrow)
     {
-        assert(vrs.size() == values.size());
-        return fmi2_import_set_string(_fmu.get(), vrs.data(), vrs.size(),
-                                      values.data());
+        if (!this->_check([&] { return vrs.size() == values.size(); })) {
+            return this->_fail(fmi2_call_t::set_string);
+        }
+        return this->_invoke(fmi2_call_t::set_string, [&] {
+            return this->_call.set_string(_fmu.get(), vrs.data(), vrs.size(),
+                                          values.data());
+        });
     }
 
     /**
-     * @brief Set single real value through variable name
+     * @brief Get single real value through variable name
      *
      */
-    template <bool pedantic = false>
-    fmi2_status_t get_real(const char *name, fmi2_real_t &value) const noexcept
+    template <bool pedantic = check_policy::pedantic>
+    fmi2_status_t get_real(const char *name, fmi2_real_t &value) const
+        noexcept(_nothrow)
     {
         fmi2_value_reference_t vr = 0;
-        if constexpr (pedantic) {
-            auto v = get_variable_by_name(name);
-            if (!v) {
-                return fmi2_status_error;
-            }
-            vr = v.value().vr();
-        } else {
-            vr = get_variable_by_name(name).value().vr();
+        if (!this->template _vr_by_name<pedantic>(name, vr)) {
+            return this->_fail(fmi2_call_t::get_real);
         }
-        return fmi2_import_get_real(_fmu.get(), &vr, 1, &value);
+        return this->_invoke(fmi2_call_t::get_real, [&] {
+            return this->_call.get_real(_fmu.get(), &vr, 1, &value);
+        });
     }
 
     fmi2_status_t get_real(const fmi2_value_reference_t vrs[], size_t nvr,
-                           fmi2_real_t value[]) const noexcept
+                           fmi2_real_t values[]) const noexcept(_nothrow)
     {
-        return fmi2_import_get_real(_fmu.get(), vrs, nvr, value);
+        if (!this->_check([&] { return nvr == 0 || (vrs && values); })) {
+            return this->_fail(fmi2_call_t::get_real);
+        }
+        return this->_invoke(fmi2_call_t::get_real, [&] {
+            return this->_call.get_real(_fmu.get(), vrs, nvr, values);
+        });
     }
 
-    fmi2_status_t get_real(const std::vector<fmi2_value_reference_t> &vrs,
-                           std::vector<fmi2_real_t> &values) const noexcept
+    fmi2_status_t
+    get_real(const std::vector<fmi2_value_reference_t> &vrs,
+             std::vector<fmi2_real_t> &values) const noexcept(_nothrow)
     {
-        assert(vrs.size() == values.size());
-        return fmi2_import_get_real(_fmu.get(), vrs.data(), vrs.size(),
-                                    values.data());
+        if (!this->_check([&] { return vrs.size() == values.size(); })) {
+            return this->_fail(fmi2_call_t::get_real);
+        }
+        return this->_invoke(fmi2_call_t::get_real, [&] {
+            return this->_call.get_real(_fmu.get(), vrs.data(), vrs.size(),
+                                        values.data());
+        });
     }
 
-    template <bool pedantic = false>
+    template <bool pedantic = check_policy::pedantic>
     fmi2_status_t get_integer(const char *name, fmi2_integer_t &value) const
-        noexcept
+        noexcept(_nothrow)
     {
         fmi2_value_reference_t vr = 0;
-        if constexpr (pedantic) {
-            auto v = get_variable_by_name(name);
-            if (!v) {
-                return fmi2_status_error;
-            }
-            vr = v.value().vr();
-        } else {
-            vr = get_variable_by_name(name).value().vr();
+        if (!this->template _vr_by_name<pedantic>(name, vr)) {
+            return this->_fail(fmi2_call_t::get_integer);
         }
-        return fmi2_import_get_integer(_fmu.get(), &vr, 1, &value);
+        return this->_invoke(fmi2_call_t::get_integer, [&] {
+            return this->_call.get_integer(_fmu.get(), &vr, 1, &value);
+        });
     }
 
     fmi2_status_t get_integer(const fmi2_value_reference_t vrs[], size_t nvr,
-                              fmi2_integer_t value[]) const noexcept
+                              fmi2_integer_t values[]) const noexcept(_nothrow)
     {
-        return fmi2_import_get_integer(_fmu.get(), vrs, nvr, value);
+        if (!this->_check([&] { return nvr == 0 || (vrs && values); })) {
+            return this->_fail(fmi2_call_t::get_integer);
+        }
+        return this->_invoke(fmi2_call_t::get_integer, [&] {
+            return this->_call.get_integer(_fmu.get(), vrs, nvr, values);
+        });
     }
 
-    fmi2_status_t get_integer(const std::vector<fmi2_value_reference_t> &vrs,
-                              std::vector<fmi2_integer_t> &values) const
-        noexcept
+    fmi2_status_t
+    get_integer(const std::vector<fmi2_value_reference_t> &vrs,
+                std::vector<fmi2_integer_t> &values) const noexcept(_nothrow)
     {
-        assert(vrs.size() == values.size());
-        return fmi2_import_get_integer(_fmu.get(), vrs.data(), vrs.size(),
-                                       values.data());
+        if (!this->_check([&] { return vrs.size() == values.size(); })) {
+            return this->_fail(fmi2_call_t::get_integer);
+        }
+        return this->_invoke(fmi2_call_t::get_integer, [&] {
+            return this->_call.get_integer(_fmu.get(), vrs.data(), vrs.size(),
+                                           values.data());
+        });
     }
 
-    template <bool pedantic = false>
+    template <bool pedantic = check_policy::pedantic>
     fmi2_status_t get_boolean(const char *name, fmi2_boolean_t &value) const
-        noexcept
+        noexcept(_nothrow)
     {
         fmi2_value_reference_t vr = 0;
-        if constexpr (pedantic) {
-            auto v = get_variable_by_name(name);
-            if (!v) {
-                return fmi2_status_error;
-            }
-            vr = v.value().vr();
-        } else {
-            vr = get_variable_by_name(name).value().vr();
+        if (!this->template _vr_by_name<pedantic>(name, vr)) {
+            return this->_fail(fmi2_call_t::get_boolean);
         }
-        return fmi2_import_get_boolean(_fmu.get(), &vr, 1, &value);
+        return this->_invoke(fmi2_call_t::get_boolean, [&] {
+            return this->_call.get_boolean(_fmu.get(), &vr, 1, &value);
+        });
     }
 
     fmi2_status_t get_boolean(const fmi2_value_reference_t vrs[], size_t nvr,
-                              fmi2_boolean_t value[]) const noexcept
+                              fmi2_boolean_t values[]) const noexcept(_nothrow)
     {
-        return fmi2_import_get_boolean(_fmu.get(), vrs, nvr, value);
+        if (!this->_check([&] { return nvr == 0 || (vrs && values); })) {
+            return this->_fail(fmi2_call_t::get_boolean);
+        }
+        return this->_invoke(fmi2_call_t::get_boolean, [&] {
+            return this->_call.get_boolean(_fmu.get(), vrs, nvr, values);
+        });
     }
 
-    fmi2_status_t get_boolean(const std::vector<fmi2_value_reference_t> &vrs,
-                              std::vector<fmi2_boolean_t> &values) const
-        noexcept
+    fmi2_status_t
+    get_boolean(const std::vector<fmi2_value_reference_t> &vrs,
+                std::vector<fmi2_boolean_t> &values) const noexcept(_nothrow)
     {
-        assert(vrs.size() == values.size());
-        return fmi2_import_get_boolean(_fmu.get(), vrs.data(), vrs.size(),
-                                       values.data());
+        if (!this->_check([&] { return vrs.size() == values.size(); })) {
+            return this->_fail(fmi2_call_t::get_boolean);
+        }
+        return this->_invoke(fmi2_call_t::get_boolean, [&] {
+            return this->_call.get_boolean(_fmu.get(), vrs.data(), vrs.size(),
+                                           values.data());
+        });
     }
 
-    template <bool pedantic = false>
+    template <bool pedantic = check_policy::pedantic>
     fmi2_status_t get_string(const char *name, fmi2_string_t &value) const
-        noexcept
+        noexcept(_nothrow)
     {
         fmi2_value_reference_t vr = 0;
-        if constexpr (pedantic) {
-            auto v = get_variable_by_name(name);
-            if (!v) {
-                return fmi2_status_error;
-            }
-            vr = v.value().vr();
-        } else {
-            vr = get_variable_by_name(name).value().vr();
+        if (!this->template _vr_by_name<pedantic>(name, vr)) {
+            return this->_fail(fmi2_call_t::get_string);
+        }
+        return this->_invoke(fmi2_call_t::get_string, [&] {
+            return this->_call.get_string(_fmu.get(), &vr, 1, &value);
+        });
+    }
+
+    fmi2_status_t get_string(const fmi2_value_reference_t vrs[], size_t nvr,
+                             fmi2_string_t values[]) const noexcept(_nothrow)
+    {
+        if (!this->_check([&] { return nvr == 0 || (vrs && values); })) {
+            return this->_fail(fmi2_call_t::get_string);
         }
-        return fmi2_import_get_string(_fmu.get(), &vr, 1, &value);
+        return this->_invoke(fmi2_call_t::get_string, [&] {
+            return this->_call.get_string(_fmu.get(), vrs, nvr, values);
+        });
     }
 
+    fmi2_status_t
+    get_string(const std::vector<fmi2_value_reference_t> &vrs,
+               std::vector<fmi2_string_t> &values) const noexcept(_nothrow)
+    {
+        if (!this->_check([&] { return vrs.size() == values.size(); })) {
+            return this->_fail(fmi2_call_t::get_string);
+        }
+        return this->_invoke(fmi2_call_t::get_string, [&] {
+            return this->_call.get_string(_fmu.get(), vrs.data(), vrs.size(),
+                                          values.data());
+        });
+    }
+
+    /**
+     * @brief Get string values and copy them into `arena`
+     *
+     * The returned views stay valid after further calls into the FMU, until
+     * `arena.clear()` is called.
+     */
     fmi2_status_t get_string(const fmi2_value_reference_t vrs[], size_t nvr,
-                             fmi2_string_t value[]) const noexcept
+                             std::string_view values[],
+                             string_arena_t &arena) const
     {
-        return fmi2_import_get_string(_fmu.get(), vrs, nvr, value);
+        auto raw = arena.raw_buffer(nvr);
+        auto status = get_string(vrs, nvr, raw);
+        if (status == fmi2_status_ok || status == fmi2_status_warning) {
+            arena.capture(raw, nvr, values);
+        }
+        return status;
     }
 
     fmi2_status_t get_string(const std::vector<fmi2_value_reference_t> &vrs,
-                             std::vector<fmi2_string_t> &values) const noexcept
+                             std::vector<std::string_view> &values,
+                             string_arena_t &arena) const
     {
-        assert(vrs.size() == values.size());
-        return fmi2_import_get_string(_fmu.get(), vrs.data(), vrs.size(),
-                                      values.data());
+        if (!this->_check([&] { return vrs.size() == values.size(); })) {
+            return this->_fail(fmi2_call_t::get_string);
+        }
+        return get_string(vrs.data(), vrs.size(), values.data(), arena);
     }
 
     const char *types_platform() const noexcept
@@ -1571,200 +3439,342 @@ public:
         return fmi2_import_get_types_platform(_fmu.get());
     }
 
-    fmi2_status_t get_fmu_state(fmi2_FMU_state_t *s) const noexcept
+    fmi2_status_t get_fmu_state(fmi2_FMU_state_t *s) const noexcept(_nothrow)
     {
-        return fmi2_import_get_fmu_state(_fmu.get(), s);
+        if (!this->_check([&] { return s != nullptr; })) {
+            return this->_fail(fmi2_call_t::get_fmu_state);
+        }
+        return this->_invoke(fmi2_call_t::get_fmu_state, [&] {
+            return this->_call.get_fmu_state(_fmu.get(), s);
+        });
     }
 
-    fmi2_status_t set_fmu_state(fmi2_FMU_state_t s) noexcept
+    fmi2_status_t set_fmu_state(fmi2_FMU_state_t s) noexcept(_nothrow)
     {
-        return fmi2_import_set_fmu_state(_fmu.get(), s);
+        return this->_invoke(fmi2_call_t::set_fmu_state, [&] {
+            return this->_call.set_fmu_state(_fmu.get(), s);
+        });
     }
 
-    fmi2_status_t free_fmu_state(fmi2_FMU_state_t *s) const noexcept
+    fmi2_status_t free_fmu_state(fmi2_FMU_state_t *s) const noexcept(_nothrow)
     {
-        return fmi2_import_free_fmu_state(_fmu.get(), s);
+        if (!this->_check([&] { return s != nullptr; })) {
+            return this->_fail(fmi2_call_t::free_fmu_state);
+        }
+        return this->_invoke(fmi2_call_t::free_fmu_state, [&] {
+            return this->_call.free_fmu_state(_fmu.get(), s);
+        });
     }
 
     fmi2_status_t serialized_fmu_state_size(fmi2_FMU_state_t s,
-                                            size_t *sz) const noexcept
+                                            size_t *sz) const noexcept(_nothrow)
     {
-        return fmi2_import_serialized_fmu_state_size(_fmu.get(), s, sz);
+        if (!this->_check([&] { return sz != nullptr; })) {
+            return this->_fail(fmi2_call_t::serialized_fmu_state_size);
+        }
+        return this->_invoke(fmi2_call_t::serialized_fmu_state_size, [&] {
+            return this->_call.serialized_fmu_state_size(_fmu.get(), s, sz);
+        });
     }
 
     fmi2_status_t serialize_fmu_state(fmi2_FMU_state_t s, fmi2_byte_t data[],
-                                      size_t sz) const noexcept
+                                      size_t sz) const noexcept(_nothrow)
     {
-        return fmi2_import_serialize_fmu_state(_fmu.get(), s, data, sz);
+        return this->_invoke(fmi2_call_t::serialize_fmu_state, [&] {
+            return this->_call.serialize_fmu_state(_fmu.get(), s, data, sz);
+        });
     }
 
     fmi2_status_t serialize_fmu_state(fmi2_FMU_state_t s,
                                       std::vector<fmi2_byte_t> &data) const
-        noexcept
+        noexcept(_nothrow)
     {
-        return fmi2_import_serialize_fmu_state(_fmu.get(), s, data.data(),
-                                               data.size());
+        return this->_invoke(fmi2_call_t::serialize_fmu_state, [&] {
+            return this->_call.serialize_fmu_state(_fmu.get(), s, data.data(),
+                                                   data.size());
+        });
     }
 
     fmi2_status_t de_serialize_fmu_state(const fmi2_byte_t data[], size_t sz,
-                                         fmi2_FMU_state_t *s) const noexcept
+                                         fmi2_FMU_state_t *s) const
+        noexcept(_nothrow)
     {
-        return fmi2_import_de_serialize_fmu_state(_fmu.get(), data, sz, s);
+        if (!this->_check([&] { return s != nullptr; })) {
+            return this->_fail(fmi2_call_t::de_serialize_fmu_state);
+        }
+        return this->_invoke(fmi2_call_t::de_serialize_fmu_state, [&] {
+            return this->_call.de_serialize_fmu_state(_fmu.get(), data, sz, s);
+        });
     }
 
     fmi2_status_t de_serialize_fmu_state(const std::vector<fmi2_byte_t> &data,
-                                         fmi2_FMU_state_t *s) const noexcept
+                                         fmi2_FMU_state_t *s) const
+        noexcept(_nothrow)
     {
-        return fmi2_import_de_serialize_fmu_state(_fmu.get(), data.data(),
-                                                  data.size(), s);
+        if (!this->_check([&] { return s != nullptr; })) {
+            return this->_fail(fmi2_call_t::de_serialize_fmu_state);
+        }
+        return this->_invoke(fmi2_call_t::de_serialize_fmu_state, [&] {
+            return this->_call.de_serialize_fmu_state(_fmu.get(), data.data(),
+                                                      data.size(), s);
+        });
     }
 
     fmi2_status_t
     get_directional_derivative(const fmi2_value_reference_t v_ref[], size_t nv,
                                const fmi2_value_reference_t z_ref[], size_t nz,
                                const fmi2_real_t dv[], fmi2_real_t dz[]) const
-        noexcept
+        noexcept(_nothrow)
     {
-        return fmi2_import_get_directional_derivative(_fmu.get(), v_ref, nv,
-                                                      z_ref, nz, dv, dz);
+        return this->_invoke(fmi2_call_t::get_directional_derivative, [&] {
+            return this->_call.get_directional_derivative(_fmu.get(), v_ref, nv,
+                                                          z_ref, nz, dv, dz);
+        });
     }
 
     fmi2_status_t
-    get_directional_derivative(const std::vector<fmi2_value_reference_t> v_ref,
-                               const std::vector<fmi2_value_reference_t> z_ref,
-                               const std::vector<fmi2_real_t> dv,
-                               std::vector<fmi2_real_t> &dz) const noexcept
-    {
-        return fmi2_import_get_directional_derivative(
-            _fmu.get(), v_ref.data(), v_ref.size(), z_ref.data(), z_ref.size(),
-            dv.data(), dz.data());
+    get_directional_derivative(const std::vector<fmi2_value_reference_t> &v_ref,
+                               const std::vector<fmi2_value_reference_t> &z_ref,
+                               const std::vector<fmi2_real_t> &dv,
+                               std::vector<fmi2_real_t> &dz) const
+        noexcept(_nothrow)
+    {
+        if (!this->_check([&] {
+                return v_ref.size() == dv.size() && z_ref.size() == dz.size();
+            })) {
+            return this->_fail(fmi2_call_t::get_directional_derivative);
+        }
+        return this->_invoke(fmi2_call_t::get_directional_derivative, [&] {
+            return this->_call.get_directional_derivative(_fmu.get(),
+                                                          v_ref.data(),
+                                                          v_ref.size(),
+                                                          z_ref.data(),
+                                                          z_ref.size(),
+                                                          dv.data(), dz.data());
+        });
     }
 
     ///////////////////////////////////////////////////////////////////////////
     //  ModelExchange API
     ///////////////////////////////////////////////////////////////////////////
     template <bool is_me = is_model_exchange>
-    typename std::enable_if_t<is_me, fmi2_status_t> enter_event_mode() noexcept
+    typename std::enable_if_t<is_me, fmi2_status_t>
+    enter_event_mode() noexcept(_nothrow)
     {
-        return fmi2_import_enter_event_mode(_fmu.get());
+        return this->_invoke(fmi2_call_t::enter_event_mode, [&] {
+            return this->_call.enter_event_mode(_fmu.get());
+        });
     }
 
     template <bool is_me = is_model_exchange>
     typename std::enable_if_t<is_me, fmi2_status_t>
-    new_discrete_states(fmi2_event_info_t *event_info) noexcept
+    new_discrete_states(fmi2_event_info_t *event_info) noexcept(_nothrow)
     {
-        return fmi2_import_new_discrete_states(_fmu.get(), event_info);
+        if (!this->_check([&] { return event_info != nullptr; })) {
+            return this->_fail(fmi2_call_t::new_discrete_states);
+        }
+        return this->_invoke(fmi2_call_t::new_discrete_states, [&] {
+            return this->_call.new_discrete_states(_fmu.get(), event_info);
+        });
     }
 
     template <bool is_me = is_model_exchange>
     typename std::enable_if_t<is_me, fmi2_status_t>
-    enter_continuous_time_mode() noexcept
+    enter_continuous_time_mode() noexcept(_nothrow)
     {
-        return fmi2_import_enter_continuous_time_mode(_fmu.get());
+        return this->_invoke(fmi2_call_t::enter_continuous_time_mode, [&] {
+            return this->_call.enter_continuous_time_mode(_fmu.get());
+        });
     }
 
     template <bool is_me = is_model_exchange>
     typename std::enable_if_t<is_me, fmi2_status_t>
-    set_time(fmi2_real_t time) noexcept
+    set_time(fmi2_real_t time) noexcept(_nothrow)
     {
-        return fmi2_import_set_time(_fmu.get(), time);
+        return this->_invoke(fmi2_call_t::set_time, [&] {
+            return this->_call.set_time(_fmu.get(), time);
+        });
     }
 
     template <bool is_me = is_model_exchange>
     typename std::enable_if_t<is_me, fmi2_status_t>
-    set_continuous_states(const fmi2_real_t x[], size_t nx) noexcept
+    set_continuous_states(const fmi2_real_t x[], size_t nx) noexcept(_nothrow)
     {
-        return fmi2_import_set_continuous_states(_fmu.get(), x, nx);
+        if (!this->_check([&] {
+                return nx == this->number_of_continuous_states();
+            })) {
+            return this->_fail(fmi2_call_t::set_continuous_states);
+        }
+        return this->_invoke(fmi2_call_t::set_continuous_states, [&] {
+            return this->_call.set_continuous_states(_fmu.get(), x, nx);
+        });
     }
 
     template <bool is_me = is_model_exchange>
     typename std::enable_if_t<is_me, fmi2_status_t>
-    set_continuous_states(const std::vector<fmi2_real_t> &x) noexcept
+    set_continuous_states(const std::vector<fmi2_real_t> &x) noexcept(_nothrow)
     {
-        return fmi2_import_set_continuous_states(_fmu.get(), x.data(),
-                                                 x.size());
+        if (!this->_check([&] {
+                return x.size() == this->number_of_continuous_states();
+            })) {
+            return this->_fail(fmi2_call_t::set_continuous_states);
+        }
+        return this->_invoke(fmi2_call_t::set_continuous_states, [&] {
+            return this->_call.set_continuous_states(_fmu.get(), x.data(),
+                                                     x.size());
+        });
     }
 
     template <bool is_me = is_model_exchange>
     typename std::enable_if_t<is_me, fmi2_status_t> completed_integrator_step(
         fmi2_boolean_t no_set_fmu_state_prior_to_current_point,
         fmi2_boolean_t *enter_event_mode,
-        fmi2_boolean_t *terminate_simulation) noexcept
+        fmi2_boolean_t *terminate_simulation) noexcept(_nothrow)
     {
-        return fmi2_import_completed_integrator_step(
-            _fmu.get(), no_set_fmu_state_prior_to_current_point,
-            enter_event_mode, terminate_simulation);
+        if (!this->_check([&] {
+                return enter_event_mode && terminate_simulation;
+            })) {
+            return this->_fail(fmi2_call_t::completed_integrator_step);
+        }
+        return this->_invoke(fmi2_call_t::completed_integrator_step, [&] {
+            return this->_call.completed_integrator_step(
+                _fmu.get(), no_set_fmu_state_prior_to_current_point,
+                enter_event_mode, terminate_simulation);
+        });
     }
 
     template <bool is_me = is_model_exchange>
     typename std::enable_if_t<is_me, fmi2_status_t>
-    get_derivatives(fmi2_real_t derivatives[], size_t nx) const noexcept
+    get_derivatives(fmi2_real_t derivatives[], size_t nx) const
+        noexcept(_nothrow)
     {
-        return fmi2_import_get_derivatives(_fmu.get(), derivatives, nx);
+        if (!this->_check([&] {
+                return nx == this->number_of_continuous_states();
+            })) {
+            return this->_fail(fmi2_call_t::get_derivatives);
+        }
+        return this->_invoke(fmi2_call_t::get_derivatives, [&] {
+            return this->_call.get_derivatives(_fmu.get(), derivatives, nx);
+        });
     }
 
     template <bool is_me = is_model_exchange>
     typename std::enable_if_t<is_me, fmi2_status_t>
-    get_derivatives(std::vector<fmi2_real_t> &derivatives) const noexcept
-    {
-        assert(derivatives.size() == number_of_continuous_states());
-        return fmi2_import_get_derivatives(_fmu.get(), derivatives.data(),
-                                           derivatives.size());
+    get_derivatives(std::vector<fmi2_real_t> &derivatives) const
+        noexcept(_nothrow)
+    {
+        if (!this->_check([&] {
+                return derivatives.size()
+                       == this->number_of_continuous_states();
+            })) {
+            return this->_fail(fmi2_call_t::get_derivatives);
+        }
+        return this->_invoke(fmi2_call_t::get_derivatives, [&] {
+            return this->_call.get_derivatives(_fmu.get(), derivatives.data(),
+                                               derivatives.size());
+        });
     }
 
     template <bool is_me = is_model_exchange>
     typename std::enable_if_t<is_me, fmi2_status_t>
     get_event_indicators(fmi2_real_t event_indicators[], size_t ni) const
-        noexcept
+        noexcept(_nothrow)
     {
-        return fmi2_import_get_event_indicators(_fmu.get(), event_indicators,
-                                                ni);
+        if (!this->_check([&] {
+                return ni == this->number_of_event_indicators();
+            })) {
+            return this->_fail(fmi2_call_t::get_event_indicators);
+        }
+        return this->_invoke(fmi2_call_t::get_event_indicators, [&] {
+            return this->_call.get_event_indicators(_fmu.get(),
+                                                    event_indicators, ni);
+        });
     }
 
     template <bool is_me = is_model_exchange>
     typename std::enable_if_t<is_me, fmi2_status_t>
     get_event_indicators(std::vector<fmi2_real_t> &event_indicators) const
-        noexcept
+        noexcept(_nothrow)
     {
-        assert(event_indicators.size() == number_of_event_indicators());
-        return fmi2_import_get_event_indicators(
-            _fmu.get(), event_indicators.data(), event_indicators.size());
+        if (!this->_check([&] {
+                return event_indicators.size()
+                       == this->number_of_event_indicators();
+            })) {
+            return this->_fail(fmi2_call_t::get_event_indicators);
+        }
+        return this->_invoke(fmi2_call_t::get_event_indicators, [&] {
+            return this->_call.get_event_indicators(_fmu.get(),
+                                                    event_indicators.data(),
+                                                    event_indicators.size());
+        });
     }
 
     template <bool is_me = is_model_exchange>
     typename std::enable_if_t<is_me, fmi2_status_t>
-    get_continuous_states(fmi2_real_t states[], size_t nx) const noexcept
+    get_continuous_states(fmi2_real_t states[], size_t nx) const
+        noexcept(_nothrow)
     {
-        return fmi2_import_get_continuous_states(_fmu.get(), states, nx);
+        if (!this->_check([&] {
+                return nx == this->number_of_continuous_states();
+            })) {
+            return this->_fail(fmi2_call_t::get_continuous_states);
+        }
+        return this->_invoke(fmi2_call_t::get_continuous_states, [&] {
+            return this->_call.get_continuous_states(_fmu.get(), states, nx);
+        });
     }
 
     template <bool is_me = is_model_exchange>
     typename std::enable_if_t<is_me, fmi2_status_t>
-    get_continuous_states(std::vector<fmi2_real_t> &states) const noexcept
+    get_continuous_states(std::vector<fmi2_real_t> &states) const
+        noexcept(_nothrow)
     {
-        assert(states.size() == number_of_continuous_states());
-        return fmi2_import_get_continuous_states(_fmu.get(), states.data(),
-                                                 states.size());
+        if (!this->_check([&] {
+                return states.size() == this->number_of_continuous_states();
+            })) {
+            return this->_fail(fmi2_call_t::get_continuous_states);
+        }
+        return this->_invoke(fmi2_call_t::get_continuous_states, [&] {
+            return this->_call.get_continuous_states(_fmu.get(), states.data(),
+                                                     states.size());
+        });
     }
 
     template <bool is_me = is_model_exchange>
     typename std::enable_if_t<is_me, fmi2_status_t>
     get_nominals_of_continuous_states(fmi2_real_t x_nominal[], size_t nx) const
-        noexcept
+        noexcept(_nothrow)
     {
-        return fmi2_import_get_nominals_of_continuous_states(_fmu.get(),
-                                                             x_nominal, nx);
+        if (!this->_check([&] {
+                return nx == this->number_of_continuous_states();
+            })) {
+            return this->_fail(fmi2_call_t::get_nominals_of_continuous_states);
+        }
+        return this->_invoke(
+            fmi2_call_t::get_nominals_of_continuous_states, [&] {
+                return this->_call.get_nominals_of_continuous_states(_fmu.get(),
+                                                                     x_nominal,
+                                                                     nx);
+            });
     }
 
     template <bool is_me = is_model_exchange>
     typename std::enable_if_t<is_me, fmi2_status_t>
     get_nominals_of_continuous_states(std::vector<fmi2_real_t> &x_nominal) const
-        noexcept
+        noexcept(_nothrow)
     {
-        assert(x_nominal.size() == number_of_continuous_states());
-        return fmi2_import_get_nominals_of_continuous_states(
-            _fmu.get(), x_nominal.data(), x_nominal.size());
+        if (!this->_check([&] {
+                return x_nominal.size() == this->number_of_continuous_states();
+            })) {
+            return this->_fail(fmi2_call_t::get_nominals_of_continuous_states);
+        }
+        return this->_invoke(
+            fmi2_call_t::get_nominals_of_continuous_states, [&] {
+                return this->_call.get_nominals_of_continuous_states(
+                    _fmu.get(), x_nominal.data(), x_nominal.size());
+            });
     }
+
     ///////////////////////////////////////////////////////////////////////////
     //  CoSimulation API
     ///////////////////////////////////////////////////////////////////////////
@@ -1772,102 +3782,205 @@ public:
     typename std::enable_if_t<is_cs, fmi2_status_t>
     set_real_input_derivatives(const fmi2_value_reference_t vr[], size_t nvr,
                                const fmi2_integer_t order[],
-                               const fmi2_real_t value[]) noexcept
+                               const fmi2_real_t value[]) noexcept(_nothrow)
     {
-        return fmi2_import_set_real_input_derivatives(_fmu.get(), vr, nvr,
-                                                      order, value);
+        return this->_invoke(fmi2_call_t::set_real_input_derivatives, [&] {
+            return this->_call.set_real_input_derivatives(_fmu.get(), vr, nvr,
+                                                          order, value);
+        });
     }
 
     template <bool is_cs = !is_model_exchange>
     typename std::enable_if_t<is_cs, fmi2_status_t>
     set_real_input_derivatives(const std::vector<fmi2_value_reference_t> &vrs,
                                const std::vector<fmi2_integer_t> &order,
-                               const std::vector<fmi2_real_t> &value) noexcept
+                               const std::vector<fmi2_real_t> &value)
+        noexcept(_nothrow)
     {
-        assert(vrs.size() == order.size() && vrs.size() == value.size());
-
-        return fmi2_import_set_real_input_derivatives(
-            _fmu.get(), vrs.data(), vrs.size(), order.data(), value.data());
+        if (!this->_check([&] {
+                return vrs.size() == order.size() && vrs.size() == value.size();
+            })) {
+            return this->_fail(fmi2_call_t::set_real_input_derivatives);
+        }
+        return this->_invoke(fmi2_call_t::set_real_input_derivatives, [&] {
+            return this->_call.set_real_input_derivatives(_fmu.get(),
+                                                          vrs.data(),
+                                                          vrs.size(),
+                                                          order.data(),
+                                                          value.data());
+        });
     }
 
     template <bool is_cs = !is_model_exchange>
     typename std::enable_if_t<is_cs, fmi2_status_t>
     get_real_output_derivatives(const fmi2_value_reference_t vr[], size_t nvr,
                                 const fmi2_integer_t order[],
-                                fmi2_real_t value[]) const noexcept
+                                fmi2_real_t value[]) const noexcept(_nothrow)
     {
-        return fmi2_import_get_real_output_derivatives(_fmu.get(), vr, nvr,
-                                                       order, value);
+        return this->_invoke(fmi2_call_t::get_real_output_derivatives, [&] {
+            return this->_call.get_real_output_derivatives(_fmu.get(), vr, nvr,
+                                                           order, value);
+        });
     }
 
     template <bool is_cs = !is_model_exchange>
     typename std::enable_if_t<is_cs, fmi2_status_t>
     get_real_output_derivatives(const std::vector<fmi2_value_reference_t> &vrs,
                                 const std::vector<fmi2_integer_t> &order,
-                                std::vector<fmi2_real_t> &value) const noexcept
+                                std::vector<fmi2_real_t> &value) const
+        noexcept(_nothrow)
     {
-        assert((vrs.size() == order.size()) && (vrs.size() == value.size()));
-
-        return fmi2_import_get_real_output_derivatives(
-            _fmu.get(), vrs.data(), vrs.size(), order.data(), value.data());
+        if (!this->_check([&] {
+                return vrs.size() == order.size() && vrs.size() == value.size();
+            })) {
+            return this->_fail(fmi2_call_t::get_real_output_derivatives);
+        }
+        return this->_invoke(fmi2_call_t::get_real_output_derivatives, [&] {
+            return this->_call.get_real_output_derivatives(_fmu.get(),
+                                                           vrs.data(),
+                                                           vrs.size(),
+                                                           order.data(),
+                                                           value.data());
+        });
     }
 
     template <bool is_cs = !is_model_exchange>
-    typename std::enable_if_t<is_cs, fmi2_status_t> cancel_step() noexcept
+    typename std::enable_if_t<is_cs, fmi2_status_t> cancel_step()
+        noexcept(_nothrow)
     {
-        return fmi2_import_cancel_step(_fmu.get());
+        return this->_invoke(fmi2_call_t::cancel_step, [&] {
+            return this->_call.cancel_step(_fmu.get());
+        });
     }
 
     template <bool is_cs = !is_model_exchange>
     typename std::enable_if_t<is_cs, fmi2_status_t>
     do_step(fmi2_real_t current_communication_point,
             fmi2_real_t communication_step_size,
-            fmi2_boolean_t new_step) noexcept
+            fmi2_boolean_t new_step) noexcept(_nothrow)
     {
-        return fmi2_import_do_step(_fmu.get(), current_communication_point,
-                                   communication_step_size, new_step);
+        return this->_invoke(fmi2_call_t::do_step, [&] {
+            return this->_call.do_step(_fmu.get(), current_communication_point,
+                                       communication_step_size, new_step);
+        });
     }
 
     template <bool is_cs = !is_model_exchange>
     typename std::enable_if_t<is_cs, fmi2_status_t>
-    get_status(const fmi2_status_kind_t s, fmi2_status_t *value) const noexcept
+    get_status(const fmi2_status_kind_t s, fmi2_status_t *value) const
+        noexcept(_nothrow)
     {
-        return fmi2_import_get_status(_fmu.get(), s, value);
+        if (!this->_check([&] { return value != nullptr; })) {
+            return this->_fail(fmi2_call_t::get_status);
+        }
+        return this->_invoke(fmi2_call_t::get_status, [&] {
+            return this->_call.get_status(_fmu.get(), s, value);
+        });
     }
 
     template <bool is_cs = !is_model_exchange>
     typename std::enable_if_t<is_cs, fmi2_status_t>
     get_real_status(const fmi2_status_kind_t s, fmi2_real_t *value) const
-        noexcept
+        noexcept(_nothrow)
     {
-        return fmi2_import_get_real_status(_fmu.get(), s, value);
+        if (!this->_check([&] { return value != nullptr; })) {
+            return this->_fail(fmi2_call_t::get_real_status);
+        }
+        return this->_invoke(fmi2_call_t::get_real_status, [&] {
+            return this->_call.get_real_status(_fmu.get(), s, value);
+        });
     }
 
     template <bool is_cs = !is_model_exchange>
     typename std::enable_if_t<is_cs, fmi2_status_t>
     get_integer_status(const fmi2_status_kind_t s, fmi2_integer_t *value) const
-        noexcept
+        noexcept(_nothrow)
     {
-        return fmi2_import_get_integer_status(_fmu.get(), s, value);
+        if (!this->_check([&] { return value != nullptr; })) {
+            return this->_fail(fmi2_call_t::get_integer_status);
+        }
+        return this->_invoke(fmi2_call_t::get_integer_status, [&] {
+            return this->_call.get_integer_status(_fmu.get(), s, value);
+        });
     }
 
     template <bool is_cs = !is_model_exchange>
     typename std::enable_if_t<is_cs, fmi2_status_t>
     get_boolean_status(const fmi2_status_kind_t s, fmi2_boolean_t *value) const
-        noexcept
+        noexcept(_nothrow)
     {
-        return fmi2_import_get_boolean_status(_fmu.get(), s, value);
+        if (!this->_check([&] { return value != nullptr; })) {
+            return this->_fail(fmi2_call_t::get_boolean_status);
+        }
+        return this->_invoke(fmi2_call_t::get_boolean_status, [&] {
+            return this->_call.get_boolean_status(_fmu.get(), s, value);
+        });
     }
 
     template <bool is_cs = !is_model_exchange>
     typename std::enable_if_t<is_cs, fmi2_status_t>
     get_string_status(const fmi2_status_kind_t s, fmi2_string_t *value) const
-        noexcept
+        noexcept(_nothrow)
     {
-        return fmi2_import_get_string_status(_fmu.get(), s, value);
+        if (!this->_check([&] { return value != nullptr; })) {
+            return this->_fail(fmi2_call_t::get_string_status);
+        }
+        return this->_invoke(fmi2_call_t::get_string_status, [&] {
+            return this->_call.get_string_status(_fmu.get(), s, value);
+        });
     }
 }; // class fmi2_t
 
 using fmi2_me_t = fmi2_t<true>;
 using fmi2_cs_t = fmi2_t<false>;
+
+/**
+ * @brief Diagnosis builds: validate every call and trace it to std::clog
+ *
+ * The error policy is unchanged so master code takes the same paths as with
+ * fmi2_me_t/fmi2_cs_t.
+ */
+using fmi2_debug_me_t = fmi2_t<true, strict_check_t, stream_trace_t>;
+using fmi2_debug_cs_t = fmi2_t<false, strict_check_t, stream_trace_t>;
+
+/**
+ * @brief fmi2_t with `direct_call_t`, the raw function-pointer fast path
+ *
+ * The model description API and the policies behave as in fmi2_t.
+ */
+template <bool is_model_exchange = true,
+          typename check_policy = assert_check_t,
+          typename trace_policy = no_trace_t,
+          typename cache_policy = no_cache_t,
+          typename error_policy = return_status_t>
+class fmi2_direct_t
+    : public fmi2_t<is_model_exchange, check_policy, trace_policy,
+                    cache_policy, error_policy, direct_call_t>
+{
+private:
+    using base_t = fmi2_t<is_model_exchange, check_policy, trace_policy,
+                          cache_policy, error_policy, direct_call_t>;
+
+public:
+    using base_t::base_t;
+
+    /**
+     * @brief Raw functions, valid after construction
+     */
+    const fmi2_functions_t &functions() const noexcept
+    {
+        return this->_call.functions();
+    }
+
+    /**
+     * @brief Raw component, valid after `instantiate`
+     */
+    fmi2_component_t component() const noexcept
+    {
+        return this->_call.component();
+    }
+}; // class fmi2_direct_t
+
+using fmi2_direct_me_t = fmi2_direct_t<true>;
+using fmi2_direct_cs_t = fmi2_direct_t<false>;
 } // namespace fmilib
\ No newline at end of file
@@ -0,0 +1,1229 @@
+/*
+ *   Copyright (c) 2018, Hang Yu
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ *   * Neither the name of  nor the names of its contributors may be used to
+ *   endorse or promote products derived from this software without specific
+ *   prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *   ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *   LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *   CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *   SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *   INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *   CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *   ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#include <fmilib/integrator.hpp>
+#include <fmilib/jacobian.hpp>
+#include <fmilib/krylov.hpp>
+#include <fmilib/linalg.hpp>
+#include <fmilib/sensitivity.hpp>
+#include <fmilib/sparse_lu.hpp>
+
+namespace fmilib
+{
+/**
+ * @brief Variable-order (1 to 5), variable-step BDF driver for stiff
+ * ModelExchange FMUs
+ *
+ * The solution history is kept as backward differences; a step size
+ * change rescales the differences (quasi-constant step size BDF, as in
+ * Shampine & Reichelt, "The MATLAB ODE Suite"). The corrector is a
+ * modified Newton iteration on `I - h / alpha_k * J`:
+ *
+ * - J is reused across steps and only re-evaluated when Newton fails to
+ *   converge with an outdated J.
+ * - The iteration matrix is refactorized when the step size or order
+ *   changes, or after a convergence failure.
+ * - Large models with a sparse Jacobian keep J on the derivative
+ *   dependencies and factorize with sparse_lu_t, analyzed once and
+ *   refactorized on its pivot order; small or dense ones use
+ *   dense_lu_t, see `set_sparse_linear_solver`.
+ * - Models too large for any factorization solve the Newton systems
+ *   with GMRES or BiCGStab instead (`set_krylov_solver`): J v comes
+ *   matrix-free at the current iterate, and J itself only feeds the
+ *   preconditioner, if any.
+ *
+ * Error scaling follows dopri45_integrator_t: the absolute tolerance of a
+ * state is `rtol` times its nominal value.
+ *
+ * Forward sensitivities dx/dp (`set_sensitivity_parameters`) are
+ * co-integrated with a staggered corrector: once the states of a step
+ * have converged, the linear sensitivity equations of the same BDF
+ * formula are solved with the same iteration matrix, one directional
+ * derivative per parameter and iteration.
+ */
+template <typename model_t> class bdf_integrator_t
+{
+private:
+    static constexpr int _max_order = 5;
+    static constexpr int _newton_max_iter = 4;
+    static constexpr fmi2_real_t _min_factor = 0.2;
+    static constexpr fmi2_real_t _max_factor = 10.0;
+
+    using differences_t = std::array<std::vector<fmi2_real_t>, _max_order + 3>;
+
+    /* null if the system is shared with another driver */
+    std::unique_ptr<me_system_t<model_t>> _own_sys;
+    me_system_t<model_t> &_sys;
+    dense_jacobian_t<model_t> _jac;
+    std::function<fmi2_status_t(fmi2_real_t, const fmi2_real_t *,
+                                const fmi2_real_t *, fmi2_real_t *)>
+        _jac_external;
+    dense_lu_t _lu;
+    /* sparse iteration matrix on the Jacobian pattern plus the diagonal:
+     * position of every Jacobian nonzero and of every diagonal entry */
+    bool _sparse = false;
+    sparse_lu_t _slu;
+    sparsity_pattern_t _m_pattern;
+    std::vector<size_t> _m_pos, _m_diag;
+    std::vector<fmi2_real_t> _m_values;
+    /* Newton-Krylov: c of the iteration matrix, point of the products
+     * and derivatives there, if known */
+    std::unique_ptr<krylov_solver_t> _krylov;
+    std::unique_ptr<jacobian_operator_t<model_t>> _jv;
+    preconditioner_t _prec;
+    fmi2_real_t _c = 0.0;
+    fmi2_real_t _t_solve = 0.0;
+    const fmi2_real_t *_f_solve = nullptr;
+    std::vector<fmi2_real_t> _kx;
+    size_t _n;
+    fmi2_real_t _rtol;
+    fmi2_real_t _newton_tol;
+    fmi2_real_t _h_min = 0.0;
+    fmi2_real_t _h_max = std::numeric_limits<fmi2_real_t>::infinity();
+    fmi2_real_t _h = 0.0;
+    fmi2_real_t _t = 0.0;
+    fmi2_real_t _t0 = 0.0;
+    /* step size and order of the last step, for interpolation */
+    fmi2_real_t _h_last = 0.0;
+    int _order_last = 1;
+    /* step size change chosen after the last step, applied to the
+     * differences when the next step starts */
+    fmi2_real_t _factor_pending = 1.0;
+    fmi2_real_t _t_event = std::numeric_limits<fmi2_real_t>::infinity();
+    int _order = 1;
+    int _n_equal_steps = 0;
+    bool _jac_current = false;
+    bool _lu_valid = false;
+    bool _started = false;
+    bool _enter_event_mode = false;
+    bool _terminate = false;
+
+    /* _d[j] holds the j-th backward difference, _d[0] the solution */
+    differences_t _d;
+    std::vector<fmi2_real_t> _x, _atol, _J, _M, _scale;
+    std::vector<fmi2_real_t> _y, _y_pred, _psi, _dsum, _dy, _f;
+    std::array<fmi2_real_t, _max_order + 2> _gamma{}, _alpha{}, _error_const{};
+    std::vector<fmi2_real_t> _R, _U, _RU, _tmp;
+
+    /* forward sensitivities, one set of differences per parameter */
+    std::unique_ptr<parameter_sensitivity_t<model_t>> _sens;
+    bool _sens_error_control = false;
+    /* convergence rate of the last sensitivity corrector */
+    fmi2_real_t _sens_rate = 1.0;
+    std::vector<differences_t> _sd;
+    std::vector<std::vector<fmi2_real_t>> _s, _s_y, _s_dsum;
+    std::vector<fmi2_real_t> _s_psi, _s_scale, _g;
+
+    static bool _failed(fmi2_status_t s) noexcept
+    {
+        return s > fmi2_status_warning;
+    }
+
+    fmi2_real_t _norm(const std::vector<fmi2_real_t> &v,
+                      const std::vector<fmi2_real_t> &scale) const
+    {
+        fmi2_real_t sum = 0.0;
+        for (size_t i = 0; i < _n; ++i) {
+            auto r = v[i] / scale[i];
+            sum += r * r;
+        }
+        return _n ? std::sqrt(sum / _n) : 0.0;
+    }
+
+    fmi2_real_t _norm(const std::vector<fmi2_real_t> &v) const
+    {
+        return _norm(v, _scale);
+    }
+
+    void _set_scale(const std::vector<fmi2_real_t> &y)
+    {
+        for (size_t i = 0; i < _n; ++i) {
+            _scale[i] = _atol[i] + _rtol * std::abs(y[i]);
+        }
+    }
+
+    /* the absolute tolerance of dx/dp is that of x divided by |p| */
+    void _set_sens_scale(size_t p, const std::vector<fmi2_real_t> &s)
+    {
+        auto v = std::abs(_sens->values()[p]);
+        auto p_bar = v > 0.0 ? v : 1.0;
+        for (size_t i = 0; i < _n; ++i) {
+            _s_scale[i] = _atol[i] / p_bar + _rtol * std::abs(s[i]);
+        }
+    }
+
+    /* largest norm of `e[j] * d[j]` over the sensitivities */
+    fmi2_real_t _sens_norm(size_t j, fmi2_real_t e)
+    {
+        fmi2_real_t norm = 0.0;
+        for (size_t p = 0; p < _sd.size(); ++p) {
+            _set_sens_scale(p, _s[p]);
+            for (size_t i = 0; i < _n; ++i) {
+                _g[i] = e * _sd[p][j][i];
+            }
+            norm = std::max(norm, _norm(_g, _s_scale));
+        }
+        return norm;
+    }
+
+    /* (order + 1) x (order + 1) matrix R of Shampine & Reichelt */
+    static void _compute_r(int order, fmi2_real_t factor,
+                           std::vector<fmi2_real_t> &R)
+    {
+        auto k = static_cast<size_t>(order) + 1;
+        R.assign(k * k, 0.0);
+        for (size_t j = 0; j < k; ++j) {
+            R[j] = 1.0;
+        }
+        for (size_t i = 1; i < k; ++i) {
+            for (size_t j = 0; j < k; ++j) {
+                auto m = j == 0 ? 0.0
+                                : (i - 1.0 - factor * j) / static_cast<double>(i);
+                R[i * k + j] = R[(i - 1) * k + j] * m;
+            }
+            R[i * k] = 0.0;
+        }
+    }
+
+    /* rescale the differences for a step size change by `factor` */
+    void _change_d(fmi2_real_t factor)
+    {
+        auto k = static_cast<size_t>(_order) + 1;
+        _compute_r(_order, factor, _R);
+        _compute_r(_order, 1.0, _U);
+        _RU.assign(k * k, 0.0);
+        for (size_t i = 0; i < k; ++i) {
+            for (size_t l = 0; l < k; ++l) {
+                auto r = _R[i * k + l];
+                for (size_t j = 0; j < k; ++j) {
+                    _RU[i * k + j] += r * _U[l * k + j];
+                }
+            }
+        }
+        _rescale(_d, k);
+        for (auto &d : _sd) {
+            _rescale(d, k);
+        }
+        _n_equal_steps = 0;
+        _lu_valid = false;
+    }
+
+    /* D[:k] = RU^T D[:k] */
+    void _rescale(differences_t &d, size_t k)
+    {
+        for (size_t c = 0; c < _n; ++c) {
+            for (size_t j = 0; j < k; ++j) {
+                fmi2_real_t sum = 0.0;
+                for (size_t i = 0; i < k; ++i) {
+                    sum += _RU[i * k + j] * d[i][c];
+                }
+                _tmp[j] = sum;
+            }
+            for (size_t j = 0; j < k; ++j) {
+                d[j][c] = _tmp[j];
+            }
+        }
+    }
+
+    /* add the corrections `dsum` of an accepted step to the differences */
+    void _update_d(differences_t &d, const std::vector<fmi2_real_t> &dsum)
+    {
+        auto k = static_cast<size_t>(_order);
+        for (size_t i = 0; i < _n; ++i) {
+            d[k + 2][i] = dsum[i] - d[k + 1][i];
+            d[k + 1][i] = dsum[i];
+        }
+        for (size_t j = k + 1; j-- > 0;) {
+            for (size_t i = 0; i < _n; ++i) {
+                d[j][i] += d[j + 1][i];
+            }
+        }
+    }
+
+    void _interpolate(const differences_t &d, fmi2_real_t t,
+                      fmi2_real_t x[]) const
+    {
+        std::copy(d[0].begin(), d[0].end(), x);
+        if (_h_last == 0.0) {
+            return;
+        }
+        fmi2_real_t p = 1.0;
+        for (int j = 0; j < _order_last; ++j) {
+            p *= (t - (_t - _h_last * j)) / (_h_last * (j + 1));
+            const auto &dj = d[j + 1];
+            for (size_t i = 0; i < _n; ++i) {
+                x[i] += dj[i] * p;
+            }
+        }
+    }
+
+    /* pattern of I - c J and the positions of J and I in it */
+    void _iteration_pattern()
+    {
+        if (_m_diag.size() == _n && !_m_values.empty()) {
+            return;
+        }
+        _m_pattern = _jac.sparse().pattern().with_diagonal(&_m_pos);
+        _m_diag.resize(_n);
+        for (size_t i = 0; i < _n; ++i) {
+            _m_diag[i] = _m_pattern.find(i, i);
+        }
+        _m_values.resize(_m_pattern.nnz());
+    }
+
+    void _iteration_matrix(fmi2_real_t c)
+    {
+        const auto &values = _jac.sparse().values();
+        std::fill(_m_values.begin(), _m_values.end(), 0.0);
+        for (size_t k = 0; k < values.size(); ++k) {
+            _m_values[_m_pos[k]] = -c * values[k];
+        }
+        for (auto k : _m_diag) {
+            _m_values[k] += 1.0;
+        }
+    }
+
+    fmi2_status_t _factor(fmi2_real_t c)
+    {
+        _sens_rate = 1.0;
+        if (_krylov) {
+            _c = c;
+            if (_prec.kind() != preconditioner_kind_t::none) {
+                ++_sys.stats.factorizations;
+                _iteration_matrix(c);
+                _prec.setup(_m_pattern, _m_values.data());
+            }
+            _lu_valid = true;
+            return fmi2_status_ok;
+        }
+        ++_sys.stats.factorizations;
+        if (_sparse) {
+            _iteration_matrix(c);
+            _lu_valid = _slu.refactor(_m_values);
+            return _lu_valid ? fmi2_status_ok : fmi2_status_error;
+        }
+        auto n2 = _n * _n;
+        for (size_t i = 0; i < n2; ++i) {
+            _M[i] = -c * _J[i];
+        }
+        for (size_t i = 0; i < _n; ++i) {
+            _M[i * _n + i] += 1.0;
+        }
+        _lu_valid = _lu.factor(_M, _n);
+        return _lu_valid ? fmi2_status_ok : fmi2_status_error;
+    }
+
+    /* (I - c J) x = b in place; the Krylov methods bound the residual
+     * in the error norm well below the Newton tolerance, with J v at
+     * (_t_solve, _y), which the FMU holds */
+    fmi2_status_t _solve(std::vector<fmi2_real_t> &b,
+                         const std::vector<fmi2_real_t> &scale)
+    {
+        if (!_krylov) {
+            if (_sparse) {
+                _slu.solve(b);
+            } else {
+                _lu.solve(b);
+            }
+            return fmi2_status_ok;
+        }
+        std::fill(_kx.begin(), _kx.end(), 0.0);
+        auto s = _krylov->solve(
+            [this](const fmi2_real_t v[], fmi2_real_t w[]) {
+                auto s = _jv->apply(_t_solve, _y.data(), _f_solve, v, w);
+                for (size_t i = 0; i < _n; ++i) {
+                    w[i] = v[i] - _c * w[i];
+                }
+                return s;
+            },
+            [this](fmi2_real_t v[]) { _prec.apply(v); }, b.data(),
+            _kx.data(), _n, 0.05 * _newton_tol * std::sqrt(_n), 5 * _n + 10,
+            scale.data());
+        _sys.stats.krylov_iterations += _krylov->iterations();
+        b = _kx;
+        return s;
+    }
+
+    /* modified Newton on y = y_pred + d, returns iterations or 0 */
+    int _newton(fmi2_real_t t_new, fmi2_real_t c, fmi2_status_t &status)
+    {
+        _y = _y_pred;
+        std::fill(_dsum.begin(), _dsum.end(), 0.0);
+        fmi2_real_t dy_norm_old = -1.0;
+        status = fmi2_status_ok;
+        for (int k = 0; k < _newton_max_iter; ++k) {
+            ++_sys.stats.newton_iterations;
+            status = _sys.derivatives(t_new, _y.data(), _f.data());
+            if (_failed(status)) {
+                return 0;
+            }
+            for (size_t i = 0; i < _n; ++i) {
+                if (!std::isfinite(_f[i])) {
+                    return 0;
+                }
+                _dy[i] = c * _f[i] - _psi[i] - _dsum[i];
+            }
+            _t_solve = t_new;
+            _f_solve = _f.data();
+            status = _solve(_dy, _scale);
+            if (_failed(status)) {
+                return 0;
+            }
+            auto dy_norm = _norm(_dy);
+            fmi2_real_t rate = -1.0;
+            if (dy_norm_old >= 0.0) {
+                rate = dy_norm / dy_norm_old;
+                if (rate >= 1.0
+                    || std::pow(rate, _newton_max_iter - k) / (1.0 - rate)
+                               * dy_norm
+                           > _newton_tol) {
+                    return 0;
+                }
+            }
+            for (size_t i = 0; i < _n; ++i) {
+                _y[i] += _dy[i];
+                _dsum[i] += _dy[i];
+            }
+            if (dy_norm == 0.0
+                || (rate >= 0.0 && rate / (1.0 - rate) * dy_norm < _newton_tol)) {
+                return k + 1;
+            }
+            dy_norm_old = dy_norm;
+        }
+        return 0;
+    }
+
+    /* staggered corrector for parameter p with the states _y of the
+     * step converged; the sensitivity equations are linear, so with a
+     * current J one iteration is usually enough */
+    bool _sens_newton(fmi2_real_t t_new, fmi2_real_t c, size_t p,
+                      fmi2_status_t &status)
+    {
+        auto k = static_cast<size_t>(_order);
+        auto &d = _sd[p];
+        auto &s = _s_y[p];
+        auto &dsum = _s_dsum[p];
+        for (size_t i = 0; i < _n; ++i) {
+            fmi2_real_t pred = 0.0, psi = 0.0;
+            for (size_t j = 0; j <= k; ++j) {
+                pred += d[j][i];
+            }
+            for (size_t j = 1; j <= k; ++j) {
+                psi += _gamma[j] * d[j][i];
+            }
+            s[i] = pred;
+            _s_psi[i] = psi / _alpha[k];
+        }
+        _set_sens_scale(p, s);
+        std::fill(dsum.begin(), dsum.end(), 0.0);
+        const fmi2_real_t *f = _sens->directional() ? nullptr : _f.data();
+        fmi2_real_t ds_norm_old = -1.0;
+        status = fmi2_status_ok;
+        for (int it = 0; it < _newton_max_iter; ++it) {
+            status = _sens->evaluate(t_new, _y.data(), f, p, s.data(),
+                                     _g.data());
+            if (_failed(status)) {
+                return false;
+            }
+            for (size_t i = 0; i < _n; ++i) {
+                if (!std::isfinite(_g[i])) {
+                    return false;
+                }
+                _g[i] = c * _g[i] - _s_psi[i] - dsum[i];
+            }
+            _t_solve = t_new;
+            _f_solve = f;
+            status = _solve(_g, _s_scale);
+            if (_failed(status)) {
+                return false;
+            }
+            auto ds_norm = _norm(_g, _s_scale);
+            for (size_t i = 0; i < _n; ++i) {
+                s[i] += _g[i];
+                dsum[i] += _g[i];
+            }
+            if (ds_norm_old >= 0.0) {
+                auto rate = ds_norm / ds_norm_old;
+                if (rate >= 1.0) {
+                    return false;
+                }
+                _sens_rate = std::max(0.3 * _sens_rate, rate);
+            }
+            if (ds_norm == 0.0
+                || std::min(1.0, _sens_rate) * ds_norm < _newton_tol) {
+                return true;
+            }
+            ds_norm_old = ds_norm;
+        }
+        return false;
+    }
+
+    /* sensitivity correctors of all parameters, refreshing an outdated J
+     * once; returns false if they do not converge */
+    bool _sens_correct(fmi2_real_t t_new, fmi2_real_t c, fmi2_status_t &status)
+    {
+        status = fmi2_status_ok;
+        if (!_sens->directional()) {
+            status = _sys.derivatives(t_new, _y.data(), _f.data());
+            if (_failed(status)) {
+                return false;
+            }
+        }
+        for (;;) {
+            auto converged = true;
+            for (size_t p = 0; p < _sd.size() && converged; ++p) {
+                converged = _sens_newton(t_new, c, p, status);
+            }
+            if (converged || _failed(status) || _jac_current) {
+                return converged;
+            }
+            status = _jacobian(t_new, _y.data(), nullptr);
+            if (_failed(status)) {
+                return false;
+            }
+            _jac_current = true;
+            if (_failed(_factor(c))) {
+                return false;
+            }
+        }
+    }
+
+    fmi2_status_t _jacobian(fmi2_real_t t, const fmi2_real_t x[],
+                            const fmi2_real_t f[])
+    {
+        if (_jac_external) {
+            return _jac_external(t, x, f, _J.data());
+        }
+        if (_krylov && _prec.kind() == preconditioner_kind_t::none) {
+            return fmi2_status_ok;
+        }
+        return _sparse || _krylov ? _jac.sparse().evaluate(t, x, f)
+                       : _jac.evaluate(t, x, f, _J.data());
+    }
+
+    fmi2_status_t _start()
+    {
+        // derivative at the initial point and a first order step estimate
+        if (auto s = _sys.derivatives(_t, _x.data(), _f.data()); _failed(s)) {
+            return s;
+        }
+        if (auto s = _jacobian(_t, _x.data(), _f.data());
+            _failed(s)) {
+            return s;
+        }
+        _jac_current = true;
+        if (_h <= 0.0) {
+            _set_scale(_x);
+            auto d0 = _norm(_x);
+            auto d1 = _norm(_f);
+            _h = (d0 < 1e-5 || d1 < 1e-5) ? 1e-6 : 0.01 * d0 / d1;
+            _h = std::max(std::min(_h, _h_max), _h_min);
+        }
+        for (auto &d : _d) {
+            std::fill(d.begin(), d.end(), 0.0);
+        }
+        _d[0] = _x;
+        for (size_t i = 0; i < _n; ++i) {
+            _d[1][i] = _h * _f[i];
+        }
+        for (size_t p = 0; p < _sd.size(); ++p) {
+            for (auto &d : _sd[p]) {
+                std::fill(d.begin(), d.end(), 0.0);
+            }
+            _sd[p][0] = _s[p];
+            if (auto s = _sens->evaluate(_t, _x.data(), _f.data(), p,
+                                         _s[p].data(), _g.data());
+                _failed(s)) {
+                return s;
+            }
+            for (size_t i = 0; i < _n; ++i) {
+                _sd[p][1][i] = _h * _g[i];
+            }
+        }
+        _order = 1;
+        _n_equal_steps = 0;
+        _lu_valid = false;
+        _started = true;
+        return fmi2_status_ok;
+    }
+
+    bdf_integrator_t(model_t &m, me_system_t<model_t> *shared,
+                     fmi2_real_t rtol, bool directional)
+        : _own_sys{shared ? nullptr
+                          : std::make_unique<me_system_t<model_t>>(m)},
+          _sys{shared ? *shared : *_own_sys}, _jac{_sys, directional},
+          _n{_sys.size()},
+          _rtol{rtol > 0.0 ? rtol : m.default_experiment_tolerance()}
+    {
+        constexpr auto eps = std::numeric_limits<fmi2_real_t>::epsilon();
+        _newton_tol = std::max(10.0 * eps / _rtol,
+                               std::min(0.03, std::sqrt(_rtol)));
+        for (auto &d : _d) {
+            d.resize(_n);
+        }
+        for (auto v : {&_x, &_atol, &_scale, &_y, &_y_pred, &_psi, &_dsum, &_dy,
+                       &_f}) {
+            v->resize(_n);
+        }
+        set_sparse_linear_solver(
+            sparse_lu_t::preferred(_jac.sparse().pattern()));
+        _s_psi.resize(_n);
+        _s_scale.resize(_n);
+        _g.resize(_n);
+        _tmp.resize(_max_order + 3);
+        for (int k = 1; k <= _max_order; ++k) {
+            _gamma[k] = _gamma[k - 1] + 1.0 / k;
+        }
+        _alpha = _gamma;
+        for (int k = 0; k <= _max_order + 1; ++k) {
+            _error_const[k] = 1.0 / (k + 1);
+        }
+    }
+
+public:
+    /**
+     * @brief Construct with relative tolerance `rtol`, defaults to the
+     * default experiment tolerance of the FMU
+     *
+     * @param directional use directional derivatives for the Jacobian if
+     * the FMU provides them
+     */
+    explicit bdf_integrator_t(model_t &m, fmi2_real_t rtol = 0.0,
+                              bool directional = true)
+        : bdf_integrator_t{m, nullptr, rtol, directional}
+    {
+    }
+
+    /**
+     * @brief Construct on the system of another driver of the same FMU,
+     * sharing its cached time and statistics
+     */
+    explicit bdf_integrator_t(me_system_t<model_t> &sys,
+                              fmi2_real_t rtol = 0.0, bool directional = true)
+        : bdf_integrator_t{sys.model(), &sys, rtol, directional}
+    {
+    }
+
+    /**
+     * @brief Start at `t` with order 1, reading states and nominals from
+     * the FMU
+     */
+    fmi2_status_t reset(fmi2_real_t t)
+    {
+        _t = t;
+        _t0 = t;
+        _h_last = 0.0;
+        _factor_pending = 1.0;
+        _started = false;
+        _enter_event_mode = false;
+        _terminate = false;
+        _sys.invalidate();
+        if (auto s = _sys.set_time(t); _failed(s)) {
+            return s;
+        }
+        if (auto s = _sys.read_states(_x.data()); _failed(s)) {
+            return s;
+        }
+        if (auto s = _sys.nominals(_atol.data()); _failed(s)) {
+            return s;
+        }
+        for (auto &a : _atol) {
+            a = _rtol * std::abs(a);
+        }
+        return _sens ? _sens->read_parameters() : fmi2_status_ok;
+    }
+
+    /**
+     * @brief Restart at `t` with order 1 from states the caller already
+     * holds, keeping the nominals of the last `reset(t)`
+     *
+     * The FMU must hold `x` at `t`.
+     */
+    fmi2_status_t reset(fmi2_real_t t, const fmi2_real_t x[])
+    {
+        _t = t;
+        _t0 = t;
+        _h_last = 0.0;
+        _factor_pending = 1.0;
+        _started = false;
+        _enter_event_mode = false;
+        _terminate = false;
+        std::copy(x, x + _n, _x.begin());
+        return _sys.set_time(t);
+    }
+
+    /**
+     * @brief Evaluate the Jacobian with `jac.evaluate(t, x, f, J)` instead
+     * of the built-in dense_jacobian_t, e.g. with a parallel_fd_jacobian_t
+     *
+     * `jac` must outlive the driver. J is dense, so the driver switches
+     * to dense_lu_t.
+     */
+    template <typename jacobian_t> void set_jacobian(jacobian_t &jac)
+    {
+        set_krylov_solver(krylov_method_t::none);
+        set_sparse_linear_solver(false);
+        _jac_external = [&jac](fmi2_real_t t, const fmi2_real_t x[],
+                               const fmi2_real_t f[], fmi2_real_t J[]) {
+            return jac.evaluate(t, x, f, J);
+        };
+        _jac_current = false;
+    }
+
+    /**
+     * @brief Factorize with sparse_lu_t on the derivative dependencies
+     * instead of dense_lu_t
+     *
+     * Chosen by sparse_lu_t::preferred on construction, ignored while an
+     * external Jacobian is set and deferred while a Krylov solver is.
+     * The symbolic analysis runs once; J is re-evaluated for the next
+     * step.
+     */
+    void set_sparse_linear_solver(bool sparse)
+    {
+        _sparse = sparse && !_jac_external;
+        _lu_valid = false;
+        _jac_current = false;
+        if (_krylov) {
+            return;
+        }
+        if (!_sparse) {
+            _J.resize(_n * _n);
+            _M.resize(_n * _n);
+            return;
+        }
+        if (_slu.size() != _n) {
+            _iteration_pattern();
+            _slu.analyze(_m_pattern);
+        }
+        _J.clear();
+        _J.shrink_to_fit();
+        _M.clear();
+        _M.shrink_to_fit();
+    }
+
+    bool sparse_linear_solver() const noexcept
+    {
+        return _sparse;
+    }
+
+    /**
+     * @brief Solve the Newton systems with a Krylov method instead of a
+     * factorization, `krylov_method_t::none` switches back
+     *
+     * J v is a directional derivative or a forward difference at the
+     * current Newton iterate, so no Jacobian is formed unless the
+     * preconditioner needs the sparse J; ILU(0) keeps its pattern. The
+     * external Jacobian of `set_jacobian` is dropped.
+     *
+     * @param restart Krylov subspace dimension of GMRES
+     * @param directional use directional derivatives for J v if the FMU
+     * provides them
+     */
+    void set_krylov_solver(
+        krylov_method_t method,
+        preconditioner_kind_t preconditioner = preconditioner_kind_t::ilu0,
+        size_t restart = 30, bool directional = true)
+    {
+        _lu_valid = false;
+        _jac_current = false;
+        if (method == krylov_method_t::none) {
+            if (_krylov) {
+                _krylov.reset();
+                set_sparse_linear_solver(_sparse);
+            }
+            return;
+        }
+        _jac_external = nullptr;
+        _J.clear();
+        _J.shrink_to_fit();
+        _M.clear();
+        _M.shrink_to_fit();
+        _krylov = std::make_unique<krylov_solver_t>(method, restart);
+        if (!_jv || _jv->directional() != directional) {
+            _jv = std::make_unique<jacobian_operator_t<model_t>>(_sys,
+                                                                 directional);
+        }
+        _prec = preconditioner_t{preconditioner};
+        if (preconditioner != preconditioner_kind_t::none) {
+            _iteration_pattern();
+        }
+        _kx.resize(_n);
+    }
+
+    krylov_method_t krylov_solver() const noexcept
+    {
+        return _krylov ? _krylov->method() : krylov_method_t::none;
+    }
+
+    /**
+     * @brief Newton-Krylov without preconditioner, no Jacobian is formed
+     */
+    bool matrix_free() const noexcept
+    {
+        return _krylov && _prec.kind() == preconditioner_kind_t::none;
+    }
+
+    /**
+     * @brief Co-integrate the forward sensitivities dx/dp of the real
+     * parameters `parameters`, starting from zero
+     *
+     * Sensitivities are continuous across `reset`, jumps at events are
+     * not modelled. An empty list switches them off. Takes effect with
+     * the next step, which restarts at order 1. Throws
+     * std::runtime_error if the value references cannot be resolved.
+     *
+     * @param error_control include the sensitivities in the local error
+     * test and the step size selection
+     * @param directional use directional derivatives if the FMU
+     * provides them, otherwise forward differences
+     */
+    void set_sensitivity_parameters(
+        std::vector<fmi2_value_reference_t> parameters,
+        bool error_control = false, bool directional = true)
+    {
+        auto np = parameters.size();
+        if (np == 0) {
+            _sens.reset();
+        } else {
+            _sens = std::make_unique<parameter_sensitivity_t<model_t>>(
+                _sys, std::move(parameters), directional);
+        }
+        _sens_error_control = error_control;
+        _sd.resize(np);
+        for (auto &d : _sd) {
+            for (auto &v : d) {
+                v.assign(_n, 0.0);
+            }
+        }
+        for (auto v : {&_s, &_s_y, &_s_dsum}) {
+            v->assign(np, std::vector<fmi2_real_t>(_n, 0.0));
+        }
+        _h_last = 0.0;
+        _started = false;
+    }
+
+    /**
+     * @brief Set dx/dp_k, e.g. if start values depend on the parameter;
+     * takes effect with the next step
+     */
+    void set_sensitivities(size_t k, const fmi2_real_t s[])
+    {
+        std::copy(s, s + _n, _s[k].begin());
+        _sd[k][0] = _s[k];
+        _h_last = 0.0;
+        _started = false;
+    }
+
+    void set_step_limits(fmi2_real_t h_min, fmi2_real_t h_max) noexcept
+    {
+        _h_min = h_min;
+        _h_max = h_max;
+    }
+
+    void set_next_time_event(fmi2_real_t t) noexcept
+    {
+        _t_event = t;
+    }
+
+    void clear_next_time_event() noexcept
+    {
+        _t_event = std::numeric_limits<fmi2_real_t>::infinity();
+    }
+
+    /**
+     * @brief Take one accepted step towards `t_stop`
+     *
+     * Does nothing if `t_stop` is not ahead of the current time.
+     *
+     * @return fmi2_status_error if the step size falls below the minimum
+     */
+    fmi2_status_t step(fmi2_real_t t_stop)
+    {
+        auto eps = 100.0 * std::numeric_limits<fmi2_real_t>::epsilon()
+                   * std::max({1.0, std::abs(_t), std::abs(t_stop)});
+        if (t_stop - _t <= eps) {
+            return fmi2_status_ok;
+        }
+        if (!_started) {
+            if (auto s = _start(); _failed(s)) {
+                return s;
+            }
+        }
+        auto h_min = std::max(_h_min, eps);
+        if (_factor_pending != 1.0) {
+            _change_d(_factor_pending);
+            _factor_pending = 1.0;
+        }
+        if (_h > _h_max) {
+            _change_d(_h_max / _h);
+            _h = _h_max;
+        } else if (_h < h_min) {
+            _change_d(h_min / _h);
+            _h = h_min;
+        }
+
+        fmi2_real_t error_norm = 0.0;
+        fmi2_real_t safety = 0.0;
+        fmi2_real_t t_new = 0.0;
+        for (;;) {
+            if (_h < h_min) {
+                return fmi2_status_error;
+            }
+            t_new = _t + _h;
+            if (t_new > t_stop - eps) {
+                t_new = t_stop;
+                if (t_stop - _t != _h) {
+                    _change_d((t_stop - _t) / _h);
+                    _h = t_stop - _t;
+                }
+            }
+            auto k = static_cast<size_t>(_order);
+            for (size_t i = 0; i < _n; ++i) {
+                fmi2_real_t pred = 0.0, psi = 0.0;
+                for (size_t j = 0; j <= k; ++j) {
+                    pred += _d[j][i];
+                }
+                for (size_t j = 1; j <= k; ++j) {
+                    psi += _gamma[j] * _d[j][i];
+                }
+                _y_pred[i] = pred;
+                _psi[i] = psi / _alpha[k];
+            }
+            _set_scale(_y_pred);
+            auto c = _h / _alpha[k];
+
+            int iterations = 0;
+            fmi2_status_t s = fmi2_status_ok;
+            for (;;) {
+                if (!_lu_valid) {
+                    if (_failed(_factor(c))) {
+                        break;
+                    }
+                }
+                iterations = _newton(t_new, c, s);
+                if (iterations > 0 || _jac_current) {
+                    break;
+                }
+                // retry with a fresh Jacobian at the predicted point
+                s = _jacobian(t_new, _y_pred.data(), nullptr);
+                if (_failed(s)) {
+                    return s;
+                }
+                _jac_current = true;
+                _lu_valid = false;
+            }
+            if (s == fmi2_status_fatal) {
+                return s;
+            }
+            if (iterations == 0) {
+                ++_sys.stats.newton_failures;
+                ++_sys.stats.rejected_steps;
+                _change_d(0.5);
+                _h *= 0.5;
+                continue;
+            }
+
+            safety = 0.9 * (2.0 * _newton_max_iter + 1.0)
+                     / (2.0 * _newton_max_iter + iterations);
+            _set_scale(_y);
+            for (size_t i = 0; i < _n; ++i) {
+                _dy[i] = _error_const[k] * _dsum[i];
+            }
+            error_norm = _norm(_dy);
+            if (error_norm <= 1.0 && _sens) {
+                if (!_sens_correct(t_new, c, s)) {
+                    if (s == fmi2_status_fatal) {
+                        return s;
+                    }
+                    ++_sys.stats.newton_failures;
+                    ++_sys.stats.rejected_steps;
+                    _change_d(0.5);
+                    _h *= 0.5;
+                    continue;
+                }
+                for (size_t p = 0; p < _sd.size() && _sens_error_control;
+                     ++p) {
+                    _set_sens_scale(p, _s_y[p]);
+                    for (size_t i = 0; i < _n; ++i) {
+                        _dy[i] = _error_const[k] * _s_dsum[p][i];
+                    }
+                    error_norm = std::max(error_norm, _norm(_dy, _s_scale));
+                }
+            }
+            if (error_norm > 1.0) {
+                ++_sys.stats.rejected_steps;
+                auto factor = std::max(
+                    _min_factor, safety * std::pow(error_norm, -1.0 / (k + 1)));
+                // the iteration matrix is kept, Newton converged fine
+                auto lu_valid = _lu_valid;
+                _change_d(factor);
+                _lu_valid = lu_valid;
+                _h *= factor;
+                continue;
+            }
+            break;
+        }
+
+        // accepted
+        ++_n_equal_steps;
+        _t0 = _t;
+        _t = t_new;
+        _h_last = _h;
+        _order_last = _order;
+        _x = _y;
+        _jac_current = false;
+        auto k = static_cast<size_t>(_order);
+        _update_d(_d, _dsum);
+        for (size_t p = 0; p < _sd.size(); ++p) {
+            _s[p] = _s_y[p];
+            _update_d(_sd[p], _s_dsum[p]);
+        }
+
+        ++_sys.stats.steps;
+        if (auto s = _sys.set_point(_t, _x.data()); _failed(s)) {
+            return s;
+        }
+        auto status = _sys.completed_step(_enter_event_mode, _terminate);
+
+        if (_n_equal_steps < _order + 1) {
+            return status;
+        }
+        // order and step size selection
+        auto inf = std::numeric_limits<fmi2_real_t>::infinity();
+        fmi2_real_t err_m = inf, err_p = inf;
+        if (_order > 1) {
+            for (size_t i = 0; i < _n; ++i) {
+                _dy[i] = _error_const[k - 1] * _d[k][i];
+            }
+            err_m = _norm(_dy);
+            if (_sens_error_control) {
+                err_m = std::max(err_m, _sens_norm(k, _error_const[k - 1]));
+            }
+        }
+        if (_order < _max_order) {
+            for (size_t i = 0; i < _n; ++i) {
+                _dy[i] = _error_const[k + 1] * _d[k + 2][i];
+            }
+            err_p = _norm(_dy);
+            if (_sens_error_control) {
+                err_p = std::max(err_p,
+                                 _sens_norm(k + 2, _error_const[k + 1]));
+            }
+        }
+        fmi2_real_t errs[] = {err_m, error_norm, err_p};
+        int best = 1;
+        fmi2_real_t best_factor = 0.0;
+        for (int i = 0; i < 3; ++i) {
+            auto f = errs[i] == 0.0 ? inf
+                                    : std::pow(errs[i], -1.0 / (_order + i));
+            if (f > best_factor) {
+                best_factor = f;
+                best = i;
+            }
+        }
+        _order += best - 1;
+        // deferred so the differences still interpolate the last step
+        _factor_pending = std::min(_max_factor, safety * best_factor);
+        _h *= _factor_pending;
+        return status;
+    }
+
+    /**
+     * @brief Same as `step`, the entry point shared with
+     * fixed_step_integrator_t
+     */
+    fmi2_status_t advance(fmi2_real_t t_stop)
+    {
+        return step(t_stop);
+    }
+
+    /**
+     * @brief Integrate up to `t_end`, calling `observer(t, x)` after every
+     * step
+     */
+    template <typename observer_t = null_observer_t>
+    fmi2_status_t integrate(fmi2_real_t t_end, observer_t &&observer = {})
+    {
+        auto status = fmi2_status_ok;
+        auto t_stop = std::min(t_end, _t_event);
+        auto eps = 100.0 * std::numeric_limits<fmi2_real_t>::epsilon()
+                   * std::max({1.0, std::abs(_t), std::abs(t_stop)});
+        while (_t < t_stop - eps && !_enter_event_mode && !_terminate) {
+            auto s = step(t_stop);
+            status = std::max(status, s);
+            if (_failed(s)) {
+                return s;
+            }
+            observer(_t, _x);
+        }
+        return status;
+    }
+
+    /**
+     * @brief States at `t` within the last step, from the interpolating
+     * polynomial of the backward differences
+     */
+    fmi2_status_t interpolate(fmi2_real_t t, fmi2_real_t x[]) const
+    {
+        _interpolate(_d, t, x);
+        return fmi2_status_ok;
+    }
+
+    /**
+     * @brief Sensitivities dx/dp_k at `t` within the last step
+     */
+    fmi2_status_t interpolate_sensitivities(fmi2_real_t t, size_t k,
+                                            fmi2_real_t s[]) const
+    {
+        _interpolate(_sd[k], t, s);
+        return fmi2_status_ok;
+    }
+
+    fmi2_real_t time() const noexcept
+    {
+        return _t;
+    }
+
+    /**
+     * @brief Start time of the last step
+     */
+    fmi2_real_t previous_time() const noexcept
+    {
+        return _t0;
+    }
+
+    fmi2_real_t step_size() const noexcept
+    {
+        return _h;
+    }
+
+    int order() const noexcept
+    {
+        return _order;
+    }
+
+    /**
+     * @brief Last evaluated df/dx (row-major), possibly from an earlier
+     * step; empty with the sparse linear solver or a Krylov solver
+     */
+    const std::vector<fmi2_real_t> &jacobian() const noexcept
+    {
+        return _J;
+    }
+
+    /**
+     * @brief `w = J v` with the last evaluated df/dx, dense or sparse
+     *
+     * A Krylov solver without preconditioner forms no J; the product is
+     * then taken matrix-free at the last accepted point, which costs a
+     * directional derivative or a derivative evaluation of the FMU.
+     */
+    fmi2_status_t multiply_jacobian(const fmi2_real_t v[], fmi2_real_t w[])
+    {
+        if (matrix_free()) {
+            if (auto s = _sys.set_point(_t, _x.data()); _failed(s)) {
+                return s;
+            }
+            return _jv->apply(_t, _x.data(), nullptr, v, w);
+        }
+        if (!_sparse && !_krylov) {
+            for (size_t i = 0; i < _n; ++i) {
+                fmi2_real_t sum = 0.0;
+                for (size_t j = 0; j < _n; ++j) {
+                    sum += _J[i * _n + j] * v[j];
+                }
+                w[i] = sum;
+            }
+            return fmi2_status_ok;
+        }
+        const auto &p = _jac.sparse().pattern();
+        const auto &values = _jac.sparse().values();
+        for (size_t i = 0; i < _n; ++i) {
+            fmi2_real_t sum = 0.0;
+            for (auto k = p.row_start[i]; k < p.row_start[i + 1]; ++k) {
+                sum += values[k] * v[p.columns[k]];
+            }
+            w[i] = sum;
+        }
+        return fmi2_status_ok;
+    }
+
+    const std::vector<fmi2_real_t> &states() const noexcept
+    {
+        return _x;
+    }
+
+    /**
+     * @brief Number of sensitivity parameters
+     */
+    size_t sensitivity_size() const noexcept
+    {
+        return _s.size();
+    }
+
+    /**
+     * @brief Sensitivities dx/dp_k at `time()`
+     */
+    const std::vector<fmi2_real_t> &sensitivities(size_t k) const noexcept
+    {
+        return _s[k];
+    }
+
+    bool enter_event_mode() const noexcept
+    {
+        return _enter_event_mode;
+    }
+
+    bool terminate_simulation() const noexcept
+    {
+        return _terminate;
+    }
+
+    const integrator_stats_t &stats() const noexcept
+    {
+        return _sys.stats;
+    }
+
+    me_system_t<model_t> &system() noexcept
+    {
+        return _sys;
+    }
+};
+} // namespace fmilib
@@ -0,0 +1,561 @@
+/*
+ *   Copyright (c) 2018, Hang Yu
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ *   * Neither the name of  nor the names of its contributors may be used to
+ *   endorse or promote products derived from this software without specific
+ *   prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *   ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *   LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *   CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *   SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *   INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *   CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *   ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#ifndef FMILIB_WITH_SUNDIALS
+#error "fmilib/cvode.hpp needs SUNDIALS, configure with -DENABLE_SUNDIALS=ON"
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include <cvode/cvode.h>
+#include <nvector/nvector_serial.h>
+#ifdef FMILIB_WITH_KLU
+#include <sunlinsol/sunlinsol_klu.h>
+#include <sunmatrix/sunmatrix_sparse.h>
+#else
+#include <sunlinsol/sunlinsol_dense.h>
+#include <sunmatrix/sunmatrix_dense.h>
+#endif
+
+#include <fmilib/integrator.hpp>
+#include <fmilib/jacobian.hpp>
+
+namespace fmilib
+{
+/**
+ * @brief Hybrid simulation loop for ModelExchange FMUs on SUNDIALS CVODE
+ *
+ * CVODE integrates with variable order BDF and Newton iteration. The
+ * Jacobian comes from sparse_jacobian_t and is handed to KLU as a CSR
+ * matrix on the derivative dependencies plus the diagonal, or to the
+ * dense solver if SUNDIALS was built without KLU. State events are found
+ * by CVODE root finding on `get_event_indicators`, time events end steps
+ * through the stop time, and step events come from
+ * `completed_integrator_step`. Event iteration and restarts follow
+ * event_driver_t, CVODE is reinitialized after every event.
+ *
+ * The absolute tolerance of every state is `rtol` times its nominal
+ * value. Counters of CVODE are folded into `stats()`; the observer and
+ * `interpolate` are those of the built-in drivers, so grid_sampler_t
+ * works unchanged.
+ *
+ * @tparam model_t fmi2_t<true, ...> or fmi2_direct_t<true, ...>
+ */
+template <typename model_t> class cvode_driver_t
+{
+private:
+    static_assert(std::is_same_v<sunrealtype, fmi2_real_t>,
+                  "SUNDIALS must be built with double precision");
+
+    me_system_t<model_t> _sys;
+    sparse_jacobian_t<model_t> _jac;
+    size_t _n;
+    size_t _nz;
+    fmi2_real_t _rtol;
+    sparsity_pattern_t _pattern;
+    /* position of every Jacobian nonzero in _pattern */
+    std::vector<size_t> _position;
+    /* states and their interpolant, shared with the N_Vectors */
+    std::vector<fmi2_real_t> _x, _dky;
+    fmi2_real_t _t = 0.0;
+    fmi2_real_t _t0 = 0.0;
+    fmi2_real_t _t_next = std::numeric_limits<fmi2_real_t>::infinity();
+    fmi2_event_info_t _info{};
+    bool _terminated = false;
+    /* worst status of the FMU calls made by CVODE callbacks */
+    fmi2_status_t _callback_status = fmi2_status_ok;
+    /* counters of CVODE runs before the last reinitialization */
+    integrator_stats_t _base;
+
+    /* frees every kind of SUNDIALS handle */
+    struct sundials_deleter_t
+    {
+        void operator()(SUNContext ctx) const noexcept
+        {
+            SUNContext_Free(&ctx);
+        }
+        void operator()(N_Vector v) const noexcept
+        {
+            N_VDestroy(v);
+        }
+        void operator()(SUNMatrix A) const noexcept
+        {
+            SUNMatDestroy(A);
+        }
+        void operator()(SUNLinearSolver ls) const noexcept
+        {
+            SUNLinSolFree(ls);
+        }
+        void operator()(void *mem) const noexcept
+        {
+            CVodeFree(&mem);
+        }
+    };
+
+    template <typename handle_t>
+    using handle_ptr_t
+        = std::unique_ptr<std::remove_pointer_t<handle_t>, sundials_deleter_t>;
+
+    /* SUNDIALS handles, freed in reverse order, CVODE memory first and
+     * the context last */
+    handle_ptr_t<SUNContext> _ctx;
+    handle_ptr_t<N_Vector> _y, _y_dky, _atol;
+    handle_ptr_t<SUNMatrix> _A;
+    handle_ptr_t<SUNLinearSolver> _ls;
+    handle_ptr_t<void *> _mem;
+
+    static bool _failed(fmi2_status_t s) noexcept
+    {
+        return s > fmi2_status_warning;
+    }
+
+    static fmi2_real_t _eps(fmi2_real_t t) noexcept
+    {
+        return 100.0 * std::numeric_limits<fmi2_real_t>::epsilon()
+               * std::max(1.0, std::abs(t));
+    }
+
+    /* CVODE retries a step after a recoverable failure (positive) */
+    int _callback(fmi2_status_t s) noexcept
+    {
+        _callback_status = std::max(_callback_status, s);
+        if (s == fmi2_status_discard) {
+            return 1;
+        }
+        return _failed(s) ? -1 : 0;
+    }
+
+    static int _rhs(sunrealtype t, N_Vector y, N_Vector ydot, void *data)
+    {
+        auto self = static_cast<cvode_driver_t *>(data);
+        return self->_callback(self->_sys.derivatives(
+            t, N_VGetArrayPointer(y), N_VGetArrayPointer(ydot)));
+    }
+
+    static int _indicators(sunrealtype t, N_Vector y, sunrealtype *g,
+                           void *data)
+    {
+        auto self = static_cast<cvode_driver_t *>(data);
+        auto &sys = self->_sys;
+        if (auto s = sys.set_point(t, N_VGetArrayPointer(y)); _failed(s)) {
+            return self->_callback(s);
+        }
+        ++sys.stats.indicator_evaluations;
+        return self->_callback(sys.model().get_event_indicators(g, self->_nz));
+    }
+
+    static int _jacobian(sunrealtype t, N_Vector y, N_Vector fy, SUNMatrix J,
+                         void *data, N_Vector, N_Vector, N_Vector)
+    {
+        auto self = static_cast<cvode_driver_t *>(data);
+        auto &jac = self->_jac;
+        auto s = jac.evaluate(t, N_VGetArrayPointer(y), N_VGetArrayPointer(fy));
+        if (_failed(s)) {
+            return self->_callback(s);
+        }
+        auto &values = jac.values();
+#ifdef FMILIB_WITH_KLU
+        auto &p = self->_pattern;
+        // SUNMatZero clears the structure as well, write all of it
+        if (static_cast<size_t>(SUNSparseMatrix_NNZ(J)) < p.nnz()
+            && SUNSparseMatrix_Reallocate(J, p.nnz()) != 0) {
+            return -1;
+        }
+        auto ptrs = SUNSparseMatrix_IndexPointers(J);
+        auto cols = SUNSparseMatrix_IndexValues(J);
+        auto data_j = SUNSparseMatrix_Data(J);
+        for (size_t i = 0; i <= p.rows; ++i) {
+            ptrs[i] = static_cast<sunindextype>(p.row_start[i]);
+        }
+        for (size_t k = 0; k < p.nnz(); ++k) {
+            cols[k] = static_cast<sunindextype>(p.columns[k]);
+            data_j[k] = 0.0;
+        }
+        for (size_t k = 0; k < values.size(); ++k) {
+            data_j[self->_position[k]] = values[k];
+        }
+#else
+        SUNMatZero(J);
+        auto &jp = jac.pattern();
+        for (size_t i = 0; i < jp.rows; ++i) {
+            for (auto k = jp.row_start[i]; k < jp.row_start[i + 1]; ++k) {
+                SUNDenseMatrix_Column(J, jp.columns[k])[i] = values[k];
+            }
+        }
+#endif
+        return self->_callback(s);
+    }
+
+    void _check(int flag, const char *what) const
+    {
+        if (flag < 0) {
+            throw std::runtime_error(what);
+        }
+    }
+
+    /* fold the CVODE counters into the stats */
+    void _collect() noexcept
+    {
+        long nst = 0, netf = 0, nni = 0, ncfn = 0, nsetups = 0;
+        CVodeGetNumSteps(_mem.get(), &nst);
+        CVodeGetNumErrTestFails(_mem.get(), &netf);
+        CVodeGetNumNonlinSolvIters(_mem.get(), &nni);
+        CVodeGetNumNonlinSolvConvFails(_mem.get(), &ncfn);
+        CVodeGetNumLinSolvSetups(_mem.get(), &nsetups);
+        auto &stats = _sys.stats;
+        stats.steps = _base.steps + static_cast<size_t>(nst);
+        stats.rejected_steps = _base.rejected_steps + static_cast<size_t>(netf);
+        stats.newton_iterations
+            = _base.newton_iterations + static_cast<size_t>(nni);
+        stats.newton_failures
+            = _base.newton_failures + static_cast<size_t>(ncfn);
+        stats.factorizations = _base.factorizations
+                               + static_cast<size_t>(nsetups);
+    }
+
+    /* restart CVODE at `t` from _x, reading the nominals if asked to */
+    fmi2_status_t _restart(fmi2_real_t t, bool nominals)
+    {
+        _collect();
+        _base = _sys.stats;
+        _t = t;
+        _t0 = t;
+        _sys.invalidate();
+        if (nominals) {
+            auto atol = N_VGetArrayPointer(_atol.get());
+            if (auto s = _sys.nominals(atol); _failed(s)) {
+                return s;
+            }
+            for (size_t i = 0; i < _n; ++i) {
+                atol[i] = _rtol * std::abs(atol[i]);
+            }
+            if (CVodeSVtolerances(_mem.get(), _rtol, _atol.get()) < 0) {
+                return fmi2_status_error;
+            }
+        }
+        if (CVodeReInit(_mem.get(), t, _y.get()) < 0) {
+            return fmi2_status_error;
+        }
+        return _sys.set_point(t, _x.data());
+    }
+
+    /* event iteration at `t`, the FMU is in event mode and holds _x unless
+     * `read` is set */
+    fmi2_status_t _iterate(fmi2_real_t t, bool read)
+    {
+        auto status = fmi2_status_ok;
+        auto nominals = read;
+        _info.newDiscreteStatesNeeded = fmi2_true;
+        _info.terminateSimulation = fmi2_false;
+        while (_info.newDiscreteStatesNeeded && !_info.terminateSimulation) {
+            ++_sys.stats.event_iterations;
+            auto s = _sys.model().new_discrete_states(&_info);
+            status = std::max(status, s);
+            if (_failed(s)) {
+                return s;
+            }
+            read = read || _info.valuesOfContinuousStatesChanged
+                   || _info.nominalsOfContinuousStatesChanged;
+            nominals = nominals || _info.nominalsOfContinuousStatesChanged;
+        }
+        _t_next = _info.nextEventTimeDefined
+                      ? _info.nextEventTime
+                      : std::numeric_limits<fmi2_real_t>::infinity();
+        if (_info.terminateSimulation) {
+            _terminated = true;
+            return status;
+        }
+        auto s = _sys.model().enter_continuous_time_mode();
+        status = std::max(status, s);
+        if (_failed(s)) {
+            return s;
+        }
+        if (read) {
+            s = _sys.read_states(_x.data());
+            status = std::max(status, s);
+            if (_failed(s)) {
+                return s;
+            }
+        }
+        s = _restart(t, nominals);
+        return std::max(status, s);
+    }
+
+public:
+    /**
+     * @param m instance with continuous states
+     * @param rtol relative tolerance, the default tolerance of the FMU if
+     * not positive
+     * @param directional use directional derivatives if the FMU
+     * provides them
+     */
+    explicit cvode_driver_t(model_t &m, fmi2_real_t rtol = 0.0,
+                            bool directional = true)
+        : _sys{m}, _jac{_sys, directional}, _n{_sys.size()},
+          _nz{m.number_of_event_indicators()},
+          _rtol{rtol > 0.0 ? rtol : m.default_experiment_tolerance()}
+    {
+        if (_n == 0) {
+            throw std::runtime_error("CVODE needs continuous states");
+        }
+        _x.resize(_n);
+        _dky.resize(_n);
+        _pattern = _jac.pattern().with_diagonal(&_position);
+        SUNContext ctx = nullptr;
+#if SUNDIALS_VERSION_MAJOR >= 7
+        auto flag = SUNContext_Create(SUN_COMM_NULL, &ctx);
+#else
+        auto flag = SUNContext_Create(nullptr, &ctx);
+#endif
+        _ctx.reset(ctx);
+        _check(flag, "Failed to create the SUNDIALS context");
+        auto n = static_cast<sunindextype>(_n);
+        _y.reset(N_VMake_Serial(n, _x.data(), ctx));
+        _y_dky.reset(N_VMake_Serial(n, _dky.data(), ctx));
+        _atol.reset(N_VNew_Serial(n, ctx));
+        _mem.reset(CVodeCreate(CV_BDF, ctx));
+        if (!_y || !_y_dky || !_atol || !_mem) {
+            throw std::runtime_error("Failed to create CVODE");
+        }
+        auto mem = _mem.get();
+        N_VConst(_rtol, _atol.get());
+        _check(CVodeInit(mem, _rhs, 0.0, _y.get()),
+               "Failed to initialize CVODE");
+        _check(CVodeSetUserData(mem, this), "Failed to set CVODE user data");
+        _check(CVodeSVtolerances(mem, _rtol, _atol.get()),
+               "Failed to set CVODE tolerances");
+        if (_nz > 0) {
+            _check(CVodeRootInit(mem, static_cast<int>(_nz), _indicators),
+                   "Failed to initialize CVODE root finding");
+            CVodeSetNoInactiveRootWarn(mem);
+        }
+#ifdef FMILIB_WITH_KLU
+        _A.reset(SUNSparseMatrix(
+            n, n, static_cast<sunindextype>(_pattern.nnz()), CSR_MAT, ctx));
+        if (_A) {
+            _ls.reset(SUNLinSol_KLU(_y.get(), _A.get(), ctx));
+        }
+#else
+        _A.reset(SUNDenseMatrix(n, n, ctx));
+        if (_A) {
+            _ls.reset(SUNLinSol_Dense(_y.get(), _A.get(), ctx));
+        }
+#endif
+        if (!_ls) {
+            throw std::runtime_error(
+                "Failed to create the CVODE linear solver");
+        }
+        _check(CVodeSetLinearSolver(mem, _ls.get(), _A.get()),
+               "Failed to attach the CVODE linear solver");
+        _check(CVodeSetJacFn(mem, _jacobian),
+               "Failed to set the CVODE Jacobian");
+    }
+
+    cvode_driver_t(const cvode_driver_t &) = delete;
+    cvode_driver_t &operator=(const cvode_driver_t &) = delete;
+
+    /**
+     * @brief Run the initial event iteration and start CVODE at `t0`
+     *
+     * Call right after `exit_initialization_mode`, with the FMU in event
+     * mode.
+     */
+    fmi2_status_t initialize(fmi2_real_t t0)
+    {
+        _terminated = false;
+        return _iterate(t0, true);
+    }
+
+    /**
+     * @brief Start at `t`, reading states and nominals from the FMU
+     *
+     * The FMU must be in continuous time mode; time events announced
+     * earlier are forgotten.
+     */
+    fmi2_status_t reset(fmi2_real_t t)
+    {
+        _terminated = false;
+        _t_next = std::numeric_limits<fmi2_real_t>::infinity();
+        if (auto s = _sys.read_states(_x.data()); _failed(s)) {
+            return s;
+        }
+        return _restart(t, true);
+    }
+
+    /**
+     * @brief Integrate up to `t_end` across events
+     *
+     * `observer(t, x)` is called after every step; at an event it is
+     * called with the states just before and just after the event
+     * iteration.
+     */
+    template <typename observer_t = null_observer_t>
+    fmi2_status_t integrate(fmi2_real_t t_end, observer_t &&observer = {})
+    {
+        auto status = fmi2_status_ok;
+        auto &stats = _sys.stats;
+        while (!_terminated && _t < t_end - _eps(t_end)) {
+            auto t_stop = std::min(t_end, _t_next);
+            if (CVodeSetStopTime(_mem.get(), t_stop) < 0) {
+                return fmi2_status_error;
+            }
+            _callback_status = fmi2_status_ok;
+            sunrealtype t = _t;
+            auto flag = CVode(_mem.get(), t_stop, _y.get(), &t, CV_ONE_STEP);
+            _collect();
+            status = std::max(status, _callback_status);
+            if (flag < 0) {
+                return _failed(_callback_status) ? _callback_status
+                                                 : fmi2_status_error;
+            }
+            _t0 = _t;
+            _t = t;
+            auto s = _sys.set_point(t, _x.data());
+            status = std::max(status, s);
+            if (_failed(s)) {
+                return s;
+            }
+            if (flag == CV_ROOT_RETURN) {
+                ++stats.state_events;
+            } else {
+                auto enter_event_mode = false, terminate = false;
+                s = _sys.completed_step(enter_event_mode, terminate);
+                status = std::max(status, s);
+                if (_failed(s)) {
+                    return s;
+                }
+                if (terminate) {
+                    _terminated = true;
+                    observer(t, _x);
+                    break;
+                }
+                auto time_event = t >= _t_next - _eps(_t_next);
+                if (!time_event && !enter_event_mode) {
+                    observer(t, _x);
+                    continue;
+                }
+                stats.time_events += time_event;
+                stats.step_events += enter_event_mode;
+            }
+            observer(t, _x);
+            s = _sys.model().enter_event_mode();
+            status = std::max(status, s);
+            if (_failed(s)) {
+                return s;
+            }
+            s = _iterate(t, false);
+            status = std::max(status, s);
+            if (_failed(s)) {
+                return s;
+            }
+            observer(t, _x);
+        }
+        return status;
+    }
+
+    /**
+     * @brief States at `t` within the last step, from the CVODE
+     * interpolant
+     */
+    fmi2_status_t interpolate(fmi2_real_t t, fmi2_real_t x[])
+    {
+        if (t == _t) {
+            std::copy(_x.begin(), _x.end(), x);
+            return fmi2_status_ok;
+        }
+        if (CVodeGetDky(_mem.get(), t, 0, _y_dky.get()) < 0) {
+            return fmi2_status_error;
+        }
+        std::copy(_dky.begin(), _dky.end(), x);
+        return fmi2_status_ok;
+    }
+
+    fmi2_real_t time() const noexcept
+    {
+        return _t;
+    }
+
+    /**
+     * @brief Start time of the last step
+     */
+    fmi2_real_t previous_time() const noexcept
+    {
+        return _t0;
+    }
+
+    const std::vector<fmi2_real_t> &states() const noexcept
+    {
+        return _x;
+    }
+
+    /**
+     * @brief Next time event, infinity if none is scheduled
+     */
+    fmi2_real_t next_event_time() const noexcept
+    {
+        return _t_next;
+    }
+
+    bool terminated() const noexcept
+    {
+        return _terminated;
+    }
+
+    const fmi2_event_info_t &event_info() const noexcept
+    {
+        return _info;
+    }
+
+    /**
+     * @brief Pattern of the iteration matrix handed to the linear solver
+     */
+    const sparsity_pattern_t &pattern() const noexcept
+    {
+        return _pattern;
+    }
+
+    const integrator_stats_t &stats() const noexcept
+    {
+        return _sys.stats;
+    }
+
+    me_system_t<model_t> &system() noexcept
+    {
+        return _sys;
+    }
+};
+} // namespace fmilib
@@ -0,0 +1,506 @@
+/*
+ *   Copyright (c) 2018, Hang Yu
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ *   * Neither the name of  nor the names of its contributors may be used to
+ *   endorse or promote products derived from this software without specific
+ *   prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *   ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *   LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *   CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *   SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *   INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *   CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *   ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#include <fmilib/integrator.hpp>
+
+namespace fmilib
+{
+/**
+ * @brief Adaptive Dormand-Prince 5(4) driver for ModelExchange FMUs
+ *
+ * The error of each component is scaled by
+ * `rtol * (|nominal| + max(|x|, |x_new|))`, i.e. the absolute tolerance of
+ * a state is `rtol` times its nominal value. The last stage is evaluated
+ * at the accepted point, so it is reused as the first stage of the next
+ * step (FSAL) and the FMU already holds the accepted point when
+ * `completed_integrator_step` is called.
+ */
+template <typename model_t> class dopri45_integrator_t
+{
+private:
+    /* null if the system is shared with another driver */
+    std::unique_ptr<me_system_t<model_t>> _own_sys;
+    me_system_t<model_t> &_sys;
+    fmi2_real_t _rtol;
+    fmi2_real_t _h_min = 0.0;
+    fmi2_real_t _h_max = std::numeric_limits<fmi2_real_t>::infinity();
+    fmi2_real_t _h = 0.0;
+    fmi2_real_t _h_last = 0.0;
+    fmi2_real_t _t = 0.0;
+    fmi2_real_t _t0 = 0.0;
+    fmi2_real_t _t_event = std::numeric_limits<fmi2_real_t>::infinity();
+    std::vector<fmi2_real_t> _x, _x_new, _xs, _atol;
+    std::vector<fmi2_real_t> _k[7];
+    bool _fsal = false;
+    bool _enter_event_mode = false;
+    bool _terminate = false;
+
+    static bool _failed(fmi2_status_t s) noexcept
+    {
+        return s > fmi2_status_warning;
+    }
+
+    fmi2_real_t _scale(size_t i, fmi2_real_t a, fmi2_real_t b) const noexcept
+    {
+        return _atol[i] + _rtol * std::max(std::abs(a), std::abs(b));
+    }
+
+    /* RMS norm of v scaled with x */
+    fmi2_real_t _norm(const fmi2_real_t v[], const fmi2_real_t x[]) const
+    {
+        fmi2_real_t sum = 0.0;
+        for (size_t i = 0; i < _x.size(); ++i) {
+            auto r = v[i] / _scale(i, x[i], x[i]);
+            sum += r * r;
+        }
+        return _x.empty() ? 0.0 : std::sqrt(sum / _x.size());
+    }
+
+    /* stage s: _xs = _x + h * sum_j a[j] * k[j] */
+    fmi2_status_t _stage(int s, const fmi2_real_t a[], fmi2_real_t c,
+                         fmi2_real_t h)
+    {
+        for (size_t i = 0; i < _x.size(); ++i) {
+            fmi2_real_t sum = 0.0;
+            for (int j = 0; j < s; ++j) {
+                sum += a[j] * _k[j][i];
+            }
+            _xs[i] = _x[i] + h * sum;
+        }
+        return _sys.derivatives(_t + c * h, _xs.data(), _k[s].data());
+    }
+
+    /* Hairer, Norsett & Wanner, starting step size algorithm */
+    fmi2_status_t _initial_step(fmi2_real_t t_stop)
+    {
+        auto &f0 = _k[0];
+        auto d0 = _norm(_x.data(), _x.data());
+        auto d1 = _norm(f0.data(), _x.data());
+        auto h0 = (d0 < 1e-5 || d1 < 1e-5) ? 1e-6 : 0.01 * d0 / d1;
+        // never zero, even if the caller steps to the current time
+        auto h_floor = 100.0 * std::numeric_limits<fmi2_real_t>::epsilon()
+                       * std::max(1.0, std::abs(_t));
+        h0 = std::max(std::min({h0, _h_max, t_stop - _t}), h_floor);
+        for (size_t i = 0; i < _x.size(); ++i) {
+            _xs[i] = _x[i] + h0 * f0[i];
+        }
+        auto &f1 = _k[1];
+        if (auto s = _sys.derivatives(_t + h0, _xs.data(), f1.data());
+            _failed(s)) {
+            return s;
+        }
+        for (size_t i = 0; i < _x.size(); ++i) {
+            _xs[i] = f1[i] - f0[i];
+        }
+        auto d2 = _norm(_xs.data(), _x.data()) / h0;
+        auto dm = std::max(d1, d2);
+        auto h1 = dm <= 1e-15 ? std::max(1e-6, h0 * 1e-3)
+                              : std::pow(0.01 / dm, 0.2);
+        _h = std::max(std::min({100.0 * h0, h1, _h_max}), _h_min);
+        return fmi2_status_ok;
+    }
+
+    dopri45_integrator_t(model_t &m, me_system_t<model_t> *shared,
+                         fmi2_real_t rtol)
+        : _own_sys{shared ? nullptr
+                          : std::make_unique<me_system_t<model_t>>(m)},
+          _sys{shared ? *shared : *_own_sys},
+          _rtol{rtol > 0.0 ? rtol : m.default_experiment_tolerance()}
+    {
+        auto nx = _sys.size();
+        _x.resize(nx);
+        _x_new.resize(nx);
+        _xs.resize(nx);
+        _atol.resize(nx);
+        for (auto &k : _k) {
+            k.resize(nx);
+        }
+    }
+
+public:
+    /**
+     * @brief Construct with relative tolerance `rtol`, defaults to the
+     * default experiment tolerance of the FMU
+     */
+    explicit dopri45_integrator_t(model_t &m, fmi2_real_t rtol = 0.0)
+        : dopri45_integrator_t{m, nullptr, rtol}
+    {
+    }
+
+    /**
+     * @brief Construct on the system of another driver of the same FMU,
+     * sharing its cached time and statistics
+     */
+    explicit dopri45_integrator_t(me_system_t<model_t> &sys,
+                                  fmi2_real_t rtol = 0.0)
+        : dopri45_integrator_t{sys.model(), &sys, rtol}
+    {
+    }
+
+    /**
+     * @brief Start at `t`, reading states and nominals from the FMU
+     *
+     * The FMU must be in continuous time mode. The step size estimate is
+     * kept, so restarting after an event does not begin from scratch.
+     */
+    fmi2_status_t reset(fmi2_real_t t)
+    {
+        _t = t;
+        _t0 = t;
+        _fsal = false;
+        _enter_event_mode = false;
+        _terminate = false;
+        _sys.invalidate();
+        if (auto s = _sys.set_time(t); _failed(s)) {
+            return s;
+        }
+        if (auto s = _sys.read_states(_x.data()); _failed(s)) {
+            return s;
+        }
+        if (auto s = _sys.nominals(_atol.data()); _failed(s)) {
+            return s;
+        }
+        for (auto &a : _atol) {
+            a = _rtol * std::abs(a);
+        }
+        return fmi2_status_ok;
+    }
+
+    /**
+     * @brief Restart at `t` from states the caller already holds, keeping
+     * the nominals of the last `reset(t)`
+     *
+     * The FMU must hold `x` at `t`.
+     */
+    fmi2_status_t reset(fmi2_real_t t, const fmi2_real_t x[])
+    {
+        _t = t;
+        _t0 = t;
+        _fsal = false;
+        _enter_event_mode = false;
+        _terminate = false;
+        std::copy(x, x + _x.size(), _x.begin());
+        return _sys.set_time(t);
+    }
+
+    void set_tolerance(fmi2_real_t rtol) noexcept
+    {
+        for (auto &a : _atol) {
+            a *= rtol / _rtol;
+        }
+        _rtol = rtol;
+    }
+
+    fmi2_real_t tolerance() const noexcept
+    {
+        return _rtol;
+    }
+
+    void set_step_limits(fmi2_real_t h_min, fmi2_real_t h_max) noexcept
+    {
+        _h_min = h_min;
+        _h_max = h_max;
+    }
+
+    void set_next_time_event(fmi2_real_t t) noexcept
+    {
+        _t_event = t;
+    }
+
+    void clear_next_time_event() noexcept
+    {
+        _t_event = std::numeric_limits<fmi2_real_t>::infinity();
+    }
+
+    /**
+     * @brief Take one accepted step towards `t_stop`, retrying with
+     * smaller steps until the error test passes
+     *
+     * Does nothing if `t_stop` is not ahead of the current time.
+     *
+     * @return fmi2_status_error if the step size falls below the minimum
+     */
+    fmi2_status_t step(fmi2_real_t t_stop)
+    {
+        static constexpr fmi2_real_t c[] = {0.0, 1.0 / 5, 3.0 / 10, 4.0 / 5,
+                                            8.0 / 9, 1.0, 1.0};
+        static constexpr fmi2_real_t a[7][6] = {
+            {},
+            {1.0 / 5},
+            {3.0 / 40, 9.0 / 40},
+            {44.0 / 45, -56.0 / 15, 32.0 / 9},
+            {19372.0 / 6561, -25360.0 / 2187, 64448.0 / 6561, -212.0 / 729},
+            {9017.0 / 3168, -355.0 / 33, 46732.0 / 5247, 49.0 / 176,
+             -5103.0 / 18656},
+            {35.0 / 384, 0.0, 500.0 / 1113, 125.0 / 192, -2187.0 / 6784,
+             11.0 / 84}};
+        static constexpr fmi2_real_t e[] = {71.0 / 57600,  0.0,
+                                            -71.0 / 16695, 71.0 / 1920,
+                                            -17253.0 / 339200, 22.0 / 525,
+                                            -1.0 / 40};
+        auto eps = 100.0 * std::numeric_limits<fmi2_real_t>::epsilon()
+                   * std::max({1.0, std::abs(_t), std::abs(t_stop)});
+        if (t_stop - _t <= eps) {
+            return fmi2_status_ok;
+        }
+        fmi2_status_t s;
+        auto nx = _x.size();
+        if (!_fsal) {
+            if (s = _sys.derivatives(_t, _x.data(), _k[0].data());
+                _failed(s)) {
+                return s;
+            }
+            if (_h <= 0.0) {
+                if (s = _initial_step(t_stop); _failed(s)) {
+                    return s;
+                }
+            }
+            _fsal = true;
+        }
+        auto fac_max = 5.0;
+        for (;;) {
+            auto h = std::min(_h, _h_max);
+            auto clipped = t_stop - _t < h + eps;
+            if (clipped) {
+                h = t_stop - _t;
+            }
+            for (int st = 1; st < 6; ++st) {
+                if (s = _stage(st, a[st], c[st], h); _failed(s)) {
+                    return s;
+                }
+            }
+            // 5th order solution, its derivative is the FSAL stage
+            for (size_t i = 0; i < nx; ++i) {
+                fmi2_real_t sum = 0.0;
+                for (int j = 0; j < 6; ++j) {
+                    sum += a[6][j] * _k[j][i];
+                }
+                _x_new[i] = _x[i] + h * sum;
+            }
+            if (s = _sys.derivatives(_t + h, _x_new.data(), _k[6].data());
+                _failed(s)) {
+                return s;
+            }
+            fmi2_real_t err = 0.0;
+            for (size_t i = 0; i < nx; ++i) {
+                fmi2_real_t sum = 0.0;
+                for (int j = 0; j < 7; ++j) {
+                    sum += e[j] * _k[j][i];
+                }
+                auto r = h * sum / _scale(i, _x[i], _x_new[i]);
+                err += r * r;
+            }
+            err = nx ? std::sqrt(err / nx) : 0.0;
+
+            auto fac = err > 0.0 ? 0.9 * std::pow(err, -0.2) : fac_max;
+            if (err <= 1.0) {
+                _h_last = h;
+                _t0 = _t;
+                _t = clipped ? t_stop : _t + h;
+                // the previous point stays in _x_new and _k[6]
+                std::swap(_x, _x_new);
+                std::swap(_k[0], _k[6]);
+                // a clipped step says nothing about the natural step size
+                if (!clipped || fac < 1.0) {
+                    _h = std::max(h * std::min(fac_max, std::max(0.2, fac)),
+                                  _h_min);
+                }
+                ++_sys.stats.steps;
+                return _sys.completed_step(_enter_event_mode, _terminate);
+            }
+            ++_sys.stats.rejected_steps;
+            fac_max = 1.0;
+            _h = h * std::max(0.2, fac);
+            if (_h < _h_min || _h <= eps) {
+                return fmi2_status_error;
+            }
+        }
+    }
+
+    /**
+     * @brief Same as `step`, the entry point shared with
+     * fixed_step_integrator_t
+     */
+    fmi2_status_t advance(fmi2_real_t t_stop)
+    {
+        return step(t_stop);
+    }
+
+    /**
+     * @brief Integrate up to `t_end`, calling `observer(t, x)` after every
+     * step
+     */
+    template <typename observer_t = null_observer_t>
+    fmi2_status_t integrate(fmi2_real_t t_end, observer_t &&observer = {})
+    {
+        auto status = fmi2_status_ok;
+        auto t_stop = std::min(t_end, _t_event);
+        auto eps = 100.0 * std::numeric_limits<fmi2_real_t>::epsilon()
+                   * std::max({1.0, std::abs(_t), std::abs(t_stop)});
+        while (_t < t_stop - eps && !_enter_event_mode && !_terminate) {
+            auto s = step(t_stop);
+            status = std::max(status, s);
+            if (_failed(s)) {
+                return s;
+            }
+            observer(_t, _x);
+        }
+        return status;
+    }
+
+    /**
+     * @brief States at `t` within the last step from the 4th order
+     * continuous extension of Dormand & Prince
+     *
+     * Uses the stages of the accepted step, no extra derivative
+     * evaluations (Hairer, Norsett & Wanner, "Solving Ordinary
+     * Differential Equations I", II.6).
+     */
+    fmi2_status_t interpolate(fmi2_real_t t, fmi2_real_t x[]) const
+    {
+        static constexpr fmi2_real_t d[] = {-12715105075.0 / 11282082432.0,
+                                            0.0,
+                                            87487479700.0 / 32700410799.0,
+                                            -10690763975.0 / 1880347072.0,
+                                            701980252875.0 / 199316789632.0,
+                                            -1453857185.0 / 822651844.0,
+                                            69997945.0 / 29380423.0};
+        auto h = _h_last;
+        auto theta = h != 0.0 ? (t - _t0) / h : 1.0;
+        auto theta1 = 1.0 - theta;
+        // the previous point is in _x_new and its derivative in _k[6]
+        const auto &x0 = _x_new;
+        const auto &k1 = _k[6];
+        const auto &k7 = _k[0];
+        for (size_t i = 0; i < _x.size(); ++i) {
+            auto r2 = _x[i] - x0[i];
+            auto r3 = h * k1[i] - r2;
+            auto r4 = r2 - h * k7[i] - r3;
+            auto r5 = h
+                      * (d[0] * k1[i] + d[2] * _k[2][i] + d[3] * _k[3][i]
+                         + d[4] * _k[4][i] + d[5] * _k[5][i] + d[6] * k7[i]);
+            x[i] = x0[i]
+                   + theta * (r2 + theta1 * (r3 + theta * (r4 + theta1 * r5)));
+        }
+        return fmi2_status_ok;
+    }
+
+    /**
+     * @brief Estimate of `h * |lambda|` for the dominant eigenvalue over
+     * the last accepted step
+     *
+     * Compares the derivatives of the last two stages, which are
+     * evaluated at the same time (Hairer & Wanner, "Solving Ordinary
+     * Differential Equations II", IV.2). Values above about 3.3 mean the
+     * step size is limited by stability rather than accuracy.
+     */
+    fmi2_real_t stiffness_estimate() const noexcept
+    {
+        // stage 6 was evaluated at _xs, stage 7 at the new point _x
+        fmi2_real_t num = 0.0, den = 0.0;
+        for (size_t i = 0; i < _x.size(); ++i) {
+            auto dk = _k[0][i] - _k[5][i];
+            auto dx = _x[i] - _xs[i];
+            num += dk * dk;
+            den += dx * dx;
+        }
+        return den > 0.0 ? _h_last * std::sqrt(num / den) : 0.0;
+    }
+
+    fmi2_real_t time() const noexcept
+    {
+        return _t;
+    }
+
+    /**
+     * @brief Start time of the last step
+     */
+    fmi2_real_t previous_time() const noexcept
+    {
+        return _t0;
+    }
+
+    /**
+     * @brief Proposed size of the next step
+     */
+    fmi2_real_t step_size() const noexcept
+    {
+        return _h;
+    }
+
+    /**
+     * @brief Size of the last accepted step
+     */
+    fmi2_real_t last_step_size() const noexcept
+    {
+        return _h_last;
+    }
+
+    const std::vector<fmi2_real_t> &states() const noexcept
+    {
+        return _x;
+    }
+
+    /**
+     * @brief Derivatives at the current point
+     */
+    const std::vector<fmi2_real_t> &derivatives() const noexcept
+    {
+        return _k[0];
+    }
+
+    bool enter_event_mode() const noexcept
+    {
+        return _enter_event_mode;
+    }
+
+    bool terminate_simulation() const noexcept
+    {
+        return _terminate;
+    }
+
+    const integrator_stats_t &stats() const noexcept
+    {
+        return _sys.stats;
+    }
+
+    me_system_t<model_t> &system() noexcept
+    {
+        return _sys;
+    }
+};
+} // namespace fmilib
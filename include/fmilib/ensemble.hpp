@@ -0,0 +1,479 @@
+/*
+ *   Copyright (c) 2018, Hang Yu
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ *   * Neither the name of  nor the names of its contributors may be used to
+ *   endorse or promote products derived from this software without specific
+ *   prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *   ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *   LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *   CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *   SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *   INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *   CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *   ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+#include <fmilib/integrator.hpp>
+
+namespace fmilib
+{
+/**
+ * @brief Dormand-Prince 5(4) driver advancing many instances of one
+ * ModelExchange FMU in lockstep
+ *
+ * States are stored structure-of-arrays: state `i` of member `m` is at
+ * `i * size() + m`, so stage combinations, error norms and step size
+ * updates are plain loops over contiguous members that the compiler can
+ * vectorize. Every member keeps its own time and step size; accepting or
+ * rejecting a step is a per-member mask. Only the FMU calls are made
+ * member by member.
+ *
+ * A member stops at `t_end` or when its FMU asks for event mode or
+ * termination; event handling is left to the caller.
+ */
+template <typename model_t> class ensemble_dopri45_t
+{
+private:
+    std::vector<me_system_t<model_t>> _sys;
+    size_t _n;
+    size_t _nx;
+    fmi2_real_t _rtol;
+    fmi2_real_t _h_min = 0.0;
+    fmi2_real_t _h_max = std::numeric_limits<fmi2_real_t>::infinity();
+
+    /* per member */
+    std::vector<fmi2_real_t> _t, _h, _h_step, _err, _d1;
+    std::vector<unsigned char> _running, _active, _accept,
+        _enter_event_mode, _terminate;
+    /* structure-of-arrays, nx * n */
+    std::vector<fmi2_real_t> _x, _x_new, _xs, _atol;
+    std::vector<fmi2_real_t> _k[7];
+    /* contiguous states of one member for the FMU calls */
+    std::vector<fmi2_real_t> _xm, _fm;
+
+    static bool _failed(fmi2_status_t s) noexcept
+    {
+        return s > fmi2_status_warning;
+    }
+
+    /* derivatives of the active members at t + c * h for states `xs` */
+    fmi2_status_t _evaluate(fmi2_real_t c, const std::vector<fmi2_real_t> &xs,
+                            std::vector<fmi2_real_t> &k)
+    {
+        auto status = fmi2_status_ok;
+        for (size_t m = 0; m < _n; ++m) {
+            if (!_active[m]) {
+                continue;
+            }
+            for (size_t i = 0; i < _nx; ++i) {
+                _xm[i] = xs[i * _n + m];
+            }
+            auto s = _sys[m].derivatives(_t[m] + c * _h_step[m], _xm.data(),
+                                         _fm.data());
+            status = std::max(status, s);
+            if (_failed(s)) {
+                return s;
+            }
+            for (size_t i = 0; i < _nx; ++i) {
+                k[i * _n + m] = _fm[i];
+            }
+        }
+        return status;
+    }
+
+    /* read states and nominals of member `m` and mark it active */
+    fmi2_status_t _load(size_t m, fmi2_real_t t)
+    {
+        auto &sys = _sys[m];
+        sys.invalidate();
+        if (auto s = sys.set_time(t); _failed(s)) {
+            return s;
+        }
+        if (auto s = sys.read_states(_xm.data()); _failed(s)) {
+            return s;
+        }
+        if (auto s = sys.nominals(_fm.data()); _failed(s)) {
+            return s;
+        }
+        for (size_t i = 0; i < _nx; ++i) {
+            _x[i * _n + m] = _xm[i];
+            _atol[i * _n + m] = _rtol * std::abs(_fm[i]);
+        }
+        _t[m] = t;
+        _h_step[m] = 0.0;
+        _running[m] = 1;
+        _active[m] = 1;
+        _enter_event_mode[m] = 0;
+        _terminate[m] = 0;
+        return fmi2_status_ok;
+    }
+
+    /* first stage and initial step size of the active members */
+    fmi2_status_t _start()
+    {
+        if (auto s = _evaluate(0.0, _x, _k[0]); _failed(s)) {
+            return s;
+        }
+        // h = 0.01 * |x| / |f| in the weighted RMS norm
+        std::fill(_err.begin(), _err.end(), 0.0);
+        std::fill(_d1.begin(), _d1.end(), 0.0);
+        for (size_t i = 0; i < _nx; ++i) {
+            const auto *x = _x.data() + i * _n;
+            const auto *f = _k[0].data() + i * _n;
+            const auto *a = _atol.data() + i * _n;
+            for (size_t m = 0; m < _n; ++m) {
+                auto sc = a[m] + _rtol * std::abs(x[m]);
+                _err[m] += (x[m] / sc) * (x[m] / sc);
+                _d1[m] += (f[m] / sc) * (f[m] / sc);
+            }
+        }
+        for (size_t m = 0; m < _n; ++m) {
+            if (!_active[m]) {
+                continue;
+            }
+            auto d0 = std::sqrt(_err[m] / std::max<size_t>(_nx, 1));
+            auto d1 = std::sqrt(_d1[m] / std::max<size_t>(_nx, 1));
+            auto h = (d0 < 1e-5 || d1 < 1e-5) ? 1e-6 : 0.01 * d0 / d1;
+            _h[m] = std::max(std::min(h, _h_max), _h_min);
+        }
+        return fmi2_status_ok;
+    }
+
+    /* _xs = _x + h * sum_j a[j] k[j], for all members */
+    void _combine(int stages, const fmi2_real_t a[],
+                  std::vector<fmi2_real_t> &out)
+    {
+        const auto *h = _h_step.data();
+        for (size_t i = 0; i < _nx; ++i) {
+            auto *o = out.data() + i * _n;
+            const auto *x = _x.data() + i * _n;
+            for (size_t m = 0; m < _n; ++m) {
+                o[m] = 0.0;
+            }
+            for (int j = 0; j < stages; ++j) {
+                if (a[j] == 0.0) {
+                    continue;
+                }
+                const auto *k = _k[j].data() + i * _n;
+                for (size_t m = 0; m < _n; ++m) {
+                    o[m] += a[j] * k[m];
+                }
+            }
+            for (size_t m = 0; m < _n; ++m) {
+                o[m] = x[m] + h[m] * o[m];
+            }
+        }
+    }
+
+public:
+    /**
+     * @brief Construct over initialized instances of the same FMU, all in
+     * continuous time mode
+     *
+     * @param rtol relative tolerance, defaults to the default experiment
+     * tolerance of the first member
+     */
+    explicit ensemble_dopri45_t(const std::vector<model_t *> &members,
+                                fmi2_real_t rtol = 0.0)
+        : _n{members.size()}
+    {
+        if (members.empty()) {
+            throw std::runtime_error("Ensemble needs at least one member");
+        }
+        _rtol = rtol > 0.0 ? rtol
+                           : members.front()->default_experiment_tolerance();
+        _sys.reserve(_n);
+        for (auto m : members) {
+            _sys.emplace_back(*m);
+            if (_sys.back().size() != _sys.front().size()) {
+                throw std::runtime_error("Ensemble members differ in the "
+                                         "number of continuous states");
+            }
+        }
+        _nx = _sys.front().size();
+        for (auto *v : {&_t, &_h, &_h_step, &_err, &_d1}) {
+            v->assign(_n, 0.0);
+        }
+        for (auto *v :
+             {&_running, &_active, &_accept, &_enter_event_mode, &_terminate}) {
+            v->assign(_n, 0);
+        }
+        for (auto *v : {&_x, &_x_new, &_xs, &_atol}) {
+            v->assign(_nx * _n, 0.0);
+        }
+        for (auto &k : _k) {
+            k.assign(_nx * _n, 0.0);
+        }
+        _xm.resize(_nx);
+        _fm.resize(_nx);
+    }
+
+    /**
+     * @brief Number of members
+     */
+    size_t size() const noexcept
+    {
+        return _n;
+    }
+
+    size_t states_size() const noexcept
+    {
+        return _nx;
+    }
+
+    void set_step_limits(fmi2_real_t h_min, fmi2_real_t h_max) noexcept
+    {
+        _h_min = h_min;
+        _h_max = h_max;
+    }
+
+    /**
+     * @brief Start all members at `t`, reading states and nominals from
+     * the FMUs
+     */
+    fmi2_status_t reset(fmi2_real_t t)
+    {
+        for (size_t m = 0; m < _n; ++m) {
+            if (auto s = _load(m, t); _failed(s)) {
+                return s;
+            }
+        }
+        return _start();
+    }
+
+    /**
+     * @brief Restart member `m` at `t`, e.g. after the caller handled its
+     * event; the other members keep their state
+     */
+    fmi2_status_t reset(size_t m, fmi2_real_t t)
+    {
+        std::fill(_active.begin(), _active.end(), 0);
+        if (auto s = _load(m, t); _failed(s)) {
+            return s;
+        }
+        return _start();
+    }
+
+    /**
+     * @brief One lockstep attempt: every running member tries a step
+     * towards `t_stop` and accepts or rejects it on its own
+     *
+     * @return fmi2_status_error if a member's step size falls below the
+     * minimum; the members that accepted their step still advance
+     */
+    fmi2_status_t step(fmi2_real_t t_stop)
+    {
+        static constexpr fmi2_real_t c[] = {0.0, 1.0 / 5, 3.0 / 10, 4.0 / 5,
+                                            8.0 / 9, 1.0, 1.0};
+        static constexpr fmi2_real_t a[7][6] = {
+            {},
+            {1.0 / 5},
+            {3.0 / 40, 9.0 / 40},
+            {44.0 / 45, -56.0 / 15, 32.0 / 9},
+            {19372.0 / 6561, -25360.0 / 2187, 64448.0 / 6561, -212.0 / 729},
+            {9017.0 / 3168, -355.0 / 33, 46732.0 / 5247, 49.0 / 176,
+             -5103.0 / 18656},
+            {35.0 / 384, 0.0, 500.0 / 1113, 125.0 / 192, -2187.0 / 6784,
+             11.0 / 84}};
+        static constexpr fmi2_real_t e[] = {71.0 / 57600,  0.0,
+                                            -71.0 / 16695, 71.0 / 1920,
+                                            -17253.0 / 339200, 22.0 / 525,
+                                            -1.0 / 40};
+        auto status = fmi2_status_ok;
+        auto eps = 100.0 * std::numeric_limits<fmi2_real_t>::epsilon()
+                   * std::max(1.0, std::abs(t_stop));
+        for (size_t m = 0; m < _n; ++m) {
+            _active[m] = _running[m] && _t[m] < t_stop - eps;
+            auto h = std::min(_h[m], _h_max);
+            // land on t_stop instead of leaving a sliver
+            h = _t[m] + 1.01 * h >= t_stop ? t_stop - _t[m] : h;
+            _h_step[m] = _active[m] ? h : 0.0;
+        }
+
+        for (int st = 1; st < 6; ++st) {
+            _combine(st, a[st], _xs);
+            auto s = _evaluate(c[st], _xs, _k[st]);
+            status = std::max(status, s);
+            if (_failed(s)) {
+                return s;
+            }
+        }
+        _combine(6, a[6], _x_new);
+        auto s = _evaluate(c[6], _x_new, _k[6]);
+        status = std::max(status, s);
+        if (_failed(s)) {
+            return s;
+        }
+
+        // weighted RMS error per member
+        std::fill(_err.begin(), _err.end(), 0.0);
+        for (size_t i = 0; i < _nx; ++i) {
+            const auto *x = _x.data() + i * _n;
+            const auto *xn = _x_new.data() + i * _n;
+            const auto *at = _atol.data() + i * _n;
+            const auto *h = _h_step.data();
+            auto *err = _err.data();
+            const fmi2_real_t *k[7];
+            for (int j = 0; j < 7; ++j) {
+                k[j] = _k[j].data() + i * _n;
+            }
+            for (size_t m = 0; m < _n; ++m) {
+                auto sum = e[0] * k[0][m] + e[2] * k[2][m] + e[3] * k[3][m]
+                           + e[4] * k[4][m] + e[5] * k[5][m] + e[6] * k[6][m];
+                auto sc = at[m]
+                          + _rtol * std::max(std::abs(x[m]), std::abs(xn[m]));
+                auto r = h[m] * sum / sc;
+                err[m] += r * r;
+            }
+        }
+        // members that accepted are committed even if another one fails
+        auto underflow = false;
+        for (size_t m = 0; m < _n; ++m) {
+            auto err = _nx ? std::sqrt(_err[m] / _nx) : 0.0;
+            auto fac = err > 0.0 ? 0.9 * std::pow(err, -0.2) : 5.0;
+            auto ok = _active[m] && err <= 1.0;
+            _accept[m] = ok;
+            auto clipped = _h_step[m] < std::min(_h[m], _h_max);
+            if (ok) {
+                if (!clipped || fac < 1.0) {
+                    _h[m] = std::max(
+                        _h_step[m] * std::min(5.0, std::max(0.2, fac)),
+                        _h_min);
+                }
+                _t[m] += _h_step[m];
+            } else if (_active[m]) {
+                ++_sys[m].stats.rejected_steps;
+                _h[m] = _h_step[m] * std::max(0.2, std::min(1.0, fac));
+                underflow = underflow || _h[m] < _h_min || _h[m] <= eps;
+            }
+        }
+
+        // masked commit, FSAL: the last stage becomes the first
+        const auto *acc = _accept.data();
+        for (size_t i = 0; i < _nx; ++i) {
+            auto *x = _x.data() + i * _n;
+            auto *k0 = _k[0].data() + i * _n;
+            const auto *xn = _x_new.data() + i * _n;
+            const auto *k6 = _k[6].data() + i * _n;
+            for (size_t m = 0; m < _n; ++m) {
+                x[m] = acc[m] ? xn[m] : x[m];
+                k0[m] = acc[m] ? k6[m] : k0[m];
+            }
+        }
+
+        for (size_t m = 0; m < _n; ++m) {
+            if (!_accept[m]) {
+                continue;
+            }
+            auto &sys = _sys[m];
+            ++sys.stats.steps;
+            // the last stage already left the FMU at the accepted point
+            bool enter = false, terminate = false;
+            auto s = sys.completed_step(enter, terminate);
+            status = std::max(status, s);
+            if (_failed(s)) {
+                return s;
+            }
+            _enter_event_mode[m] = enter;
+            _terminate[m] = terminate;
+            if (enter || terminate) {
+                _running[m] = 0;
+            }
+        }
+        return underflow ? fmi2_status_error : status;
+    }
+
+    /**
+     * @brief Advance all members to `t_end`, or until their FMU asks for
+     * event mode or termination
+     */
+    fmi2_status_t integrate(fmi2_real_t t_end)
+    {
+        auto status = fmi2_status_ok;
+        auto eps = 100.0 * std::numeric_limits<fmi2_real_t>::epsilon()
+                   * std::max(1.0, std::abs(t_end));
+        for (;;) {
+            auto any = false;
+            for (size_t m = 0; m < _n; ++m) {
+                any = any || (_running[m] && _t[m] < t_end - eps);
+            }
+            if (!any) {
+                return status;
+            }
+            auto s = step(t_end);
+            status = std::max(status, s);
+            if (_failed(s)) {
+                return s;
+            }
+        }
+    }
+
+    fmi2_real_t time(size_t m) const noexcept
+    {
+        return _t[m];
+    }
+
+    fmi2_real_t step_size(size_t m) const noexcept
+    {
+        return _h[m];
+    }
+
+    /**
+     * @brief State `i` of member `m`
+     */
+    fmi2_real_t state(size_t m, size_t i) const noexcept
+    {
+        return _x[i * _n + m];
+    }
+
+    /**
+     * @brief All states, state `i` of member `m` at `i * size() + m`
+     */
+    const std::vector<fmi2_real_t> &states() const noexcept
+    {
+        return _x;
+    }
+
+    bool enter_event_mode(size_t m) const noexcept
+    {
+        return _enter_event_mode[m];
+    }
+
+    bool terminate_simulation(size_t m) const noexcept
+    {
+        return _terminate[m];
+    }
+
+    const integrator_stats_t &stats(size_t m) const noexcept
+    {
+        return _sys[m].stats;
+    }
+
+    me_system_t<model_t> &system(size_t m) noexcept
+    {
+        return _sys[m];
+    }
+};
+} // namespace fmilib
@@ -0,0 +1,272 @@
+/*
+ *   Copyright (c) 2018, Hang Yu
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ *   * Neither the name of  nor the names of its contributors may be used to
+ *   endorse or promote products derived from this software without specific
+ *   prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *   ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *   LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *   CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *   SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *   INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *   CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *   ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <fmilib/event_locator.hpp>
+#include <fmilib/integrator.hpp>
+
+namespace fmilib
+{
+/**
+ * @brief Hybrid simulation loop around one of the ModelExchange drivers
+ *
+ * Alternates continuous integration with event iteration:
+ *
+ * - Steps are clipped to the next time event announced by
+ *   `new_discrete_states`.
+ * - State events are located with event_locator_t, step events come from
+ *   `completed_integrator_step`. It is called once the locator has
+ *   accepted the step end, or at the located event time, and only if the
+ *   FMU needs it; the wrapped driver leaves it out of its own steps.
+ * - After an event the driver is restarted from the states already at
+ *   hand; they are only read back from the FMU if
+ *   `valuesOfContinuousStatesChanged` or
+ *   `nominalsOfContinuousStatesChanged` was set.
+ *
+ * @tparam driver_t fixed_step_integrator_t, dopri45_integrator_t or
+ * bdf_integrator_t
+ */
+template <typename driver_t> class event_driver_t
+{
+public:
+    using system_t = std::remove_reference_t<
+        decltype(std::declval<driver_t &>().system())>;
+    using model_t = typename system_t::model_type;
+
+private:
+    driver_t &_driver;
+    model_t &_m;
+    event_locator_t<model_t> _locator;
+    fmi2_event_info_t _info{};
+    fmi2_real_t _t_next = std::numeric_limits<fmi2_real_t>::infinity();
+    std::vector<fmi2_real_t> _x;
+    bool _terminated = false;
+
+    static bool _failed(fmi2_status_t s) noexcept
+    {
+        return s > fmi2_status_warning;
+    }
+
+    static fmi2_real_t _eps(fmi2_real_t t) noexcept
+    {
+        return 100.0 * std::numeric_limits<fmi2_real_t>::epsilon()
+               * std::max(1.0, std::abs(t));
+    }
+
+    /* event iteration at `t`, the FMU is in event mode and holds _x unless
+     * `read` is set */
+    fmi2_status_t _iterate(fmi2_real_t t, bool read)
+    {
+        auto status = fmi2_status_ok;
+        auto &stats = _driver.system().stats;
+        _info.newDiscreteStatesNeeded = fmi2_true;
+        _info.terminateSimulation = fmi2_false;
+        while (_info.newDiscreteStatesNeeded && !_info.terminateSimulation) {
+            ++stats.event_iterations;
+            auto s = _m.new_discrete_states(&_info);
+            status = std::max(status, s);
+            if (_failed(s)) {
+                return s;
+            }
+            read = read || _info.valuesOfContinuousStatesChanged
+                   || _info.nominalsOfContinuousStatesChanged;
+        }
+        _t_next = _info.nextEventTimeDefined
+                      ? _info.nextEventTime
+                      : std::numeric_limits<fmi2_real_t>::infinity();
+        if (_info.terminateSimulation) {
+            _terminated = true;
+            return status;
+        }
+        auto s = _m.enter_continuous_time_mode();
+        status = std::max(status, s);
+        if (_failed(s)) {
+            return s;
+        }
+        s = read ? _driver.reset(t) : _driver.reset(t, _x.data());
+        status = std::max(status, s);
+        if (_failed(s)) {
+            return s;
+        }
+        s = _locator.start();
+        return std::max(status, s);
+    }
+
+public:
+    explicit event_driver_t(driver_t &driver)
+        : _driver{driver}, _m{driver.system().model()},
+          _locator{driver.system()}
+    {
+        _x.resize(driver.system().size());
+        driver.system().defer_completed_step(true);
+    }
+
+    /**
+     * @brief Run the initial event iteration and start the driver at `t0`
+     *
+     * Call right after `exit_initialization_mode`, with the FMU in event
+     * mode.
+     */
+    fmi2_status_t initialize(fmi2_real_t t0)
+    {
+        _terminated = false;
+        return _iterate(t0, true);
+    }
+
+    /**
+     * @brief Restart at `t` from states `x`, handed to the FMU in
+     * continuous time mode, e.g. after `set_fmu_state`
+     *
+     * Reads the nominals and starts the locator like an event iteration
+     * would.
+     *
+     * @param t_next next time event, as `next_event_time` reported it
+     * where the FMU state was taken
+     */
+    fmi2_status_t restart(fmi2_real_t t, const fmi2_real_t x[],
+                          fmi2_real_t t_next)
+    {
+        _terminated = false;
+        _t_next = t_next;
+        auto &sys = _driver.system();
+        sys.invalidate();
+        if (auto s = sys.set_point(t, x); _failed(s)) {
+            return s;
+        }
+        if (auto s = _driver.reset(t); _failed(s)) {
+            return s;
+        }
+        return _locator.start();
+    }
+
+    /**
+     * @brief Integrate up to `t_end` across events
+     *
+     * `observer(t, x)` is called after every step; at an event it is
+     * called with the states just before and just after the event
+     * iteration.
+     */
+    template <typename observer_t = null_observer_t>
+    fmi2_status_t integrate(fmi2_real_t t_end, observer_t &&observer = {})
+    {
+        auto status = fmi2_status_ok;
+        auto &stats = _driver.system().stats;
+        while (!_terminated && _driver.time() < t_end - _eps(t_end)) {
+            auto s = _driver.advance(std::min(t_end, _t_next));
+            status = std::max(status, s);
+            if (_failed(s)) {
+                return s;
+            }
+            auto state_event = false;
+            s = _locator.check(_driver, state_event);
+            status = std::max(status, s);
+            if (_failed(s)) {
+                return s;
+            }
+            auto t = _driver.time();
+            if (state_event) {
+                // step and time events after the crossing are not reached
+                t = _locator.event_time();
+                _x = _locator.states();
+            }
+            // the FMU holds t, the integration is complete up to there
+            auto step_event = false, terminate = false;
+            s = _driver.system().accept_step(step_event, terminate);
+            status = std::max(status, s);
+            if (_failed(s)) {
+                return s;
+            }
+            if (terminate) {
+                _terminated = true;
+                observer(t, state_event ? _x : _driver.states());
+                break;
+            }
+            if (!state_event) {
+                auto time_event = t >= _t_next - _eps(_t_next);
+                if (!time_event && !step_event) {
+                    observer(t, _driver.states());
+                    continue;
+                }
+                stats.time_events += time_event;
+                stats.step_events += step_event;
+                _x = _driver.states();
+            }
+            observer(t, _x);
+            s = _m.enter_event_mode();
+            status = std::max(status, s);
+            if (_failed(s)) {
+                return s;
+            }
+            s = _iterate(t, false);
+            status = std::max(status, s);
+            if (_failed(s)) {
+                return s;
+            }
+            observer(t, _terminated ? _x : _driver.states());
+        }
+        return status;
+    }
+
+    /**
+     * @brief Next time event, infinity if none is scheduled
+     */
+    fmi2_real_t next_event_time() const noexcept
+    {
+        return _t_next;
+    }
+
+    bool terminated() const noexcept
+    {
+        return _terminated;
+    }
+
+    const fmi2_event_info_t &event_info() const noexcept
+    {
+        return _info;
+    }
+
+    event_locator_t<model_t> &locator() noexcept
+    {
+        return _locator;
+    }
+
+    const integrator_stats_t &stats() const noexcept
+    {
+        return _driver.stats();
+    }
+};
+} // namespace fmilib
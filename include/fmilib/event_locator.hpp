@@ -0,0 +1,283 @@
+/*
+ *   Copyright (c) 2018, Hang Yu
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ *   * Neither the name of  nor the names of its contributors may be used to
+ *   endorse or promote products derived from this software without specific
+ *   prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *   ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *   LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *   CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *   SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *   INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *   CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *   ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include <fmilib/integrator.hpp>
+
+namespace fmilib
+{
+/**
+ * @brief Locates state events inside accepted steps
+ *
+ * After every step the event indicators at the new point are compared
+ * with those at the previous point. If any indicator changed its domain
+ * (`z > 0` versus `z <= 0`) the earliest crossing is bracketed with the
+ * Illinois variant of regula falsi, evaluating the indicators at states
+ * taken from the interpolant of the driver. The step is never rejected
+ * or recomputed.
+ *
+ * The driver must provide `time()`, `previous_time()`,
+ * `interpolate(t, x)` and `system()`.
+ */
+template <typename model_t> class event_locator_t
+{
+private:
+    me_system_t<model_t> &_sys;
+    size_t _nz;
+    fmi2_real_t _t_tol = 0.0;
+    fmi2_real_t _t_event = 0.0;
+    size_t _iterations = 0;
+    /* indicators at the previous point (_z0) and the step end (_z1) */
+    std::vector<fmi2_real_t> _z0, _z1, _z_lo, _z_hi, _z_mid;
+    std::vector<fmi2_real_t> _x;
+    std::vector<unsigned char> _mask;
+
+    static bool _failed(fmi2_status_t s) noexcept
+    {
+        return s > fmi2_status_warning;
+    }
+
+    /* mark the indicators that changed domain from a to b */
+    size_t _scan(const fmi2_real_t a[], const fmi2_real_t b[]) noexcept
+    {
+        size_t changed = 0;
+        auto mask = _mask.data();
+        for (size_t i = 0; i < _nz; ++i) {
+            auto m = static_cast<unsigned char>((a[i] > 0.0) != (b[i] > 0.0));
+            mask[i] = m;
+            changed += m;
+        }
+        return changed;
+    }
+
+    /* among the marked indicators, the one with the crossing closest to a */
+    size_t _leading(const std::vector<fmi2_real_t> &a,
+                    const std::vector<fmi2_real_t> &b) const noexcept
+    {
+        size_t lead = 0;
+        fmi2_real_t max_frac = -1.0;
+        for (size_t i = 0; i < _nz; ++i) {
+            if (!_mask[i]) {
+                continue;
+            }
+            auto d = b[i] - a[i];
+            auto frac = d != 0.0 ? std::abs(b[i] / d) : 1.0;
+            if (frac > max_frac) {
+                max_frac = frac;
+                lead = i;
+            }
+        }
+        return lead;
+    }
+
+    fmi2_status_t _indicators(fmi2_real_t z[])
+    {
+        ++_sys.stats.indicator_evaluations;
+        return _sys.model().get_event_indicators(z, _nz);
+    }
+
+    template <typename stepper_t>
+    fmi2_status_t _evaluate(stepper_t &stepper, fmi2_real_t t,
+                            fmi2_real_t z[])
+    {
+        if (auto s = stepper.interpolate(t, _x.data()); _failed(s)) {
+            return s;
+        }
+        if (auto s = _sys.set_point(t, _x.data()); _failed(s)) {
+            return s;
+        }
+        return _indicators(z);
+    }
+
+public:
+    explicit event_locator_t(me_system_t<model_t> &sys)
+        : _sys{sys}, _nz{sys.model().number_of_event_indicators()}
+    {
+        _z0.resize(_nz);
+        _z1.resize(_nz);
+        _z_lo.resize(_nz);
+        _z_hi.resize(_nz);
+        _z_mid.resize(_nz);
+        _x.resize(_sys.size());
+        _mask.resize(_nz);
+    }
+
+    size_t size() const noexcept
+    {
+        return _nz;
+    }
+
+    /**
+     * @brief Width of the final bracket, defaults to a few ulps of the
+     * step end time
+     */
+    void set_time_tolerance(fmi2_real_t t_tol) noexcept
+    {
+        _t_tol = t_tol;
+    }
+
+    /**
+     * @brief Read the indicators at the point the FMU holds, call after
+     * every reset of the driver
+     */
+    fmi2_status_t start()
+    {
+        return _nz ? _indicators(_z0.data()) : fmi2_status_ok;
+    }
+
+    /**
+     * @brief Check the last step of `stepper` for state events
+     *
+     * On a detected event the FMU is left at `event_time()` with the
+     * interpolated states, just past the earliest crossing, ready for
+     * `enter_event_mode`. Otherwise the FMU still holds the step end.
+     *
+     * @param found set if any indicator changed its domain during the
+     * step
+     */
+    template <typename stepper_t>
+    fmi2_status_t check(stepper_t &stepper, bool &found)
+    {
+        found = false;
+        _iterations = 0;
+        if (_nz == 0) {
+            return fmi2_status_ok;
+        }
+        auto t_hi = stepper.time();
+        if (auto s = _indicators(_z1.data()); _failed(s)) {
+            return s;
+        }
+        if (_scan(_z0.data(), _z1.data()) == 0) {
+            std::swap(_z0, _z1);
+            return fmi2_status_ok;
+        }
+        found = true;
+        ++_sys.stats.state_events;
+
+        auto t_lo = stepper.previous_time();
+        auto tol = _t_tol > 0.0
+                       ? _t_tol
+                       : 100.0 * std::numeric_limits<fmi2_real_t>::epsilon()
+                             * (std::abs(t_hi) + std::abs(t_hi - t_lo));
+        _z_lo = _z0;
+        _z_hi = _z1;
+        auto lead = _leading(_z_lo, _z_hi);
+        fmi2_real_t alpha = 1.0;
+        int side = 0, side_prev = -1;
+        auto at_hi = true;
+        while (t_hi - t_lo > tol) {
+            // Illinois: weaken the end point that was retained twice
+            if (side == side_prev) {
+                alpha = side == 2 ? 2.0 * alpha : 0.5 * alpha;
+            } else {
+                alpha = 1.0;
+            }
+            auto width = t_hi - t_lo;
+            auto den = _z_hi[lead] - alpha * _z_lo[lead];
+            auto t_mid = den != 0.0 ? t_hi - width * _z_hi[lead] / den
+                                    : t_lo + 0.5 * width;
+            // keep the estimate away from the bracket ends
+            auto frac = width / tol > 5.0 ? 0.1 : 0.5 * tol / width;
+            if (!(t_mid - t_lo >= 0.5 * tol)) {
+                t_mid = t_lo + frac * width;
+            } else if (!(t_hi - t_mid >= 0.5 * tol)) {
+                t_mid = t_hi - frac * width;
+            }
+            if (auto s = _evaluate(stepper, t_mid, _z_mid.data()); _failed(s)) {
+                return s;
+            }
+            at_hi = false;
+            ++_iterations;
+            side_prev = side;
+            if (_scan(_z_lo.data(), _z_mid.data()) > 0) {
+                t_hi = t_mid;
+                std::swap(_z_hi, _z_mid);
+                at_hi = true;
+                side = 1;
+            } else {
+                t_lo = t_mid;
+                std::swap(_z_lo, _z_mid);
+                _scan(_z_lo.data(), _z_hi.data());
+                side = 2;
+            }
+            lead = _leading(_z_lo, _z_hi);
+        }
+        _t_event = t_hi;
+        _scan(_z0.data(), _z_hi.data());
+        std::swap(_z0, _z_hi);
+        if (at_hi && _iterations > 0) {
+            return fmi2_status_ok;
+        }
+        if (auto s = stepper.interpolate(t_hi, _x.data()); _failed(s)) {
+            return s;
+        }
+        // the FMU holds t_lo, move it past the crossing
+        return at_hi ? fmi2_status_ok : _sys.set_point(t_hi, _x.data());
+    }
+
+    /**
+     * @brief Time of the last located event
+     */
+    fmi2_real_t event_time() const noexcept
+    {
+        return _t_event;
+    }
+
+    /**
+     * @brief States at the last located event
+     */
+    const std::vector<fmi2_real_t> &states() const noexcept
+    {
+        return _x;
+    }
+
+    /**
+     * @brief Indicators that changed domain in the last located event,
+     * one flag per indicator
+     */
+    const std::vector<unsigned char> &triggered() const noexcept
+    {
+        return _mask;
+    }
+
+    /**
+     * @brief Indicator evaluations spent bracketing the last event
+     */
+    size_t iterations() const noexcept
+    {
+        return _iterations;
+    }
+};
+} // namespace fmilib
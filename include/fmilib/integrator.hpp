@@ -0,0 +1,658 @@
+/*
+ *   Copyright (c) 2018, Hang Yu
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ *   * Neither the name of  nor the names of its contributors may be used to
+ *   endorse or promote products derived from this software without specific
+ *   prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *   ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *   LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *   CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *   SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *   INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *   CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *   ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+#include <fmilib.hpp>
+
+namespace fmilib
+{
+/**
+ * @brief Counters shared by all ModelExchange drivers
+ */
+struct integrator_stats_t
+{
+    /** @brief accepted steps */
+    size_t steps = 0;
+    /** @brief rejected steps */
+    size_t rejected_steps = 0;
+    /** @brief `get_derivatives` calls */
+    size_t derivative_evaluations = 0;
+    /** @brief `completed_integrator_step` calls */
+    size_t completed_integrator_steps = 0;
+    /** @brief Jacobian evaluations */
+    size_t jacobian_evaluations = 0;
+    /** @brief LU factorizations */
+    size_t factorizations = 0;
+    /** @brief Newton iterations */
+    size_t newton_iterations = 0;
+    /** @brief Newton convergence failures */
+    size_t newton_failures = 0;
+    /** @brief `get_event_indicators` calls */
+    size_t indicator_evaluations = 0;
+    /** @brief located state events */
+    size_t state_events = 0;
+    /** @brief time events reached */
+    size_t time_events = 0;
+    /** @brief events requested by `completed_integrator_step` */
+    size_t step_events = 0;
+    /** @brief `new_discrete_states` calls */
+    size_t event_iterations = 0;
+    /** @brief forward sensitivity right-hand side evaluations */
+    size_t sensitivity_evaluations = 0;
+    /** @brief matrix-free Jacobian-vector products */
+    size_t jacobian_vector_products = 0;
+    /** @brief linear Krylov iterations */
+    size_t krylov_iterations = 0;
+
+    void reset() noexcept
+    {
+        *this = integrator_stats_t{};
+    }
+
+    integrator_stats_t &operator+=(const integrator_stats_t &o) noexcept
+    {
+        steps += o.steps;
+        rejected_steps += o.rejected_steps;
+        derivative_evaluations += o.derivative_evaluations;
+        completed_integrator_steps += o.completed_integrator_steps;
+        jacobian_evaluations += o.jacobian_evaluations;
+        factorizations += o.factorizations;
+        newton_iterations += o.newton_iterations;
+        newton_failures += o.newton_failures;
+        indicator_evaluations += o.indicator_evaluations;
+        state_events += o.state_events;
+        time_events += o.time_events;
+        step_events += o.step_events;
+        event_iterations += o.event_iterations;
+        sensitivity_evaluations += o.sensitivity_evaluations;
+        jacobian_vector_products += o.jacobian_vector_products;
+        krylov_iterations += o.krylov_iterations;
+        return *this;
+    }
+};
+
+/**
+ * @brief Observer that records nothing
+ */
+struct null_observer_t
+{
+    void operator()(fmi2_real_t, const std::vector<fmi2_real_t> &) const
+        noexcept
+    {
+    }
+};
+
+/**
+ * @brief Observer that records every accepted point
+ *
+ * States are stored row by row, `x` holds `nx` values per entry of `t`.
+ */
+struct trajectory_t
+{
+    std::vector<fmi2_real_t> t;
+    std::vector<fmi2_real_t> x;
+
+    void operator()(fmi2_real_t time, const std::vector<fmi2_real_t> &states)
+    {
+        t.push_back(time);
+        x.insert(x.end(), states.begin(), states.end());
+    }
+
+    size_t size() const noexcept
+    {
+        return t.size();
+    }
+
+    const fmi2_real_t *states(size_t i, size_t nx) const noexcept
+    {
+        return x.data() + i * nx;
+    }
+
+    void clear() noexcept
+    {
+        t.clear();
+        x.clear();
+    }
+};
+
+/**
+ * @brief Continuous-time view of a ModelExchange instance for the drivers
+ *
+ * Owns no state vector, it only tracks the time last handed to the FMU to
+ * avoid redundant `set_time` calls and decides whether
+ * `completed_integrator_step` has to be called at all.
+ *
+ * @tparam model_t fmi2_t<true, ...> or fmi2_direct_t<true, ...>
+ */
+template <typename model_t> class me_system_t
+{
+private:
+    model_t &_m;
+    size_t _nx;
+    bool _completed_needed;
+    bool _completed_deferred = false;
+    fmi2_real_t _t = std::numeric_limits<fmi2_real_t>::quiet_NaN();
+
+public:
+    integrator_stats_t stats;
+
+    using model_type = model_t;
+
+    explicit me_system_t(model_t &m)
+        : _m{m}, _nx{m.number_of_continuous_states()},
+          _completed_needed{
+              m.capability(fmi2_me_completedIntegratorStepNotNeeded) == 0}
+    {
+    }
+
+    model_t &model() noexcept
+    {
+        return _m;
+    }
+
+    size_t size() const noexcept
+    {
+        return _nx;
+    }
+
+    fmi2_status_t set_time(fmi2_real_t t)
+    {
+        if (t == _t) {
+            return fmi2_status_ok;
+        }
+        _t = t;
+        return _m.set_time(t);
+    }
+
+    /**
+     * @brief Hand time and states to the FMU
+     */
+    fmi2_status_t set_point(fmi2_real_t t, const fmi2_real_t x[])
+    {
+        if (auto s = set_time(t); s > fmi2_status_warning) {
+            return s;
+        }
+        return _m.set_continuous_states(x, _nx);
+    }
+
+    /**
+     * @brief Derivatives at the point last handed to the FMU
+     */
+    fmi2_status_t derivatives(fmi2_real_t dx[])
+    {
+        ++stats.derivative_evaluations;
+        return _m.get_derivatives(dx, _nx);
+    }
+
+    fmi2_status_t derivatives(fmi2_real_t t, const fmi2_real_t x[],
+                              fmi2_real_t dx[])
+    {
+        if (auto s = set_point(t, x); s > fmi2_status_warning) {
+            return s;
+        }
+        return derivatives(dx);
+    }
+
+    /**
+     * @brief Read the states from the FMU, e.g. after initialization or
+     * event handling
+     */
+    fmi2_status_t read_states(fmi2_real_t x[]) const
+    {
+        return _m.get_continuous_states(x, _nx);
+    }
+
+    fmi2_status_t nominals(fmi2_real_t x_nominal[]) const
+    {
+        return _m.get_nominals_of_continuous_states(x_nominal, _nx);
+    }
+
+    /**
+     * @brief Forget the cached time, e.g. after the FMU left continuous
+     * time mode
+     */
+    void invalidate() noexcept
+    {
+        _t = std::numeric_limits<fmi2_real_t>::quiet_NaN();
+    }
+
+    /**
+     * @brief Whether `vr` is a real input, which FMI 2.0 lets a caller set
+     * and seed directional derivatives with in continuous time mode
+     *
+     * Tunable parameters are only accepted in event mode, see
+     * set_in_event_mode, so the drivers that vary variables between
+     * derivative evaluations (linearizer_t, trim_solver_t) take real
+     * inputs only.
+     */
+    bool is_input(fmi2_value_reference_t vr) const
+    {
+        auto v = _m.get_variable_by_vr(fmi2_base_type_real, vr);
+        return v && v.value().causality() == fmi2_causality_enu_input;
+    }
+
+    /**
+     * @brief Set real variables that FMI 2.0 only accepts in event mode,
+     * e.g. tunable parameters, from continuous time mode
+     *
+     * Enters event mode, sets the values, runs the event iteration and
+     * returns to continuous time mode. The iteration may reinitialize the
+     * states, hand the point to the FMU again with `set_point`. Returns
+     * fmi2_status_error if the FMU asks to terminate.
+     */
+    fmi2_status_t set_in_event_mode(const fmi2_value_reference_t vr[],
+                                    size_t n, const fmi2_real_t values[])
+    {
+        invalidate();
+        auto status = _m.enter_event_mode();
+        if (status > fmi2_status_warning) {
+            return status;
+        }
+        auto s = _m.set_real(vr, n, values);
+        status = std::max(status, s);
+        if (s > fmi2_status_warning) {
+            return s;
+        }
+        fmi2_event_info_t info{};
+        info.newDiscreteStatesNeeded = fmi2_true;
+        while (info.newDiscreteStatesNeeded && !info.terminateSimulation) {
+            s = _m.new_discrete_states(&info);
+            status = std::max(status, s);
+            if (s > fmi2_status_warning) {
+                return s;
+            }
+        }
+        if (info.terminateSimulation) {
+            return fmi2_status_error;
+        }
+        return std::max(status, _m.enter_continuous_time_mode());
+    }
+
+    /**
+     * @brief Let `completed_step` skip the FMU call, for callers that only
+     * know after the step whether its end stands, e.g. after event
+     * location; they call `accept_step` at the point they keep
+     */
+    void defer_completed_step(bool defer) noexcept
+    {
+        _completed_deferred = defer;
+    }
+
+    /**
+     * @brief Called by the drivers at the end of every accepted step,
+     * same as `accept_step` unless deferred
+     */
+    fmi2_status_t completed_step(bool &enter_event_mode,
+                                 bool &terminate_simulation)
+    {
+        if (_completed_deferred) {
+            enter_event_mode = false;
+            terminate_simulation = false;
+            return fmi2_status_ok;
+        }
+        return accept_step(enter_event_mode, terminate_simulation);
+    }
+
+    /**
+     * @brief Call `completed_integrator_step` unless the FMU declares it
+     * is not needed
+     *
+     * The accepted point must be set in the FMU.
+     */
+    fmi2_status_t accept_step(bool &enter_event_mode,
+                              bool &terminate_simulation)
+    {
+        enter_event_mode = false;
+        terminate_simulation = false;
+        if (!_completed_needed) {
+            return fmi2_status_ok;
+        }
+        ++stats.completed_integrator_steps;
+        fmi2_boolean_t event = fmi2_false, terminate = fmi2_false;
+        auto s = _m.completed_integrator_step(fmi2_true, &event, &terminate);
+        enter_event_mode = event != fmi2_false;
+        terminate_simulation = terminate != fmi2_false;
+        return s;
+    }
+};
+
+/**
+ * @brief Cubic Hermite interpolation between (t0, x0, f0) and (t1, x1, f1)
+ */
+inline void hermite_interpolate(fmi2_real_t t0, const fmi2_real_t x0[],
+                                const fmi2_real_t f0[], fmi2_real_t t1,
+                                const fmi2_real_t x1[], const fmi2_real_t f1[],
+                                fmi2_real_t t, fmi2_real_t x[], size_t n)
+{
+    auto h = t1 - t0;
+    auto s = h != 0.0 ? (t - t0) / h : 1.0;
+    auto s2 = s * s, s3 = s2 * s;
+    auto h00 = 2.0 * s3 - 3.0 * s2 + 1.0;
+    auto h10 = (s3 - 2.0 * s2 + s) * h;
+    auto h01 = -2.0 * s3 + 3.0 * s2;
+    auto h11 = (s3 - s2) * h;
+    for (size_t i = 0; i < n; ++i) {
+        x[i] = h00 * x0[i] + h10 * f0[i] + h01 * x1[i] + h11 * f1[i];
+    }
+}
+
+enum class explicit_method_t { euler, heun, rk4 };
+
+/**
+ * @brief Fixed-step explicit Runge-Kutta driver for ModelExchange FMUs
+ *
+ * All stage buffers are allocated once. The driver owns the state vector,
+ * so `get_continuous_states` is only called by `reset`. Integration stops
+ * early when `completed_integrator_step` requests event mode or
+ * termination, or at the time set by `set_next_time_event`; the caller
+ * handles the event and calls `reset` again.
+ */
+template <typename model_t> class fixed_step_integrator_t
+{
+private:
+    me_system_t<model_t> _sys;
+    explicit_method_t _method;
+    fmi2_real_t _h;
+    fmi2_real_t _t = 0.0;
+    fmi2_real_t _t0 = 0.0;
+    fmi2_real_t _t_event = std::numeric_limits<fmi2_real_t>::infinity();
+    std::vector<fmi2_real_t> _x;
+    std::vector<fmi2_real_t> _x0;
+    std::vector<fmi2_real_t> _xs;
+    std::vector<fmi2_real_t> _k1, _k2, _k3, _k4;
+    /* derivatives at (_t, _x), evaluated on demand by `interpolate` */
+    std::vector<fmi2_real_t> _f1;
+    bool _f1_valid = false;
+    bool _enter_event_mode = false;
+    bool _terminate = false;
+
+    static bool _failed(fmi2_status_t s) noexcept
+    {
+        return s > fmi2_status_warning;
+    }
+
+    /* x_s = x + a * k */
+    void _stage(fmi2_real_t a, const std::vector<fmi2_real_t> &k)
+    {
+        for (size_t i = 0; i < _x.size(); ++i) {
+            _xs[i] = _x[i] + a * k[i];
+        }
+    }
+
+public:
+    fixed_step_integrator_t(model_t &m, explicit_method_t method,
+                            fmi2_real_t h)
+        : _sys{m}, _method{method}, _h{h}
+    {
+        if (!(h > 0.0)) {
+            throw std::runtime_error("Step size must be positive");
+        }
+        auto nx = _sys.size();
+        _x.resize(nx);
+        _x0.resize(nx);
+        _xs.resize(nx);
+        _k1.resize(nx);
+        _f1.resize(nx);
+        if (method != explicit_method_t::euler) {
+            _k2.resize(nx);
+        }
+        if (method == explicit_method_t::rk4) {
+            _k3.resize(nx);
+            _k4.resize(nx);
+        }
+    }
+
+    /**
+     * @brief Start at `t`, reading the states from the FMU
+     *
+     * The FMU must be in continuous time mode.
+     */
+    fmi2_status_t reset(fmi2_real_t t)
+    {
+        _t = t;
+        _t0 = t;
+        _f1_valid = false;
+        _enter_event_mode = false;
+        _terminate = false;
+        _sys.invalidate();
+        if (auto s = _sys.set_time(t); _failed(s)) {
+            return s;
+        }
+        if (auto s = _sys.read_states(_x.data()); _failed(s)) {
+            return s;
+        }
+        _x0 = _x;
+        return fmi2_status_ok;
+    }
+
+    /**
+     * @brief Restart at `t` from states the caller already holds
+     *
+     * Skips `get_continuous_states`, the FMU must hold `x` at `t`.
+     */
+    fmi2_status_t reset(fmi2_real_t t, const fmi2_real_t x[])
+    {
+        _t = t;
+        _t0 = t;
+        _f1_valid = false;
+        _enter_event_mode = false;
+        _terminate = false;
+        std::copy(x, x + _x.size(), _x.begin());
+        _x0 = _x;
+        return _sys.set_time(t);
+    }
+
+    /**
+     * @brief Next time event, steps are clipped to land on it
+     */
+    void set_next_time_event(fmi2_real_t t) noexcept
+    {
+        _t_event = t;
+    }
+
+    void clear_next_time_event() noexcept
+    {
+        _t_event = std::numeric_limits<fmi2_real_t>::infinity();
+    }
+
+    /**
+     * @brief Take one step of size `h`
+     */
+    fmi2_status_t step(fmi2_real_t h)
+    {
+        fmi2_status_t s;
+        auto nx = _x.size();
+        // FMU holds (_t, _x) from the previous step or reset
+        if (_f1_valid) {
+            std::swap(_k1, _f1);
+            _f1_valid = false;
+        } else if (s = _sys.derivatives(_k1.data()); _failed(s)) {
+            return s;
+        }
+        _t0 = _t;
+        _x0 = _x;
+        switch (_method) {
+            case explicit_method_t::euler:
+                for (size_t i = 0; i < nx; ++i) {
+                    _x[i] += h * _k1[i];
+                }
+                break;
+            case explicit_method_t::heun:
+                _stage(h, _k1);
+                if (s = _sys.derivatives(_t + h, _xs.data(), _k2.data());
+                    _failed(s)) {
+                    return s;
+                }
+                for (size_t i = 0; i < nx; ++i) {
+                    _x[i] += 0.5 * h * (_k1[i] + _k2[i]);
+                }
+                break;
+            case explicit_method_t::rk4:
+                _stage(0.5 * h, _k1);
+                if (s = _sys.derivatives(_t + 0.5 * h, _xs.data(), _k2.data());
+                    _failed(s)) {
+                    return s;
+                }
+                _stage(0.5 * h, _k2);
+                if (s = _sys.derivatives(_t + 0.5 * h, _xs.data(), _k3.data());
+                    _failed(s)) {
+                    return s;
+                }
+                _stage(h, _k3);
+                if (s = _sys.derivatives(_t + h, _xs.data(), _k4.data());
+                    _failed(s)) {
+                    return s;
+                }
+                for (size_t i = 0; i < nx; ++i) {
+                    _x[i] += h / 6.0
+                             * (_k1[i] + 2.0 * (_k2[i] + _k3[i]) + _k4[i]);
+                }
+                break;
+        }
+        _t += h;
+        if (s = _sys.set_point(_t, _x.data()); _failed(s)) {
+            return s;
+        }
+        ++_sys.stats.steps;
+        return _sys.completed_step(_enter_event_mode, _terminate);
+    }
+
+    /**
+     * @brief Take one step of the configured size, shortened to land on
+     * `t_stop`
+     */
+    fmi2_status_t advance(fmi2_real_t t_stop)
+    {
+        auto eps = 100.0 * std::numeric_limits<fmi2_real_t>::epsilon()
+                   * std::max({1.0, std::abs(_t), std::abs(t_stop)});
+        return step((t_stop - _t < _h + eps) ? t_stop - _t : _h);
+    }
+
+    /**
+     * @brief Integrate up to `t_end`, calling `observer(t, x)` after every
+     * step
+     */
+    template <typename observer_t = null_observer_t>
+    fmi2_status_t integrate(fmi2_real_t t_end, observer_t &&observer = {})
+    {
+        auto status = fmi2_status_ok;
+        auto t_stop = std::min(t_end, _t_event);
+        auto eps = 100.0 * std::numeric_limits<fmi2_real_t>::epsilon()
+                   * std::max({1.0, std::abs(_t), std::abs(t_stop)});
+        while (_t < t_stop - eps && !_enter_event_mode && !_terminate) {
+            auto s = advance(t_stop);
+            status = std::max(status, s);
+            if (_failed(s)) {
+                return s;
+            }
+            observer(_t, _x);
+        }
+        return status;
+    }
+
+    /**
+     * @brief States at `t` within the last step, by cubic Hermite
+     * interpolation
+     *
+     * The derivatives at the end of the step are evaluated on the first
+     * call and reused by the next step. The FMU must hold the accepted
+     * point.
+     */
+    fmi2_status_t interpolate(fmi2_real_t t, fmi2_real_t x[])
+    {
+        if (!_f1_valid) {
+            if (auto s = _sys.derivatives(_f1.data()); _failed(s)) {
+                return s;
+            }
+            _f1_valid = true;
+        }
+        hermite_interpolate(_t0, _x0.data(), _k1.data(), _t, _x.data(),
+                            _f1.data(), t, x, _x.size());
+        return fmi2_status_ok;
+    }
+
+    fmi2_real_t time() const noexcept
+    {
+        return _t;
+    }
+
+    /**
+     * @brief Start time of the last step
+     */
+    fmi2_real_t previous_time() const noexcept
+    {
+        return _t0;
+    }
+
+    fmi2_real_t step_size() const noexcept
+    {
+        return _h;
+    }
+
+    void set_step_size(fmi2_real_t h) noexcept
+    {
+        _h = h;
+    }
+
+    const std::vector<fmi2_real_t> &states() const noexcept
+    {
+        return _x;
+    }
+
+    /**
+     * @brief `completed_integrator_step` requested event mode
+     */
+    bool enter_event_mode() const noexcept
+    {
+        return _enter_event_mode;
+    }
+
+    bool terminate_simulation() const noexcept
+    {
+        return _terminate;
+    }
+
+    const integrator_stats_t &stats() const noexcept
+    {
+        return _sys.stats;
+    }
+
+    me_system_t<model_t> &system() noexcept
+    {
+        return _sys;
+    }
+};
+} // namespace fmilib
@@ -0,0 +1,338 @@
+/*
+ *   Copyright (c) 2018, Hang Yu
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ *   * Neither the name of  nor the names of its contributors may be used to
+ *   endorse or promote products derived from this software without specific
+ *   prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *   ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *   LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *   CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *   SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *   INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *   CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *   ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+#include <fmilib/integrator.hpp>
+#include <fmilib/sparsity.hpp>
+
+namespace fmilib
+{
+/**
+ * @brief Forward difference step `sqrt(eps) * max(|value|, |nominal|)`
+ * of a variable, never zero
+ */
+inline fmi2_real_t fd_perturbation(fmi2_real_t value,
+                                   fmi2_real_t nominal) noexcept
+{
+    static const auto sqrt_eps
+        = std::sqrt(std::numeric_limits<fmi2_real_t>::epsilon());
+    return sqrt_eps
+           * std::max({std::abs(value), std::abs(nominal),
+                       std::numeric_limits<fmi2_real_t>::min()});
+}
+
+/**
+ * @brief Scatter `values`, aligned with `pattern.columns`, into the
+ * row-major dense matrix `a`
+ */
+inline void to_dense(const sparsity_pattern_t &pattern,
+                     const std::vector<fmi2_real_t> &values, fmi2_real_t a[])
+{
+    auto n = pattern.cols;
+    std::fill(a, a + pattern.rows * n, 0.0);
+    for (size_t i = 0; i < pattern.rows; ++i) {
+        for (auto k = pattern.row_start[i]; k < pattern.row_start[i + 1];
+             ++k) {
+            a[i * n + pattern.columns[k]] = values[k];
+        }
+    }
+}
+
+/**
+ * @brief Sparse state Jacobian df/dx of a ModelExchange FMU
+ *
+ * The pattern comes from the derivative dependencies of the FMU. Columns
+ * are grouped by a Curtis-Powell-Reid coloring and every group costs one
+ * `get_directional_derivative` call seeded with all of its states, or one
+ * derivative evaluation if the FMU provides no directional derivatives,
+ * perturbed by fd_perturbation.
+ *
+ * Values are stored in the order of `pattern().columns`.
+ */
+template <typename model_t> class sparse_jacobian_t
+{
+private:
+    me_system_t<model_t> &_sys;
+    bool _directional;
+    sparsity_pattern_t _pattern;
+    sparsity_pattern_t _csc;
+    std::vector<size_t> _csc_pos;
+    column_coloring_t _coloring;
+    std::vector<fmi2_value_reference_t> _x_vr, _dx_vr, _seed_vr;
+    std::vector<fmi2_real_t> _values, _seed, _xp, _f0, _f1, _delta, _nominal;
+
+    /* values of the columns of color `c` from the column response `df` */
+    void _scatter(size_t c, const fmi2_real_t df[])
+    {
+        for (auto l = _coloring.color_start[c];
+             l < _coloring.color_start[c + 1]; ++l) {
+            auto j = _coloring.columns[l];
+            for (auto k = _csc.row_start[j]; k < _csc.row_start[j + 1]; ++k) {
+                _values[_csc_pos[k]] = df[_csc.columns[k]];
+            }
+        }
+    }
+
+public:
+    /**
+     * @param sys system to differentiate
+     * @param directional use directional derivatives if the FMU
+     * provides them
+     * @param dependencies use the derivative dependencies of the FMU,
+     * otherwise the pattern is dense
+     */
+    explicit sparse_jacobian_t(me_system_t<model_t> &sys,
+                               bool directional = true,
+                               bool dependencies = true)
+        : _sys{sys}
+    {
+        auto &m = sys.model();
+        auto n = sys.size();
+        _directional
+            = directional
+              && m.capability(fmi2_me_providesDirectionalDerivatives) != 0;
+        if (_directional) {
+            auto x_vr = m.state_vrs();
+            auto dx = m.derivative_list();
+            if (!x_vr || !dx || x_vr.value().size() != n
+                || dx.value().size() != n) {
+                throw std::runtime_error(
+                    "Failed to get state and derivative value references");
+            }
+            _x_vr = x_vr.value();
+            _dx_vr = dx.value().vrs();
+        }
+        _pattern = dependencies && n > 0 ? derivatives_sparsity(m)
+                                         : sparsity_pattern_t::dense(n, n);
+        _csc = _pattern.transpose(&_csc_pos);
+        _coloring = column_coloring_t::greedy(_pattern);
+        _values.resize(_pattern.nnz());
+        _seed_vr.resize(n);
+        _seed.assign(n, 1.0);
+        _xp.resize(n);
+        _f0.resize(n);
+        _f1.resize(n);
+        _delta.resize(n);
+        _nominal.resize(n);
+        if (auto s = sys.nominals(_nominal.data()); s > fmi2_status_warning) {
+            throw std::runtime_error("Failed to get nominal values");
+        }
+    }
+
+    bool directional() const noexcept
+    {
+        return _directional;
+    }
+
+    const std::vector<fmi2_value_reference_t> &state_vrs() const noexcept
+    {
+        return _x_vr;
+    }
+
+    const std::vector<fmi2_value_reference_t> &derivative_vrs() const noexcept
+    {
+        return _dx_vr;
+    }
+
+    const sparsity_pattern_t &pattern() const noexcept
+    {
+        return _pattern;
+    }
+
+    const column_coloring_t &coloring() const noexcept
+    {
+        return _coloring;
+    }
+
+    /**
+     * @brief Nonzero values, aligned with `pattern().columns`
+     */
+    const std::vector<fmi2_real_t> &values() const noexcept
+    {
+        return _values;
+    }
+
+    /**
+     * @brief Evaluate the nonzeros at (t, x)
+     *
+     * @param f derivatives at (t, x) if known, saves one evaluation for
+     * finite differences
+     *
+     * The FMU holds (t, x) on return.
+     */
+    fmi2_status_t evaluate(fmi2_real_t t, const fmi2_real_t x[],
+                           const fmi2_real_t f[] = nullptr)
+    {
+        auto n = _sys.size();
+        ++_sys.stats.jacobian_evaluations;
+        if (_directional) {
+            if (auto s = _sys.set_point(t, x); s > fmi2_status_warning) {
+                return s;
+            }
+            for (size_t c = 0; c < _coloring.colors; ++c) {
+                auto first = _coloring.color_start[c];
+                auto nv = _coloring.color_start[c + 1] - first;
+                for (size_t l = 0; l < nv; ++l) {
+                    _seed_vr[l] = _x_vr[_coloring.columns[first + l]];
+                }
+                auto s = _sys.model().get_directional_derivative(
+                    _seed_vr.data(), nv, _dx_vr.data(), n, _seed.data(),
+                    _f1.data());
+                if (s > fmi2_status_warning) {
+                    return s;
+                }
+                _scatter(c, _f1.data());
+            }
+            return fmi2_status_ok;
+        }
+
+        if (f == nullptr) {
+            if (auto s = _sys.derivatives(t, x, _f0.data());
+                s > fmi2_status_warning) {
+                return s;
+            }
+            f = _f0.data();
+        }
+        std::copy(x, x + n, _xp.begin());
+        for (size_t c = 0; c < _coloring.colors; ++c) {
+            auto first = _coloring.columns.begin() + _coloring.color_start[c];
+            auto last
+                = _coloring.columns.begin() + _coloring.color_start[c + 1];
+            for (auto it = first; it != last; ++it) {
+                auto j = *it;
+                _xp[j] = x[j] + fd_perturbation(x[j], _nominal[j]);
+                _delta[j] = _xp[j] - x[j];
+            }
+            if (auto s = _sys.derivatives(t, _xp.data(), _f1.data());
+                s > fmi2_status_warning) {
+                return s;
+            }
+            for (auto it = first; it != last; ++it) {
+                auto j = *it;
+                for (auto k = _csc.row_start[j]; k < _csc.row_start[j + 1];
+                     ++k) {
+                    auto i = _csc.columns[k];
+                    _values[_csc_pos[k]] = (_f1[i] - f[i]) / _delta[j];
+                }
+                _xp[j] = x[j];
+            }
+        }
+        return _sys.set_point(t, x);
+    }
+
+    /**
+     * @brief Scatter the nonzeros into a row-major dense matrix
+     */
+    void to_dense(fmi2_real_t jac[]) const
+    {
+        fmilib::to_dense(_pattern, _values, jac);
+    }
+};
+
+/**
+ * @brief Dense state Jacobian df/dx of a ModelExchange FMU
+ *
+ * Evaluated through sparse_jacobian_t, so a sparse FMU still only costs
+ * one call per color.
+ */
+template <typename model_t> class dense_jacobian_t
+{
+private:
+    sparse_jacobian_t<model_t> _sparse;
+
+public:
+    /**
+     * @param sys system to differentiate
+     * @param directional use directional derivatives if the FMU
+     * provides them
+     */
+    explicit dense_jacobian_t(me_system_t<model_t> &sys,
+                              bool directional = true)
+        : _sparse{sys, directional}
+    {
+    }
+
+    bool directional() const noexcept
+    {
+        return _sparse.directional();
+    }
+
+    const std::vector<fmi2_value_reference_t> &state_vrs() const noexcept
+    {
+        return _sparse.state_vrs();
+    }
+
+    const std::vector<fmi2_value_reference_t> &derivative_vrs() const noexcept
+    {
+        return _sparse.derivative_vrs();
+    }
+
+    sparse_jacobian_t<model_t> &sparse() noexcept
+    {
+        return _sparse;
+    }
+
+    const sparse_jacobian_t<model_t> &sparse() const noexcept
+    {
+        return _sparse;
+    }
+
+    /**
+     * @brief Evaluate `jac` (row-major) at (t, x)
+     *
+     * @param f derivatives at (t, x) if known, saves one evaluation for
+     * finite differences
+     *
+     * The FMU holds (t, x) on return.
+     */
+    fmi2_status_t evaluate(fmi2_real_t t, const fmi2_real_t x[],
+                           const fmi2_real_t f[], fmi2_real_t jac[])
+    {
+        auto s = _sparse.evaluate(t, x, f);
+        if (s <= fmi2_status_warning) {
+            _sparse.to_dense(jac);
+        }
+        return s;
+    }
+
+    fmi2_status_t evaluate(fmi2_real_t t, const std::vector<fmi2_real_t> &x,
+                           std::vector<fmi2_real_t> &jac)
+    {
+        jac.resize(x.size() * x.size());
+        return evaluate(t, x.data(), nullptr, jac.data());
+    }
+};
+} // namespace fmilib
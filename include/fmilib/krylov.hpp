@@ -0,0 +1,609 @@
+/*
+ *   Copyright (c) 2018, Hang Yu
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ *   * Neither the name of  nor the names of its contributors may be used to
+ *   endorse or promote products derived from this software without specific
+ *   prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *   ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *   LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *   CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *   SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *   INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *   CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *   ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+#include <fmilib/integrator.hpp>
+#include <fmilib/sparsity.hpp>
+
+namespace fmilib
+{
+/**
+ * @brief Matrix-free product `jv = df/dx v` of a ModelExchange FMU
+ *
+ * One `get_directional_derivative` call seeded on all states, or one
+ * forward difference along `v`. Value references and buffers are
+ * allocated once.
+ */
+template <typename model_t> class jacobian_operator_t
+{
+private:
+    me_system_t<model_t> &_sys;
+    bool _directional;
+    std::vector<fmi2_value_reference_t> _x_vr, _dx_vr;
+    std::vector<fmi2_real_t> _xp, _f0, _f1, _nominal;
+
+public:
+    /**
+     * @param sys system to differentiate
+     * @param directional use directional derivatives if the FMU
+     * provides them
+     */
+    explicit jacobian_operator_t(me_system_t<model_t> &sys,
+                                 bool directional = true)
+        : _sys{sys}
+    {
+        auto &m = sys.model();
+        auto n = sys.size();
+        _directional
+            = directional
+              && m.capability(fmi2_me_providesDirectionalDerivatives) != 0;
+        if (_directional) {
+            auto x_vr = m.state_vrs();
+            auto dx = m.derivative_list();
+            if (!x_vr || !dx || x_vr.value().size() != n
+                || dx.value().size() != n) {
+                throw std::runtime_error(
+                    "Failed to get state and derivative value references");
+            }
+            _x_vr = x_vr.value();
+            _dx_vr = dx.value().vrs();
+        }
+        _xp.resize(n);
+        _f0.resize(n);
+        _f1.resize(n);
+        _nominal.resize(n);
+        if (auto s = read_nominals(); s > fmi2_status_warning) {
+            throw std::runtime_error("Failed to get nominal values");
+        }
+    }
+
+    bool directional() const noexcept
+    {
+        return _directional;
+    }
+
+    /**
+     * @brief Re-read the nominals bounding the difference increment, they
+     * may change at events
+     */
+    fmi2_status_t read_nominals()
+    {
+        return _sys.nominals(_nominal.data());
+    }
+
+    /**
+     * @brief `jv = df/dx(t, x) v`, the FMU must hold (t, x)
+     *
+     * @param f derivatives at (t, x) if known, saves one evaluation for
+     * finite differences
+     *
+     * The FMU holds (t, x) on return.
+     */
+    fmi2_status_t apply(fmi2_real_t t, const fmi2_real_t x[],
+                        const fmi2_real_t f[], const fmi2_real_t v[],
+                        fmi2_real_t jv[])
+    {
+        auto n = _sys.size();
+        ++_sys.stats.jacobian_vector_products;
+        if (_directional) {
+            return _sys.model().get_directional_derivative(
+                _x_vr.data(), n, _dx_vr.data(), n, v, jv);
+        }
+
+        // perturb every state by at most sqrt(eps) relative to its
+        // magnitude
+        static const auto sqrt_eps
+            = std::sqrt(std::numeric_limits<fmi2_real_t>::epsilon());
+        auto tiny = std::numeric_limits<fmi2_real_t>::min();
+        fmi2_real_t ratio = 0.0;
+        for (size_t i = 0; i < n; ++i) {
+            ratio = std::max(ratio, std::abs(v[i])
+                                        / std::max({std::abs(x[i]),
+                                                    std::abs(_nominal[i]),
+                                                    tiny}));
+        }
+        if (ratio == 0.0) {
+            std::fill(jv, jv + n, 0.0);
+            return fmi2_status_ok;
+        }
+        if (f == nullptr) {
+            if (auto s = _sys.derivatives(_f0.data());
+                s > fmi2_status_warning) {
+                return s;
+            }
+            f = _f0.data();
+        }
+        auto delta = sqrt_eps / ratio;
+        for (size_t i = 0; i < n; ++i) {
+            _xp[i] = x[i] + delta * v[i];
+        }
+        if (auto s = _sys.derivatives(t, _xp.data(), _f1.data());
+            s > fmi2_status_warning) {
+            return s;
+        }
+        for (size_t i = 0; i < n; ++i) {
+            jv[i] = (_f1[i] - f[i]) / delta;
+        }
+        return _sys.set_point(t, x);
+    }
+};
+
+enum class preconditioner_kind_t { none, jacobi, ilu0 };
+
+/**
+ * @brief Jacobi or ILU(0) preconditioner of a sparse matrix
+ *
+ * ILU(0) keeps the pattern of the matrix, which must contain the
+ * diagonal (see sparsity_pattern_t::with_diagonal). If it meets a zero
+ * pivot the preconditioner degrades to Jacobi, and rows with a zero
+ * diagonal are left unscaled.
+ */
+class preconditioner_t
+{
+private:
+    preconditioner_kind_t _kind = preconditioner_kind_t::none;
+    preconditioner_kind_t _active = preconditioner_kind_t::none;
+    const sparsity_pattern_t *_pattern = nullptr;
+    std::vector<size_t> _diag;
+    std::vector<size_t> _marker;
+    std::vector<double> _values, _inv_diag;
+
+    bool _ilu0()
+    {
+        const auto &p = *_pattern;
+        auto n = p.rows;
+        auto none = std::numeric_limits<size_t>::max();
+        _marker.assign(p.cols, none);
+        for (size_t i = 0; i < n; ++i) {
+            for (auto k = p.row_start[i]; k < p.row_start[i + 1]; ++k) {
+                _marker[p.columns[k]] = k;
+            }
+            for (auto k = p.row_start[i]; k < _diag[i]; ++k) {
+                auto j = p.columns[k];
+                auto l = _values[k] /= _values[_diag[j]];
+                for (auto kk = _diag[j] + 1; kk < p.row_start[j + 1]; ++kk) {
+                    auto pos = _marker[p.columns[kk]];
+                    if (pos != none) {
+                        _values[pos] -= l * _values[kk];
+                    }
+                }
+            }
+            for (auto k = p.row_start[i]; k < p.row_start[i + 1]; ++k) {
+                _marker[p.columns[k]] = none;
+            }
+            auto d = _values[_diag[i]];
+            if (!(std::abs(d) > 0.0) || !std::isfinite(d)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+public:
+    preconditioner_t() = default;
+
+    explicit preconditioner_t(preconditioner_kind_t kind) noexcept
+        : _kind{kind}
+    {
+    }
+
+    preconditioner_kind_t kind() const noexcept
+    {
+        return _kind;
+    }
+
+    /**
+     * @brief Kind in use after the last `setup`, less than `kind()` if
+     * ILU(0) broke down
+     */
+    preconditioner_kind_t active() const noexcept
+    {
+        return _active;
+    }
+
+    /**
+     * @brief Build from `values` on `pattern`, which must outlive the
+     * preconditioner
+     */
+    void setup(const sparsity_pattern_t &pattern, const double values[])
+    {
+        _active = _kind;
+        if (_kind == preconditioner_kind_t::none) {
+            return;
+        }
+        auto n = pattern.rows;
+        if (_pattern != &pattern || _diag.size() != n) {
+            _pattern = &pattern;
+            _diag.resize(n);
+            for (size_t i = 0; i < n; ++i) {
+                _diag[i] = pattern.find(i, i);
+            }
+        }
+        auto has_diagonal = std::none_of(
+            _diag.begin(), _diag.end(),
+            [&](size_t k) { return k == pattern.nnz(); });
+        if (_kind == preconditioner_kind_t::ilu0 && has_diagonal) {
+            _values.assign(values, values + pattern.nnz());
+            if (_ilu0()) {
+                return;
+            }
+        }
+        _active = preconditioner_kind_t::jacobi;
+        _inv_diag.resize(n);
+        for (size_t i = 0; i < n; ++i) {
+            auto d = _diag[i] < pattern.nnz() ? values[_diag[i]] : 0.0;
+            _inv_diag[i] = std::abs(d) > 0.0 && std::isfinite(d) ? 1.0 / d
+                                                                 : 1.0;
+        }
+    }
+
+    /**
+     * @brief Apply the inverse of the preconditioner to `v` in place
+     */
+    void apply(double v[]) const
+    {
+        switch (_active) {
+            case preconditioner_kind_t::none:
+                break;
+            case preconditioner_kind_t::jacobi:
+                for (size_t i = 0; i < _inv_diag.size(); ++i) {
+                    v[i] *= _inv_diag[i];
+                }
+                break;
+            case preconditioner_kind_t::ilu0: {
+                const auto &p = *_pattern;
+                for (size_t i = 0; i < p.rows; ++i) {
+                    auto sum = v[i];
+                    for (auto k = p.row_start[i]; k < _diag[i]; ++k) {
+                        sum -= _values[k] * v[p.columns[k]];
+                    }
+                    v[i] = sum;
+                }
+                for (auto i = p.rows; i-- > 0;) {
+                    auto sum = v[i];
+                    for (auto k = _diag[i] + 1; k < p.row_start[i + 1]; ++k) {
+                        sum -= _values[k] * v[p.columns[k]];
+                    }
+                    v[i] = sum / _values[_diag[i]];
+                }
+                break;
+            }
+        }
+    }
+};
+
+enum class krylov_method_t { none, gmres, bicgstab };
+
+/**
+ * @brief Restarted GMRES and BiCGStab for A x = b with right
+ * preconditioning
+ *
+ * The operator is `op(v, w)` computing `w = A v` and returning a status,
+ * the preconditioner `prec(v)` applies its inverse in place. Norms and
+ * inner products are weighted by `1 / weights[i]` when weights are
+ * given, so the tolerance can be an error-weighted norm. All Krylov
+ * vectors are allocated once per size.
+ */
+class krylov_solver_t
+{
+private:
+    krylov_method_t _method;
+    size_t _restart;
+    size_t _n = 0;
+    size_t _iterations = 0;
+    double _residual = 0.0;
+    const double *_w = nullptr;
+    std::vector<std::vector<double>> _v;
+    std::vector<double> _h, _cs, _sn, _g, _y, _r, _r0, _p, _s, _t, _ph, _sh,
+        _z;
+
+    double _dot(const double a[], const double b[]) const noexcept
+    {
+        double sum = 0.0;
+        if (_w) {
+            for (size_t i = 0; i < _n; ++i) {
+                sum += a[i] * b[i] / (_w[i] * _w[i]);
+            }
+        } else {
+            for (size_t i = 0; i < _n; ++i) {
+                sum += a[i] * b[i];
+            }
+        }
+        return sum;
+    }
+
+    double _norm(const double a[]) const noexcept
+    {
+        return std::sqrt(_dot(a, a));
+    }
+
+    void _resize(size_t n)
+    {
+        if (n == _n && !_r.empty()) {
+            return;
+        }
+        _n = n;
+        for (auto v : {&_r, &_z}) {
+            v->resize(n);
+        }
+        if (_method == krylov_method_t::gmres) {
+            _v.assign(_restart + 1, std::vector<double>(n));
+            _h.resize((_restart + 1) * _restart);
+            for (auto v : {&_cs, &_sn, &_y}) {
+                v->resize(_restart);
+            }
+            _g.resize(_restart + 1);
+        } else {
+            for (auto v : {&_r0, &_p, &_s, &_t, &_ph, &_sh}) {
+                v->resize(n);
+            }
+        }
+    }
+
+    /* _r = b - A x, without a product for the usual zero guess */
+    template <typename op_t>
+    fmi2_status_t _residual_of(op_t &op, const double b[], const double x[])
+    {
+        if (std::all_of(x, x + _n, [](double a) { return a == 0.0; })) {
+            std::copy(b, b + _n, _r.begin());
+            return fmi2_status_ok;
+        }
+        if (auto s = op(x, _r.data()); s > fmi2_status_warning) {
+            return s;
+        }
+        for (size_t i = 0; i < _n; ++i) {
+            _r[i] = b[i] - _r[i];
+        }
+        return fmi2_status_ok;
+    }
+
+    template <typename op_t, typename prec_t>
+    fmi2_status_t _gmres(op_t &op, prec_t &prec, const double b[],
+                         double x[], double tol, size_t max_iter)
+    {
+        auto m = _restart;
+        auto h = [&](size_t i, size_t j) -> double & {
+            return _h[i * m + j];
+        };
+        for (;;) {
+            if (auto s = _residual_of(op, b, x); s > fmi2_status_warning) {
+                return s;
+            }
+            auto beta = _residual = _norm(_r.data());
+            if (beta <= tol) {
+                return fmi2_status_ok;
+            }
+            if (_iterations >= max_iter) {
+                return fmi2_status_discard;
+            }
+            for (size_t i = 0; i < _n; ++i) {
+                _v[0][i] = _r[i] / beta;
+            }
+            std::fill(_g.begin(), _g.end(), 0.0);
+            _g[0] = beta;
+            size_t k = 0;
+            while (k < m && _iterations < max_iter) {
+                ++_iterations;
+                _z = _v[k];
+                prec(_z.data());
+                if (auto s = op(_z.data(), _v[k + 1].data());
+                    s > fmi2_status_warning) {
+                    return s;
+                }
+                // modified Gram-Schmidt
+                auto &w = _v[k + 1];
+                for (size_t i = 0; i <= k; ++i) {
+                    auto hik = h(i, k) = _dot(w.data(), _v[i].data());
+                    for (size_t l = 0; l < _n; ++l) {
+                        w[l] -= hik * _v[i][l];
+                    }
+                }
+                auto hk = _norm(w.data());
+                h(k + 1, k) = hk;
+                if (hk > 0.0) {
+                    for (auto &a : w) {
+                        a /= hk;
+                    }
+                }
+                // Givens rotations keep H upper triangular
+                for (size_t i = 0; i < k; ++i) {
+                    auto a = h(i, k), c = h(i + 1, k);
+                    h(i, k) = _cs[i] * a + _sn[i] * c;
+                    h(i + 1, k) = -_sn[i] * a + _cs[i] * c;
+                }
+                auto a = h(k, k), c = h(k + 1, k);
+                auto r = std::hypot(a, c);
+                _cs[k] = r > 0.0 ? a / r : 1.0;
+                _sn[k] = r > 0.0 ? c / r : 0.0;
+                h(k, k) = r;
+                h(k + 1, k) = 0.0;
+                _g[k + 1] = -_sn[k] * _g[k];
+                _g[k] *= _cs[k];
+                ++k;
+                _residual = std::abs(_g[k]);
+                if (_residual <= tol || hk == 0.0) {
+                    break;
+                }
+            }
+            // x += M^-1 V y with H y = g
+            for (auto i = k; i-- > 0;) {
+                auto sum = _g[i];
+                for (auto j = i + 1; j < k; ++j) {
+                    sum -= h(i, j) * _y[j];
+                }
+                _y[i] = h(i, i) != 0.0 ? sum / h(i, i) : 0.0;
+            }
+            std::fill(_z.begin(), _z.end(), 0.0);
+            for (size_t j = 0; j < k; ++j) {
+                for (size_t i = 0; i < _n; ++i) {
+                    _z[i] += _y[j] * _v[j][i];
+                }
+            }
+            prec(_z.data());
+            for (size_t i = 0; i < _n; ++i) {
+                x[i] += _z[i];
+            }
+            // the Givens residual is exact up to rounding
+            if (_residual <= tol) {
+                return fmi2_status_ok;
+            }
+        }
+    }
+
+    template <typename op_t, typename prec_t>
+    fmi2_status_t _bicgstab(op_t &op, prec_t &prec, const double b[],
+                            double x[], double tol, size_t max_iter)
+    {
+        if (auto s = _residual_of(op, b, x); s > fmi2_status_warning) {
+            return s;
+        }
+        _residual = _norm(_r.data());
+        if (_residual <= tol) {
+            return fmi2_status_ok;
+        }
+        _r0 = _r;
+        std::fill(_p.begin(), _p.end(), 0.0);
+        std::fill(_t.begin(), _t.end(), 0.0);
+        double rho = 1.0, alpha = 1.0, omega = 1.0;
+        // _t holds A p_hat until it is reused for A s_hat
+        auto &v = _z;
+        std::fill(v.begin(), v.end(), 0.0);
+        while (_iterations < max_iter) {
+            ++_iterations;
+            auto rho_new = _dot(_r0.data(), _r.data());
+            if (rho_new == 0.0 || omega == 0.0) {
+                return fmi2_status_discard;
+            }
+            auto beta = rho_new / rho * (alpha / omega);
+            for (size_t i = 0; i < _n; ++i) {
+                _p[i] = _r[i] + beta * (_p[i] - omega * v[i]);
+            }
+            _ph = _p;
+            prec(_ph.data());
+            if (auto s = op(_ph.data(), v.data()); s > fmi2_status_warning) {
+                return s;
+            }
+            auto r0v = _dot(_r0.data(), v.data());
+            if (r0v == 0.0) {
+                return fmi2_status_discard;
+            }
+            alpha = rho_new / r0v;
+            for (size_t i = 0; i < _n; ++i) {
+                _s[i] = _r[i] - alpha * v[i];
+            }
+            _residual = _norm(_s.data());
+            if (_residual <= tol) {
+                for (size_t i = 0; i < _n; ++i) {
+                    x[i] += alpha * _ph[i];
+                }
+                return fmi2_status_ok;
+            }
+            _sh = _s;
+            prec(_sh.data());
+            if (auto s = op(_sh.data(), _t.data()); s > fmi2_status_warning) {
+                return s;
+            }
+            auto tt = _dot(_t.data(), _t.data());
+            omega = tt > 0.0 ? _dot(_t.data(), _s.data()) / tt : 0.0;
+            for (size_t i = 0; i < _n; ++i) {
+                x[i] += alpha * _ph[i] + omega * _sh[i];
+                _r[i] = _s[i] - omega * _t[i];
+            }
+            _residual = _norm(_r.data());
+            if (_residual <= tol) {
+                return fmi2_status_ok;
+            }
+            rho = rho_new;
+        }
+        return fmi2_status_discard;
+    }
+
+public:
+    /**
+     * @param restart Krylov subspace dimension of GMRES
+     */
+    explicit krylov_solver_t(krylov_method_t method = krylov_method_t::gmres,
+                             size_t restart = 30)
+        : _method{method}, _restart{std::max<size_t>(restart, 1)}
+    {
+        if (method == krylov_method_t::none) {
+            throw std::invalid_argument("No Krylov method given");
+        }
+    }
+
+    krylov_method_t method() const noexcept
+    {
+        return _method;
+    }
+
+    /**
+     * @brief Solve A x = b starting from `x`
+     *
+     * @param tol bound on the (weighted) norm of the residual
+     * @retval fmi2_status_discard no convergence within `max_iter`
+     * iterations or a breakdown
+     */
+    template <typename op_t, typename prec_t>
+    fmi2_status_t solve(op_t &&op, prec_t &&prec, const double b[],
+                        double x[], size_t n, double tol, size_t max_iter,
+                        const double weights[] = nullptr)
+    {
+        _resize(n);
+        _w = weights;
+        _iterations = 0;
+        return _method == krylov_method_t::gmres
+                   ? _gmres(op, prec, b, x, tol, max_iter)
+                   : _bicgstab(op, prec, b, x, tol, max_iter);
+    }
+
+    /**
+     * @brief Iterations of the last `solve`, one operator application
+     * each for GMRES and two for BiCGStab
+     */
+    size_t iterations() const noexcept
+    {
+        return _iterations;
+    }
+
+    /**
+     * @brief Residual norm reached by the last `solve`
+     */
+    double residual_norm() const noexcept
+    {
+        return _residual;
+    }
+};
+} // namespace fmilib
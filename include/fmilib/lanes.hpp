@@ -0,0 +1,215 @@
+/*
+ *   Copyright (c) 2018, Hang Yu
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ *   * Neither the name of  nor the names of its contributors may be used to
+ *   endorse or promote products derived from this software without specific
+ *   prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *   ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *   LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *   CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *   SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *   INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *   CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *   ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <exception>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <fmilib.hpp>
+
+namespace fmilib
+{
+/**
+ * @brief Run `fn(k)` for every lane k < `lanes`, lane 0 on the calling
+ * thread and each other lane on a thread of its own
+ *
+ * The threads are started and joined on every call. That costs some tens
+ * of microseconds per lane, little against the FMU calls a lane makes,
+ * but it adds up for tiny models evaluated very often.
+ *
+ * An exception escaping `fn`, e.g. fmi2_error_t under throw_on_error_t,
+ * is caught on its thread and rethrown on the calling thread once all
+ * lanes have joined; the first lane's exception wins.
+ */
+template <typename fn_t> void run_lanes(size_t lanes, fn_t &&fn)
+{
+    std::vector<std::exception_ptr> errors(lanes);
+    auto guarded = [&](size_t k) {
+        try {
+            fn(k);
+        } catch (...) {
+            errors[k] = std::current_exception();
+        }
+    };
+    std::vector<std::thread> threads;
+    threads.reserve(lanes > 1 ? lanes - 1 : 0);
+    try {
+        for (size_t k = 1; k < lanes; ++k) {
+            threads.emplace_back(guarded, k);
+        }
+    } catch (...) {
+        for (auto &th : threads) {
+            th.join();
+        }
+        throw;
+    }
+    if (lanes > 0) {
+        guarded(0);
+    }
+    for (auto &th : threads) {
+        th.join();
+    }
+    for (auto &e : errors) {
+        if (e) {
+            std::rethrow_exception(e);
+        }
+    }
+}
+
+/**
+ * @brief Get the FMU state of `m` into `state` and serialize it into
+ * `bytes`
+ */
+template <typename model_t>
+fmi2_status_t save_fmu_state(model_t &m, fmi2_FMU_state_t &state,
+                             std::vector<fmi2_byte_t> &bytes)
+{
+    if (auto s = m.get_fmu_state(&state); s > fmi2_status_warning) {
+        return s;
+    }
+    size_t size = 0;
+    if (auto s = m.serialized_fmu_state_size(state, &size);
+        s > fmi2_status_warning) {
+        return s;
+    }
+    bytes.resize(size);
+    return m.serialize_fmu_state(state, bytes.data(), size);
+}
+
+/**
+ * @brief Deserialize `bytes` into `state`, replacing the one it held, and
+ * set it on `m`
+ */
+template <typename model_t>
+fmi2_status_t load_fmu_state(model_t &m, fmi2_FMU_state_t &state,
+                             const std::vector<fmi2_byte_t> &bytes)
+{
+    if (state) {
+        m.free_fmu_state(&state);
+    }
+    auto s = m.de_serialize_fmu_state(bytes.data(), bytes.size(), &state);
+    if (s > fmi2_status_warning) {
+        return s;
+    }
+    return m.set_fmu_state(state);
+}
+
+/**
+ * @brief Throw std::runtime_error unless `worker` can take lanes of
+ * `main`
+ *
+ * A worker must be instantiated from the same FMU as the main instance,
+ * be initialized and support `canGetAndSetFMUstate` and
+ * `canSerializeFMUstate`; only the last two and the number of continuous
+ * states can be checked.
+ */
+template <typename model_t> void check_worker(model_t &main, model_t &worker)
+{
+    if (!worker.capability(fmi2_me_canGetAndSetFMUstate)
+        || !worker.capability(fmi2_me_canSerializeFMUstate)) {
+        throw std::runtime_error(
+            "Worker instances must get, set and serialize FMU state");
+    }
+    if (worker.number_of_continuous_states()
+        != main.number_of_continuous_states()) {
+        throw std::runtime_error(
+            "Worker instance has a different number of continuous states");
+    }
+}
+
+/**
+ * @brief FMU states of a main instance and its workers
+ *
+ * synchronize() serializes the FMU state of the main instance and
+ * restores it into every worker, so discrete states and parameters
+ * match before the lanes run. The workers are checked by check_worker().
+ */
+template <typename model_t> class worker_states_t
+{
+private:
+    std::vector<model_t *> _models;
+    std::vector<fmi2_FMU_state_t> _states;
+    std::vector<fmi2_byte_t> _bytes;
+
+public:
+    worker_states_t(model_t &main, const std::vector<model_t *> &workers)
+    {
+        _models.reserve(workers.size() + 1);
+        _models.push_back(&main);
+        for (auto w : workers) {
+            check_worker(main, *w);
+            _models.push_back(w);
+        }
+        _states.resize(_models.size(), nullptr);
+    }
+
+    worker_states_t(const worker_states_t &) = delete;
+    worker_states_t &operator=(const worker_states_t &) = delete;
+
+    ~worker_states_t()
+    {
+        for (size_t k = 0; k < _models.size(); ++k) {
+            if (_states[k]) {
+                _models[k]->free_fmu_state(&_states[k]);
+            }
+        }
+    }
+
+    /**
+     * @brief Copy the FMU state of the main instance into every worker
+     */
+    fmi2_status_t synchronize()
+    {
+        if (auto s = save_fmu_state(*_models[0], _states[0], _bytes);
+            s > fmi2_status_warning) {
+            return s;
+        }
+        for (size_t k = 1; k < _models.size(); ++k) {
+            if (auto s = load_fmu_state(*_models[k], _states[k], _bytes);
+                s > fmi2_status_warning) {
+                return s;
+            }
+        }
+        return fmi2_status_ok;
+    }
+
+    /**
+     * @brief Reset the main instance to the state of the last
+     * synchronize()
+     */
+    fmi2_status_t restore_main()
+    {
+        return _models[0]->set_fmu_state(_states[0]);
+    }
+};
+} // namespace fmilib
@@ -0,0 +1,133 @@
+/*
+ *   Copyright (c) 2018, Hang Yu
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ *   * Neither the name of  nor the names of its contributors may be used to
+ *   endorse or promote products derived from this software without specific
+ *   prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *   ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *   LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *   CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *   SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *   INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *   CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *   ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <cmath>
+#include <utility>
+#include <vector>
+
+namespace fmilib
+{
+/**
+ * @brief Dense LU factorization with partial pivoting
+ *
+ * Matrices are row-major, `a[i * n + j]` is row i, column j.
+ */
+class dense_lu_t
+{
+private:
+    size_t _n = 0;
+    std::vector<double> _lu;
+    std::vector<size_t> _piv;
+
+public:
+    /**
+     * @brief Factorize the `n` x `n` matrix `a`
+     *
+     * @retval false the matrix is singular
+     */
+    bool factor(const double a[], size_t n)
+    {
+        _n = n;
+        _lu.assign(a, a + n * n);
+        _piv.resize(n);
+        for (size_t k = 0; k < n; ++k) {
+            auto p = k;
+            auto max = std::abs(_lu[k * n + k]);
+            for (size_t i = k + 1; i < n; ++i) {
+                if (std::abs(_lu[i * n + k]) > max) {
+                    max = std::abs(_lu[i * n + k]);
+                    p = i;
+                }
+            }
+            _piv[k] = p;
+            if (max == 0.0) {
+                return false;
+            }
+            if (p != k) {
+                for (size_t j = 0; j < n; ++j) {
+                    std::swap(_lu[k * n + j], _lu[p * n + j]);
+                }
+            }
+            auto inv = 1.0 / _lu[k * n + k];
+            for (size_t i = k + 1; i < n; ++i) {
+                auto l = _lu[i * n + k] *= inv;
+                if (l == 0.0) {
+                    continue;
+                }
+                for (size_t j = k + 1; j < n; ++j) {
+                    _lu[i * n + j] -= l * _lu[k * n + j];
+                }
+            }
+        }
+        return true;
+    }
+
+    bool factor(const std::vector<double> &a, size_t n)
+    {
+        return factor(a.data(), n);
+    }
+
+    /**
+     * @brief Solve A x = b in place
+     */
+    void solve(double b[]) const
+    {
+        auto n = _n;
+        for (size_t k = 0; k < n; ++k) {
+            std::swap(b[k], b[_piv[k]]);
+        }
+        for (size_t i = 1; i < n; ++i) {
+            double sum = b[i];
+            for (size_t j = 0; j < i; ++j) {
+                sum -= _lu[i * n + j] * b[j];
+            }
+            b[i] = sum;
+        }
+        for (size_t i = n; i-- > 0;) {
+            double sum = b[i];
+            for (size_t j = i + 1; j < n; ++j) {
+                sum -= _lu[i * n + j] * b[j];
+            }
+            b[i] = sum / _lu[i * n + i];
+        }
+    }
+
+    void solve(std::vector<double> &b) const
+    {
+        solve(b.data());
+    }
+
+    size_t size() const noexcept
+    {
+        return _n;
+    }
+};
+} // namespace fmilib
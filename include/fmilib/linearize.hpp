@@ -0,0 +1,520 @@
+/*
+ *   Copyright (c) 2018, Hang Yu
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ *   * Neither the name of  nor the names of its contributors may be used to
+ *   endorse or promote products derived from this software without specific
+ *   prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *   ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *   LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *   CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *   SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *   INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *   CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *   ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <optional>
+#include <stdexcept>
+#include <vector>
+
+#include <fmilib/integrator.hpp>
+#include <fmilib/jacobian.hpp>
+#include <fmilib/lanes.hpp>
+#include <fmilib/sparsity.hpp>
+
+namespace fmilib
+{
+/**
+ * @brief Sparse matrix in compressed sparse row format, `values` aligned
+ * with `pattern.columns`
+ */
+struct csr_matrix_t
+{
+    sparsity_pattern_t pattern;
+    std::vector<fmi2_real_t> values;
+
+    /**
+     * @brief Entry (i, j), 0 if structurally zero
+     */
+    fmi2_real_t operator()(size_t i, size_t j) const noexcept
+    {
+        auto k = pattern.find(i, j);
+        return k < values.size() ? values[k] : 0.0;
+    }
+
+    /**
+     * @brief Scatter into a row-major dense matrix
+     */
+    void to_dense(fmi2_real_t a[]) const
+    {
+        fmilib::to_dense(pattern, values, a);
+    }
+};
+
+/**
+ * @brief Linearization `dx' = A dx + B du`, `dy = C dx + D du` around an
+ * operating point
+ */
+struct linear_model_t
+{
+    csr_matrix_t A, B, C, D;
+};
+
+/**
+ * @brief Time, states and input values of an operating point
+ */
+struct operating_point_t
+{
+    fmi2_real_t t = 0.0;
+    std::vector<fmi2_real_t> x;
+    std::vector<fmi2_real_t> u;
+};
+
+/**
+ * @brief Sparse linearization of a ModelExchange FMU with respect to its
+ * states and real inputs
+ *
+ * The pattern of [A B; C D] comes from the derivative and output
+ * dependencies (system_sparsity). Its columns are colored once, and every
+ * color costs one `get_directional_derivative` call seeded with all of
+ * its states and inputs, which returns derivatives and outputs together.
+ * Without directional derivatives every color costs one forward
+ * difference perturbed by fd_perturbation.
+ */
+template <typename model_t> class linearizer_t
+{
+private:
+    me_system_t<model_t> _sys;
+    bool _directional;
+    size_t _n;
+    std::vector<fmi2_value_reference_t> _u_vr, _y_vr, _col_vr, _row_vr,
+        _seed_vr;
+    sparsity_pattern_t _pattern;
+    sparsity_pattern_t _csc;
+    std::vector<size_t> _csc_pos;
+    column_coloring_t _coloring;
+    /* block (A, B, C, D) and position within it of every nonzero */
+    std::vector<unsigned char> _block;
+    std::vector<size_t> _block_pos;
+    linear_model_t _empty;
+    std::vector<fmi2_real_t> _values, _x, _u, _z, _zp, _delta, _nominal;
+    std::vector<fmi2_real_t> _r0, _r1, _seed;
+
+    static bool _failed(fmi2_status_t s) noexcept
+    {
+        return s > fmi2_status_warning;
+    }
+
+    static std::vector<fmi2_value_reference_t>
+    _reals(const std::optional<variable_list_t> &list)
+    {
+        std::vector<fmi2_value_reference_t> vrs;
+        for (size_t i = 0; list && i < list->size(); ++i) {
+            auto v = (*list)[i];
+            if (v && v->base_type() == fmi2_base_type_real) {
+                vrs.push_back(v->vr());
+            }
+        }
+        return vrs;
+    }
+
+    /* derivatives and outputs at the unknowns z = [x; u] */
+    fmi2_status_t _residual(fmi2_real_t t, const std::vector<fmi2_real_t> &z,
+                            std::vector<fmi2_real_t> &r)
+    {
+        auto status = fmi2_status_ok;
+        if (!_u_vr.empty()) {
+            status = _sys.model().set_real(_u_vr.data(), _u_vr.size(),
+                                           z.data() + _n);
+            if (_failed(status)) {
+                return status;
+            }
+        }
+        status = std::max(status, _sys.derivatives(t, z.data(), r.data()));
+        if (!_failed(status) && !_y_vr.empty()) {
+            status = std::max(status,
+                              _sys.model().get_real(_y_vr.data(), _y_vr.size(),
+                                                    r.data() + _n));
+        }
+        return status;
+    }
+
+    /* nonzeros of [A B; C D] at (t, _x, _u), the FMU holds them on
+     * return */
+    fmi2_status_t _evaluate(fmi2_real_t t)
+    {
+        ++_sys.stats.jacobian_evaluations;
+        std::copy(_x.begin(), _x.end(), _z.begin());
+        std::copy(_u.begin(), _u.end(), _z.begin() + _n);
+        auto status = _residual(t, _z, _r0);
+        if (_failed(status)) {
+            return status;
+        }
+        _zp = _z;
+        for (size_t c = 0; c < _coloring.colors; ++c) {
+            auto first = _coloring.color_start[c];
+            auto nv = _coloring.color_start[c + 1] - first;
+            fmi2_status_t s;
+            if (_directional) {
+                for (size_t l = 0; l < nv; ++l) {
+                    _seed_vr[l] = _col_vr[_coloring.columns[first + l]];
+                }
+                s = _sys.model().get_directional_derivative(
+                    _seed_vr.data(), nv, _row_vr.data(), _row_vr.size(),
+                    _seed.data(), _r1.data());
+            } else {
+                for (size_t l = 0; l < nv; ++l) {
+                    auto j = _coloring.columns[first + l];
+                    _zp[j] = _z[j] + fd_perturbation(_z[j], _nominal[j]);
+                    _delta[j] = _zp[j] - _z[j];
+                }
+                s = _residual(t, _zp, _r1);
+                for (size_t l = 0; l < nv; ++l) {
+                    auto j = _coloring.columns[first + l];
+                    _zp[j] = _z[j];
+                }
+            }
+            if (_failed(s)) {
+                return s;
+            }
+            status = std::max(status, s);
+            for (size_t l = 0; l < nv; ++l) {
+                auto j = _coloring.columns[first + l];
+                for (auto k = _csc.row_start[j]; k < _csc.row_start[j + 1];
+                     ++k) {
+                    auto i = _csc.columns[k];
+                    _values[_csc_pos[k]] = _directional
+                                               ? _r1[i]
+                                               : (_r1[i] - _r0[i]) / _delta[j];
+                }
+            }
+        }
+        if (!_directional) {
+            status = std::max(status, _residual(t, _z, _r1));
+        }
+        return status;
+    }
+
+    void _split(linear_model_t &lm) const
+    {
+        csr_matrix_t *blocks[] = {&lm.A, &lm.B, &lm.C, &lm.D};
+        const csr_matrix_t *empty[] = {&_empty.A, &_empty.B, &_empty.C,
+                                       &_empty.D};
+        for (int b = 0; b < 4; ++b) {
+            auto &p = blocks[b]->pattern;
+            auto &e = empty[b]->pattern;
+            if (p.rows != e.rows || p.cols != e.cols
+                || p.row_start != e.row_start || p.columns != e.columns) {
+                *blocks[b] = *empty[b];
+            }
+        }
+        for (size_t k = 0; k < _values.size(); ++k) {
+            blocks[_block[k]]->values[_block_pos[k]] = _values[k];
+        }
+    }
+
+public:
+    /**
+     * @param inputs real inputs u, anything else throws
+     * std::runtime_error, see me_system_t::is_input
+     * @param outputs real variables y, usually outputs
+     * @param directional use directional derivatives if the FMU
+     * provides them
+     */
+    linearizer_t(model_t &m, std::vector<fmi2_value_reference_t> inputs,
+                 std::vector<fmi2_value_reference_t> outputs,
+                 bool directional = true)
+        : _sys{m}, _n{_sys.size()}, _u_vr{std::move(inputs)},
+          _y_vr{std::move(outputs)}
+    {
+        auto nu = _u_vr.size();
+        auto ny = _y_vr.size();
+        for (auto vr : _u_vr) {
+            if (!_sys.is_input(vr)) {
+                throw std::runtime_error(
+                    "Linearization inputs must be real inputs");
+            }
+        }
+        _directional
+            = directional
+              && m.capability(fmi2_me_providesDirectionalDerivatives) != 0;
+        if (_directional) {
+            auto x_vr = m.state_vrs();
+            auto dx = m.derivative_list();
+            if (!x_vr || !dx || x_vr.value().size() != _n
+                || dx.value().size() != _n) {
+                throw std::runtime_error(
+                    "Failed to get state and derivative value references");
+            }
+            _col_vr = x_vr.value();
+            _col_vr.insert(_col_vr.end(), _u_vr.begin(), _u_vr.end());
+            _row_vr = dx.value().vrs();
+            _row_vr.insert(_row_vr.end(), _y_vr.begin(), _y_vr.end());
+        }
+
+        std::vector<size_t> states(_n);
+        for (size_t i = 0; i < _n; ++i) {
+            states[i] = i;
+        }
+        _pattern = system_sparsity(m, states, _u_vr, _y_vr);
+        _csc = _pattern.transpose(&_csc_pos);
+        _coloring = column_coloring_t::greedy(_pattern);
+
+        // split the pattern into A, B, C and D
+        csr_matrix_t *blocks[] = {&_empty.A, &_empty.B, &_empty.C,
+                                  &_empty.D};
+        for (int b = 0; b < 4; ++b) {
+            blocks[b]->pattern.rows = b < 2 ? _n : ny;
+            blocks[b]->pattern.cols = b % 2 == 0 ? _n : nu;
+            blocks[b]->pattern.row_start.assign(1, 0);
+        }
+        _block.resize(_pattern.nnz());
+        _block_pos.resize(_pattern.nnz());
+        for (size_t i = 0; i < _pattern.rows; ++i) {
+            for (auto k = _pattern.row_start[i]; k < _pattern.row_start[i + 1];
+                 ++k) {
+                auto j = _pattern.columns[k];
+                auto b = (i < _n ? 0 : 2) + (j < _n ? 0 : 1);
+                auto &p = blocks[b]->pattern;
+                _block[k] = static_cast<unsigned char>(b);
+                _block_pos[k] = p.columns.size();
+                p.columns.push_back(j < _n ? j : j - _n);
+            }
+            for (int b = i < _n ? 0 : 2, e = b + 2; b < e; ++b) {
+                auto &p = blocks[b]->pattern;
+                p.row_start.push_back(p.columns.size());
+            }
+        }
+        for (auto b : blocks) {
+            b->values.assign(b->pattern.nnz(), 0.0);
+        }
+
+        _values.resize(_pattern.nnz());
+        _x.resize(_n);
+        _u.resize(nu);
+        _z.resize(_n + nu);
+        _zp.resize(_n + nu);
+        _delta.resize(_n + nu);
+        _r0.resize(_n + ny);
+        _r1.resize(_n + ny);
+        _seed_vr.resize(_n + nu);
+        _seed.assign(_n + nu, 1.0);
+        _nominal.resize(_n + nu, 1.0);
+        if (auto s = _sys.nominals(_nominal.data()); _failed(s)) {
+            throw std::runtime_error("Failed to get nominal values");
+        }
+        for (size_t j = 0; j < nu; ++j) {
+            auto v = m.get_variable_by_vr(fmi2_base_type_real, _u_vr[j]);
+            auto rv = fmi2_import_get_variable_as_real(v.value().c_ptr());
+            _nominal[_n + j] = fmi2_import_get_real_variable_nominal(rv);
+        }
+    }
+
+    /**
+     * @brief Linearize with respect to all real inputs, for all real
+     * outputs
+     */
+    explicit linearizer_t(model_t &m, bool directional = true)
+        : linearizer_t(m, _reals(m.input_list()), _reals(m.output_list()),
+                       directional)
+    {
+    }
+
+    bool directional() const noexcept
+    {
+        return _directional;
+    }
+
+    const std::vector<fmi2_value_reference_t> &inputs() const noexcept
+    {
+        return _u_vr;
+    }
+
+    const std::vector<fmi2_value_reference_t> &outputs() const noexcept
+    {
+        return _y_vr;
+    }
+
+    /**
+     * @brief Pattern of [A B; C D]
+     */
+    const sparsity_pattern_t &pattern() const noexcept
+    {
+        return _pattern;
+    }
+
+    const column_coloring_t &coloring() const noexcept
+    {
+        return _coloring;
+    }
+
+    /**
+     * @brief Linearize at time `t` around the states and inputs the FMU
+     * currently holds
+     */
+    fmi2_status_t linearize(fmi2_real_t t, linear_model_t &lm)
+    {
+        _sys.invalidate();
+        if (auto s = _sys.read_states(_x.data()); _failed(s)) {
+            return s;
+        }
+        if (!_u.empty()) {
+            if (auto s = _sys.model().get_real(_u_vr.data(), _u_vr.size(),
+                                               _u.data());
+                _failed(s)) {
+                return s;
+            }
+        }
+        auto status = _evaluate(t);
+        if (!_failed(status)) {
+            _split(lm);
+        }
+        return status;
+    }
+
+    /**
+     * @brief Linearize around `op`; the FMU holds its states and inputs
+     * on return
+     */
+    fmi2_status_t linearize(const operating_point_t &op, linear_model_t &lm)
+    {
+        if (op.x.size() != _n || op.u.size() != _u.size()) {
+            return fmi2_status_error;
+        }
+        _sys.invalidate();
+        _x = op.x;
+        _u = op.u;
+        auto status = _evaluate(op.t);
+        if (!_failed(status)) {
+            _split(lm);
+        }
+        return status;
+    }
+
+    const integrator_stats_t &stats() const noexcept
+    {
+        return _sys.stats;
+    }
+
+    me_system_t<model_t> &system() noexcept
+    {
+        return _sys;
+    }
+};
+
+/**
+ * @brief Linearization of many operating points in parallel on worker
+ * instances of the same FMU
+ *
+ * The operating points are dealt round-robin to the main instance and
+ * the workers after worker_states_t::synchronize(), see run_lanes and
+ * check_worker.
+ */
+template <typename model_t> class parallel_linearizer_t
+{
+private:
+    worker_states_t<model_t> _workers;
+    std::vector<linearizer_t<model_t>> _lanes;
+    std::vector<fmi2_status_t> _status;
+
+    static bool _failed(fmi2_status_t s) noexcept
+    {
+        return s > fmi2_status_warning;
+    }
+
+public:
+    /**
+     * @param m main instance
+     * @param workers additional instances, one thread each
+     * @param inputs see linearizer_t
+     * @param outputs see linearizer_t
+     */
+    parallel_linearizer_t(model_t &m, const std::vector<model_t *> &workers,
+                          const std::vector<fmi2_value_reference_t> &inputs,
+                          const std::vector<fmi2_value_reference_t> &outputs,
+                          bool directional = true)
+        : _workers{m, workers}
+    {
+        _lanes.reserve(workers.size() + 1);
+        _lanes.emplace_back(m, inputs, outputs, directional);
+        for (auto w : workers) {
+            _lanes.emplace_back(*w, inputs, outputs, directional);
+        }
+        _status.resize(_lanes.size());
+    }
+
+    parallel_linearizer_t(const parallel_linearizer_t &) = delete;
+    parallel_linearizer_t &operator=(const parallel_linearizer_t &) = delete;
+
+    /**
+     * @brief Main instance plus workers
+     */
+    size_t lanes() const noexcept
+    {
+        return _lanes.size();
+    }
+
+    const linearizer_t<model_t> &linearizer() const noexcept
+    {
+        return _lanes[0];
+    }
+
+    /**
+     * @brief Linearize around every point of `points` into `models`
+     *
+     * The main instance is restored to its FMU state on return.
+     *
+     * @return the worst status over all points
+     */
+    fmi2_status_t linearize(const std::vector<operating_point_t> &points,
+                            std::vector<linear_model_t> &models)
+    {
+        models.resize(points.size());
+        if (auto s = _workers.synchronize(); _failed(s)) {
+            return s;
+        }
+        auto run = [&](size_t k) {
+            _status[k] = fmi2_status_ok;
+            for (auto i = k; i < points.size(); i += _lanes.size()) {
+                auto s = _lanes[k].linearize(points[i], models[i]);
+                _status[k] = std::max(_status[k], s);
+                if (_failed(s)) {
+                    return;
+                }
+            }
+        };
+        run_lanes(_lanes.size(), run);
+        auto status = *std::max_element(_status.begin(), _status.end());
+        return std::max(status, _workers.restore_main());
+    }
+
+    /**
+     * @brief Statistics summed over all lanes
+     */
+    integrator_stats_t stats() const
+    {
+        integrator_stats_t stats;
+        for (auto &lane : _lanes) {
+            stats += lane.stats();
+        }
+        return stats;
+    }
+};
+} // namespace fmilib
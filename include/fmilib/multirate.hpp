@@ -0,0 +1,801 @@
+/*
+ *   Copyright (c) 2018, Hang Yu
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ *   * Neither the name of  nor the names of its contributors may be used to
+ *   endorse or promote products derived from this software without specific
+ *   prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *   ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *   LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *   CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *   SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *   INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *   CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *   ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include <fmilib/integrator.hpp>
+#include <fmilib/jacobian.hpp>
+#include <fmilib/sparsity.hpp>
+
+namespace fmilib
+{
+/**
+ * @brief States whose rate exceeds `separation` times the median rate at
+ * (t, x)
+ *
+ * The rate of state `i` is the symmetrized Gershgorin bound
+ * `|J_ii| + sum_j sqrt(|J_ij J_ji|)`, so both states of an oscillating
+ * pair count as fast while a one-way coupling does not. The median is
+ * taken over the states with a nonzero rate; if none moves, no state is
+ * fast. States whose derivatives read a fast state join the fast group,
+ * one level deep.
+ *
+ * The Jacobian is evaluated once through sparse_jacobian_t, so it costs
+ * one call per column color.
+ */
+template <typename model_t>
+std::vector<size_t> fast_states(me_system_t<model_t> &sys, fmi2_real_t t,
+                                const fmi2_real_t x[],
+                                fmi2_real_t separation = 10.0,
+                                bool directional = true)
+{
+    std::vector<size_t> fast;
+    auto n = sys.size();
+    if (n == 0) {
+        return fast;
+    }
+    sparse_jacobian_t<model_t> jac{sys, directional};
+    if (jac.evaluate(t, x) > fmi2_status_warning) {
+        throw std::runtime_error("Failed to evaluate the state Jacobian");
+    }
+    const auto &p = jac.pattern();
+    std::vector<fmi2_real_t> rate(n, 0.0);
+    const auto &v = jac.values();
+    for (size_t i = 0; i < n; ++i) {
+        for (auto k = p.row_start[i]; k < p.row_start[i + 1]; ++k) {
+            auto j = p.columns[k];
+            auto kt = j == i ? k : p.find(j, i);
+            if (kt < p.nnz()) {
+                rate[i] += std::sqrt(std::abs(v[k] * v[kt]));
+            }
+        }
+    }
+    // held states have no rate and would drag the median to zero, which
+    // makes every moving state fast; compare against the moving ones only
+    auto floor = std::numeric_limits<fmi2_real_t>::epsilon()
+                 * *std::max_element(rate.begin(), rate.end());
+    std::vector<fmi2_real_t> moving;
+    for (auto r : rate) {
+        if (r > floor) {
+            moving.push_back(r);
+        }
+    }
+    if (moving.empty()) {
+        return fast;
+    }
+    auto mid = moving.begin() + moving.size() / 2;
+    std::nth_element(moving.begin(), mid, moving.end());
+    auto median = *mid;
+    std::vector<unsigned char> is_fast(n, 0);
+    for (size_t i = 0; i < n; ++i) {
+        is_fast[i] = rate[i] > separation * median;
+    }
+    // states driven by a fast state would alias it in a slow step
+    for (size_t i = 0; i < n; ++i) {
+        auto driven = false;
+        for (auto k = p.row_start[i]; k < p.row_start[i + 1]; ++k) {
+            driven = driven || is_fast[p.columns[k]];
+        }
+        if (is_fast[i] || driven) {
+            fast.push_back(i);
+        }
+    }
+    return fast;
+}
+
+/**
+ * @brief Counters of the fast group, see multirate_integrator_t
+ */
+struct multirate_stats_t
+{
+    /** @brief accepted micro steps */
+    size_t fast_steps = 0;
+    /** @brief rejected micro steps */
+    size_t fast_rejected_steps = 0;
+    /** @brief macro steps refined twice because the coupled slow states
+     * strayed from what the first refinement assumed */
+    size_t corrector_sweeps = 0;
+
+    void reset() noexcept
+    {
+        *this = multirate_stats_t{};
+    }
+};
+
+/**
+ * @brief Multirate Dormand-Prince 5(4) driver for ModelExchange FMUs
+ * with a fast and a slow group of states
+ *
+ * Fastest first: every macro step `H` first refines the fast states with
+ * their own adaptive micro steps. The slow states they depend on (taken
+ * from the derivative dependencies) are extrapolated with the continuous
+ * extension of the previous macro step; all other slow states are held.
+ * The slow states then take one step of size `H`, reading the fast states
+ * from the continuous extension of the micro steps. If the coupled slow
+ * states end up farther from the extrapolation than the tolerance, the
+ * fast states are refined once more against the new slow solution and the
+ * next macro step is shortened. Each group has its own error test, so a
+ * fast transient only rejects micro steps.
+ *
+ * Every micro stage still hands the full state vector to the FMU and
+ * costs one `get_derivatives` call; the saving is the solver work on the
+ * slow states, which is done once per macro step. Without a partition
+ * the fast group is chosen by fast_states at the first `reset(t)`; with
+ * an empty fast or slow group the driver is plain Dormand-Prince.
+ */
+template <typename model_t> class multirate_integrator_t
+{
+private:
+    static constexpr fmi2_real_t _c[] = {0.0, 1.0 / 5, 3.0 / 10, 4.0 / 5,
+                                         8.0 / 9, 1.0, 1.0};
+    static constexpr fmi2_real_t _a[7][6] = {
+        {},
+        {1.0 / 5},
+        {3.0 / 40, 9.0 / 40},
+        {44.0 / 45, -56.0 / 15, 32.0 / 9},
+        {19372.0 / 6561, -25360.0 / 2187, 64448.0 / 6561, -212.0 / 729},
+        {9017.0 / 3168, -355.0 / 33, 46732.0 / 5247, 49.0 / 176,
+         -5103.0 / 18656},
+        {35.0 / 384, 0.0, 500.0 / 1113, 125.0 / 192, -2187.0 / 6784,
+         11.0 / 84}};
+    static constexpr fmi2_real_t _e[] = {71.0 / 57600,  0.0,
+                                         -71.0 / 16695, 71.0 / 1920,
+                                         -17253.0 / 339200, 22.0 / 525,
+                                         -1.0 / 40};
+
+    me_system_t<model_t> _sys;
+    fmi2_real_t _rtol;
+    fmi2_real_t _separation = 10.0;
+    fmi2_real_t _h_min = 0.0;
+    fmi2_real_t _h_max = std::numeric_limits<fmi2_real_t>::infinity();
+    fmi2_real_t _h = 0.0;
+    fmi2_real_t _h_fast = 0.0;
+    fmi2_real_t _h_last = 0.0;
+    fmi2_real_t _h_sweep = 0.0;
+    fmi2_real_t _t = 0.0;
+    fmi2_real_t _t0 = 0.0;
+    fmi2_real_t _t_event = std::numeric_limits<fmi2_real_t>::infinity();
+    bool _partitioned = false;
+    bool _fsal = false;
+    bool _corrector = false;
+    bool _extrapolate = false;
+    bool _enter_event_mode = false;
+    bool _terminate = false;
+    std::vector<size_t> _fast, _slow, _coupled;
+    std::vector<fmi2_real_t> _x, _x_new, _xs, _fs, _atol;
+    std::vector<fmi2_real_t> _k[7];
+    /* fast group during the refinement */
+    std::vector<fmi2_real_t> _xf, _xf_new;
+    std::vector<fmi2_real_t> _kf[7];
+    /* accepted micro steps of the current macro step: start, size and
+     * x0, x1, k1, k3, k4, k5, k6, k7 of the fast group */
+    std::vector<fmi2_real_t> _micro_t0, _micro_h, _micro;
+    /* coupled slow states at the end of the macro step as assumed by the
+     * refinement */
+    std::vector<fmi2_real_t> _assumed;
+    multirate_stats_t _stats;
+
+    static bool _failed(fmi2_status_t s) noexcept
+    {
+        return s > fmi2_status_warning;
+    }
+
+    /* 4th order continuous extension of Dormand & Prince */
+    static fmi2_real_t _dense(fmi2_real_t theta, fmi2_real_t h,
+                              fmi2_real_t x0, fmi2_real_t x1, fmi2_real_t k1,
+                              fmi2_real_t k3, fmi2_real_t k4, fmi2_real_t k5,
+                              fmi2_real_t k6, fmi2_real_t k7) noexcept
+    {
+        static constexpr fmi2_real_t d[] = {-12715105075.0 / 11282082432.0,
+                                            87487479700.0 / 32700410799.0,
+                                            -10690763975.0 / 1880347072.0,
+                                            701980252875.0 / 199316789632.0,
+                                            -1453857185.0 / 822651844.0,
+                                            69997945.0 / 29380423.0};
+        auto theta1 = 1.0 - theta;
+        auto r2 = x1 - x0;
+        auto r3 = h * k1 - r2;
+        auto r4 = r2 - h * k7 - r3;
+        auto r5 = h
+                  * (d[0] * k1 + d[1] * k3 + d[2] * k4 + d[3] * k5 + d[4] * k6
+                     + d[5] * k7);
+        return x0 + theta * (r2 + theta1 * (r3 + theta * (r4 + theta1 * r5)));
+    }
+
+    fmi2_real_t _scale(size_t i, fmi2_real_t a, fmi2_real_t b) const noexcept
+    {
+        return _atol[i] + _rtol * std::max(std::abs(a), std::abs(b));
+    }
+
+    /* fast state l at `t` within the micro steps of the macro step */
+    fmi2_real_t _fast_at(size_t l, fmi2_real_t t) const noexcept
+    {
+        auto it = std::upper_bound(_micro_t0.begin(), _micro_t0.end(), t);
+        size_t r = it == _micro_t0.begin() ? 0 : it - _micro_t0.begin() - 1;
+        auto h = _micro_h[r];
+        auto theta = h != 0.0 ? (t - _micro_t0[r]) / h : 1.0;
+        auto nf = _fast.size();
+        const auto *v = _micro.data() + r * 8 * nf + l;
+        return _dense(theta, h, v[0], v[nf], v[2 * nf], v[3 * nf], v[4 * nf],
+                      v[5 * nf], v[6 * nf], v[7 * nf]);
+    }
+
+    /* coupled slow state `j` at `t` as seen by the refinement: the
+     * continuous extension of the first sweep in the corrector, else
+     * extrapolated from the previous macro step, or linearly after a
+     * restart or rejection */
+    fmi2_real_t _coupled_at(size_t j, fmi2_real_t t) const noexcept
+    {
+        if (_corrector) {
+            return _dense((t - _t) / _h_sweep, _h_sweep, _x[j], _x_new[j],
+                          _k[0][j], _k[2][j], _k[3][j], _k[4][j], _k[5][j],
+                          _k[6][j]);
+        }
+        if (_extrapolate) {
+            return _dense((t - _t0) / _h_last, _h_last, _x_new[j], _x[j],
+                          _k[6][j], _k[2][j], _k[3][j], _k[4][j], _k[5][j],
+                          _k[0][j]);
+        }
+        return _x[j] + (t - _t) * _k[0][j];
+    }
+
+    /* derivatives of the fast group at `t` with the coupled slow states
+     * extrapolated from the start of the macro step */
+    fmi2_status_t _fast_derivatives(fmi2_real_t t, std::vector<fmi2_real_t> &k)
+    {
+        for (auto j : _coupled) {
+            _xs[j] = _coupled_at(j, t);
+        }
+        if (auto s = _sys.derivatives(t, _xs.data(), _fs.data()); _failed(s)) {
+            return s;
+        }
+        for (size_t l = 0; l < _fast.size(); ++l) {
+            k[l] = _fs[_fast[l]];
+        }
+        return fmi2_status_ok;
+    }
+
+    /* micro steps of the fast group over [_t, _t + H] */
+    fmi2_status_t _refine(fmi2_real_t H)
+    {
+        auto nf = _fast.size();
+        _micro_t0.clear();
+        _micro_h.clear();
+        _micro.clear();
+        std::copy(_x.begin(), _x.end(), _xs.begin());
+        for (size_t l = 0; l < nf; ++l) {
+            _xf[l] = _x[_fast[l]];
+            _kf[0][l] = _k[0][_fast[l]];
+        }
+        auto t_end = _t + H;
+        for (size_t l = 0; l < _coupled.size(); ++l) {
+            _assumed[l] = _coupled_at(_coupled[l], t_end);
+        }
+        auto eps = 100.0 * std::numeric_limits<fmi2_real_t>::epsilon()
+                   * std::max({1.0, std::abs(_t), std::abs(t_end)});
+        auto tf = _t;
+        auto fac_max = 5.0;
+        while (tf < t_end - eps) {
+            auto h = std::min(_h_fast, H);
+            auto clipped = t_end - tf < h + eps;
+            if (clipped) {
+                h = t_end - tf;
+            }
+            for (int st = 1; st < 7; ++st) {
+                for (size_t l = 0; l < nf; ++l) {
+                    fmi2_real_t sum = 0.0;
+                    for (int j = 0; j < st; ++j) {
+                        sum += _a[st][j] * _kf[j][l];
+                    }
+                    _xs[_fast[l]] = _xf[l] + h * sum;
+                }
+                if (auto s = _fast_derivatives(tf + _c[st] * h, _kf[st]);
+                    _failed(s)) {
+                    return s;
+                }
+            }
+            fmi2_real_t err = 0.0;
+            for (size_t l = 0; l < nf; ++l) {
+                auto i = _fast[l];
+                _xf_new[l] = _xs[i];
+                fmi2_real_t sum = 0.0;
+                for (int j = 0; j < 7; ++j) {
+                    sum += _e[j] * _kf[j][l];
+                }
+                auto r = h * sum / _scale(i, _xf[l], _xf_new[l]);
+                err += r * r;
+            }
+            err = std::sqrt(err / nf);
+
+            auto fac = err > 0.0 ? 0.9 * std::pow(err, -0.2) : fac_max;
+            if (err <= 1.0) {
+                _micro_t0.push_back(tf);
+                _micro_h.push_back(h);
+                for (auto *v : {&_xf, &_xf_new, &_kf[0], &_kf[2], &_kf[3],
+                                &_kf[4], &_kf[5], &_kf[6]}) {
+                    _micro.insert(_micro.end(), v->begin(), v->end());
+                }
+                tf = clipped ? t_end : tf + h;
+                std::swap(_xf, _xf_new);
+                std::swap(_kf[0], _kf[6]);
+                if (!clipped || fac < 1.0) {
+                    _h_fast = std::max(
+                        h * std::min(fac_max, std::max(0.2, fac)), _h_min);
+                }
+                fac_max = 5.0;
+                ++_stats.fast_steps;
+                continue;
+            }
+            ++_stats.fast_rejected_steps;
+            fac_max = 1.0;
+            _h_fast = h * std::max(0.2, fac);
+            if (_h_fast < _h_min || _h_fast <= eps) {
+                return fmi2_status_error;
+            }
+        }
+        return fmi2_status_ok;
+    }
+
+    /* RMS of the scaled difference between the coupled slow states at the
+     * end of the macro step and what the refinement assumed */
+    fmi2_real_t _defect() const
+    {
+        fmi2_real_t sum = 0.0;
+        for (size_t l = 0; l < _coupled.size(); ++l) {
+            auto j = _coupled[l];
+            auto r = (_xs[j] - _assumed[l]) / _scale(j, _x[j], _xs[j]);
+            sum += r * r;
+        }
+        return _coupled.empty() ? 0.0 : std::sqrt(sum / _coupled.size());
+    }
+
+    /* slow stages of a macro step, the fast states follow the micro steps;
+     * ends with the new point in _xs and its derivatives in _k[6] */
+    fmi2_status_t _slow_step(fmi2_real_t h, bool multirate)
+    {
+        const auto &controlled = _slow.empty() ? _fast : _slow;
+        for (int st = 1; st < 7; ++st) {
+            for (auto i : controlled) {
+                fmi2_real_t sum = 0.0;
+                for (int j = 0; j < st; ++j) {
+                    sum += _a[st][j] * _k[j][i];
+                }
+                _xs[i] = _x[i] + h * sum;
+            }
+            if (multirate) {
+                for (size_t l = 0; l < _fast.size(); ++l) {
+                    _xs[_fast[l]]
+                        = st < 5 ? _fast_at(l, _t + _c[st] * h) : _xf[l];
+                }
+            }
+            if (auto s = _sys.derivatives(_t + _c[st] * h, _xs.data(),
+                                          _k[st].data());
+                _failed(s)) {
+                return s;
+            }
+        }
+        return fmi2_status_ok;
+    }
+
+    /* RMS of the scaled increments `h * f` and states over `group` */
+    void _norms(const std::vector<size_t> &group, fmi2_real_t &d0,
+                fmi2_real_t &d1) const
+    {
+        d0 = 0.0;
+        d1 = 0.0;
+        for (auto i : group) {
+            auto sc = _scale(i, _x[i], _x[i]);
+            d0 += (_x[i] / sc) * (_x[i] / sc);
+            d1 += (_k[0][i] / sc) * (_k[0][i] / sc);
+        }
+        d0 = std::sqrt(d0 / std::max<size_t>(group.size(), 1));
+        d1 = std::sqrt(d1 / std::max<size_t>(group.size(), 1));
+    }
+
+    static fmi2_real_t _guess(fmi2_real_t d0, fmi2_real_t d1) noexcept
+    {
+        return (d0 < 1e-5 || d1 < 1e-5) ? 1e-6 : 0.01 * d0 / d1;
+    }
+
+public:
+    /**
+     * @brief Construct with relative tolerance `rtol`, defaults to the
+     * default experiment tolerance of the FMU
+     *
+     * @param fast indices of the fast states, chosen by fast_states at
+     * the first `reset(t)` if empty
+     */
+    explicit multirate_integrator_t(model_t &m, fmi2_real_t rtol = 0.0,
+                                    std::vector<size_t> fast = {})
+        : _sys{m}, _rtol{rtol > 0.0 ? rtol : m.default_experiment_tolerance()}
+    {
+        auto nx = _sys.size();
+        for (auto *v : {&_x, &_x_new, &_xs, &_fs, &_atol}) {
+            v->resize(nx);
+        }
+        for (auto &k : _k) {
+            k.resize(nx);
+        }
+        auto partitioned = !fast.empty();
+        set_fast_states(std::move(fast));
+        _partitioned = partitioned;
+    }
+
+    /**
+     * @brief Set the fast group; the slow states its derivatives depend
+     * on are taken from the derivative dependencies of the FMU
+     */
+    void set_fast_states(std::vector<size_t> fast)
+    {
+        auto nx = _sys.size();
+        std::sort(fast.begin(), fast.end());
+        fast.erase(std::unique(fast.begin(), fast.end()), fast.end());
+        _fast = std::move(fast);
+        _slow.clear();
+        _coupled.clear();
+        std::vector<unsigned char> is_fast(nx, 0), coupled(nx, 0);
+        for (auto i : _fast) {
+            is_fast[i] = 1;
+        }
+        for (size_t i = 0; i < nx; ++i) {
+            if (!is_fast[i]) {
+                _slow.push_back(i);
+            }
+        }
+        if (!_fast.empty() && !_slow.empty()) {
+            auto p = derivatives_sparsity(_sys.model());
+            for (auto i : _fast) {
+                for (auto k = p.row_start[i]; k < p.row_start[i + 1]; ++k) {
+                    coupled[p.columns[k]] = !is_fast[p.columns[k]];
+                }
+            }
+        }
+        for (size_t j = 0; j < nx; ++j) {
+            if (coupled[j]) {
+                _coupled.push_back(j);
+            }
+        }
+        _assumed.resize(_coupled.size());
+        auto nf = _fast.size();
+        _xf.resize(nf);
+        _xf_new.resize(nf);
+        for (auto &k : _kf) {
+            k.resize(nf);
+        }
+        _partitioned = true;
+        _h = 0.0;
+        _fsal = false;
+        _extrapolate = false;
+    }
+
+    /**
+     * @brief Separation of the rates used by the automatic partition
+     */
+    void set_separation(fmi2_real_t separation) noexcept
+    {
+        _separation = separation;
+    }
+
+    const std::vector<size_t> &fast() const noexcept
+    {
+        return _fast;
+    }
+
+    const std::vector<size_t> &slow() const noexcept
+    {
+        return _slow;
+    }
+
+    /**
+     * @brief Slow states the fast derivatives depend on
+     */
+    const std::vector<size_t> &coupled() const noexcept
+    {
+        return _coupled;
+    }
+
+    /**
+     * @brief Start at `t`, reading states and nominals from the FMU
+     *
+     * The FMU must be in continuous time mode.
+     */
+    fmi2_status_t reset(fmi2_real_t t)
+    {
+        _t = t;
+        _t0 = t;
+        _fsal = false;
+        _extrapolate = false;
+        _enter_event_mode = false;
+        _terminate = false;
+        _sys.invalidate();
+        if (auto s = _sys.set_time(t); _failed(s)) {
+            return s;
+        }
+        if (auto s = _sys.read_states(_x.data()); _failed(s)) {
+            return s;
+        }
+        if (auto s = _sys.nominals(_atol.data()); _failed(s)) {
+            return s;
+        }
+        for (auto &a : _atol) {
+            a = _rtol * std::abs(a);
+        }
+        if (!_partitioned) {
+            set_fast_states(fast_states(_sys, t, _x.data(), _separation));
+        }
+        return fmi2_status_ok;
+    }
+
+    /**
+     * @brief Restart at `t` from states the caller already holds, keeping
+     * the nominals of the last `reset(t)`
+     *
+     * The FMU must hold `x` at `t`.
+     */
+    fmi2_status_t reset(fmi2_real_t t, const fmi2_real_t x[])
+    {
+        _t = t;
+        _t0 = t;
+        _fsal = false;
+        _extrapolate = false;
+        _enter_event_mode = false;
+        _terminate = false;
+        std::copy(x, x + _x.size(), _x.begin());
+        return _sys.set_time(t);
+    }
+
+    void set_step_limits(fmi2_real_t h_min, fmi2_real_t h_max) noexcept
+    {
+        _h_min = h_min;
+        _h_max = h_max;
+    }
+
+    void set_next_time_event(fmi2_real_t t) noexcept
+    {
+        _t_event = t;
+    }
+
+    void clear_next_time_event() noexcept
+    {
+        _t_event = std::numeric_limits<fmi2_real_t>::infinity();
+    }
+
+    /**
+     * @brief Take one accepted macro step towards `t_stop`
+     *
+     * @return fmi2_status_error if a step size falls below the minimum
+     */
+    fmi2_status_t step(fmi2_real_t t_stop)
+    {
+        fmi2_status_t s;
+        auto multirate = !_fast.empty() && !_slow.empty();
+        const auto &controlled = _slow.empty() ? _fast : _slow;
+        if (!_fsal) {
+            if (s = _sys.derivatives(_t, _x.data(), _k[0].data());
+                _failed(s)) {
+                return s;
+            }
+            fmi2_real_t d0, d1;
+            if (_h <= 0.0) {
+                _norms(controlled, d0, d1);
+                _h = std::max(std::min(_guess(d0, d1), _h_max), _h_min);
+            }
+            if (multirate && _h_fast <= 0.0) {
+                _norms(_fast, d0, d1);
+                _h_fast = std::max(_guess(d0, d1), _h_min);
+            }
+            _fsal = true;
+        }
+        auto eps = 100.0 * std::numeric_limits<fmi2_real_t>::epsilon()
+                   * std::max({1.0, std::abs(_t), std::abs(t_stop)});
+        auto fac_max = 5.0;
+        for (;;) {
+            auto h = std::min(_h, _h_max);
+            auto clipped = t_stop - _t < h + eps;
+            if (clipped) {
+                h = t_stop - _t;
+            }
+            if (multirate) {
+                if (s = _refine(h); _failed(s)) {
+                    return s;
+                }
+            }
+            if (s = _slow_step(h, multirate); _failed(s)) {
+                return s;
+            }
+            // a failed extrapolation also limits the next macro step
+            auto defect = multirate ? _defect() : 0.0;
+            auto extrapolated = _extrapolate;
+            // the stages of the previous step are gone
+            _extrapolate = false;
+            if (defect > 1.0) {
+                // second sweep with the coupled slow states interpolated
+                ++_stats.corrector_sweeps;
+                std::copy(_xs.begin(), _xs.end(), _x_new.begin());
+                _corrector = true;
+                _h_sweep = h;
+                s = _refine(h);
+                _corrector = false;
+                if (_failed(s)) {
+                    return s;
+                }
+                if (s = _slow_step(h, multirate); _failed(s)) {
+                    return s;
+                }
+            }
+            std::copy(_xs.begin(), _xs.end(), _x_new.begin());
+            fmi2_real_t err = 0.0;
+            for (auto i : controlled) {
+                fmi2_real_t sum = 0.0;
+                for (int j = 0; j < 7; ++j) {
+                    sum += _e[j] * _k[j][i];
+                }
+                auto r = h * sum / _scale(i, _x[i], _x_new[i]);
+                err += r * r;
+            }
+            err = controlled.empty() ? 0.0 : std::sqrt(err / controlled.size());
+
+            auto ctrl = extrapolated ? std::max(err, defect) : err;
+            auto fac = ctrl > 0.0 ? 0.9 * std::pow(ctrl, -0.2) : fac_max;
+            if (err <= 1.0) {
+                _h_last = h;
+                _t0 = _t;
+                _t = clipped ? t_stop : _t + h;
+                // the previous point stays in _x_new and _k[6]
+                std::swap(_x, _x_new);
+                std::swap(_k[0], _k[6]);
+                _extrapolate = multirate;
+                if (!clipped || fac < 1.0) {
+                    _h = std::max(h * std::min(fac_max, std::max(0.2, fac)),
+                                  _h_min);
+                }
+                ++_sys.stats.steps;
+                return _sys.completed_step(_enter_event_mode, _terminate);
+            }
+            ++_sys.stats.rejected_steps;
+            fac_max = 1.0;
+            _h = h * std::max(0.2, fac);
+            if (_h < _h_min || _h <= eps) {
+                return fmi2_status_error;
+            }
+        }
+    }
+
+    /**
+     * @brief Same as `step`, the entry point shared with
+     * fixed_step_integrator_t
+     */
+    fmi2_status_t advance(fmi2_real_t t_stop)
+    {
+        return step(t_stop);
+    }
+
+    /**
+     * @brief Integrate up to `t_end`, calling `observer(t, x)` after every
+     * macro step
+     */
+    template <typename observer_t = null_observer_t>
+    fmi2_status_t integrate(fmi2_real_t t_end, observer_t &&observer = {})
+    {
+        auto status = fmi2_status_ok;
+        auto t_stop = std::min(t_end, _t_event);
+        auto eps = 100.0 * std::numeric_limits<fmi2_real_t>::epsilon()
+                   * std::max({1.0, std::abs(_t), std::abs(t_stop)});
+        while (_t < t_stop - eps && !_enter_event_mode && !_terminate) {
+            auto s = step(t_stop);
+            status = std::max(status, s);
+            if (_failed(s)) {
+                return s;
+            }
+            observer(_t, _x);
+        }
+        return status;
+    }
+
+    /**
+     * @brief States at `t` within the last macro step, from the
+     * continuous extensions of the macro step (slow states) and of the
+     * micro steps (fast states)
+     */
+    fmi2_status_t interpolate(fmi2_real_t t, fmi2_real_t x[]) const
+    {
+        auto h = _h_last;
+        auto theta = h != 0.0 ? (t - _t0) / h : 1.0;
+        const auto &controlled = _slow.empty() ? _fast : _slow;
+        for (auto i : controlled) {
+            x[i] = _dense(theta, h, _x_new[i], _x[i], _k[6][i], _k[2][i],
+                          _k[3][i], _k[4][i], _k[5][i], _k[0][i]);
+        }
+        if (!_fast.empty() && !_slow.empty()) {
+            for (size_t l = 0; l < _fast.size(); ++l) {
+                x[_fast[l]] = _micro_h.empty() ? _x[_fast[l]] : _fast_at(l, t);
+            }
+        }
+        return fmi2_status_ok;
+    }
+
+    fmi2_real_t time() const noexcept
+    {
+        return _t;
+    }
+
+    /**
+     * @brief Start of the last macro step
+     */
+    fmi2_real_t previous_time() const noexcept
+    {
+        return _t0;
+    }
+
+    fmi2_real_t step_size() const noexcept
+    {
+        return _h;
+    }
+
+    fmi2_real_t fast_step_size() const noexcept
+    {
+        return _h_fast;
+    }
+
+    const std::vector<fmi2_real_t> &states() const noexcept
+    {
+        return _x;
+    }
+
+    bool enter_event_mode() const noexcept
+    {
+        return _enter_event_mode;
+    }
+
+    bool terminate_simulation() const noexcept
+    {
+        return _terminate;
+    }
+
+    const integrator_stats_t &stats() const noexcept
+    {
+        return _sys.stats;
+    }
+
+    const multirate_stats_t &multirate_stats() const noexcept
+    {
+        return _stats;
+    }
+
+    me_system_t<model_t> &system() noexcept
+    {
+        return _sys;
+    }
+};
+} // namespace fmilib
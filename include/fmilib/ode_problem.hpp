@@ -0,0 +1,419 @@
+/*
+ *   Copyright (c) 2018, Hang Yu
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ *   * Neither the name of  nor the names of its contributors may be used to
+ *   endorse or promote products derived from this software without specific
+ *   prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *   ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *   LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *   CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *   SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *   INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *   CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *   ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include <fmilib/integrator.hpp>
+#include <fmilib/krylov.hpp>
+
+namespace fmilib
+{
+/**
+ * @brief Non-owning view of a contiguous array
+ *
+ * Stands in for `std::span` until the library moves past C++17.
+ */
+template <typename T> class span_t
+{
+private:
+    T *_data = nullptr;
+    size_t _size = 0;
+
+public:
+    using value_type = std::remove_cv_t<T>;
+
+    span_t() noexcept = default;
+
+    span_t(T *data, size_t size) noexcept : _data{data}, _size{size}
+    {
+    }
+
+    template <typename U,
+              typename = std::enable_if_t<std::is_convertible_v<U *, T *>>>
+    span_t(span_t<U> s) noexcept : _data{s.data()}, _size{s.size()}
+    {
+    }
+
+    template <typename U,
+              typename = std::enable_if_t<std::is_convertible_v<U *, T *>>>
+    span_t(std::vector<U> &v) noexcept : _data{v.data()}, _size{v.size()}
+    {
+    }
+
+    template <typename U,
+              typename = std::enable_if_t<std::is_const_v<T>
+                                          && std::is_convertible_v<const U *,
+                                                                   T *>>>
+    span_t(const std::vector<U> &v) noexcept
+        : _data{v.data()}, _size{v.size()}
+    {
+    }
+
+    T *data() const noexcept
+    {
+        return _data;
+    }
+
+    size_t size() const noexcept
+    {
+        return _size;
+    }
+
+    bool empty() const noexcept
+    {
+        return _size == 0;
+    }
+
+    T &operator[](size_t i) const noexcept
+    {
+        return _data[i];
+    }
+
+    T *begin() const noexcept
+    {
+        return _data;
+    }
+
+    T *end() const noexcept
+    {
+        return _data + _size;
+    }
+};
+
+/**
+ * @brief A ModelExchange instance seen as the ODE x' = f(t, x) with event
+ * functions g(t, x), for solvers outside this library
+ *
+ * States and derivatives are handed to and from the FMU in the buffers of
+ * the caller. The last point (t, x) and its derivatives are cached, so a
+ * solver evaluating the same point twice, e.g. at the first stage of a
+ * FSAL method or for a finite difference Jacobian, does not re-enter the
+ * FMU. Call `invalidate` whenever anything else changed the FMU, e.g. after
+ * event handling or `set_real` on a parameter.
+ *
+ * With nominal scaling the solver sees z = x / nominal instead, which
+ * costs one copy of the states per new point.
+ *
+ * The call operator follows the system signature of Boost.Odeint and
+ * throws on errors.
+ *
+ * @tparam model_t fmi2_t<true, ...> or fmi2_direct_t<true, ...>
+ */
+template <typename model_t> class ode_problem_t
+{
+private:
+    me_system_t<model_t> _sys;
+    jacobian_operator_t<model_t> _jv;
+    size_t _nz;
+    bool _scaled = false;
+    /* the point the FMU holds and whether _f holds its derivatives */
+    fmi2_real_t _t = std::numeric_limits<fmi2_real_t>::quiet_NaN();
+    bool _x_valid = false;
+    bool _f_valid = false;
+    std::vector<fmi2_real_t> _x, _f, _xp, _seed, _nominal;
+
+    static bool _failed(fmi2_status_t s) noexcept
+    {
+        return s > fmi2_status_warning;
+    }
+
+    void _check(span_t<const fmi2_real_t> x) const
+    {
+        if (x.size() != _x.size()) {
+            throw std::runtime_error("State vector has the wrong size");
+        }
+    }
+
+    bool _cached(fmi2_real_t t, const fmi2_real_t x[]) const noexcept
+    {
+        return _x_valid && t == _t && std::equal(_x.begin(), _x.end(), x);
+    }
+
+    /* hand (t, x) to the FMU unless it already holds it, x unscaled */
+    fmi2_status_t _set_point(fmi2_real_t t, const fmi2_real_t x[])
+    {
+        if (_cached(t, x)) {
+            return fmi2_status_ok;
+        }
+        _x_valid = false;
+        _f_valid = false;
+        if (auto s = _sys.set_point(t, x); _failed(s)) {
+            return s;
+        }
+        _t = t;
+        std::copy(x, x + _x.size(), _x.begin());
+        _x_valid = true;
+        return fmi2_status_ok;
+    }
+
+    /* unscaled states of the solver variables z */
+    const fmi2_real_t *_unscale(const fmi2_real_t z[])
+    {
+        if (!_scaled) {
+            return z;
+        }
+        for (size_t i = 0; i < _xp.size(); ++i) {
+            _xp[i] = z[i] * _nominal[i];
+        }
+        return _xp.data();
+    }
+
+    /* derivatives at the point the FMU holds, into _f */
+    fmi2_status_t _derivatives()
+    {
+        if (_f_valid) {
+            return fmi2_status_ok;
+        }
+        if (auto s = _sys.derivatives(_f.data()); _failed(s)) {
+            return s;
+        }
+        _f_valid = true;
+        return fmi2_status_ok;
+    }
+
+public:
+    using model_type = model_t;
+
+    /**
+     * @param m instance in continuous time mode
+     * @param directional use directional derivatives for `jac_vec` if the
+     * FMU provides them
+     */
+    explicit ode_problem_t(model_t &m, bool directional = true)
+        : _sys{m}, _jv{_sys, directional},
+          _nz{m.number_of_event_indicators()}
+    {
+        auto n = _sys.size();
+        _x.resize(n);
+        _f.resize(n);
+        _xp.resize(n);
+        _seed.resize(n);
+        _nominal.resize(n);
+        if (auto s = _sys.nominals(_nominal.data()); _failed(s)) {
+            throw std::runtime_error("Failed to get nominal values");
+        }
+    }
+
+    /**
+     * @brief Number of states
+     */
+    size_t size() const noexcept
+    {
+        return _x.size();
+    }
+
+    /**
+     * @brief Number of event functions
+     */
+    size_t number_of_events() const noexcept
+    {
+        return _nz;
+    }
+
+    bool directional() const noexcept
+    {
+        return _jv.directional();
+    }
+
+    /**
+     * @brief Let the solver work on x / nominal instead of x
+     */
+    void set_scaling(bool scaled) noexcept
+    {
+        _scaled = scaled;
+    }
+
+    bool scaled() const noexcept
+    {
+        return _scaled;
+    }
+
+    const std::vector<fmi2_real_t> &nominals() const noexcept
+    {
+        return _nominal;
+    }
+
+    /**
+     * @brief Re-read the nominals, they may change at events
+     */
+    fmi2_status_t read_nominals()
+    {
+        if (auto s = _jv.read_nominals(); _failed(s)) {
+            return s;
+        }
+        return _sys.nominals(_nominal.data());
+    }
+
+    /**
+     * @brief Forget the cached point, e.g. after event handling
+     */
+    void invalidate() noexcept
+    {
+        _x_valid = false;
+        _f_valid = false;
+        _sys.invalidate();
+    }
+
+    /**
+     * @brief Solver variables of the states the FMU holds, e.g. the
+     * initial value after initialization or event handling
+     */
+    fmi2_status_t initial_states(span_t<fmi2_real_t> x)
+    {
+        _check(x);
+        invalidate();
+        if (auto s = _sys.read_states(x.data()); _failed(s)) {
+            return s;
+        }
+        if (_scaled) {
+            for (size_t i = 0; i < x.size(); ++i) {
+                x[i] /= _nominal[i];
+            }
+        }
+        return fmi2_status_ok;
+    }
+
+    /**
+     * @brief Right-hand side `xdot = f(t, x)`
+     *
+     * The FMU holds (t, x) on return.
+     */
+    fmi2_status_t rhs(fmi2_real_t t, span_t<const fmi2_real_t> x,
+                      span_t<fmi2_real_t> xdot)
+    {
+        _check(x);
+        _check(xdot);
+        if (auto s = _set_point(t, _unscale(x.data())); _failed(s)) {
+            return s;
+        }
+        if (auto s = _derivatives(); _failed(s)) {
+            return s;
+        }
+        for (size_t i = 0; i < _f.size(); ++i) {
+            xdot[i] = _scaled ? _f[i] / _nominal[i] : _f[i];
+        }
+        return fmi2_status_ok;
+    }
+
+    /**
+     * @brief Jacobian-vector product `jv = df/dx(t, x) v`
+     *
+     * One `get_directional_derivative` call, or a forward difference
+     * along `v` with the derivatives at (t, x) taken from the cache when
+     * possible. The FMU holds (t, x) on return.
+     */
+    fmi2_status_t jac_vec(fmi2_real_t t, span_t<const fmi2_real_t> x,
+                          span_t<const fmi2_real_t> v, span_t<fmi2_real_t> jv)
+    {
+        _check(x);
+        _check(v);
+        _check(jv);
+        auto n = _x.size();
+        if (auto s = _set_point(t, _unscale(x.data())); _failed(s)) {
+            return s;
+        }
+        for (size_t i = 0; i < n; ++i) {
+            _seed[i] = _scaled ? v[i] * _nominal[i] : v[i];
+        }
+        // the cached derivatives spare the forward difference one
+        // evaluation
+        if (!_jv.directional()) {
+            if (auto s = _derivatives(); _failed(s)) {
+                return s;
+            }
+        }
+        auto s = _jv.apply(t, _x.data(), _f.data(), _seed.data(), jv.data());
+        if (_failed(s)) {
+            _x_valid = false;
+            _f_valid = false;
+            return s;
+        }
+        if (_scaled) {
+            for (size_t i = 0; i < n; ++i) {
+                jv[i] /= _nominal[i];
+            }
+        }
+        return s;
+    }
+
+    /**
+     * @brief Event functions `g = z(t, x)`, the event indicators of the
+     * FMU
+     *
+     * The FMU holds (t, x) on return.
+     */
+    fmi2_status_t events(fmi2_real_t t, span_t<const fmi2_real_t> x,
+                         span_t<fmi2_real_t> g)
+    {
+        _check(x);
+        if (g.size() != _nz) {
+            throw std::runtime_error("Event vector has the wrong size");
+        }
+        if (auto s = _set_point(t, _unscale(x.data())); _failed(s)) {
+            return s;
+        }
+        if (_nz == 0) {
+            return fmi2_status_ok;
+        }
+        ++_sys.stats.indicator_evaluations;
+        return _sys.model().get_event_indicators(g.data(), _nz);
+    }
+
+    /**
+     * @brief System function in the form Boost.Odeint expects, throws on
+     * errors
+     */
+    template <typename state_t>
+    void operator()(const state_t &x, state_t &dxdt, fmi2_real_t t)
+    {
+        dxdt.resize(x.size());
+        auto s = rhs(t, {x.data(), x.size()}, {dxdt.data(), dxdt.size()});
+        if (_failed(s)) {
+            throw std::runtime_error("Failed to evaluate the derivatives");
+        }
+    }
+
+    const integrator_stats_t &stats() const noexcept
+    {
+        return _sys.stats;
+    }
+
+    me_system_t<model_t> &system() noexcept
+    {
+        return _sys;
+    }
+};
+} // namespace fmilib
@@ -0,0 +1,173 @@
+/*
+ *   Copyright (c) 2018, Hang Yu
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ *   * Neither the name of  nor the names of its contributors may be used to
+ *   endorse or promote products derived from this software without specific
+ *   prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *   ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *   LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *   CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *   SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *   INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *   CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *   ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <fmilib/integrator.hpp>
+
+namespace fmilib
+{
+/**
+ * @brief Observer that samples outputs on a fixed time grid from the
+ * interpolant of a driver
+ *
+ * The driver steps freely. After every step each grid point it passed is
+ * produced by handing the interpolated states to the FMU and reading only
+ * the requested real variables. Afterwards the FMU is put back to the
+ * point the observer was called with.
+ *
+ * Works as the observer of the drivers' `integrate` and of
+ * event_driver_t; at an event, grid points up to and including the event
+ * time take the values before the event.
+ *
+ * Values are stored row by row, one row of `vrs.size()` entries per entry
+ * of `t`.
+ */
+template <typename driver_t> class grid_sampler_t
+{
+public:
+    using system_t = std::remove_reference_t<
+        decltype(std::declval<driver_t &>().system())>;
+
+private:
+    driver_t &_driver;
+    system_t &_sys;
+    std::vector<fmi2_value_reference_t> _vrs;
+    fmi2_real_t _t0;
+    fmi2_real_t _dt;
+    size_t _next = 0;
+    std::vector<fmi2_real_t> _x;
+    fmi2_status_t _status = fmi2_status_ok;
+
+    static bool _failed(fmi2_status_t s) noexcept
+    {
+        return s > fmi2_status_warning;
+    }
+
+    bool _update(fmi2_status_t s) noexcept
+    {
+        _status = std::max(_status, s);
+        return !_failed(s);
+    }
+
+public:
+    std::vector<fmi2_real_t> t;
+    std::vector<fmi2_real_t> values;
+
+    /**
+     * @param vrs real variables to record
+     * @param t0 first grid point
+     * @param dt grid spacing, throws std::runtime_error unless positive
+     */
+    grid_sampler_t(driver_t &driver, std::vector<fmi2_value_reference_t> vrs,
+                   fmi2_real_t t0, fmi2_real_t dt)
+        : _driver{driver}, _sys{driver.system()}, _vrs{std::move(vrs)},
+          _t0{t0}, _dt{dt}
+    {
+        if (!(dt > 0.0)) {
+            throw std::runtime_error("Grid spacing must be positive");
+        }
+        _x.resize(_sys.size());
+    }
+
+    void operator()(fmi2_real_t time, const std::vector<fmi2_real_t> &states)
+    {
+        if (_failed(_status)) {
+            return;
+        }
+        auto eps = 100.0 * std::numeric_limits<fmi2_real_t>::epsilon()
+                   * std::max(1.0, std::abs(time));
+        auto sampled = false;
+        for (;;) {
+            auto tg = _t0 + static_cast<fmi2_real_t>(_next) * _dt;
+            if (tg > time + eps) {
+                break;
+            }
+            ++_next;
+            if (tg < _driver.previous_time() - eps) {
+                // before the interpolant, e.g. a grid started in the past
+                continue;
+            }
+            if (!_update(_driver.interpolate(tg, _x.data()))
+                || !_update(_sys.set_point(tg, _x.data()))) {
+                return;
+            }
+            auto row = values.size();
+            values.resize(row + _vrs.size());
+            if (!_update(_sys.model().get_real(_vrs.data(), _vrs.size(),
+                                               values.data() + row))) {
+                return;
+            }
+            t.push_back(tg);
+            sampled = true;
+        }
+        if (sampled) {
+            _update(_sys.set_point(time, states.data()));
+        }
+    }
+
+    /**
+     * @brief Worst status seen, sampling stops after an error
+     */
+    fmi2_status_t status() const noexcept
+    {
+        return _status;
+    }
+
+    size_t size() const noexcept
+    {
+        return t.size();
+    }
+
+    const fmi2_real_t *row(size_t i) const noexcept
+    {
+        return values.data() + i * _vrs.size();
+    }
+
+    /**
+     * @brief Restart at grid point `t0`, dropping the recorded samples
+     */
+    void reset(fmi2_real_t t0) noexcept
+    {
+        _t0 = t0;
+        _next = 0;
+        _status = fmi2_status_ok;
+        t.clear();
+        values.clear();
+    }
+};
+} // namespace fmilib
@@ -0,0 +1,243 @@
+/*
+ *   Copyright (c) 2018, Hang Yu
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ *   * Neither the name of  nor the names of its contributors may be used to
+ *   endorse or promote products derived from this software without specific
+ *   prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *   ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *   LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *   CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *   SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *   INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *   CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *   ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+#include <fmilib/integrator.hpp>
+#include <fmilib/jacobian.hpp>
+#include <fmilib/lanes.hpp>
+#include <fmilib/sparsity.hpp>
+
+namespace fmilib
+{
+/**
+ * @brief Finite difference state Jacobian evaluated in parallel on
+ * worker instances of the same FMU
+ *
+ * Every evaluation first brings the workers to the point of the main
+ * instance with worker_states_t::synchronize(), then splits the color
+ * groups of the derivative sparsity pattern over the lanes, see
+ * run_lanes and check_worker. The perturbation is fd_perturbation.
+ * Values are stored in the order of `pattern().columns`.
+ */
+template <typename model_t> class parallel_fd_jacobian_t
+{
+private:
+    struct lane_t
+    {
+        me_system_t<model_t> sys;
+        std::vector<fmi2_real_t> xp, f1, delta;
+        fmi2_status_t status = fmi2_status_ok;
+
+        explicit lane_t(model_t &m) : sys{m}
+        {
+        }
+    };
+
+    me_system_t<model_t> &_sys;
+    worker_states_t<model_t> _workers;
+    std::vector<lane_t> _lanes;
+    sparsity_pattern_t _pattern;
+    sparsity_pattern_t _csc;
+    std::vector<size_t> _csc_pos;
+    column_coloring_t _coloring;
+    std::vector<fmi2_real_t> _values, _f0, _nominal;
+
+    static bool _failed(fmi2_status_t s) noexcept
+    {
+        return s > fmi2_status_warning;
+    }
+
+    /* evaluate the colors k, k + lanes, k + 2 lanes, ... */
+    void _run(size_t k, fmi2_real_t t, const fmi2_real_t x[],
+              const fmi2_real_t f[])
+    {
+        auto &lane = _lanes[k];
+        auto n = _sys.size();
+        lane.status = fmi2_status_ok;
+        std::copy(x, x + n, lane.xp.begin());
+        for (auto c = k; c < _coloring.colors; c += _lanes.size()) {
+            auto first = _coloring.columns.begin() + _coloring.color_start[c];
+            auto last
+                = _coloring.columns.begin() + _coloring.color_start[c + 1];
+            for (auto it = first; it != last; ++it) {
+                auto j = *it;
+                lane.xp[j] = x[j] + fd_perturbation(x[j], _nominal[j]);
+                lane.delta[j] = lane.xp[j] - x[j];
+            }
+            auto s = lane.sys.derivatives(t, lane.xp.data(), lane.f1.data());
+            lane.status = std::max(lane.status, s);
+            if (_failed(s)) {
+                return;
+            }
+            for (auto it = first; it != last; ++it) {
+                auto j = *it;
+                for (auto l = _csc.row_start[j]; l < _csc.row_start[j + 1];
+                     ++l) {
+                    auto i = _csc.columns[l];
+                    _values[_csc_pos[l]] = (lane.f1[i] - f[i]) / lane.delta[j];
+                }
+                lane.xp[j] = x[j];
+            }
+        }
+    }
+
+public:
+    /**
+     * @param sys system of the main instance
+     * @param workers additional instances, one thread each
+     * @param dependencies use the derivative dependencies of the FMU,
+     * otherwise the pattern is dense
+     */
+    parallel_fd_jacobian_t(me_system_t<model_t> &sys,
+                           const std::vector<model_t *> &workers,
+                           bool dependencies = true)
+        : _sys{sys}, _workers{sys.model(), workers}
+    {
+        auto n = sys.size();
+        _lanes.reserve(workers.size() + 1);
+        _lanes.emplace_back(sys.model());
+        for (auto w : workers) {
+            _lanes.emplace_back(*w);
+        }
+        for (auto &lane : _lanes) {
+            lane.xp.resize(n);
+            lane.f1.resize(n);
+            lane.delta.resize(n);
+        }
+        _pattern = dependencies && n > 0
+                       ? derivatives_sparsity(sys.model())
+                       : sparsity_pattern_t::dense(n, n);
+        _csc = _pattern.transpose(&_csc_pos);
+        _coloring = column_coloring_t::greedy(_pattern);
+        _values.resize(_pattern.nnz());
+        _f0.resize(n);
+        _nominal.resize(n);
+        if (auto s = sys.nominals(_nominal.data()); _failed(s)) {
+            throw std::runtime_error("Failed to get nominal values");
+        }
+    }
+
+    parallel_fd_jacobian_t(const parallel_fd_jacobian_t &) = delete;
+    parallel_fd_jacobian_t &operator=(const parallel_fd_jacobian_t &) = delete;
+
+    /**
+     * @brief Main instance plus workers
+     */
+    size_t lanes() const noexcept
+    {
+        return _lanes.size();
+    }
+
+    const sparsity_pattern_t &pattern() const noexcept
+    {
+        return _pattern;
+    }
+
+    const column_coloring_t &coloring() const noexcept
+    {
+        return _coloring;
+    }
+
+    /**
+     * @brief Nonzero values, aligned with `pattern().columns`
+     */
+    const std::vector<fmi2_real_t> &values() const noexcept
+    {
+        return _values;
+    }
+
+    /**
+     * @brief Evaluate the nonzeros at (t, x)
+     *
+     * @param f derivatives at (t, x) if known, saves one evaluation
+     *
+     * The main instance holds (t, x) on return.
+     */
+    fmi2_status_t evaluate(fmi2_real_t t, const fmi2_real_t x[],
+                           const fmi2_real_t f[] = nullptr)
+    {
+        ++_sys.stats.jacobian_evaluations;
+        if (f == nullptr) {
+            if (auto s = _sys.derivatives(t, x, _f0.data()); _failed(s)) {
+                return s;
+            }
+            f = _f0.data();
+        }
+        if (auto s = _sys.set_point(t, x); _failed(s)) {
+            return s;
+        }
+        if (auto s = _workers.synchronize(); _failed(s)) {
+            return s;
+        }
+        for (size_t k = 1; k < _lanes.size(); ++k) {
+            _lanes[k].sys.invalidate();
+        }
+
+        run_lanes(_lanes.size(), [&](size_t k) { _run(k, t, x, f); });
+
+        auto status = fmi2_status_ok;
+        for (auto &lane : _lanes) {
+            _sys.stats.derivative_evaluations
+                += lane.sys.stats.derivative_evaluations;
+            lane.sys.stats.reset();
+            status = std::max(status, lane.status);
+        }
+        if (_failed(status)) {
+            return status;
+        }
+        return std::max(status, _sys.set_point(t, x));
+    }
+
+    /**
+     * @brief Evaluate `jac` (row-major) at (t, x), see dense_jacobian_t
+     */
+    fmi2_status_t evaluate(fmi2_real_t t, const fmi2_real_t x[],
+                           const fmi2_real_t f[], fmi2_real_t jac[])
+    {
+        auto s = evaluate(t, x, f);
+        if (!_failed(s)) {
+            to_dense(jac);
+        }
+        return s;
+    }
+
+    /**
+     * @brief Scatter the nonzeros into a row-major dense matrix
+     */
+    void to_dense(fmi2_real_t jac[]) const
+    {
+        fmilib::to_dense(_pattern, _values, jac);
+    }
+};
+} // namespace fmilib
@@ -0,0 +1,673 @@
+/*
+ *   Copyright (c) 2018, Hang Yu
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ *   * Neither the name of  nor the names of its contributors may be used to
+ *   endorse or promote products derived from this software without specific
+ *   prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *   ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *   LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *   CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *   SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *   INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *   CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *   ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <istream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <fmilib.hpp>
+
+namespace fmilib
+{
+/**
+ * @brief On-disk layout of a binary parameter set file
+ *
+ * The file starts with this header followed by the GUID, the value
+ * reference tables of the real, integer and boolean columns and the value
+ * rows. Values are stored scenario by scenario so that one scenario of one
+ * type is a contiguous array that can be handed to `set_real`,
+ * `set_integer` and `set_boolean` as is. All sections start at 8-byte
+ * aligned offsets and use the native byte order.
+ */
+struct parameter_set_header_t
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t guid_size;
+    uint64_t file_size;
+    uint64_t scenarios;
+    uint64_t n_real;
+    uint64_t n_integer;
+    uint64_t n_boolean;
+    uint64_t guid_offset;
+    uint64_t real_vr_offset;
+    uint64_t integer_vr_offset;
+    uint64_t boolean_vr_offset;
+    uint64_t real_value_offset;
+    uint64_t integer_value_offset;
+    uint64_t boolean_value_offset;
+
+    static constexpr char magic_value[8] = {'F', 'M', 'I', 'P',
+                                            'S', 'E', 'T', '\0'};
+    static constexpr uint32_t version_value = 1;
+};
+
+/**
+ * @brief Read-only memory-mapped binary parameter set
+ *
+ * The file is mapped once and scenarios are applied straight from the
+ * mapped pages, without copying or parsing.
+ */
+class parameter_set_t
+{
+private:
+    const char *_data = nullptr;
+    size_t _size = 0;
+#ifdef _WIN32
+    HANDLE _file = INVALID_HANDLE_VALUE;
+    HANDLE _mapping = nullptr;
+#endif
+
+    const parameter_set_header_t &_header() const noexcept
+    {
+        return *reinterpret_cast<const parameter_set_header_t *>(_data);
+    }
+
+    template <typename T>
+    const T *_at(uint64_t offset) const noexcept
+    {
+        return reinterpret_cast<const T *>(_data + offset);
+    }
+
+    void _unmap() noexcept
+    {
+#ifdef _WIN32
+        if (_data) UnmapViewOfFile(_data);
+        if (_mapping) CloseHandle(_mapping);
+        if (_file != INVALID_HANDLE_VALUE) CloseHandle(_file);
+        _mapping = nullptr;
+        _file = INVALID_HANDLE_VALUE;
+#else
+        if (_data) munmap(const_cast<char *>(_data), _size);
+#endif
+        _data = nullptr;
+        _size = 0;
+    }
+
+    void _map(const std::string &path)
+    {
+#ifdef _WIN32
+        _file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                            nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                            nullptr);
+        if (_file == INVALID_HANDLE_VALUE) {
+            throw std::runtime_error("Failed to open parameter set " + path);
+        }
+        LARGE_INTEGER sz;
+        if (!GetFileSizeEx(_file, &sz) || sz.QuadPart == 0) {
+            _unmap();
+            throw std::runtime_error("Failed to stat parameter set " + path);
+        }
+        _size = static_cast<size_t>(sz.QuadPart);
+        _mapping
+            = CreateFileMappingA(_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!_mapping) {
+            _unmap();
+            throw std::runtime_error("Failed to map parameter set " + path);
+        }
+        _data = static_cast<const char *>(
+            MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0));
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("Failed to open parameter set " + path);
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) {
+            ::close(fd);
+            throw std::runtime_error("Failed to stat parameter set " + path);
+        }
+        _size = static_cast<size_t>(st.st_size);
+        void *p = mmap(nullptr, _size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        _data = p == MAP_FAILED ? nullptr : static_cast<const char *>(p);
+#endif
+        if (!_data) {
+            _unmap();
+            throw std::runtime_error("Failed to map parameter set " + path);
+        }
+    }
+
+    bool _section_valid(uint64_t offset, uint64_t count,
+                        uint64_t item_size) const noexcept
+    {
+        return offset % 8 == 0 && offset <= _size
+               && (item_size == 0 || count <= (_size - offset) / item_size);
+    }
+
+    void _validate(const std::string &path)
+    {
+        // the header is only readable once the file is known to hold it
+        if (_size < sizeof(parameter_set_header_t)) {
+            _unmap();
+            throw std::runtime_error("Invalid parameter set file " + path);
+        }
+        auto &h = _header();
+        auto s = h.scenarios;
+        bool valid
+            = std::memcmp(h.magic, parameter_set_header_t::magic_value,
+                          sizeof(h.magic))
+                  == 0
+              && h.version == parameter_set_header_t::version_value
+              && h.file_size == _size
+              && _section_valid(h.guid_offset,
+                                static_cast<uint64_t>(h.guid_size) + 1, 1)
+              && _section_valid(h.real_vr_offset, h.n_real,
+                                sizeof(fmi2_value_reference_t))
+              && _section_valid(h.integer_vr_offset, h.n_integer,
+                                sizeof(fmi2_value_reference_t))
+              && _section_valid(h.boolean_vr_offset, h.n_boolean,
+                                sizeof(fmi2_value_reference_t))
+              && (s == 0
+                  || (h.n_real <= _size / s
+                      && _section_valid(h.real_value_offset, h.n_real * s,
+                                        sizeof(fmi2_real_t))
+                      && h.n_integer <= _size / s
+                      && _section_valid(h.integer_value_offset,
+                                        h.n_integer * s,
+                                        sizeof(fmi2_integer_t))
+                      && h.n_boolean <= _size / s
+                      && _section_valid(h.boolean_value_offset,
+                                        h.n_boolean * s,
+                                        sizeof(fmi2_boolean_t))));
+        if (!valid) {
+            _unmap();
+            throw std::runtime_error("Invalid parameter set file " + path);
+        }
+    }
+
+public:
+    parameter_set_t() = delete;
+
+    /**
+     * @brief Map a parameter set file
+     *
+     * @param[in] path file written by `parameter_set_builder_t::write`
+     */
+    explicit parameter_set_t(const std::string &path)
+    {
+        _map(path);
+        _validate(path);
+    }
+
+    parameter_set_t(parameter_set_t const &) = delete;
+    parameter_set_t &operator=(parameter_set_t const &) = delete;
+
+    parameter_set_t(parameter_set_t &&m) noexcept
+    {
+        *this = std::move(m);
+    }
+
+    parameter_set_t &operator=(parameter_set_t &&m) noexcept
+    {
+        if (this != &m) {
+            _unmap();
+            std::swap(_data, m._data);
+            std::swap(_size, m._size);
+#ifdef _WIN32
+            std::swap(_file, m._file);
+            std::swap(_mapping, m._mapping);
+#endif
+        }
+        return *this;
+    }
+
+    ~parameter_set_t()
+    {
+        _unmap();
+    }
+
+    std::string_view guid() const noexcept
+    {
+        return {_at<char>(_header().guid_offset), _header().guid_size};
+    }
+
+    /**
+     * @brief Check if the parameter set was written for `fmu`
+     */
+    template <typename fmu_t>
+    bool matches(const fmu_t &fmu) const noexcept
+    {
+        auto g = fmu.GUID();
+        return g != nullptr && guid() == g;
+    }
+
+    size_t scenarios() const noexcept
+    {
+        return static_cast<size_t>(_header().scenarios);
+    }
+
+    size_t number_of_reals() const noexcept
+    {
+        return static_cast<size_t>(_header().n_real);
+    }
+
+    size_t number_of_integers() const noexcept
+    {
+        return static_cast<size_t>(_header().n_integer);
+    }
+
+    size_t number_of_booleans() const noexcept
+    {
+        return static_cast<size_t>(_header().n_boolean);
+    }
+
+    const fmi2_value_reference_t *real_vrs() const noexcept
+    {
+        return _at<fmi2_value_reference_t>(_header().real_vr_offset);
+    }
+
+    const fmi2_value_reference_t *integer_vrs() const noexcept
+    {
+        return _at<fmi2_value_reference_t>(_header().integer_vr_offset);
+    }
+
+    const fmi2_value_reference_t *boolean_vrs() const noexcept
+    {
+        return _at<fmi2_value_reference_t>(_header().boolean_vr_offset);
+    }
+
+    const fmi2_real_t *real_values(size_t scenario) const noexcept
+    {
+        assert(scenario < scenarios());
+        return _at<fmi2_real_t>(_header().real_value_offset)
+               + scenario * number_of_reals();
+    }
+
+    const fmi2_integer_t *integer_values(size_t scenario) const noexcept
+    {
+        assert(scenario < scenarios());
+        return _at<fmi2_integer_t>(_header().integer_value_offset)
+               + scenario * number_of_integers();
+    }
+
+    const fmi2_boolean_t *boolean_values(size_t scenario) const noexcept
+    {
+        assert(scenario < scenarios());
+        return _at<fmi2_boolean_t>(_header().boolean_value_offset)
+               + scenario * number_of_booleans();
+    }
+
+    /**
+     * @brief Apply one scenario to `fmu`
+     *
+     * Values are passed to the FMU directly from the mapped file. Returns
+     * `fmi2_status_error` if the GUID does not match or the scenario does
+     * not exist, otherwise the worst status of the set calls.
+     */
+    template <typename fmu_t>
+    fmi2_status_t apply(fmu_t &fmu, size_t scenario) const noexcept
+    {
+        if (scenario >= scenarios() || !matches(fmu)) {
+            return fmi2_status_error;
+        }
+        auto status = fmi2_status_ok;
+        if (number_of_reals() > 0) {
+            status = std::max(status, fmu.set_real(real_vrs(),
+                                                   number_of_reals(),
+                                                   real_values(scenario)));
+        }
+        if (number_of_integers() > 0) {
+            status = std::max(status,
+                              fmu.set_integer(integer_vrs(),
+                                              number_of_integers(),
+                                              integer_values(scenario)));
+        }
+        if (number_of_booleans() > 0) {
+            status = std::max(status,
+                              fmu.set_boolean(boolean_vrs(),
+                                              number_of_booleans(),
+                                              boolean_values(scenario)));
+        }
+        return status;
+    }
+};
+
+/**
+ * @brief Assembles a binary parameter set and writes it to disk
+ *
+ * Columns (value references) are declared first, then scenarios are added
+ * row by row.
+ */
+class parameter_set_builder_t
+{
+private:
+    std::string _guid;
+    std::vector<fmi2_value_reference_t> _real_vrs, _integer_vrs, _boolean_vrs;
+    std::vector<fmi2_real_t> _reals;
+    std::vector<fmi2_integer_t> _integers;
+    std::vector<fmi2_boolean_t> _booleans;
+    size_t _scenarios = 0;
+
+    static uint64_t _align(uint64_t offset) noexcept
+    {
+        return (offset + 7) & ~uint64_t(7);
+    }
+
+    static bool _parse_boolean(const std::string &s, fmi2_boolean_t &value)
+    {
+        if (s == "true" || s == "1") {
+            value = fmi2_true;
+        } else if (s == "false" || s == "0") {
+            value = fmi2_false;
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    static std::string _trim(const std::string &s)
+    {
+        auto b = s.find_first_not_of(" \t\r\"");
+        if (b == std::string::npos) {
+            return {};
+        }
+        auto e = s.find_last_not_of(" \t\r\"");
+        return s.substr(b, e - b + 1);
+    }
+
+    static std::vector<std::string> _split(const std::string &line)
+    {
+        std::vector<std::string> cells;
+        std::stringstream ss{line};
+        std::string cell;
+        while (std::getline(ss, cell, ',')) {
+            cells.push_back(_trim(cell));
+        }
+        return cells;
+    }
+
+public:
+    parameter_set_builder_t() = delete;
+
+    explicit parameter_set_builder_t(std::string guid)
+        : _guid{std::move(guid)}
+    {
+    }
+
+    void add_real(fmi2_value_reference_t vr)
+    {
+        assert(_scenarios == 0);
+        _real_vrs.push_back(vr);
+    }
+
+    void add_integer(fmi2_value_reference_t vr)
+    {
+        assert(_scenarios == 0);
+        _integer_vrs.push_back(vr);
+    }
+
+    void add_boolean(fmi2_value_reference_t vr)
+    {
+        assert(_scenarios == 0);
+        _boolean_vrs.push_back(vr);
+    }
+
+    /**
+     * @brief Append one scenario
+     *
+     * Each array holds one value per declared column of its type and may be
+     * null if there is no column of that type.
+     */
+    void add_scenario(const fmi2_real_t reals[],
+                      const fmi2_integer_t integers[],
+                      const fmi2_boolean_t booleans[])
+    {
+        _reals.insert(_reals.end(), reals, reals + _real_vrs.size());
+        _integers.insert(_integers.end(), integers,
+                         integers + _integer_vrs.size());
+        _booleans.insert(_booleans.end(), booleans,
+                         booleans + _boolean_vrs.size());
+        ++_scenarios;
+    }
+
+    size_t scenarios() const noexcept
+    {
+        return _scenarios;
+    }
+
+    /**
+     * @brief Write the parameter set file, throws on I/O errors
+     */
+    void write(const std::string &path) const
+    {
+        parameter_set_header_t h{};
+        std::memcpy(h.magic, parameter_set_header_t::magic_value,
+                    sizeof(h.magic));
+        h.version = parameter_set_header_t::version_value;
+        h.guid_size = static_cast<uint32_t>(_guid.size());
+        h.scenarios = _scenarios;
+        h.n_real = _real_vrs.size();
+        h.n_integer = _integer_vrs.size();
+        h.n_boolean = _boolean_vrs.size();
+
+        constexpr auto vr_size = sizeof(fmi2_value_reference_t);
+        h.guid_offset = _align(sizeof(parameter_set_header_t));
+        h.real_vr_offset = _align(h.guid_offset + _guid.size() + 1);
+        h.integer_vr_offset = _align(h.real_vr_offset + h.n_real * vr_size);
+        h.boolean_vr_offset
+            = _align(h.integer_vr_offset + h.n_integer * vr_size);
+        h.real_value_offset
+            = _align(h.boolean_vr_offset + h.n_boolean * vr_size);
+        h.integer_value_offset = _align(h.real_value_offset
+                                        + _reals.size() * sizeof(fmi2_real_t));
+        h.boolean_value_offset
+            = _align(h.integer_value_offset
+                     + _integers.size() * sizeof(fmi2_integer_t));
+        h.file_size = _align(h.boolean_value_offset
+                             + _booleans.size() * sizeof(fmi2_boolean_t));
+
+        std::vector<char> buffer(static_cast<size_t>(h.file_size), '\0');
+        auto put = [&buffer](uint64_t offset, const void *data, size_t n) {
+            if (n > 0) {
+                std::memcpy(buffer.data() + offset, data, n);
+            }
+        };
+        put(0, &h, sizeof(h));
+        put(h.guid_offset, _guid.data(), _guid.size());
+        put(h.real_vr_offset, _real_vrs.data(), _real_vrs.size() * vr_size);
+        put(h.integer_vr_offset, _integer_vrs.data(),
+            _integer_vrs.size() * vr_size);
+        put(h.boolean_vr_offset, _boolean_vrs.data(),
+            _boolean_vrs.size() * vr_size);
+        put(h.real_value_offset, _reals.data(),
+            _reals.size() * sizeof(fmi2_real_t));
+        put(h.integer_value_offset, _integers.data(),
+            _integers.size() * sizeof(fmi2_integer_t));
+        put(h.boolean_value_offset, _booleans.data(),
+            _booleans.size() * sizeof(fmi2_boolean_t));
+
+        std::ofstream out{path, std::ios::binary | std::ios::trunc};
+        out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        if (!out) {
+            throw std::runtime_error("Failed to write parameter set " + path);
+        }
+    }
+
+    /**
+     * @brief Single scenario holding the start values of all parameters
+     */
+    template <typename fmu_t>
+    static parameter_set_builder_t from_start_values(const fmu_t &fmu)
+    {
+        parameter_set_builder_t b{fmu.GUID()};
+        std::vector<fmi2_real_t> reals;
+        std::vector<fmi2_integer_t> integers;
+        std::vector<fmi2_boolean_t> booleans;
+
+        auto vl = fmu.variable_list(0);
+        if (!vl) {
+            throw std::runtime_error("Failed to get variable list");
+        }
+        for (size_t i = 0; i < vl.value().size(); ++i) {
+            auto v = vl.value()[i];
+            if (!v || v.value().causality() != fmi2_causality_enu_parameter
+                || !v.value().has_start()) {
+                continue;
+            }
+            auto p = v.value().c_ptr();
+            switch (v.value().base_type()) {
+                case fmi2_base_type_real:
+                    b.add_real(v.value().vr());
+                    reals.push_back(fmi2_import_get_real_variable_start(
+                        fmi2_import_get_variable_as_real(p)));
+                    break;
+                case fmi2_base_type_int:
+                    b.add_integer(v.value().vr());
+                    integers.push_back(fmi2_import_get_integer_variable_start(
+                        fmi2_import_get_variable_as_integer(p)));
+                    break;
+                case fmi2_base_type_enum:
+                    b.add_integer(v.value().vr());
+                    integers.push_back(fmi2_import_get_enum_variable_start(
+                        fmi2_import_get_variable_as_enum(p)));
+                    break;
+                case fmi2_base_type_bool:
+                    b.add_boolean(v.value().vr());
+                    booleans.push_back(fmi2_import_get_boolean_variable_start(
+                        fmi2_import_get_variable_as_boolean(p)));
+                    break;
+                default: /* strings are not part of parameter sets */
+                    break;
+            }
+        }
+        b.add_scenario(reals.data(), integers.data(), booleans.data());
+        return b;
+    }
+
+    /**
+     * @brief Parse a CSV parameter study
+     *
+     * The first row holds variable names, every following row is one
+     * scenario. Names are resolved against the model description of `fmu`;
+     * throws if a name is unknown, a variable is a string or a value cannot
+     * be parsed.
+     */
+    template <typename fmu_t>
+    static parameter_set_builder_t from_csv(const fmu_t &fmu, std::istream &in)
+    {
+        parameter_set_builder_t b{fmu.GUID()};
+        std::string line;
+        if (!std::getline(in, line)) {
+            throw std::runtime_error("Empty parameter set CSV");
+        }
+
+        // column -> (base type, index within the typed row)
+        std::vector<std::pair<fmi2_base_type_enu_t, size_t>> columns;
+        for (auto &name : _split(line)) {
+            auto v = fmu.get_variable_by_name(name);
+            if (!v) {
+                throw std::runtime_error("Unknown variable " + name);
+            }
+            switch (auto t = v.value().base_type(); t) {
+                case fmi2_base_type_real:
+                    columns.emplace_back(t, b._real_vrs.size());
+                    b.add_real(v.value().vr());
+                    break;
+                case fmi2_base_type_int:
+                case fmi2_base_type_enum:
+                    columns.emplace_back(fmi2_base_type_int,
+                                         b._integer_vrs.size());
+                    b.add_integer(v.value().vr());
+                    break;
+                case fmi2_base_type_bool:
+                    columns.emplace_back(t, b._boolean_vrs.size());
+                    b.add_boolean(v.value().vr());
+                    break;
+                default:
+                    throw std::runtime_error("Unsupported variable type of "
+                                             + name);
+            }
+        }
+
+        std::vector<fmi2_real_t> reals(b._real_vrs.size());
+        std::vector<fmi2_integer_t> integers(b._integer_vrs.size());
+        std::vector<fmi2_boolean_t> booleans(b._boolean_vrs.size());
+        while (std::getline(in, line)) {
+            if (_trim(line).empty()) {
+                continue;
+            }
+            auto cells = _split(line);
+            if (cells.size() != columns.size()) {
+                throw std::runtime_error("Wrong number of values in row "
+                                         + std::to_string(b._scenarios + 2));
+            }
+            for (size_t c = 0; c < cells.size(); ++c) {
+                auto &cell = cells[c];
+                char *end = nullptr;
+                bool ok = !cell.empty();
+                switch (auto [type, index] = columns[c]; type) {
+                    case fmi2_base_type_real:
+                        reals[index] = std::strtod(cell.c_str(), &end);
+                        ok = ok && *end == '\0';
+                        break;
+                    case fmi2_base_type_int:
+                        integers[index] = static_cast<fmi2_integer_t>(
+                            std::strtol(cell.c_str(), &end, 10));
+                        ok = ok && *end == '\0';
+                        break;
+                    default:
+                        ok = ok && _parse_boolean(cell, booleans[index]);
+                        break;
+                }
+                if (!ok) {
+                    throw std::runtime_error("Invalid value '" + cell
+                                             + "' in row "
+                                             + std::to_string(b._scenarios + 2));
+                }
+            }
+            b.add_scenario(reals.data(), integers.data(), booleans.data());
+        }
+        return b;
+    }
+};
+} // namespace fmilib
@@ -0,0 +1,459 @@
+/*
+ *   Copyright (c) 2018, Hang Yu
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ *   * Neither the name of  nor the names of its contributors may be used to
+ *   endorse or promote products derived from this software without specific
+ *   prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *   ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *   LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *   CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *   SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *   INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *   CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *   ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include <fmilib/dopri45.hpp>
+#include <fmilib/event_driver.hpp>
+#include <fmilib/integrator.hpp>
+#include <fmilib/lanes.hpp>
+
+namespace fmilib
+{
+/**
+ * @brief Parareal parallel-in-time simulation of a ModelExchange FMU on
+ * worker instances
+ *
+ * [t0, t_end] is cut into slices. A coarse sweep on the main instance
+ * with a fixed-step explicit method predicts the states at the slice
+ * boundaries, then every iteration
+ *
+ * - integrates the open slices with the fine tolerance in parallel, one
+ *   thread per instance (run_lanes), and
+ * - corrects the boundaries sequentially, `U[j + 1] = G(U[j]) + F - G`
+ *   with the coarse result G of the previous iteration.
+ *
+ * After iteration k the first k slices are exact, so the result never
+ * needs more iterations than slices; it converges once no boundary moves
+ * by more than the tolerance in the fine error norm. The coarse step is
+ * fixed because the correction relies on G being a smooth function of
+ * the boundary states, which step size control breaks; it must be
+ * stable for the model.
+ *
+ * Both propagators run inside event_driver_t. A slice starts from the
+ * FMU state, and so the discrete states, at the end of the fine run of
+ * the slice before it, serialized and restored into whichever instance
+ * takes the slice; only the continuous states are replaced by the
+ * corrected ones. The main instance must support `canGetAndSetFMUstate`
+ * and `canSerializeFMUstate`, the workers are checked by check_worker.
+ *
+ * @tparam driver_t fine propagator, dopri45_integrator_t,
+ * bdf_integrator_t or another driver constructible from
+ * `(model_t &, rtol)`
+ */
+template <typename model_t,
+          template <typename> class driver_t = dopri45_integrator_t>
+class parareal_t
+{
+private:
+    template <typename propagator_t> struct lane_t
+    {
+        model_t &m;
+        propagator_t driver;
+        event_driver_t<propagator_t> events;
+        fmi2_FMU_state_t state = nullptr;
+        fmi2_status_t status = fmi2_status_ok;
+
+        template <typename... args_t>
+        explicit lane_t(model_t &model, args_t... args)
+            : m{model}, driver{model, args...}, events{driver}
+        {
+        }
+    };
+
+    using fine_lane_t = lane_t<driver_t<model_t>>;
+    using coarse_lane_t = lane_t<fixed_step_integrator_t<model_t>>;
+
+    /* serialized FMU state and next time event at a slice boundary */
+    struct seed_t
+    {
+        std::vector<fmi2_byte_t> bytes;
+        fmi2_real_t t_next = 0.0;
+    };
+
+    std::vector<std::unique_ptr<fine_lane_t>> _lanes;
+    /* coarse propagator on the main instance */
+    std::unique_ptr<coarse_lane_t> _coarse;
+    fmi2_real_t _rtol;
+    fmi2_real_t _tol = 1.0;
+    size_t _max_iter = 0;
+    size_t _iterations = 0;
+    fmi2_real_t _change = 0.0;
+
+    std::vector<fmi2_real_t> _times, _atol, _x;
+    /* boundary states U, fine and coarse results of every slice */
+    std::vector<std::vector<fmi2_real_t>> _u, _f, _g;
+    /* boundary seeds of the current and the next iteration */
+    std::vector<seed_t> _seed, _fine_seed;
+
+    static bool _failed(fmi2_status_t s) noexcept
+    {
+        return s > fmi2_status_warning;
+    }
+
+    template <typename lane_type>
+    static fmi2_status_t _save(lane_type &lane, seed_t &seed)
+    {
+        seed.t_next = lane.events.next_event_time();
+        return save_fmu_state(lane.m, lane.state, seed.bytes);
+    }
+
+    /* restore `seed` and restart at `t` from the states `x` */
+    template <typename lane_type>
+    static fmi2_status_t _load(lane_type &lane, const seed_t &seed,
+                               fmi2_real_t t, const fmi2_real_t x[])
+    {
+        if (auto s = load_fmu_state(lane.m, lane.state, seed.bytes);
+            _failed(s)) {
+            return s;
+        }
+        return lane.events.restart(t, x, seed.t_next);
+    }
+
+    /* integrate a slice from where the lane was loaded to `t_end`; a
+     * slice must not end the simulation */
+    template <typename lane_type>
+    static fmi2_status_t _propagate(lane_type &lane, fmi2_real_t t_end,
+                                    std::vector<fmi2_real_t> &x)
+    {
+        auto s = lane.events.integrate(t_end);
+        if (_failed(s)) {
+            return s;
+        }
+        if (lane.events.terminated()) {
+            return fmi2_status_error;
+        }
+        x = lane.driver.states();
+        return s;
+    }
+
+    fmi2_real_t _norm(const std::vector<fmi2_real_t> &a,
+                      const std::vector<fmi2_real_t> &b) const
+    {
+        fmi2_real_t sum = 0.0;
+        auto n = a.size();
+        for (size_t i = 0; i < n; ++i) {
+            auto sc = _atol[i] + _rtol * std::abs(b[i]);
+            auto r = (a[i] - b[i]) / sc;
+            sum += r * r;
+        }
+        return n ? std::sqrt(sum / n) : 0.0;
+    }
+
+    /* fine runs of the slices from `first` on, dealt round-robin */
+    fmi2_status_t _fine(size_t first)
+    {
+        auto slices = _f.size();
+        auto run = [&](size_t k) {
+            auto &lane = *_lanes[k];
+            lane.status = fmi2_status_ok;
+            for (auto j = first + k; j < slices; j += _lanes.size()) {
+                auto s = _load(lane, _seed[j], _times[j], _u[j].data());
+                if (!_failed(s)) {
+                    s = std::max(s, _propagate(lane, _times[j + 1], _f[j]));
+                }
+                if (!_failed(s)) {
+                    s = std::max(s, _save(lane, _fine_seed[j + 1]));
+                }
+                lane.status = std::max(lane.status, s);
+                if (_failed(s)) {
+                    return;
+                }
+            }
+        };
+        run_lanes(_lanes.size(), run);
+        auto status = fmi2_status_ok;
+        for (auto &lane : _lanes) {
+            status = std::max(status, lane->status);
+        }
+        return status;
+    }
+
+public:
+    /**
+     * @param m main instance, also runs the coarse sweeps
+     * @param workers additional instances, one thread each
+     * @param h_coarse step size of the coarse propagator
+     * @param rtol relative tolerance of the fine propagator, defaults to
+     * the default experiment tolerance of the FMU
+     * @param coarse_method method of the coarse propagator
+     */
+    parareal_t(model_t &m, const std::vector<model_t *> &workers,
+               fmi2_real_t h_coarse, fmi2_real_t rtol = 0.0,
+               explicit_method_t coarse_method = explicit_method_t::rk4)
+        : _rtol{rtol > 0.0 ? rtol : m.default_experiment_tolerance()}
+    {
+        if (!m.capability(fmi2_me_canGetAndSetFMUstate)
+            || !m.capability(fmi2_me_canSerializeFMUstate)) {
+            throw std::runtime_error(
+                "Parareal needs to get, set and serialize the FMU state");
+        }
+        _lanes.reserve(workers.size() + 1);
+        _lanes.push_back(std::make_unique<fine_lane_t>(m, _rtol));
+        for (auto w : workers) {
+            check_worker(m, *w);
+            _lanes.push_back(std::make_unique<fine_lane_t>(*w, _rtol));
+        }
+        _coarse = std::make_unique<coarse_lane_t>(m, coarse_method, h_coarse);
+        _atol.resize(m.number_of_continuous_states());
+    }
+
+    parareal_t(const parareal_t &) = delete;
+    parareal_t &operator=(const parareal_t &) = delete;
+
+    ~parareal_t()
+    {
+        for (auto &lane : _lanes) {
+            if (lane->state) {
+                lane->m.free_fmu_state(&lane->state);
+            }
+        }
+        if (_coarse->state) {
+            _coarse->m.free_fmu_state(&_coarse->state);
+        }
+    }
+
+    /**
+     * @brief Main instance plus workers
+     */
+    size_t lanes() const noexcept
+    {
+        return _lanes.size();
+    }
+
+    /**
+     * @brief Converged when no boundary moves by more than `tol` in the
+     * fine error norm; `max_iterations` 0 allows as many iterations as
+     * slices
+     */
+    void set_tolerance(fmi2_real_t tol, size_t max_iterations = 0) noexcept
+    {
+        _tol = tol;
+        _max_iter = max_iterations;
+    }
+
+    /**
+     * @brief Run the initial event iteration at `t0`, see
+     * event_driver_t::initialize
+     */
+    fmi2_status_t initialize(fmi2_real_t t0)
+    {
+        return _coarse->events.initialize(t0);
+    }
+
+    /**
+     * @brief Restart at `t0` from the point the main instance holds in
+     * continuous time mode
+     *
+     * @param t_next next time event, if any
+     */
+    fmi2_status_t reset(fmi2_real_t t0,
+                        fmi2_real_t t_next
+                        = std::numeric_limits<fmi2_real_t>::infinity())
+    {
+        auto &sys = _coarse->driver.system();
+        sys.invalidate();
+        if (auto s = sys.set_time(t0); _failed(s)) {
+            return s;
+        }
+        std::vector<fmi2_real_t> x(sys.size());
+        if (auto s = sys.read_states(x.data()); _failed(s)) {
+            return s;
+        }
+        return _coarse->events.restart(t0, x.data(), t_next);
+    }
+
+    /**
+     * @brief Integrate from the current time to `t_end` in `slices` time
+     * slices, by default one per lane
+     *
+     * On return the main instance holds the end point, restored from the
+     * fine run of the last slice with the corrected states.
+     *
+     * @return fmi2_status_error if a slice ends the simulation or the
+     * iteration does not converge within the maximum number of
+     * iterations
+     */
+    fmi2_status_t integrate(fmi2_real_t t_end, size_t slices = 0)
+    {
+        auto &coarse = *_coarse;
+        auto t0 = coarse.driver.time();
+        slices = slices ? slices : _lanes.size();
+        _times.resize(slices + 1);
+        for (size_t j = 0; j <= slices; ++j) {
+            _times[j] = t0 + (t_end - t0) * static_cast<fmi2_real_t>(j)
+                                 / static_cast<fmi2_real_t>(slices);
+        }
+        _times[slices] = t_end;
+        _u.resize(slices + 1);
+        _f.resize(slices);
+        _g.resize(slices);
+        _seed.resize(slices + 1);
+        _fine_seed.resize(slices + 1);
+        _iterations = 0;
+        _change = 0.0;
+
+        auto &sys = coarse.driver.system();
+        if (auto s = sys.nominals(_atol.data()); _failed(s)) {
+            return s;
+        }
+        for (auto &a : _atol) {
+            a = _rtol * std::abs(a);
+        }
+
+        // coarse prediction, the seeds carry its discrete states
+        auto status = fmi2_status_ok;
+        _u[0] = coarse.driver.states();
+        if (auto s = _save(coarse, _seed[0]); _failed(s)) {
+            return s;
+        }
+        for (size_t j = 0; j < slices; ++j) {
+            auto s = _propagate(coarse, _times[j + 1], _g[j]);
+            if (!_failed(s)) {
+                s = std::max(s, _save(coarse, _seed[j + 1]));
+            }
+            status = std::max(status, s);
+            if (_failed(s)) {
+                return s;
+            }
+            _u[j + 1] = _g[j];
+        }
+
+        auto max_iter = _max_iter ? std::min(_max_iter, slices) : slices;
+        for (size_t done = 0;;) {
+            ++_iterations;
+            auto s = _fine(done);
+            status = std::max(status, s);
+            if (_failed(s)) {
+                return s;
+            }
+            for (auto j = done + 1; j <= slices; ++j) {
+                std::swap(_seed[j], _fine_seed[j]);
+            }
+            // the first open slice started from an exact boundary
+            _change = _norm(_f[done], _u[done + 1]);
+            _u[done + 1] = _f[done];
+            for (auto j = done + 1; j < slices; ++j) {
+                s = _load(coarse, _seed[j], _times[j], _u[j].data());
+                if (!_failed(s)) {
+                    s = std::max(s, _propagate(coarse, _times[j + 1], _x));
+                }
+                status = std::max(status, s);
+                if (_failed(s)) {
+                    return s;
+                }
+                for (size_t i = 0; i < _x.size(); ++i) {
+                    auto g = _x[i];
+                    _x[i] = g + _f[j][i] - _g[j][i];
+                    _g[j][i] = g;
+                }
+                _change = std::max(_change, _norm(_x, _u[j + 1]));
+                std::swap(_x, _u[j + 1]);
+            }
+            ++done;
+            if (_change <= _tol || done == slices) {
+                break;
+            }
+            if (_iterations >= max_iter) {
+                return fmi2_status_error;
+            }
+        }
+        auto s = _load(coarse, _seed[slices], t_end, _u[slices].data());
+        return std::max(status, s);
+    }
+
+    /**
+     * @brief Iterations of the last `integrate`
+     */
+    size_t iterations() const noexcept
+    {
+        return _iterations;
+    }
+
+    /**
+     * @brief Largest boundary change of the last iteration in the fine
+     * error norm
+     */
+    fmi2_real_t change() const noexcept
+    {
+        return _change;
+    }
+
+    fmi2_real_t time() const noexcept
+    {
+        return _coarse->driver.time();
+    }
+
+    const std::vector<fmi2_real_t> &states() const noexcept
+    {
+        return _coarse->driver.states();
+    }
+
+    /**
+     * @brief Slice boundaries of the last `integrate`
+     */
+    const std::vector<fmi2_real_t> &boundary_times() const noexcept
+    {
+        return _times;
+    }
+
+    /**
+     * @brief States at the slice boundaries
+     */
+    const std::vector<std::vector<fmi2_real_t>> &boundary_states() const
+        noexcept
+    {
+        return _u;
+    }
+
+    /**
+     * @brief Statistics of the fine propagators, summed over all lanes
+     */
+    integrator_stats_t stats() const
+    {
+        integrator_stats_t stats;
+        for (auto &lane : _lanes) {
+            stats += lane->driver.stats();
+        }
+        return stats;
+    }
+
+    const integrator_stats_t &coarse_stats() const noexcept
+    {
+        return _coarse->driver.stats();
+    }
+};
+} // namespace fmilib
@@ -0,0 +1,629 @@
+/*
+ *   Copyright (c) 2018, Hang Yu
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ *   * Neither the name of  nor the names of its contributors may be used to
+ *   endorse or promote products derived from this software without specific
+ *   prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *   ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *   LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *   CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *   SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *   INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *   CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *   ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+#include <fmilib/integrator.hpp>
+#include <fmilib/sparsity.hpp>
+
+namespace fmilib
+{
+/**
+ * @brief Smallest root `t > 0` of `c0 + c1 t + c2 t^2 + c3 t^3`, infinity
+ * if there is none
+ */
+inline fmi2_real_t smallest_positive_root(fmi2_real_t c0, fmi2_real_t c1,
+                                          fmi2_real_t c2, fmi2_real_t c3)
+{
+    constexpr auto inf = std::numeric_limits<fmi2_real_t>::infinity();
+    fmi2_real_t best = inf;
+    auto take = [&best](fmi2_real_t r) {
+        if (r > 0.0 && r < best) {
+            best = r;
+        }
+    };
+    if (c3 == 0.0) {
+        if (c2 == 0.0) {
+            if (c1 != 0.0) {
+                take(-c0 / c1);
+            }
+            return best;
+        }
+        auto disc = c1 * c1 - 4.0 * c2 * c0;
+        if (disc < 0.0) {
+            return best;
+        }
+        // avoid cancellation
+        auto q = -0.5 * (c1 + std::copysign(std::sqrt(disc), c1));
+        take(q / c2);
+        if (q != 0.0) {
+            take(c0 / q);
+        }
+        return best;
+    }
+    // depressed cubic t = y - a / 3
+    auto a = c2 / c3, b = c1 / c3, c = c0 / c3;
+    auto p = b - a * a / 3.0;
+    auto q = 2.0 * a * a * a / 27.0 - a * b / 3.0 + c;
+    auto shift = -a / 3.0;
+    auto disc = q * q / 4.0 + p * p * p / 27.0;
+    if (disc > 0.0) {
+        auto s = std::sqrt(disc);
+        take(std::cbrt(-q / 2.0 + s) + std::cbrt(-q / 2.0 - s) + shift);
+    } else if (p == 0.0) {
+        take(shift);
+    } else {
+        const auto pi = std::acos(-1.0);
+        auto r = 2.0 * std::sqrt(-p / 3.0);
+        auto arg = std::max(-1.0, std::min(1.0, 3.0 * q / (p * r)));
+        auto phi = std::acos(arg) / 3.0;
+        for (int k = 0; k < 3; ++k) {
+            take(r * std::cos(phi - 2.0 * pi * k / 3.0) + shift);
+        }
+    }
+    return best;
+}
+
+/**
+ * @brief Quantized state system driver (QSS2 or QSS3) for ModelExchange
+ * FMUs
+ *
+ * Every state advances on its own: its trajectory `x_i` is a polynomial
+ * of degree 2 (QSS2) or 3 (QSS3) and the FMU sees the quantized
+ * trajectory `q_i`, one degree lower. State `i` is requantized when
+ * `|x_i - q_i|` reaches its quantum `max(rtol * |x_i|, rtol * |nominal|)`;
+ * the requantization times sit in an indexed binary heap. Only the
+ * derivatives that depend on `x_i` (from the derivative dependencies) are
+ * updated, and only the states they depend on are refreshed in the state
+ * vector handed to the FMU.
+ *
+ * The time derivatives of `f` along the quantized trajectories come from
+ * finite differences in time: 2 derivative evaluations per
+ * requantization for QSS2, 4 for QSS3. One step is one requantization.
+ * If the FMU has event indicators or needs `completed_integrator_step`,
+ * the full state vector is handed over after every step so event_driver_t
+ * can locate events on `interpolate`; otherwise the FMU only ever holds
+ * the states the updated derivatives read. A step evaluates only the
+ * trajectories it changed, `states()` brings the others up to date.
+ */
+template <typename model_t> class qss_integrator_t
+{
+private:
+    /* trajectory of one state, x(t) = sum_k c[k] (t - t0)^k */
+    struct poly_t
+    {
+        fmi2_real_t t0 = 0.0;
+        fmi2_real_t c[4] = {};
+
+        fmi2_real_t operator()(fmi2_real_t t) const noexcept
+        {
+            auto s = t - t0;
+            return c[0] + s * (c[1] + s * (c[2] + s * c[3]));
+        }
+
+        /* re-expand around t */
+        void shift(fmi2_real_t t) noexcept
+        {
+            auto s = t - t0;
+            c[0] = c[0] + s * (c[1] + s * (c[2] + s * c[3]));
+            c[1] = c[1] + s * (2.0 * c[2] + 3.0 * s * c[3]);
+            c[2] = c[2] + 3.0 * s * c[3];
+            t0 = t;
+        }
+    };
+
+    /* undo record of a trajectory changed by the last step */
+    struct change_t
+    {
+        size_t i;
+        poly_t x;
+    };
+
+    me_system_t<model_t> _sys;
+    unsigned _order;
+    fmi2_real_t _rtol;
+    fmi2_real_t _dt_fd = 0.0;
+    fmi2_real_t _t = 0.0;
+    fmi2_real_t _t0 = 0.0;
+    fmi2_real_t _t_event = std::numeric_limits<fmi2_real_t>::infinity();
+    bool _sync;
+    bool _enter_event_mode = false;
+    bool _terminate = false;
+    sparsity_pattern_t _deps;
+    sparsity_pattern_t _influence;
+    std::vector<poly_t> _x_poly, _q_poly;
+    std::vector<fmi2_real_t> _quantum_min, _t_next;
+    /* FMU input and derivatives at t - dt, t, t + dt and again at t + dt
+     * after the requantization */
+    std::vector<fmi2_real_t> _xs, _fm, _f0, _fp, _fq;
+    /* x_i was last evaluated at _x_time[i], states() brings the rest up
+     * to _t on demand */
+    std::vector<fmi2_real_t> _x, _x_time;
+    std::vector<change_t> _changes;
+    std::vector<size_t> _requantized;
+    /* updated derivatives and the states they read */
+    std::vector<size_t> _rows, _cols;
+    std::vector<unsigned char> _row_mark, _col_mark;
+    /* indexed binary heap on _t_next */
+    std::vector<size_t> _heap, _pos;
+
+    static bool _failed(fmi2_status_t s) noexcept
+    {
+        return s > fmi2_status_warning;
+    }
+
+    bool _before(size_t a, size_t b) const noexcept
+    {
+        return _t_next[_heap[a]] < _t_next[_heap[b]];
+    }
+
+    void _swap(size_t a, size_t b) noexcept
+    {
+        std::swap(_heap[a], _heap[b]);
+        _pos[_heap[a]] = a;
+        _pos[_heap[b]] = b;
+    }
+
+    /* restore the heap order around state i after _t_next[i] changed */
+    void _reschedule(size_t i) noexcept
+    {
+        auto k = _pos[i];
+        while (k > 0 && _before(k, (k - 1) / 2)) {
+            _swap(k, (k - 1) / 2);
+            k = (k - 1) / 2;
+        }
+        for (;;) {
+            auto l = 2 * k + 1, r = l + 1, m = k;
+            if (l < _heap.size() && _before(l, m)) {
+                m = l;
+            }
+            if (r < _heap.size() && _before(r, m)) {
+                m = r;
+            }
+            if (m == k) {
+                break;
+            }
+            _swap(k, m);
+            k = m;
+        }
+    }
+
+    fmi2_real_t _quantum(size_t i) const noexcept
+    {
+        return std::max(_rtol * std::abs(_x_poly[i].c[0]), _quantum_min[i]);
+    }
+
+    /* next time |x_i - q_i| reaches the quantum, both expanded at _t */
+    fmi2_real_t _next_time(size_t i) const noexcept
+    {
+        auto x = _x_poly[i];
+        auto q = _q_poly[i];
+        x.shift(_t);
+        q.shift(_t);
+        fmi2_real_t d[4];
+        for (int k = 0; k < 4; ++k) {
+            d[k] = x.c[k] - q.c[k];
+        }
+        auto dq = _quantum(i);
+        if (std::abs(d[0]) >= dq) {
+            return _t;
+        }
+        auto up = smallest_positive_root(d[0] - dq, d[1], d[2], d[3]);
+        auto down = smallest_positive_root(d[0] + dq, d[1], d[2], d[3]);
+        return _t + std::min(up, down);
+    }
+
+    /* mark derivative rows and the state columns they read */
+    void _mark(size_t j)
+    {
+        if (_row_mark[j]) {
+            return;
+        }
+        _row_mark[j] = 1;
+        _rows.push_back(j);
+        for (auto k = _deps.row_start[j]; k < _deps.row_start[j + 1]; ++k) {
+            auto c = _deps.columns[k];
+            if (!_col_mark[c]) {
+                _col_mark[c] = 1;
+                _cols.push_back(c);
+            }
+        }
+    }
+
+    void _clear_marks() noexcept
+    {
+        for (auto j : _rows) {
+            _row_mark[j] = 0;
+        }
+        for (auto c : _cols) {
+            _col_mark[c] = 0;
+        }
+        _rows.clear();
+        _cols.clear();
+    }
+
+    /* marked derivatives at t with the quantized trajectories */
+    fmi2_status_t _derivatives(fmi2_real_t t, std::vector<fmi2_real_t> &f)
+    {
+        for (auto c : _cols) {
+            _xs[c] = _q_poly[c](t);
+        }
+        return _sys.derivatives(t, _xs.data(), f.data());
+    }
+
+    /* new trajectories of the marked derivatives at _t; the states in
+     * _requantized follow them with their quantized trajectories */
+    fmi2_status_t _update()
+    {
+        static const auto eps = std::numeric_limits<fmi2_real_t>::epsilon();
+        auto dt = _dt_fd > 0.0 ? _dt_fd
+                               : (_order == 2 ? std::sqrt(eps)
+                                              : std::pow(eps, 0.25))
+                                     * std::max(1.0, std::abs(_t));
+        for (auto j : _rows) {
+            _x_poly[j].shift(_t);
+        }
+        if (auto s = _derivatives(_t, _f0); _failed(s)) {
+            return s;
+        }
+        for (auto j : _rows) {
+            _x_poly[j].c[1] = _f0[j];
+        }
+        for (auto i : _requantized) {
+            _q_poly[i].c[1] = _f0[i];
+        }
+        if (auto s = _derivatives(_t + dt, _fp); _failed(s)) {
+            return s;
+        }
+        if (_order == 2) {
+            for (auto j : _rows) {
+                _x_poly[j].c[2] = 0.5 * (_fp[j] - _f0[j]) / dt;
+                _x_poly[j].c[3] = 0.0;
+            }
+        } else {
+            // the centered first difference does not see q_i''
+            if (auto s = _derivatives(_t - dt, _fm); _failed(s)) {
+                return s;
+            }
+            for (auto j : _rows) {
+                _x_poly[j].c[2] = 0.25 * (_fp[j] - _fm[j]) / dt;
+            }
+            for (auto i : _requantized) {
+                _q_poly[i].c[2] = _x_poly[i].c[2];
+            }
+            // the second difference does; shift both sides by the change
+            // at t + dt
+            if (auto s = _derivatives(_t + dt, _fq); _failed(s)) {
+                return s;
+            }
+            for (auto j : _rows) {
+                _x_poly[j].c[3]
+                    = (2.0 * _fq[j] - _fp[j] - 2.0 * _f0[j] + _fm[j])
+                      / (6.0 * dt * dt);
+            }
+        }
+        for (auto j : _rows) {
+            _t_next[j] = _next_time(j);
+            _reschedule(j);
+        }
+        return fmi2_status_ok;
+    }
+
+    /* start all trajectories at _t from _x */
+    fmi2_status_t _start()
+    {
+        auto n = _x.size();
+        _clear_marks();
+        _changes.clear();
+        _requantized.clear();
+        for (size_t i = 0; i < n; ++i) {
+            _requantized.push_back(i);
+            _x_poly[i] = poly_t{};
+            _x_poly[i].t0 = _t;
+            _x_poly[i].c[0] = _x[i];
+            _q_poly[i] = _x_poly[i];
+            _xs[i] = _x[i];
+            _mark(i);
+        }
+        auto s = _update();
+        _clear_marks();
+        return s;
+    }
+
+    void _refresh() noexcept
+    {
+        for (size_t i = 0; i < _x.size(); ++i) {
+            if (_x_time[i] != _t) {
+                _x[i] = _x_poly[i](_t);
+                _x_time[i] = _t;
+            }
+        }
+    }
+
+    /* update the states whose trajectories changed; the FMU only needs
+     * the full vector at _t for its indicators or completed steps */
+    fmi2_status_t _synchronize()
+    {
+        for (const auto &c : _changes) {
+            _x[c.i] = _x_poly[c.i](_t);
+            _x_time[c.i] = _t;
+        }
+        if (!_sync) {
+            return fmi2_status_ok;
+        }
+        _refresh();
+        if (auto s = _sys.set_point(_t, _x.data()); _failed(s)) {
+            return s;
+        }
+        return _sys.completed_step(_enter_event_mode, _terminate);
+    }
+
+public:
+    /**
+     * @param order 2 for QSS2 or 3 for QSS3
+     * @param rtol relative quantum, defaults to the default experiment
+     * tolerance of the FMU
+     */
+    explicit qss_integrator_t(model_t &m, unsigned order = 2,
+                              fmi2_real_t rtol = 0.0)
+        : _sys{m}, _order{order},
+          _rtol{rtol > 0.0 ? rtol : m.default_experiment_tolerance()},
+          _sync{m.number_of_event_indicators() > 0
+                || m.capability(fmi2_me_completedIntegratorStepNotNeeded)
+                       == 0}
+    {
+        if (order != 2 && order != 3) {
+            throw std::runtime_error("QSS order must be 2 or 3");
+        }
+        auto n = _sys.size();
+        _deps = n > 0 ? derivatives_sparsity(m) : sparsity_pattern_t{};
+        _influence = _deps.transpose();
+        _x_poly.resize(n);
+        _q_poly.resize(n);
+        for (auto *v :
+             {&_quantum_min, &_t_next, &_xs, &_fm, &_f0, &_fp, &_fq, &_x,
+              &_x_time}) {
+            v->resize(n);
+        }
+        _row_mark.resize(n);
+        _col_mark.resize(n);
+        _heap.resize(n);
+        _pos.resize(n);
+        for (size_t i = 0; i < n; ++i) {
+            _heap[i] = i;
+            _pos[i] = i;
+        }
+    }
+
+    unsigned order() const noexcept
+    {
+        return _order;
+    }
+
+    /**
+     * @brief Time offset of the finite differences along the quantized
+     * trajectories, defaults to `eps^(1/2)` (QSS2) or `eps^(1/4)` (QSS3)
+     * times `max(1, |t|)`
+     */
+    void set_difference_step(fmi2_real_t dt) noexcept
+    {
+        _dt_fd = dt;
+    }
+
+    /**
+     * @brief Start at `t`, reading states and nominals from the FMU
+     *
+     * The FMU must be in continuous time mode.
+     */
+    fmi2_status_t reset(fmi2_real_t t)
+    {
+        _sys.invalidate();
+        if (auto s = _sys.set_time(t); _failed(s)) {
+            return s;
+        }
+        if (auto s = _sys.read_states(_x.data()); _failed(s)) {
+            return s;
+        }
+        if (auto s = _sys.nominals(_quantum_min.data()); _failed(s)) {
+            return s;
+        }
+        for (auto &q : _quantum_min) {
+            q = _rtol * std::abs(q);
+        }
+        return reset(t, _x.data());
+    }
+
+    /**
+     * @brief Restart at `t` from states the caller already holds, keeping
+     * the nominals of the last `reset(t)`
+     */
+    fmi2_status_t reset(fmi2_real_t t, const fmi2_real_t x[])
+    {
+        _t = t;
+        _t0 = t;
+        _enter_event_mode = false;
+        _terminate = false;
+        std::copy(x, x + _x.size(), _x.begin());
+        std::fill(_x_time.begin(), _x_time.end(), t);
+        if (auto s = _start(); _failed(s)) {
+            return s;
+        }
+        // leave the FMU at the start point
+        _sys.invalidate();
+        return _sys.set_point(t, _x.data());
+    }
+
+    void set_next_time_event(fmi2_real_t t) noexcept
+    {
+        _t_event = t;
+    }
+
+    void clear_next_time_event() noexcept
+    {
+        _t_event = std::numeric_limits<fmi2_real_t>::infinity();
+    }
+
+    /**
+     * @brief Requantize the state with the earliest quantum crossing, or
+     * move to `t_stop` if it comes later
+     */
+    fmi2_status_t step(fmi2_real_t t_stop)
+    {
+        _changes.clear();
+        _t0 = _t;
+        if (_heap.empty() || _t_next[_heap.front()] > t_stop) {
+            _t = t_stop;
+            ++_sys.stats.steps;
+            return _synchronize();
+        }
+        auto i = _heap.front();
+        _t = std::max(_t, _t_next[i]);
+        _changes.push_back({i, _x_poly[i]});
+        _x_poly[i].shift(_t);
+        _q_poly[i] = _x_poly[i];
+        _q_poly[i].c[_order] = 0.0;
+        _mark(i);
+        for (auto k = _influence.row_start[i]; k < _influence.row_start[i + 1];
+             ++k) {
+            auto j = _influence.columns[k];
+            if (j != i) {
+                _changes.push_back({j, _x_poly[j]});
+            }
+            _mark(j);
+        }
+        _requantized.assign(1, i);
+        auto s = _update();
+        _clear_marks();
+        if (_failed(s)) {
+            return s;
+        }
+        ++_sys.stats.steps;
+        return _synchronize();
+    }
+
+    /**
+     * @brief Same as `step`, the entry point shared with the other drivers
+     */
+    fmi2_status_t advance(fmi2_real_t t_stop)
+    {
+        return step(t_stop);
+    }
+
+    /**
+     * @brief Integrate up to `t_end`, calling `observer(t, x)` after every
+     * requantization
+     */
+    template <typename observer_t = null_observer_t>
+    fmi2_status_t integrate(fmi2_real_t t_end, observer_t &&observer = {})
+    {
+        auto status = fmi2_status_ok;
+        auto t_stop = std::min(t_end, _t_event);
+        while (_t < t_stop && !_enter_event_mode && !_terminate) {
+            auto s = step(t_stop);
+            status = std::max(status, s);
+            if (_failed(s)) {
+                return s;
+            }
+            observer(_t, states());
+        }
+        return status;
+    }
+
+    /**
+     * @brief States at `t` within the last step
+     */
+    fmi2_status_t interpolate(fmi2_real_t t, fmi2_real_t x[]) const
+    {
+        for (size_t i = 0; i < _x_poly.size(); ++i) {
+            x[i] = _x_poly[i](t);
+        }
+        for (const auto &c : _changes) {
+            x[c.i] = c.x(t);
+        }
+        return fmi2_status_ok;
+    }
+
+    fmi2_real_t time() const noexcept
+    {
+        return _t;
+    }
+
+    /**
+     * @brief Time of the previous requantization
+     */
+    fmi2_real_t previous_time() const noexcept
+    {
+        return _t0;
+    }
+
+    /**
+     * @brief Time the state `i` is requantized next
+     */
+    fmi2_real_t next_time(size_t i) const noexcept
+    {
+        return _t_next[i];
+    }
+
+    /**
+     * @brief States at the current time, evaluated on the first call after
+     * a step
+     */
+    const std::vector<fmi2_real_t> &states() noexcept
+    {
+        _refresh();
+        return _x;
+    }
+
+    bool enter_event_mode() const noexcept
+    {
+        return _enter_event_mode;
+    }
+
+    bool terminate_simulation() const noexcept
+    {
+        return _terminate;
+    }
+
+    const integrator_stats_t &stats() const noexcept
+    {
+        return _sys.stats;
+    }
+
+    me_system_t<model_t> &system() noexcept
+    {
+        return _sys;
+    }
+};
+} // namespace fmilib
@@ -0,0 +1,358 @@
+/*
+ *   Copyright (c) 2018, Hang Yu
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ *   * Neither the name of  nor the names of its contributors may be used to
+ *   endorse or promote products derived from this software without specific
+ *   prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *   ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *   LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *   CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *   SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *   INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *   CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *   ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+#include <fmilib/integrator.hpp>
+
+namespace fmilib
+{
+/**
+ * @brief Right-hand side `J s + df/dp_k` of the forward sensitivity
+ * equations of a ModelExchange FMU with respect to real parameters
+ *
+ * `p_k` is a real input or a tunable parameter. FMI 2.0 lets inputs be
+ * set and seeded in continuous time mode: with directional derivatives
+ * an evaluation is one `get_directional_derivative` call seeded with `s`
+ * on the states and 1 on the input, otherwise one forward difference
+ * along `(s, 1)`. Parameters are only writable in event mode and are no
+ * known of the continuous-time partial derivatives, so `df/dp_k` comes
+ * from a forward difference with the perturbation bracketed by
+ * me_system_t::set_in_event_mode, and is kept until (t, x) changes. `J s`
+ * is then a directional derivative seeded on the states only, or a
+ * forward difference along `s`.
+ *
+ * The event iteration of that bracket runs at Newton trial points that
+ * a driver may still reject. If the FMU can get and set its state, the
+ * state saved before the perturbation is restored after it, so no
+ * discrete state changes stick; otherwise parameters of an FMU with
+ * event indicators throw std::runtime_error.
+ */
+template <typename model_t> class parameter_sensitivity_t
+{
+private:
+    me_system_t<model_t> &_sys;
+    bool _directional;
+    std::vector<fmi2_value_reference_t> _p_vr, _seed_vr, _dx_vr;
+    std::vector<unsigned char> _input;
+    std::vector<fmi2_real_t> _p, _nominal, _seed, _xp, _f0, _f1;
+    /* df/dp_k of the parameters at (_t_col, _x_col) */
+    std::vector<std::vector<fmi2_real_t>> _columns;
+    std::vector<unsigned char> _column_valid;
+    std::vector<fmi2_real_t> _x_col;
+    fmi2_real_t _t_col = std::numeric_limits<fmi2_real_t>::quiet_NaN();
+    bool _restore;
+    fmi2_FMU_state_t _state = nullptr;
+
+    /* forward difference of f along (s, 1 on input k), skipping the
+     * input if k is past the end */
+    fmi2_status_t _difference(fmi2_real_t t, const fmi2_real_t x[],
+                              const fmi2_real_t f[], size_t k,
+                              const fmi2_real_t s[], fmi2_real_t out[])
+    {
+        auto n = _sys.size();
+        // perturb every state and the input by at most sqrt(eps)
+        // relative to its magnitude
+        static const auto sqrt_eps
+            = std::sqrt(std::numeric_limits<fmi2_real_t>::epsilon());
+        auto tiny = std::numeric_limits<fmi2_real_t>::min();
+        auto ratio = k < _p.size() ? 1.0 / std::max(std::abs(_p[k]), tiny)
+                                   : 0.0;
+        for (size_t i = 0; i < n; ++i) {
+            ratio = std::max(ratio, std::abs(s[i])
+                                        / std::max({std::abs(x[i]),
+                                                    std::abs(_nominal[i]),
+                                                    tiny}));
+        }
+        if (ratio == 0.0) {
+            std::fill(out, out + n, 0.0);
+            return fmi2_status_ok;
+        }
+        auto delta = sqrt_eps / ratio;
+        for (size_t i = 0; i < n; ++i) {
+            _xp[i] = x[i] + delta * s[i];
+        }
+        auto status = fmi2_status_ok;
+        if (k < _p.size()) {
+            auto p = _p[k] + delta;
+            status = _sys.model().set_real(&_p_vr[k], 1, &p);
+        }
+        if (status <= fmi2_status_warning) {
+            status = std::max(status,
+                              _sys.derivatives(t, _xp.data(), _f1.data()));
+        }
+        // restore the input even if the evaluation failed
+        if (k < _p.size()) {
+            status = std::max(status,
+                              _sys.model().set_real(&_p_vr[k], 1, &_p[k]));
+        }
+        if (status > fmi2_status_warning) {
+            return status;
+        }
+        for (size_t i = 0; i < n; ++i) {
+            out[i] = (_f1[i] - f[i]) / delta;
+        }
+        return status;
+    }
+
+    /* df/dp_k of parameter k at (t, x) unless it is still valid, which
+     * moves the FMU away from (t, x) */
+    fmi2_status_t _column(fmi2_real_t t, const fmi2_real_t x[],
+                          const fmi2_real_t f[], size_t k)
+    {
+        auto n = _sys.size();
+        if (_column_valid[k]) {
+            return fmi2_status_ok;
+        }
+        static const auto sqrt_eps
+            = std::sqrt(std::numeric_limits<fmi2_real_t>::epsilon());
+        auto delta = sqrt_eps * (_p[k] != 0.0 ? std::abs(_p[k]) : 1.0);
+        auto &m = _sys.model();
+        if (_restore) {
+            if (auto s = m.get_fmu_state(&_state); s > fmi2_status_warning) {
+                return s;
+            }
+        }
+        auto p = _p[k] + delta;
+        auto status = _sys.set_in_event_mode(&_p_vr[k], 1, &p);
+        if (status <= fmi2_status_warning) {
+            status = std::max(status, _sys.derivatives(t, x, _f1.data()));
+        }
+        // undo the event iteration, or at least the parameter, even if
+        // the evaluation failed
+        if (_restore) {
+            status = std::max(status, m.set_fmu_state(_state));
+            _sys.invalidate();
+        } else {
+            status = std::max(status,
+                              _sys.set_in_event_mode(&_p_vr[k], 1, &_p[k]));
+        }
+        if (status > fmi2_status_warning) {
+            return status;
+        }
+        auto &c = _columns[k];
+        for (size_t i = 0; i < n; ++i) {
+            c[i] = (_f1[i] - f[i]) / delta;
+        }
+        _column_valid[k] = 1;
+        return status;
+    }
+
+public:
+    /**
+     * @param sys system to differentiate
+     * @param parameters value references of real inputs or tunable
+     * parameters
+     * @param directional use directional derivatives if the FMU
+     * provides them
+     */
+    parameter_sensitivity_t(me_system_t<model_t> &sys,
+                            std::vector<fmi2_value_reference_t> parameters,
+                            bool directional = true)
+        : _sys{sys}, _p_vr{std::move(parameters)}
+    {
+        auto &m = sys.model();
+        auto n = sys.size();
+        _directional
+            = directional
+              && m.capability(fmi2_me_providesDirectionalDerivatives) != 0;
+        if (_directional) {
+            auto x_vr = m.state_vrs();
+            auto dx = m.derivative_list();
+            if (!x_vr || !dx || x_vr.value().size() != n
+                || dx.value().size() != n) {
+                throw std::runtime_error(
+                    "Failed to get state and derivative value references");
+            }
+            _seed_vr = x_vr.value();
+            _seed_vr.push_back(0);
+            _dx_vr = dx.value().vrs();
+        }
+        _p.resize(_p_vr.size());
+        _input.resize(_p_vr.size());
+        _restore = m.capability(fmi2_me_canGetAndSetFMUstate) != 0;
+        for (size_t k = 0; k < _p_vr.size(); ++k) {
+            _input[k] = sys.is_input(_p_vr[k]);
+            if (!_input[k] && !_restore
+                && m.number_of_event_indicators() > 0) {
+                throw std::runtime_error(
+                    "Parameter sensitivities of an FMU with event "
+                    "indicators need canGetAndSetFMUstate");
+            }
+        }
+        _columns.assign(_p_vr.size(), std::vector<fmi2_real_t>(n));
+        _column_valid.resize(_p_vr.size());
+        _x_col.resize(n);
+        _seed.resize(n + 1);
+        _xp.resize(n);
+        _f0.resize(n);
+        _f1.resize(n);
+        _nominal.resize(n);
+        if (auto s = sys.nominals(_nominal.data()); s > fmi2_status_warning) {
+            throw std::runtime_error("Failed to get nominal values");
+        }
+        if (auto s = read_parameters(); s > fmi2_status_warning) {
+            throw std::runtime_error("Failed to get parameter values");
+        }
+    }
+
+    parameter_sensitivity_t(const parameter_sensitivity_t &) = delete;
+    parameter_sensitivity_t &operator=(const parameter_sensitivity_t &)
+        = delete;
+
+    ~parameter_sensitivity_t()
+    {
+        if (_state) {
+            _sys.model().free_fmu_state(&_state);
+        }
+    }
+
+    bool directional() const noexcept
+    {
+        return _directional;
+    }
+
+    /**
+     * @brief Number of parameters
+     */
+    size_t size() const noexcept
+    {
+        return _p_vr.size();
+    }
+
+    const std::vector<fmi2_value_reference_t> &parameters() const noexcept
+    {
+        return _p_vr;
+    }
+
+    /**
+     * @brief Parameter values, as of the last `read_parameters`
+     */
+    const std::vector<fmi2_real_t> &values() const noexcept
+    {
+        return _p;
+    }
+
+    /**
+     * @brief Read the parameter values from the FMU, e.g. after they
+     * were changed
+     */
+    fmi2_status_t read_parameters()
+    {
+        _t_col = std::numeric_limits<fmi2_real_t>::quiet_NaN();
+        return _p.empty() ? fmi2_status_ok
+                          : _sys.model().get_real(_p_vr.data(), _p_vr.size(),
+                                                  _p.data());
+    }
+
+    /**
+     * @brief Evaluate `out = J s + df/dp_k` at (t, x)
+     *
+     * @param f derivatives at (t, x) if known, saves one evaluation for
+     * finite differences
+     *
+     * The FMU holds (t, x) on return.
+     */
+    fmi2_status_t evaluate(fmi2_real_t t, const fmi2_real_t x[],
+                           const fmi2_real_t f[], size_t k,
+                           const fmi2_real_t s[], fmi2_real_t out[])
+    {
+        auto n = _sys.size();
+        ++_sys.stats.sensitivity_evaluations;
+        if (auto st = _sys.set_point(t, x); st > fmi2_status_warning) {
+            return st;
+        }
+        if (_directional && _input[k]) {
+            std::copy(s, s + n, _seed.begin());
+            _seed[n] = 1.0;
+            _seed_vr[n] = _p_vr[k];
+            return _sys.model().get_directional_derivative(
+                _seed_vr.data(), n + 1, _dx_vr.data(), n, _seed.data(), out);
+        }
+
+        if (!_input[k]
+            && (t != _t_col || !std::equal(x, x + n, _x_col.begin()))) {
+            _t_col = t;
+            std::copy(x, x + n, _x_col.begin());
+            std::fill(_column_valid.begin(), _column_valid.end(), 0);
+        }
+        auto status = fmi2_status_ok;
+        if (f == nullptr
+            && (_input[k] || !_directional || !_column_valid[k])) {
+            // the FMU holds (t, x)
+            status = _sys.derivatives(_f0.data());
+            if (status > fmi2_status_warning) {
+                return status;
+            }
+            f = _f0.data();
+        }
+        if (_input[k]) {
+            auto st = _difference(t, x, f, k, s, out);
+            if (st > fmi2_status_warning) {
+                return st;
+            }
+            return std::max({status, st, _sys.set_point(t, x)});
+        }
+
+        auto st = _column(t, x, f, k);
+        if (st > fmi2_status_warning) {
+            return st;
+        }
+        status = std::max(status, st);
+        // J s, leaving the FMU at (t, x)
+        if (_directional) {
+            st = _sys.set_point(t, x);
+            if (st <= fmi2_status_warning) {
+                st = std::max(st, _sys.model().get_directional_derivative(
+                                      _seed_vr.data(), n, _dx_vr.data(), n,
+                                      s, out));
+            }
+        } else {
+            st = _difference(t, x, f, _p.size(), s, out);
+            if (st <= fmi2_status_warning) {
+                st = std::max(st, _sys.set_point(t, x));
+            }
+        }
+        if (st > fmi2_status_warning) {
+            return st;
+        }
+        const auto &c = _columns[k];
+        for (size_t i = 0; i < n; ++i) {
+            out[i] += c[i];
+        }
+        return std::max(status, st);
+    }
+};
+} // namespace fmilib
@@ -0,0 +1,646 @@
+/*
+ *   Copyright (c) 2018, Hang Yu
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ *   * Neither the name of  nor the names of its contributors may be used to
+ *   endorse or promote products derived from this software without specific
+ *   prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *   ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *   LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *   CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *   SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *   INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *   CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *   ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+#include <limits>
+#include <set>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include <fmilib/sparsity.hpp>
+
+namespace fmilib
+{
+/**
+ * @brief Sparse LU factorization in the manner of KLU
+ *
+ * `analyze` runs once per pattern:
+ *
+ * - a maximum transversal (Duff's MC21) puts a structurally nonzero
+ *   entry on every diagonal position;
+ * - Tarjan's strongly connected components permute the matrix to block
+ *   lower triangular form, only the diagonal blocks are factorized;
+ * - every block is ordered by minimum degree on the pattern of
+ *   B + B^T, with exact degrees on the elimination graph instead of
+ *   the approximate ones of AMD.
+ *
+ * `factor` is a left-looking Gilbert-Peierls factorization of each block
+ * with threshold partial pivoting that prefers the diagonal. `refactor`
+ * reuses its pivot order and the patterns of L and U, which is all an
+ * implicit integrator needs between Jacobian updates; it falls back to
+ * `factor` when a reused pivot turns too small.
+ *
+ * Values are aligned with `pattern().columns`, as those of
+ * sparse_jacobian_t.
+ */
+class sparse_lu_t
+{
+private:
+    static constexpr size_t _none = std::numeric_limits<size_t>::max();
+    static constexpr double _pivot_tolerance = 1e-3;
+
+    size_t _n = 0;
+    sparsity_pattern_t _pattern;
+    /* position p of the permuted matrix is row _row[p] and column _col[p]
+     * of the original one */
+    std::vector<size_t> _row, _col;
+    std::vector<size_t> _block_start{0};
+    std::vector<size_t> _block_of;
+    /* diagonal blocks of the permuted matrix by column: permuted row and
+     * position of the value */
+    std::vector<size_t> _a_start, _a_row, _a_pos;
+    /* entries left of the diagonal blocks by permuted row */
+    std::vector<size_t> _f_start, _f_col, _f_pos;
+    std::vector<double> _f_val;
+    /* L without its unit diagonal and U without its diagonal by column,
+     * rows are permuted rows; U columns are kept in topological order */
+    std::vector<size_t> _l_start{0}, _l_row, _u_start{0}, _u_row;
+    std::vector<double> _l_val, _u_val, _diag;
+    /* pivot position of every permuted row and the row of every pivot */
+    std::vector<size_t> _pinv, _piv_row;
+    bool _factored = false;
+    std::vector<double> _x;
+    std::vector<size_t> _mark, _stack, _cursor, _reach;
+    std::vector<double> _c, _z;
+
+    /* column matched to every row, _none if structurally singular */
+    std::vector<size_t> _transversal() const
+    {
+        const auto &p = _pattern;
+        std::vector<size_t> row_match(_n, _none), col_match(_n, _none);
+        std::vector<size_t> visited(_n, _none), cursor(_n), stack;
+        // cheap assignment first
+        for (size_t i = 0; i < _n; ++i) {
+            for (auto k = p.row_start[i]; k < p.row_start[i + 1]; ++k) {
+                auto j = p.columns[k];
+                if (col_match[j] == _none) {
+                    col_match[j] = i;
+                    row_match[i] = j;
+                    break;
+                }
+            }
+        }
+        // augmenting paths by depth-first search
+        for (size_t i0 = 0; i0 < _n; ++i0) {
+            if (row_match[i0] != _none) {
+                continue;
+            }
+            stack.assign(1, i0);
+            cursor[i0] = p.row_start[i0];
+            auto found = _none;
+            while (!stack.empty() && found == _none) {
+                auto i = stack.back();
+                if (cursor[i] == p.row_start[i + 1]) {
+                    stack.pop_back();
+                    continue;
+                }
+                auto j = p.columns[cursor[i]++];
+                if (visited[j] == i0) {
+                    continue;
+                }
+                visited[j] = i0;
+                if (col_match[j] == _none) {
+                    found = j;
+                } else {
+                    auto r = col_match[j];
+                    cursor[r] = p.row_start[r];
+                    stack.push_back(r);
+                }
+            }
+            if (found == _none) {
+                continue;
+            }
+            // every row on the stack but i0 was reached through the
+            // column it is matched to
+            auto j = found;
+            for (auto s = stack.size(); s-- > 0;) {
+                auto r = stack[s];
+                auto released = row_match[r];
+                row_match[r] = j;
+                col_match[j] = r;
+                j = released;
+            }
+        }
+        // structurally singular: pair the leftovers, factor will fail
+        size_t free_col = 0;
+        for (size_t i = 0; i < _n; ++i) {
+            if (row_match[i] != _none) {
+                continue;
+            }
+            while (col_match[free_col] != _none) {
+                ++free_col;
+            }
+            col_match[free_col] = i;
+            row_match[i] = free_col;
+        }
+        return row_match;
+    }
+
+    /* strongly connected components of row i -> row k, where row k is
+     * matched to a column of row i; emitted dependencies first */
+    std::vector<std::vector<size_t>>
+    _components(const std::vector<size_t> &row_match) const
+    {
+        const auto &p = _pattern;
+        std::vector<size_t> row_of(_n);
+        for (size_t i = 0; i < _n; ++i) {
+            row_of[row_match[i]] = i;
+        }
+        std::vector<size_t> index(_n, _none), low(_n), cursor(_n);
+        std::vector<size_t> stack, call;
+        std::vector<bool> on_stack(_n, false);
+        std::vector<std::vector<size_t>> components;
+        size_t next = 0;
+        for (size_t root = 0; root < _n; ++root) {
+            if (index[root] != _none) {
+                continue;
+            }
+            call.assign(1, root);
+            index[root] = low[root] = next++;
+            cursor[root] = p.row_start[root];
+            stack.push_back(root);
+            on_stack[root] = true;
+            while (!call.empty()) {
+                auto i = call.back();
+                if (cursor[i] < p.row_start[i + 1]) {
+                    auto k = row_of[p.columns[cursor[i]++]];
+                    if (index[k] == _none) {
+                        index[k] = low[k] = next++;
+                        cursor[k] = p.row_start[k];
+                        stack.push_back(k);
+                        on_stack[k] = true;
+                        call.push_back(k);
+                    } else if (on_stack[k]) {
+                        low[i] = std::min(low[i], index[k]);
+                    }
+                    continue;
+                }
+                call.pop_back();
+                if (!call.empty()) {
+                    low[call.back()] = std::min(low[call.back()], low[i]);
+                }
+                if (low[i] == index[i]) {
+                    components.emplace_back();
+                    size_t k;
+                    do {
+                        k = stack.back();
+                        stack.pop_back();
+                        on_stack[k] = false;
+                        components.back().push_back(k);
+                    } while (k != i);
+                }
+            }
+        }
+        return components;
+    }
+
+    /* minimum degree order of the rows of one block on B + B^T */
+    std::vector<size_t>
+    _minimum_degree(const std::vector<size_t> &rows,
+                    const std::vector<size_t> &local,
+                    const std::vector<size_t> &row_of) const
+    {
+        auto nb = rows.size();
+        if (nb <= 2) {
+            return rows;
+        }
+        const auto &p = _pattern;
+        std::vector<std::vector<size_t>> adj(nb);
+        for (size_t a = 0; a < nb; ++a) {
+            auto i = rows[a];
+            for (auto k = p.row_start[i]; k < p.row_start[i + 1]; ++k) {
+                auto b = local[row_of[p.columns[k]]];
+                if (b != _none && b != a) {
+                    adj[a].push_back(b);
+                    adj[b].push_back(a);
+                }
+            }
+        }
+        std::set<std::pair<size_t, size_t>> queue;
+        for (size_t a = 0; a < nb; ++a) {
+            std::sort(adj[a].begin(), adj[a].end());
+            adj[a].erase(std::unique(adj[a].begin(), adj[a].end()),
+                         adj[a].end());
+            queue.emplace(adj[a].size(), a);
+        }
+        std::vector<size_t> order, merged;
+        order.reserve(nb);
+        while (!queue.empty()) {
+            auto v = queue.begin()->second;
+            queue.erase(queue.begin());
+            order.push_back(rows[v]);
+            // the neighbours of v become a clique
+            auto nv = std::move(adj[v]);
+            for (auto u : nv) {
+                queue.erase({adj[u].size(), u});
+                merged.clear();
+                std::set_union(adj[u].begin(), adj[u].end(), nv.begin(),
+                               nv.end(), std::back_inserter(merged));
+                adj[u].clear();
+                for (auto w : merged) {
+                    if (w != u && w != v) {
+                        adj[u].push_back(w);
+                    }
+                }
+                queue.emplace(adj[u].size(), u);
+            }
+        }
+        return order;
+    }
+
+    /* rows reachable from the pattern of column q through the columns of
+     * L computed so far, in topological order at the end of _reach */
+    size_t _reach_from(size_t q)
+    {
+        _reach.clear();
+        for (auto k = _a_start[q]; k < _a_start[q + 1]; ++k) {
+            auto r0 = _a_row[k];
+            if (_mark[r0] == q) {
+                continue;
+            }
+            _stack.assign(1, r0);
+            _mark[r0] = q;
+            _cursor[r0] = _pinv[r0] == _none ? 0 : _l_start[_pinv[r0]];
+            while (!_stack.empty()) {
+                auto r = _stack.back();
+                auto col = _pinv[r];
+                if (col != _none && _cursor[r] < _l_start[col + 1]) {
+                    auto child = _l_row[_cursor[r]++];
+                    if (_mark[child] != q) {
+                        _mark[child] = q;
+                        _cursor[child]
+                            = _pinv[child] == _none ? 0
+                                                    : _l_start[_pinv[child]];
+                        _stack.push_back(child);
+                    }
+                    continue;
+                }
+                _stack.pop_back();
+                _reach.push_back(r);
+            }
+        }
+        std::reverse(_reach.begin(), _reach.end());
+        return _reach.size();
+    }
+
+    void _gather_off_diagonal(const double values[])
+    {
+        for (size_t k = 0; k < _f_pos.size(); ++k) {
+            _f_val[k] = values[_f_pos[k]];
+        }
+    }
+
+public:
+    sparse_lu_t() = default;
+
+    explicit sparse_lu_t(const sparsity_pattern_t &pattern)
+    {
+        analyze(pattern);
+    }
+
+    /**
+     * @brief Heuristic for callers that can choose between dense_lu_t and
+     * sparse_lu_t
+     */
+    static bool preferred(const sparsity_pattern_t &pattern) noexcept
+    {
+        return pattern.rows >= 64
+               && 8 * pattern.nnz() <= pattern.rows * pattern.cols;
+    }
+
+    /**
+     * @brief Symbolic analysis of a square pattern
+     */
+    void analyze(const sparsity_pattern_t &pattern)
+    {
+        if (pattern.rows != pattern.cols) {
+            throw std::invalid_argument("sparse_lu_t needs a square pattern");
+        }
+        _pattern = pattern;
+        _n = pattern.rows;
+        _factored = false;
+        auto row_match = _transversal();
+        auto components = _components(row_match);
+
+        std::vector<size_t> row_of(_n), local(_n, _none);
+        for (size_t i = 0; i < _n; ++i) {
+            row_of[row_match[i]] = i;
+        }
+        _row.clear();
+        _block_start.assign(1, 0);
+        for (const auto &rows : components) {
+            for (size_t a = 0; a < rows.size(); ++a) {
+                local[rows[a]] = a;
+            }
+            auto order = _minimum_degree(rows, local, row_of);
+            _row.insert(_row.end(), order.begin(), order.end());
+            _block_start.push_back(_row.size());
+            for (auto i : rows) {
+                local[i] = _none;
+            }
+        }
+        _col.resize(_n);
+        _block_of.resize(_n);
+        std::vector<size_t> pos_of_row(_n), pos_of_col(_n);
+        for (size_t b = 0; b + 1 < _block_start.size(); ++b) {
+            for (auto q = _block_start[b]; q < _block_start[b + 1]; ++q) {
+                _block_of[q] = b;
+            }
+        }
+        for (size_t q = 0; q < _n; ++q) {
+            _col[q] = row_match[_row[q]];
+            pos_of_row[_row[q]] = q;
+            pos_of_col[_col[q]] = q;
+        }
+
+        // split into the diagonal blocks by column and the rest by row
+        _a_start.assign(_n + 1, 0);
+        _f_start.assign(_n + 1, 0);
+        for (size_t i = 0; i < _n; ++i) {
+            auto p = pos_of_row[i];
+            for (auto k = pattern.row_start[i]; k < pattern.row_start[i + 1];
+                 ++k) {
+                auto q = pos_of_col[pattern.columns[k]];
+                if (_block_of[p] == _block_of[q]) {
+                    ++_a_start[q + 1];
+                } else {
+                    ++_f_start[p + 1];
+                }
+            }
+        }
+        for (size_t q = 0; q < _n; ++q) {
+            _a_start[q + 1] += _a_start[q];
+            _f_start[q + 1] += _f_start[q];
+        }
+        _a_row.resize(_a_start[_n]);
+        _a_pos.resize(_a_start[_n]);
+        _f_col.resize(_f_start[_n]);
+        _f_pos.resize(_f_start[_n]);
+        _f_val.resize(_f_start[_n]);
+        std::vector<size_t> a_next(_a_start.begin(), _a_start.end() - 1);
+        std::vector<size_t> f_next(_f_start.begin(), _f_start.end() - 1);
+        for (size_t i = 0; i < _n; ++i) {
+            auto p = pos_of_row[i];
+            for (auto k = pattern.row_start[i]; k < pattern.row_start[i + 1];
+                 ++k) {
+                auto q = pos_of_col[pattern.columns[k]];
+                if (_block_of[p] == _block_of[q]) {
+                    auto dst = a_next[q]++;
+                    _a_row[dst] = p;
+                    _a_pos[dst] = k;
+                } else {
+                    auto dst = f_next[p]++;
+                    _f_col[dst] = q;
+                    _f_pos[dst] = k;
+                }
+            }
+        }
+
+        _x.assign(_n, 0.0);
+        _mark.assign(_n, _none);
+        _cursor.resize(_n);
+        _c.resize(_n);
+        _z.resize(_n);
+        _diag.resize(_n);
+        _pinv.resize(_n);
+        _piv_row.resize(_n);
+    }
+
+    /**
+     * @brief Factorize with fresh pivoting
+     *
+     * @retval false the matrix is singular
+     */
+    bool factor(const double values[])
+    {
+        _factored = false;
+        _gather_off_diagonal(values);
+        _l_start.assign(1, 0);
+        _u_start.assign(1, 0);
+        _l_row.clear();
+        _l_val.clear();
+        _u_row.clear();
+        _u_val.clear();
+        std::fill(_pinv.begin(), _pinv.end(), _none);
+        std::fill(_mark.begin(), _mark.end(), _none);
+        for (size_t q = 0; q < _n; ++q) {
+            _reach_from(q);
+            for (auto k = _a_start[q]; k < _a_start[q + 1]; ++k) {
+                _x[_a_row[k]] = values[_a_pos[k]];
+            }
+            // sparse triangular solve with the columns of L so far
+            for (auto r : _reach) {
+                auto col = _pinv[r];
+                if (col == _none) {
+                    continue;
+                }
+                auto xr = _x[r];
+                for (auto k = _l_start[col]; k < _l_start[col + 1]; ++k) {
+                    _x[_l_row[k]] -= _l_val[k] * xr;
+                }
+            }
+            // threshold partial pivoting, the diagonal wins ties
+            auto piv = _none;
+            double max = 0.0;
+            for (auto r : _reach) {
+                if (_pinv[r] == _none && std::abs(_x[r]) > max) {
+                    max = std::abs(_x[r]);
+                    piv = r;
+                }
+            }
+            if (!(max > 0.0) || !std::isfinite(max)) {
+                for (auto r : _reach) {
+                    _x[r] = 0.0;
+                }
+                return false;
+            }
+            if (_pinv[q] == _none && _mark[q] == q
+                && std::abs(_x[q]) >= _pivot_tolerance * max) {
+                piv = q;
+            }
+            _pinv[piv] = q;
+            _piv_row[q] = piv;
+            _diag[q] = _x[piv];
+            for (auto r : _reach) {
+                if (_pinv[r] == _none) {
+                    _l_row.push_back(r);
+                    _l_val.push_back(_x[r] / _diag[q]);
+                } else if (r != piv) {
+                    _u_row.push_back(r);
+                    _u_val.push_back(_x[r]);
+                }
+                _x[r] = 0.0;
+            }
+            _l_start.push_back(_l_row.size());
+            _u_start.push_back(_u_row.size());
+        }
+        _factored = true;
+        return true;
+    }
+
+    bool factor(const std::vector<double> &values)
+    {
+        return factor(values.data());
+    }
+
+    /**
+     * @brief Factorize new values on the pivot order and the patterns of
+     * the last successful `factor`, falling back to it if a pivot is too
+     * small or there is none yet
+     *
+     * @retval false the matrix is singular
+     */
+    bool refactor(const double values[])
+    {
+        if (!_factored) {
+            return factor(values);
+        }
+        _gather_off_diagonal(values);
+        for (size_t q = 0; q < _n; ++q) {
+            for (auto k = _a_start[q]; k < _a_start[q + 1]; ++k) {
+                _x[_a_row[k]] = values[_a_pos[k]];
+            }
+            for (auto k = _u_start[q]; k < _u_start[q + 1]; ++k) {
+                auto r = _u_row[k];
+                auto xr = _u_val[k] = _x[r];
+                _x[r] = 0.0;
+                auto col = _pinv[r];
+                for (auto l = _l_start[col]; l < _l_start[col + 1]; ++l) {
+                    _x[_l_row[l]] -= _l_val[l] * xr;
+                }
+            }
+            auto piv = _piv_row[q];
+            auto d = _x[piv];
+            _x[piv] = 0.0;
+            double max = 0.0;
+            for (auto k = _l_start[q]; k < _l_start[q + 1]; ++k) {
+                max = std::max(max, std::abs(_x[_l_row[k]]));
+            }
+            if (!std::isfinite(d) || !(std::abs(d) > 0.0)
+                || std::abs(d) < _pivot_tolerance * max) {
+                for (auto k = _l_start[q]; k < _l_start[q + 1]; ++k) {
+                    _x[_l_row[k]] = 0.0;
+                }
+                return factor(values);
+            }
+            _diag[q] = d;
+            for (auto k = _l_start[q]; k < _l_start[q + 1]; ++k) {
+                _l_val[k] = _x[_l_row[k]] / d;
+                _x[_l_row[k]] = 0.0;
+            }
+        }
+        return true;
+    }
+
+    bool refactor(const std::vector<double> &values)
+    {
+        return refactor(values.data());
+    }
+
+    /**
+     * @brief Solve A x = b in place
+     *
+     * Works in scratch space of the factorization, so threads solving
+     * with the same factors need copies of it.
+     */
+    void solve(double b[])
+    {
+        for (size_t p = 0; p < _n; ++p) {
+            _c[p] = b[_row[p]];
+        }
+        for (size_t blk = 0; blk + 1 < _block_start.size(); ++blk) {
+            auto lo = _block_start[blk], hi = _block_start[blk + 1];
+            for (auto p = lo; p < hi; ++p) {
+                auto sum = _c[p];
+                for (auto k = _f_start[p]; k < _f_start[p + 1]; ++k) {
+                    sum -= _f_val[k] * _z[_f_col[k]];
+                }
+                _z[_pinv[p]] = sum;
+            }
+            for (auto q = lo; q < hi; ++q) {
+                auto zq = _z[q];
+                for (auto k = _l_start[q]; k < _l_start[q + 1]; ++k) {
+                    _z[_pinv[_l_row[k]]] -= _l_val[k] * zq;
+                }
+            }
+            for (auto q = hi; q-- > lo;) {
+                auto zq = _z[q] /= _diag[q];
+                for (auto k = _u_start[q]; k < _u_start[q + 1]; ++k) {
+                    _z[_pinv[_u_row[k]]] -= _u_val[k] * zq;
+                }
+            }
+        }
+        for (size_t q = 0; q < _n; ++q) {
+            b[_col[q]] = _z[q];
+        }
+    }
+
+    void solve(std::vector<double> &b)
+    {
+        solve(b.data());
+    }
+
+    size_t size() const noexcept
+    {
+        return _n;
+    }
+
+    const sparsity_pattern_t &pattern() const noexcept
+    {
+        return _pattern;
+    }
+
+    /**
+     * @brief Number of diagonal blocks of the block triangular form
+     */
+    size_t blocks() const noexcept
+    {
+        return _block_start.size() - 1;
+    }
+
+    /**
+     * @brief Nonzeros of L and U including the diagonal, 0 before the
+     * first `factor`
+     */
+    size_t nnz_factors() const noexcept
+    {
+        return _factored ? _l_row.size() + _u_row.size() + _n : 0;
+    }
+
+    bool factored() const noexcept
+    {
+        return _factored;
+    }
+};
+} // namespace fmilib
@@ -0,0 +1,488 @@
+/*
+ *   Copyright (c) 2018, Hang Yu
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ *   * Neither the name of  nor the names of its contributors may be used to
+ *   endorse or promote products derived from this software without specific
+ *   prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *   ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *   LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *   CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *   SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *   INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *   CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *   ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fmilib.hpp>
+
+namespace fmilib
+{
+/**
+ * @brief Sparsity pattern in compressed sparse row (CSR) format
+ *
+ * The column indices of row `i` are
+ * `columns[row_start[i]] .. columns[row_start[i + 1] - 1]`, sorted
+ * ascending.
+ */
+struct sparsity_pattern_t
+{
+    size_t rows = 0;
+    size_t cols = 0;
+    std::vector<size_t> row_start{0};
+    std::vector<size_t> columns;
+
+    size_t nnz() const noexcept
+    {
+        return columns.size();
+    }
+
+    /**
+     * @brief Position of (i, j) in `columns`, nnz() if structurally zero
+     */
+    size_t find(size_t i, size_t j) const noexcept
+    {
+        auto first = columns.begin() + row_start[i];
+        auto last = columns.begin() + row_start[i + 1];
+        auto it = std::lower_bound(first, last, j);
+        return (it != last && *it == j) ? it - columns.begin() : nnz();
+    }
+
+    static sparsity_pattern_t dense(size_t rows, size_t cols)
+    {
+        sparsity_pattern_t p;
+        p.rows = rows;
+        p.cols = cols;
+        p.row_start.resize(rows + 1);
+        p.columns.resize(rows * cols);
+        for (size_t i = 0; i < rows; ++i) {
+            p.row_start[i + 1] = (i + 1) * cols;
+            std::iota(p.columns.begin() + i * cols,
+                      p.columns.begin() + (i + 1) * cols, size_t{0});
+        }
+        return p;
+    }
+
+    /**
+     * @brief Pattern from FMI dependency information
+     *
+     * @param start_index `rows + 1` offsets into `dependency`, nullptr if
+     * the FMU gives no dependencies (all rows dense)
+     * @param dependency 1-based variable indices, 0 means "depends on
+     * everything"
+     * @param column_of column of each variable index, `cols` for
+     * variables that are not columns of the pattern
+     */
+    static sparsity_pattern_t
+    from_dependencies(size_t rows, size_t cols, const size_t *start_index,
+                      const size_t *dependency,
+                      const std::vector<size_t> &column_of)
+    {
+        if (start_index == nullptr) {
+            return dense(rows, cols);
+        }
+        sparsity_pattern_t p;
+        p.rows = rows;
+        p.cols = cols;
+        p.row_start.resize(rows + 1);
+        for (size_t i = 0; i < rows; ++i) {
+            auto first = p.columns.size();
+            for (auto k = start_index[i]; k < start_index[i + 1]; ++k) {
+                auto index = dependency[k];
+                if (index == 0) {
+                    p.columns.resize(first + cols);
+                    std::iota(p.columns.begin() + first, p.columns.end(),
+                              size_t{0});
+                    break;
+                }
+                if (index < column_of.size() && column_of[index] < cols) {
+                    p.columns.push_back(column_of[index]);
+                }
+            }
+            std::sort(p.columns.begin() + first, p.columns.end());
+            p.columns.erase(
+                std::unique(p.columns.begin() + first, p.columns.end()),
+                p.columns.end());
+            p.row_start[i + 1] = p.columns.size();
+        }
+        return p;
+    }
+
+    /**
+     * @brief Rows `rows` of this pattern, in that order
+     */
+    sparsity_pattern_t select_rows(const std::vector<size_t> &rows) const
+    {
+        sparsity_pattern_t p;
+        p.rows = rows.size();
+        p.cols = cols;
+        p.row_start.reserve(rows.size() + 1);
+        for (auto i : rows) {
+            p.columns.insert(p.columns.end(), columns.begin() + row_start[i],
+                             columns.begin() + row_start[i + 1]);
+            p.row_start.push_back(p.columns.size());
+        }
+        return p;
+    }
+
+    /**
+     * @brief This pattern with the rows of `below` appended, both must
+     * have the same number of columns
+     */
+    sparsity_pattern_t stack(const sparsity_pattern_t &below) const
+    {
+        auto p = *this;
+        p.rows += below.rows;
+        p.columns.insert(p.columns.end(), below.columns.begin(),
+                         below.columns.end());
+        for (size_t i = 0; i < below.rows; ++i) {
+            p.row_start.push_back(nnz() + below.row_start[i + 1]);
+        }
+        return p;
+    }
+
+    /**
+     * @brief Make columns `dense_columns` structurally nonzero in every
+     * row, e.g. for variables the FMU declares no dependencies on
+     */
+    void add_dense_columns(const std::vector<size_t> &dense_columns)
+    {
+        if (dense_columns.empty()) {
+            return;
+        }
+        std::vector<size_t> merged;
+        std::vector<size_t> start{0};
+        for (size_t i = 0; i < rows; ++i) {
+            auto first = merged.size();
+            merged.insert(merged.end(), columns.begin() + row_start[i],
+                          columns.begin() + row_start[i + 1]);
+            merged.insert(merged.end(), dense_columns.begin(),
+                          dense_columns.end());
+            std::sort(merged.begin() + first, merged.end());
+            merged.erase(std::unique(merged.begin() + first, merged.end()),
+                         merged.end());
+            start.push_back(merged.size());
+        }
+        columns = std::move(merged);
+        row_start = std::move(start);
+    }
+
+    /**
+     * @brief This square pattern with the whole diagonal structurally
+     * nonzero, e.g. for iteration matrices I - gamma J
+     *
+     * @param position for every entry of this pattern, its position in
+     * `columns` of the result
+     */
+    sparsity_pattern_t
+    with_diagonal(std::vector<size_t> *position = nullptr) const
+    {
+        sparsity_pattern_t p;
+        p.rows = rows;
+        p.cols = cols;
+        p.row_start.reserve(rows + 1);
+        p.columns.reserve(nnz() + rows);
+        if (position) {
+            position->resize(nnz());
+        }
+        for (size_t i = 0; i < rows; ++i) {
+            auto diagonal = false;
+            for (auto k = row_start[i]; k < row_start[i + 1]; ++k) {
+                auto j = columns[k];
+                if (!diagonal && j >= i) {
+                    diagonal = true;
+                    if (j > i) {
+                        p.columns.push_back(i);
+                    }
+                }
+                if (position) {
+                    (*position)[k] = p.columns.size();
+                }
+                p.columns.push_back(j);
+            }
+            if (!diagonal) {
+                p.columns.push_back(i);
+            }
+            p.row_start.push_back(p.columns.size());
+        }
+        return p;
+    }
+
+    /**
+     * @brief Pattern of the transpose, also usable as a CSC view of this
+     * pattern
+     *
+     * @param position for every entry of the transpose, its position in
+     * `columns` of this pattern
+     */
+    sparsity_pattern_t transpose(std::vector<size_t> *position = nullptr) const
+    {
+        sparsity_pattern_t t;
+        t.rows = cols;
+        t.cols = rows;
+        t.row_start.assign(cols + 1, 0);
+        t.columns.resize(nnz());
+        for (auto j : columns) {
+            ++t.row_start[j + 1];
+        }
+        std::partial_sum(t.row_start.begin(), t.row_start.end(),
+                         t.row_start.begin());
+        std::vector<size_t> next(t.row_start.begin(), t.row_start.end() - 1);
+        if (position) {
+            position->resize(nnz());
+        }
+        for (size_t i = 0; i < rows; ++i) {
+            for (auto k = row_start[i]; k < row_start[i + 1]; ++k) {
+                auto dst = next[columns[k]]++;
+                t.columns[dst] = i;
+                if (position) {
+                    (*position)[dst] = k;
+                }
+            }
+        }
+        return t;
+    }
+};
+
+/**
+ * @brief Column partition of a pattern into structurally orthogonal
+ * groups
+ *
+ * Columns of one color share no row, so a single directional derivative
+ * seeded with all of them recovers each of their entries (Curtis, Powell
+ * & Reid).
+ */
+struct column_coloring_t
+{
+    size_t colors = 0;
+    /** @brief color of every column */
+    std::vector<size_t> color;
+    /** @brief columns grouped by color, CSR-like */
+    std::vector<size_t> color_start{0};
+    std::vector<size_t> columns;
+
+    /**
+     * @brief Greedy coloring, columns visited by decreasing number of
+     * entries
+     */
+    static column_coloring_t greedy(const sparsity_pattern_t &p)
+    {
+        column_coloring_t c;
+        auto csc = p.transpose();
+        std::vector<size_t> order(p.cols);
+        std::iota(order.begin(), order.end(), size_t{0});
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            return csc.row_start[a + 1] - csc.row_start[a]
+                   > csc.row_start[b + 1] - csc.row_start[b];
+        });
+
+        const auto none = p.cols;
+        c.color.assign(p.cols, none);
+        // forbidden[k] == j marks color k as taken by a neighbour of j
+        std::vector<size_t> forbidden(p.cols + 1, none);
+        for (auto j : order) {
+            for (auto k = csc.row_start[j]; k < csc.row_start[j + 1]; ++k) {
+                auto i = csc.columns[k];
+                for (auto l = p.row_start[i]; l < p.row_start[i + 1]; ++l) {
+                    auto cl = c.color[p.columns[l]];
+                    if (cl != none) {
+                        forbidden[cl] = j;
+                    }
+                }
+            }
+            size_t cl = 0;
+            while (forbidden[cl] == j) {
+                ++cl;
+            }
+            c.color[j] = cl;
+            c.colors = std::max(c.colors, cl + 1);
+        }
+
+        c.color_start.assign(c.colors + 1, 0);
+        for (auto cl : c.color) {
+            ++c.color_start[cl + 1];
+        }
+        std::partial_sum(c.color_start.begin(), c.color_start.end(),
+                         c.color_start.begin());
+        std::vector<size_t> next(c.color_start.begin(),
+                                 c.color_start.end() - 1);
+        c.columns.resize(p.cols);
+        for (size_t j = 0; j < p.cols; ++j) {
+            c.columns[next[c.color[j]]++] = j;
+        }
+        return c;
+    }
+};
+
+/**
+ * @brief 1-based variable indices of the continuous states, in the order
+ * of the derivatives list
+ */
+template <typename model_t>
+std::vector<size_t> state_variable_indices(const model_t &m)
+{
+    auto derivatives = m.derivative_list();
+    if (!derivatives) {
+        throw std::runtime_error("Failed to get derivatives list");
+    }
+    std::vector<size_t> indices;
+    for (size_t i = 0; i < derivatives->size(); ++i) {
+        auto d = (*derivatives)[i];
+        auto state = d ? fmi2_import_get_real_variable_derivative_of(
+                             (fmi2_import_real_variable_t *)d->c_ptr())
+                       : nullptr;
+        if (!state) {
+            throw std::runtime_error("Failed to get state of derivative");
+        }
+        indices.push_back(fmi2_import_get_variable_original_order(
+                              (fmi2_import_variable_t *)state)
+                          + 1);
+    }
+    return indices;
+}
+
+/**
+ * @brief Map from 1-based variable index to column for the variables in
+ * `indices`, `indices.size()` for all other variables
+ */
+inline std::vector<size_t> column_map(const std::vector<size_t> &indices)
+{
+    auto max = indices.empty()
+                   ? size_t{0}
+                   : *std::max_element(indices.begin(), indices.end());
+    std::vector<size_t> column_of(max + 1, indices.size());
+    for (size_t j = 0; j < indices.size(); ++j) {
+        column_of[indices[j]] = j;
+    }
+    return column_of;
+}
+
+/**
+ * @brief 1-based variable indices of the real variables `vrs`
+ */
+template <typename model_t>
+std::vector<size_t>
+variable_indices(model_t &m, const std::vector<fmi2_value_reference_t> &vrs)
+{
+    std::vector<size_t> indices;
+    for (auto vr : vrs) {
+        auto v = m.get_variable_by_vr(fmi2_base_type_real, vr);
+        if (!v) {
+            throw std::runtime_error("Unknown real value reference "
+                                     + std::to_string(vr));
+        }
+        indices.push_back(v.value().original_order() + 1);
+    }
+    return indices;
+}
+
+/**
+ * @brief Pattern of the derivatives with respect to the variables with
+ * 1-based indices `indices`, one column each, dense if the FMU does not
+ * declare dependencies
+ */
+template <typename model_t>
+sparsity_pattern_t derivatives_sparsity(const model_t &m,
+                                        const std::vector<size_t> &indices)
+{
+    auto n = m.number_of_continuous_states();
+    size_t *start_index = nullptr;
+    size_t *dependency = nullptr;
+    char *factor_kind = nullptr;
+    m.get_derivatives_dependencies(&start_index, &dependency, &factor_kind);
+    return sparsity_pattern_t::from_dependencies(
+        n, indices.size(), start_index, dependency, column_map(indices));
+}
+
+/**
+ * @brief Pattern of df/dx from the derivative dependencies of the FMU,
+ * dense if the FMU does not declare them
+ */
+template <typename model_t>
+sparsity_pattern_t derivatives_sparsity(const model_t &m)
+{
+    return derivatives_sparsity(m, state_variable_indices(m));
+}
+
+/**
+ * @brief Pattern of the outputs, in the order of the outputs list, with
+ * respect to the variables with 1-based indices `indices`
+ */
+template <typename model_t>
+sparsity_pattern_t outputs_sparsity(const model_t &m,
+                                    const std::vector<size_t> &indices)
+{
+    auto outputs = m.output_list();
+    auto ny = outputs ? outputs->size() : size_t{0};
+    size_t *start_index = nullptr;
+    size_t *dependency = nullptr;
+    char *factor_kind = nullptr;
+    if (ny > 0) {
+        m.get_outputs_dependencies(&start_index, &dependency, &factor_kind);
+    }
+    return sparsity_pattern_t::from_dependencies(
+        ny, indices.size(), start_index, dependency, column_map(indices));
+}
+
+/**
+ * @brief Pattern of the derivatives and the real variables `y` with
+ * respect to the states `states` and the real variables `u`
+ *
+ * Rows are the derivatives, then `y`; columns are `states`, then `u`.
+ * `u` must be real inputs. Rows of variables that are no outputs are
+ * dense, the FMU declares no dependencies for them.
+ */
+template <typename model_t>
+sparsity_pattern_t
+system_sparsity(model_t &m, const std::vector<size_t> &states,
+                const std::vector<fmi2_value_reference_t> &u,
+                const std::vector<fmi2_value_reference_t> &y)
+{
+    auto all_states = state_variable_indices(m);
+    std::vector<size_t> indices;
+    for (auto i : states) {
+        indices.push_back(all_states.at(i));
+    }
+    auto u_indices = variable_indices(m, u);
+    indices.insert(indices.end(), u_indices.begin(), u_indices.end());
+    auto cols = indices.size();
+
+    auto p = derivatives_sparsity(m, indices);
+    if (!y.empty()) {
+        std::vector<fmi2_value_reference_t> output_vrs;
+        if (auto outputs = m.output_list(); outputs) {
+            output_vrs = outputs->vrs();
+        }
+        auto ys = outputs_sparsity(m, indices);
+        for (auto vr : y) {
+            auto it = std::find(output_vrs.begin(), output_vrs.end(), vr);
+            p = p.stack(it != output_vrs.end()
+                            ? ys.select_rows({static_cast<size_t>(
+                                it - output_vrs.begin())})
+                            : sparsity_pattern_t::dense(1, cols));
+        }
+    }
+    return p;
+}
+} // namespace fmilib
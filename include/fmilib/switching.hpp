@@ -0,0 +1,380 @@
+/*
+ *   Copyright (c) 2018, Hang Yu
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ *   * Neither the name of  nor the names of its contributors may be used to
+ *   endorse or promote products derived from this software without specific
+ *   prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *   ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *   LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *   CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *   SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *   INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *   CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *   ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include <fmilib/bdf.hpp>
+#include <fmilib/dopri45.hpp>
+#include <fmilib/integrator.hpp>
+
+namespace fmilib
+{
+enum class integration_method_t { nonstiff, stiff };
+
+/**
+ * @brief Method switches of switching_integrator_t
+ */
+struct switching_stats_t
+{
+    /** @brief switches from Dormand-Prince to BDF */
+    size_t to_stiff = 0;
+    /** @brief switches from BDF to Dormand-Prince */
+    size_t to_nonstiff = 0;
+    /** @brief accepted steps with Dormand-Prince */
+    size_t nonstiff_steps = 0;
+    /** @brief accepted steps with BDF */
+    size_t stiff_steps = 0;
+
+    void reset() noexcept
+    {
+        *this = switching_stats_t{};
+    }
+};
+
+/**
+ * @brief Driver that switches between dopri45_integrator_t and
+ * bdf_integrator_t at runtime, in the spirit of LSODA
+ *
+ * - Dormand-Prince to BDF: `h * |lambda|` estimated from the last two
+ *   stages exceeds the stability boundary in `stiff_steps` steps without
+ *   six calm steps in a row in between (as in Hairer's DOPRI5).
+ * - BDF to Dormand-Prince: after at least `min_steps` BDF steps, the
+ *   spectral radius of the BDF Jacobian, estimated by power iteration,
+ *   times the BDF step size falls below 1, so an explicit step of the
+ *   same size is stable.
+ *
+ * Both drivers work on the same FMU through one shared me_system_t, so
+ * the time last handed to the FMU, the deferral of
+ * `completed_integrator_step` and the statistics are the same for both.
+ * On a switch the other driver restarts from the current point without
+ * reading the states back.
+ */
+template <typename model_t> class switching_integrator_t
+{
+private:
+    static constexpr fmi2_real_t _stability_boundary = 3.25;
+
+    me_system_t<model_t> _sys;
+    dopri45_integrator_t<model_t> _nonstiff;
+    bdf_integrator_t<model_t> _stiff;
+    integration_method_t _method = integration_method_t::nonstiff;
+    /* method that took the last step, it owns the interpolant */
+    integration_method_t _last = integration_method_t::nonstiff;
+    int _stiff_steps = 15;
+    int _min_steps = 20;
+    int _count = 0;
+    int _calm = 0;
+    fmi2_real_t _rho = 0.0;
+    size_t _rho_key = std::numeric_limits<size_t>::max();
+    std::vector<fmi2_real_t> _v, _w;
+    switching_stats_t _switch_stats;
+
+    static bool _failed(fmi2_status_t s) noexcept
+    {
+        return s > fmi2_status_warning;
+    }
+
+    /* spectral radius of the BDF Jacobian by power iteration; free with
+     * a formed J, ten FMU products if BDF runs matrix-free */
+    fmi2_real_t _spectral_radius()
+    {
+        auto n = _v.size();
+        for (size_t i = 0; i < n; ++i) {
+            // avoid starting orthogonal to the dominant eigenvector
+            _v[i] = 1.0 + 0.1 * static_cast<fmi2_real_t>(i % 7);
+        }
+        fmi2_real_t rho = 0.0;
+        for (int k = 0; k < 10; ++k) {
+            fmi2_real_t norm = 0.0;
+            for (size_t i = 0; i < n; ++i) {
+                norm += _v[i] * _v[i];
+            }
+            norm = std::sqrt(norm);
+            if (norm == 0.0) {
+                return 0.0;
+            }
+            if (_failed(_stiff.multiply_jacobian(_v.data(), _w.data()))) {
+                return 0.0;
+            }
+            fmi2_real_t wn = 0.0;
+            for (size_t i = 0; i < n; ++i) {
+                _w[i] /= norm;
+                wn += _w[i] * _w[i];
+            }
+            rho = std::sqrt(wn);
+            std::swap(_v, _w);
+        }
+        return rho;
+    }
+
+    template <typename from_t, typename to_t>
+    fmi2_status_t _switch(from_t &from, to_t &to)
+    {
+        _count = 0;
+        _calm = 0;
+        // the FMU holds the accepted point of `from`
+        _sys.invalidate();
+        return to.reset(from.time(), from.states().data());
+    }
+
+public:
+    /**
+     * @brief Construct with relative tolerance `rtol`, defaults to the
+     * default experiment tolerance of the FMU
+     *
+     * @param directional use directional derivatives for the BDF
+     * Jacobian if the FMU provides them
+     */
+    explicit switching_integrator_t(model_t &m, fmi2_real_t rtol = 0.0,
+                                    bool directional = true)
+        : _sys{m}, _nonstiff{_sys, rtol}, _stiff{_sys, rtol, directional}
+    {
+        _v.resize(_sys.size());
+        _w.resize(_v.size());
+    }
+
+    /**
+     * @brief Start at `t` with the current method, reading states and
+     * nominals from the FMU into both drivers
+     *
+     * The statistics of both drivers are those of the shared system.
+     */
+    fmi2_status_t reset(fmi2_real_t t)
+    {
+        _last = _method;
+        _count = 0;
+        if (auto s = _stiff.reset(t); _failed(s)) {
+            return s;
+        }
+        return _nonstiff.reset(t);
+    }
+
+    /**
+     * @brief Restart at `t` with the current method from states the
+     * caller already holds
+     */
+    fmi2_status_t reset(fmi2_real_t t, const fmi2_real_t x[])
+    {
+        _last = _method;
+        _count = 0;
+        _sys.invalidate();
+        return _method == integration_method_t::nonstiff
+                   ? _nonstiff.reset(t, x)
+                   : _stiff.reset(t, x);
+    }
+
+    /**
+     * @brief Stiff Dormand-Prince steps before switching to BDF, and BDF
+     * steps before switching back is considered
+     */
+    void set_switch_delays(int stiff_steps, int min_steps) noexcept
+    {
+        _stiff_steps = stiff_steps;
+        _min_steps = min_steps;
+    }
+
+    void set_step_limits(fmi2_real_t h_min, fmi2_real_t h_max) noexcept
+    {
+        _nonstiff.set_step_limits(h_min, h_max);
+        _stiff.set_step_limits(h_min, h_max);
+    }
+
+    /**
+     * @brief Take one accepted step towards `t_stop`, then decide on the
+     * method for the next one
+     */
+    fmi2_status_t step(fmi2_real_t t_stop)
+    {
+        _last = _method;
+        if (_method == integration_method_t::nonstiff) {
+            auto s = _nonstiff.step(t_stop);
+            if (_failed(s)) {
+                return s;
+            }
+            ++_switch_stats.nonstiff_steps;
+            // as in DOPRI5, a few steps below the boundary don't reset
+            if (_nonstiff.stiffness_estimate() > _stability_boundary) {
+                ++_count;
+                _calm = 0;
+            } else if (++_calm >= 6) {
+                _count = 0;
+            }
+            if (_count >= _stiff_steps && !_nonstiff.enter_event_mode()
+                && !_nonstiff.terminate_simulation()) {
+                ++_switch_stats.to_stiff;
+                _method = integration_method_t::stiff;
+                return std::max(s, _switch(_nonstiff, _stiff));
+            }
+            return s;
+        }
+
+        auto s = _stiff.step(t_stop);
+        if (_failed(s)) {
+            return s;
+        }
+        ++_switch_stats.stiff_steps;
+        if (++_count < _min_steps || _stiff.enter_event_mode()
+            || _stiff.terminate_simulation()) {
+            return s;
+        }
+        // a matrix-free BDF forms no J to key the estimate on, refresh it
+        // every `min_steps` steps instead
+        auto key = _stiff.matrix_free()
+                       ? _switch_stats.stiff_steps
+                             / static_cast<size_t>(std::max(_min_steps, 1))
+                       : _stiff.stats().jacobian_evaluations;
+        if (key != _rho_key) {
+            _rho = _spectral_radius();
+            _rho_key = key;
+        }
+        if (_rho * _stiff.step_size() < 1.0) {
+            ++_switch_stats.to_nonstiff;
+            _method = integration_method_t::nonstiff;
+            return std::max(s, _switch(_stiff, _nonstiff));
+        }
+        return s;
+    }
+
+    /**
+     * @brief Same as `step`, the entry point shared with the other drivers
+     */
+    fmi2_status_t advance(fmi2_real_t t_stop)
+    {
+        return step(t_stop);
+    }
+
+    /**
+     * @brief Integrate up to `t_end`, calling `observer(t, x)` after every
+     * step
+     */
+    template <typename observer_t = null_observer_t>
+    fmi2_status_t integrate(fmi2_real_t t_end, observer_t &&observer = {})
+    {
+        auto status = fmi2_status_ok;
+        auto eps = 100.0 * std::numeric_limits<fmi2_real_t>::epsilon()
+                   * std::max({1.0, std::abs(time()), std::abs(t_end)});
+        while (time() < t_end - eps && !enter_event_mode()
+               && !terminate_simulation()) {
+            auto s = step(t_end);
+            status = std::max(status, s);
+            if (_failed(s)) {
+                return s;
+            }
+            observer(time(), states());
+        }
+        return status;
+    }
+
+    /**
+     * @brief States at `t` within the last step, from the interpolant of
+     * the method that took it
+     */
+    fmi2_status_t interpolate(fmi2_real_t t, fmi2_real_t x[])
+    {
+        return _last == integration_method_t::nonstiff
+                   ? _nonstiff.interpolate(t, x)
+                   : _stiff.interpolate(t, x);
+    }
+
+    integration_method_t method() const noexcept
+    {
+        return _method;
+    }
+
+    fmi2_real_t time() const noexcept
+    {
+        return _last == integration_method_t::nonstiff ? _nonstiff.time()
+                                                       : _stiff.time();
+    }
+
+    fmi2_real_t previous_time() const noexcept
+    {
+        return _last == integration_method_t::nonstiff
+                   ? _nonstiff.previous_time()
+                   : _stiff.previous_time();
+    }
+
+    const std::vector<fmi2_real_t> &states() const noexcept
+    {
+        return _last == integration_method_t::nonstiff ? _nonstiff.states()
+                                                       : _stiff.states();
+    }
+
+    bool enter_event_mode() const noexcept
+    {
+        return _last == integration_method_t::nonstiff
+                   ? _nonstiff.enter_event_mode()
+                   : _stiff.enter_event_mode();
+    }
+
+    bool terminate_simulation() const noexcept
+    {
+        return _last == integration_method_t::nonstiff
+                   ? _nonstiff.terminate_simulation()
+                   : _stiff.terminate_simulation();
+    }
+
+    /**
+     * @brief Counters of both methods, kept by the shared system
+     */
+    const integrator_stats_t &stats() const noexcept
+    {
+        return _sys.stats;
+    }
+
+    const switching_stats_t &switch_stats() const noexcept
+    {
+        return _switch_stats;
+    }
+
+    /**
+     * @brief System shared by both methods, used by event locators and
+     * samplers
+     */
+    me_system_t<model_t> &system() noexcept
+    {
+        return _sys;
+    }
+
+    dopri45_integrator_t<model_t> &nonstiff() noexcept
+    {
+        return _nonstiff;
+    }
+
+    bdf_integrator_t<model_t> &stiff() noexcept
+    {
+        return _stiff;
+    }
+};
+} // namespace fmilib
@@ -0,0 +1,703 @@
+/*
+ *   Copyright (c) 2018, Hang Yu
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ *   * Neither the name of  nor the names of its contributors may be used to
+ *   endorse or promote products derived from this software without specific
+ *   prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *   ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *   LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *   CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *   SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *   INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *   CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *   ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include <fmilib/integrator.hpp>
+#include <fmilib/krylov.hpp>
+#include <fmilib/linalg.hpp>
+#include <fmilib/sparse_lu.hpp>
+#include <fmilib/sparsity.hpp>
+
+namespace fmilib
+{
+/**
+ * @brief Newton trust-region solver for equilibria (trim points) of
+ * ModelExchange FMUs
+ *
+ * Drives the derivatives to zero and the constrained outputs to their
+ * targets by adjusting the states and free real inputs. The residuals
+ * are solved in the least squares sense with Powell's dogleg method in
+ * scaled variables:
+ *
+ * - states and derivatives are divided by the state nominals, free
+ *   variables and constraints by their nominal values;
+ * - free variables are kept within their min/max attributes.
+ *
+ * The Jacobian is evaluated like sparse_jacobian_t: the columns are
+ * colored by the derivative and output dependencies, and every color
+ * costs one `get_directional_derivative` call or one forward difference.
+ * Square systems take Newton steps through sparse_lu_t on that pattern,
+ * or through an inexact Krylov solve preconditioned on it
+ * (`set_krylov_solver`); only rank-deficient or non-square ones fall back
+ * to dense normal equations.
+ *
+ * On success the FMU holds the equilibrium, so a driver can start from
+ * it with `reset(t)`.
+ */
+template <typename model_t> class trim_solver_t
+{
+private:
+    me_system_t<model_t> _sys;
+    bool _directional;
+    size_t _n;
+    fmi2_real_t _tol = 1e-8;
+    int _max_iter = 100;
+    int _iterations = 0;
+    fmi2_real_t _residual_norm = 0.0;
+    bool _prepared = false;
+
+    std::vector<size_t> _fixed;
+    std::vector<fmi2_value_reference_t> _free_vr, _con_vr;
+    std::vector<fmi2_real_t> _targets;
+
+    /* unknowns z: the states in _states, then the free variables;
+     * residuals r: the derivatives, then the constraints */
+    std::vector<size_t> _states;
+    std::vector<fmi2_value_reference_t> _col_vr, _row_vr, _seed_vr;
+    sparsity_pattern_t _pattern;
+    sparsity_pattern_t _csc;
+    std::vector<size_t> _csc_pos;
+    column_coloring_t _coloring;
+    dense_lu_t _lu;
+    sparse_lu_t _slu;
+    /* Krylov alternative to _slu, preconditioned on J plus the diagonal */
+    std::unique_ptr<krylov_solver_t> _krylov;
+    preconditioner_t _prec;
+    sparsity_pattern_t _m_pattern;
+    std::vector<size_t> _m_pos;
+    std::vector<fmi2_real_t> _m_values;
+    std::vector<fmi2_real_t> _x, _u, _u_min, _u_max, _col_scale, _row_scale;
+    std::vector<fmi2_real_t> _z, _z_trial, _r, _r_trial, _values, _A;
+    std::vector<fmi2_real_t> _g, _p, _p_gn, _Jp, _seed, _df;
+
+    static bool _failed(fmi2_status_t s) noexcept
+    {
+        return s > fmi2_status_warning;
+    }
+
+    static fmi2_real_t _norm2(const std::vector<fmi2_real_t> &v) noexcept
+    {
+        fmi2_real_t sum = 0.0;
+        for (auto a : v) {
+            sum += a * a;
+        }
+        return std::sqrt(sum);
+    }
+
+    static fmi2_real_t _nominal(model_t &m, fmi2_value_reference_t vr)
+    {
+        auto v = m.get_variable_by_vr(fmi2_base_type_real, vr);
+        auto rv = v ? fmi2_import_get_variable_as_real(v.value().c_ptr())
+                    : nullptr;
+        if (!rv) {
+            throw std::runtime_error("Unknown real value reference "
+                                     + std::to_string(vr));
+        }
+        auto nominal = std::abs(fmi2_import_get_real_variable_nominal(rv));
+        return nominal > 0.0 ? nominal : 1.0;
+    }
+
+    void _prepare()
+    {
+        auto &m = _sys.model();
+        std::vector<bool> fixed(_n, false);
+        for (auto i : _fixed) {
+            fixed.at(i) = true;
+        }
+        _states.clear();
+        for (size_t i = 0; i < _n; ++i) {
+            if (!fixed[i]) {
+                _states.push_back(i);
+            }
+        }
+        auto ns = _states.size();
+        auto nu = _free_vr.size();
+        auto nz = ns + nu;
+        auto nr = _n + _con_vr.size();
+
+        std::vector<fmi2_real_t> nominals(_n);
+        if (_failed(_sys.nominals(nominals.data()))) {
+            throw std::runtime_error("Failed to get nominal values");
+        }
+        _col_scale.resize(nz);
+        _row_scale.resize(nr);
+        for (size_t i = 0; i < _n; ++i) {
+            _row_scale[i] = std::abs(nominals[i]) > 0.0 ? std::abs(nominals[i])
+                                                        : 1.0;
+        }
+        for (size_t j = 0; j < ns; ++j) {
+            _col_scale[j] = _row_scale[_states[j]];
+        }
+        _u_min.resize(nu);
+        _u_max.resize(nu);
+        for (size_t j = 0; j < nu; ++j) {
+            _col_scale[ns + j] = _nominal(m, _free_vr[j]);
+            auto v = m.get_variable_by_vr(fmi2_base_type_real, _free_vr[j]);
+            auto rv = fmi2_import_get_variable_as_real(v.value().c_ptr());
+            _u_min[j] = fmi2_import_get_real_variable_min(rv);
+            _u_max[j] = fmi2_import_get_real_variable_max(rv);
+        }
+        for (size_t k = 0; k < _con_vr.size(); ++k) {
+            _row_scale[_n + k] = _nominal(m, _con_vr[k]);
+        }
+
+        _directional
+            = _directional
+              && m.capability(fmi2_me_providesDirectionalDerivatives) != 0;
+        if (_directional) {
+            auto x_vr = m.state_vrs();
+            auto dx = m.derivative_list();
+            if (!x_vr || !dx || x_vr.value().size() != _n
+                || dx.value().size() != _n) {
+                throw std::runtime_error(
+                    "Failed to get state and derivative value references");
+            }
+            _col_vr.clear();
+            for (auto i : _states) {
+                _col_vr.push_back(x_vr.value()[i]);
+            }
+            _col_vr.insert(_col_vr.end(), _free_vr.begin(), _free_vr.end());
+            _row_vr = dx.value().vrs();
+            _row_vr.insert(_row_vr.end(), _con_vr.begin(), _con_vr.end());
+        }
+
+        _pattern = system_sparsity(m, _states, _free_vr, _con_vr);
+        _csc = _pattern.transpose(&_csc_pos);
+        _coloring = column_coloring_t::greedy(_pattern);
+
+        _seed_vr.resize(nz);
+        _seed.resize(nz);
+        _df.resize(nr);
+        _values.resize(_pattern.nnz());
+        if (nr == nz && _krylov) {
+            _m_pattern = _pattern.with_diagonal(&_m_pos);
+            _m_values.resize(_m_pattern.nnz());
+        } else if (nr == nz) {
+            _slu.analyze(_pattern);
+        }
+        for (auto v : {&_z, &_z_trial, &_g, &_p, &_p_gn}) {
+            v->resize(nz);
+        }
+        for (auto v : {&_r, &_r_trial, &_Jp}) {
+            v->resize(nr);
+        }
+        _u.resize(nu);
+        _prepared = true;
+    }
+
+    /* hand the unknowns z to the FMU */
+    fmi2_status_t _load(fmi2_real_t t, const std::vector<fmi2_real_t> &z)
+    {
+        auto ns = _states.size();
+        for (size_t j = 0; j < ns; ++j) {
+            _x[_states[j]] = z[j] * _col_scale[j];
+        }
+        for (size_t j = 0; j < _u.size(); ++j) {
+            _u[j] = z[ns + j] * _col_scale[ns + j];
+        }
+        auto status = fmi2_status_ok;
+        if (!_u.empty()) {
+            status = _sys.model().set_real(_free_vr.data(), _free_vr.size(),
+                                           _u.data());
+            if (_failed(status)) {
+                return status;
+            }
+        }
+        return std::max(status, _sys.set_point(t, _x.data()));
+    }
+
+    fmi2_status_t _residual(fmi2_real_t t, const std::vector<fmi2_real_t> &z,
+                            std::vector<fmi2_real_t> &r)
+    {
+        auto status = _load(t, z);
+        if (_failed(status)) {
+            return status;
+        }
+        status = std::max(status, _sys.derivatives(r.data()));
+        if (!_failed(status) && !_con_vr.empty()) {
+            status = std::max(status,
+                              _sys.model().get_real(_con_vr.data(),
+                                                    _con_vr.size(),
+                                                    r.data() + _n));
+        }
+        if (_failed(status)) {
+            return status;
+        }
+        for (size_t i = 0; i < r.size(); ++i) {
+            auto target = i < _n ? 0.0 : _targets[i - _n];
+            r[i] = (r[i] - target) / _row_scale[i];
+            if (!std::isfinite(r[i])) {
+                return fmi2_status_discard;
+            }
+        }
+        return status;
+    }
+
+    /* scaled Jacobian at _z, where the residual is _r */
+    fmi2_status_t _jacobian(fmi2_real_t t)
+    {
+        ++_sys.stats.jacobian_evaluations;
+        auto nr = _r.size();
+        if (_directional) {
+            if (auto s = _load(t, _z); _failed(s)) {
+                return s;
+            }
+        }
+        for (size_t c = 0; c < _coloring.colors; ++c) {
+            auto first = _coloring.color_start[c];
+            auto nv = _coloring.color_start[c + 1] - first;
+            fmi2_status_t s;
+            if (_directional) {
+                for (size_t l = 0; l < nv; ++l) {
+                    auto j = _coloring.columns[first + l];
+                    _seed_vr[l] = _col_vr[j];
+                    _seed[l] = _col_scale[j];
+                }
+                s = _sys.model().get_directional_derivative(
+                    _seed_vr.data(), nv, _row_vr.data(), nr, _seed.data(),
+                    _df.data());
+                for (size_t i = 0; i < nr; ++i) {
+                    _df[i] /= _row_scale[i];
+                }
+            } else {
+                static const auto sqrt_eps
+                    = std::sqrt(std::numeric_limits<fmi2_real_t>::epsilon());
+                _z_trial = _z;
+                for (size_t l = 0; l < nv; ++l) {
+                    auto j = _coloring.columns[first + l];
+                    _z_trial[j] += sqrt_eps * std::max(std::abs(_z[j]), 1.0);
+                }
+                s = _residual(t, _z_trial, _df);
+                for (size_t l = 0; l < nv; ++l) {
+                    auto j = _coloring.columns[first + l];
+                    _seed[l] = _z_trial[j] - _z[j];
+                }
+            }
+            if (_failed(s)) {
+                return s;
+            }
+            for (size_t l = 0; l < nv; ++l) {
+                auto j = _coloring.columns[first + l];
+                for (auto k = _csc.row_start[j]; k < _csc.row_start[j + 1];
+                     ++k) {
+                    auto i = _csc.columns[k];
+                    _values[_csc_pos[k]]
+                        = _directional ? _df[i] : (_df[i] - _r[i]) / _seed[l];
+                }
+            }
+        }
+        return fmi2_status_ok;
+    }
+
+    /* inexact Newton step J p = -r, the forcing term shrinks with the
+     * residual for superlinear convergence */
+    bool _krylov_newton()
+    {
+        std::fill(_m_values.begin(), _m_values.end(), 0.0);
+        for (size_t k = 0; k < _values.size(); ++k) {
+            _m_values[_m_pos[k]] = _values[k];
+        }
+        _prec.setup(_m_pattern, _m_values.data());
+        for (size_t j = 0; j < _r.size(); ++j) {
+            _Jp[j] = -_r[j];
+        }
+        std::fill(_p_gn.begin(), _p_gn.end(), 0.0);
+        auto r_norm = _norm2(_r);
+        auto s = _krylov->solve(
+            [this](const fmi2_real_t v[], fmi2_real_t w[]) {
+                _multiply(v, w);
+                return fmi2_status_ok;
+            },
+            [this](fmi2_real_t v[]) { _prec.apply(v); }, _Jp.data(),
+            _p_gn.data(), _p_gn.size(), std::min(0.1, r_norm) * r_norm,
+            2 * _p_gn.size() + 10);
+        return !_failed(s);
+    }
+
+    /* Gauss-Newton step _p_gn: Newton if J is square and regular,
+     * otherwise from the slightly regularized normal equations */
+    void _gauss_newton()
+    {
+        auto nr = _r.size();
+        auto nz = _z.size();
+        auto limit = 1e8 * std::max(1.0, _norm2(_z));
+        if (nr == nz && _krylov) {
+            auto norm = _krylov_newton() ? _norm2(_p_gn) : limit;
+            if (std::isfinite(norm) && norm < limit) {
+                return;
+            }
+        } else if (nr == nz && _slu.refactor(_values)) {
+            for (size_t j = 0; j < nz; ++j) {
+                _p_gn[j] = -_r[j];
+            }
+            _slu.solve(_p_gn);
+            auto norm = _norm2(_p_gn);
+            if (std::isfinite(norm) && norm < limit) {
+                return;
+            }
+        }
+        _A.assign(nz * nz, 0.0);
+        fmi2_real_t diag = 0.0;
+        const auto &p = _pattern;
+        for (size_t i = 0; i < nr; ++i) {
+            for (auto ka = p.row_start[i]; ka < p.row_start[i + 1]; ++ka) {
+                auto v = _values[ka];
+                auto row = _A.data() + p.columns[ka] * nz;
+                for (auto kb = p.row_start[i]; kb < p.row_start[i + 1];
+                     ++kb) {
+                    row[p.columns[kb]] += v * _values[kb];
+                }
+            }
+        }
+        for (size_t j = 0; j < nz; ++j) {
+            diag = std::max(diag, _A[j * nz + j]);
+        }
+        auto mu = 1e-12 * std::max(diag, 1.0);
+        for (size_t j = 0; j < nz; ++j) {
+            _A[j * nz + j] += mu;
+            _p_gn[j] = -_g[j];
+        }
+        _lu.factor(_A, nz);
+        _lu.solve(_p_gn);
+    }
+
+    /* jp = J p */
+    void _multiply(const fmi2_real_t p[], fmi2_real_t jp[]) const
+    {
+        for (size_t i = 0; i < _r.size(); ++i) {
+            fmi2_real_t sum = 0.0;
+            for (auto k = _pattern.row_start[i]; k < _pattern.row_start[i + 1];
+                 ++k) {
+                sum += _values[k] * p[_pattern.columns[k]];
+            }
+            jp[i] = sum;
+        }
+    }
+
+    /* _Jp = J p */
+    void _multiply(const std::vector<fmi2_real_t> &p)
+    {
+        _multiply(p.data(), _Jp.data());
+    }
+
+    fmi2_real_t _max_residual() const noexcept
+    {
+        fmi2_real_t norm = 0.0;
+        for (auto a : _r) {
+            norm = std::max(norm, std::abs(a));
+        }
+        return norm;
+    }
+
+public:
+    /**
+     * @param directional use directional derivatives if the FMU
+     * provides them, otherwise forward differences
+     */
+    explicit trim_solver_t(model_t &m, bool directional = true)
+        : _sys{m}, _directional{directional}, _n{_sys.size()}
+    {
+        _x.resize(_n);
+    }
+
+    /**
+     * @brief Real inputs the solver may change, anything else throws
+     * std::runtime_error, see me_system_t::is_input
+     */
+    void set_free_variables(std::vector<fmi2_value_reference_t> vrs)
+    {
+        for (auto vr : vrs) {
+            if (!_sys.is_input(vr)) {
+                throw std::runtime_error("Free variables must be real inputs");
+            }
+        }
+        _free_vr = std::move(vrs);
+        _prepared = false;
+    }
+
+    /**
+     * @brief Real variables, usually outputs, held at `targets`
+     */
+    void set_constraints(std::vector<fmi2_value_reference_t> vrs,
+                         std::vector<fmi2_real_t> targets)
+    {
+        if (vrs.size() != targets.size()) {
+            throw std::runtime_error("Constraints and targets differ in size");
+        }
+        _con_vr = std::move(vrs);
+        _targets = std::move(targets);
+        _prepared = false;
+    }
+
+    /**
+     * @brief States kept at their start values, e.g. angles or positions
+     * that no derivative depends on
+     */
+    void set_fixed_states(std::vector<size_t> states)
+    {
+        _fixed = std::move(states);
+        _prepared = false;
+    }
+
+    /**
+     * @brief Take the Newton steps of square systems with a Krylov method
+     * instead of sparse_lu_t, `krylov_method_t::none` switches back
+     *
+     * For systems whose LU factors fill in too much; J is still
+     * evaluated, as the dogleg needs its transpose.
+     */
+    void set_krylov_solver(
+        krylov_method_t method,
+        preconditioner_kind_t preconditioner = preconditioner_kind_t::ilu0)
+    {
+        if (method == krylov_method_t::none) {
+            _krylov.reset();
+        } else {
+            _krylov = std::make_unique<krylov_solver_t>(method);
+        }
+        _prec = preconditioner_t{preconditioner};
+        _prepared = false;
+    }
+
+    /**
+     * @brief Converged when every scaled residual is below `tol`
+     */
+    void set_tolerance(fmi2_real_t tol, int max_iterations = 100) noexcept
+    {
+        _tol = tol;
+        _max_iter = max_iterations;
+    }
+
+    /**
+     * @brief Solve for an equilibrium at time `t`, starting from the
+     * states and free variables the FMU holds
+     *
+     * Throws std::runtime_error if the setup fails, e.g. on an unknown
+     * value reference.
+     *
+     * @return fmi2_status_error if the iteration does not converge within
+     * the maximum number of iterations or stalls
+     */
+    fmi2_status_t solve(fmi2_real_t t)
+    {
+        if (!_prepared) {
+            _prepare();
+        }
+        _iterations = 0;
+        _sys.invalidate();
+        if (auto s = _sys.read_states(_x.data()); _failed(s)) {
+            return s;
+        }
+        if (!_u.empty()) {
+            if (auto s = _sys.model().get_real(_free_vr.data(), _free_vr.size(),
+                                               _u.data());
+                _failed(s)) {
+                return s;
+            }
+        }
+        auto ns = _states.size();
+        for (size_t j = 0; j < ns; ++j) {
+            _z[j] = _x[_states[j]] / _col_scale[j];
+        }
+        for (size_t j = 0; j < _u.size(); ++j) {
+            _z[ns + j] = _u[j] / _col_scale[ns + j];
+        }
+        if (auto s = _residual(t, _z, _r); _failed(s)) {
+            return s;
+        }
+
+        auto nz = _z.size();
+        auto radius = std::max(1.0, _norm2(_z));
+        for (;;) {
+            _residual_norm = _max_residual();
+            if (_residual_norm <= _tol) {
+                return _load(t, _z);
+            }
+            if (_iterations == _max_iter) {
+                _load(t, _z);
+                return fmi2_status_error;
+            }
+            ++_iterations;
+            if (auto s = _jacobian(t); _failed(s)) {
+                return s;
+            }
+            // gradient J^T r of the least squares objective
+            std::fill(_g.begin(), _g.end(), 0.0);
+            for (size_t i = 0; i < _r.size(); ++i) {
+                for (auto k = _pattern.row_start[i];
+                     k < _pattern.row_start[i + 1]; ++k) {
+                    _g[_pattern.columns[k]] += _values[k] * _r[i];
+                }
+            }
+            _gauss_newton();
+            auto g_norm = _norm2(_g);
+            _multiply(_g);
+            auto Jg_norm = _norm2(_Jp);
+            auto r_norm = _norm2(_r);
+
+            // retry with a smaller trust region until a step is accepted
+            for (;;) {
+                // dogleg step within the trust region
+                auto gn_norm = _norm2(_p_gn);
+                if (gn_norm <= radius) {
+                    _p = _p_gn;
+                } else {
+                    auto alpha = Jg_norm > 0.0
+                                     ? g_norm * g_norm / (Jg_norm * Jg_norm)
+                                     : 0.0;
+                    if (alpha * g_norm >= radius || alpha == 0.0) {
+                        for (size_t j = 0; j < nz; ++j) {
+                            _p[j] = -radius / g_norm * _g[j];
+                        }
+                    } else {
+                        // p = c + tau (gn - c) with |p| = radius
+                        fmi2_real_t cc = 0.0, cd = 0.0, dd = 0.0;
+                        for (size_t j = 0; j < nz; ++j) {
+                            auto c = -alpha * _g[j];
+                            auto d = _p_gn[j] - c;
+                            cc += c * c;
+                            cd += c * d;
+                            dd += d * d;
+                        }
+                        auto tau = (-cd
+                                    + std::sqrt(cd * cd
+                                                + dd * (radius * radius - cc)))
+                                   / dd;
+                        for (size_t j = 0; j < nz; ++j) {
+                            auto c = -alpha * _g[j];
+                            _p[j] = c + tau * (_p_gn[j] - c);
+                        }
+                    }
+                }
+                // keep the free variables within their bounds
+                for (size_t j = 0; j < nz; ++j) {
+                    _z_trial[j] = _z[j] + _p[j];
+                    if (j >= ns) {
+                        auto lo = _u_min[j - ns] / _col_scale[j];
+                        auto hi = _u_max[j - ns] / _col_scale[j];
+                        _z_trial[j] = std::min(std::max(_z_trial[j], lo), hi);
+                        _p[j] = _z_trial[j] - _z[j];
+                    }
+                }
+                auto p_norm = _norm2(_p);
+                if (p_norm
+                    <= std::numeric_limits<fmi2_real_t>::epsilon()
+                           * std::max(1.0, _norm2(_z))) {
+                    // stalled, e.g. in a local minimum of |r|
+                    _load(t, _z);
+                    return fmi2_status_error;
+                }
+                _multiply(_p);
+                for (size_t i = 0; i < _r.size(); ++i) {
+                    _Jp[i] += _r[i];
+                }
+                auto predicted = r_norm * r_norm - std::pow(_norm2(_Jp), 2);
+                auto s = _residual(t, _z_trial, _r_trial);
+                if (s == fmi2_status_fatal) {
+                    return s;
+                }
+                auto rho = _failed(s) || predicted <= 0.0
+                               ? -1.0
+                               : (r_norm * r_norm
+                                  - std::pow(_norm2(_r_trial), 2))
+                                     / predicted;
+                if (rho < 0.25) {
+                    radius = 0.25 * p_norm;
+                } else if (rho > 0.75 && p_norm >= 0.99 * radius) {
+                    radius = 2.0 * radius;
+                }
+                if (rho > 1e-4) {
+                    _z.swap(_z_trial);
+                    _r.swap(_r_trial);
+                    break;
+                }
+            }
+        }
+    }
+
+    /**
+     * @brief States of the last solve, all of them
+     */
+    const std::vector<fmi2_real_t> &states() const noexcept
+    {
+        return _x;
+    }
+
+    /**
+     * @brief Values of the free variables of the last solve
+     */
+    const std::vector<fmi2_real_t> &free_values() const noexcept
+    {
+        return _u;
+    }
+
+    /**
+     * @brief Largest scaled residual of the last solve
+     */
+    fmi2_real_t residual_norm() const noexcept
+    {
+        return _residual_norm;
+    }
+
+    /**
+     * @brief Jacobian evaluations of the last solve
+     */
+    int iterations() const noexcept
+    {
+        return _iterations;
+    }
+
+    /**
+     * @brief Pattern of the residual Jacobian, rows derivatives then
+     * constraints, columns free states then free variables
+     */
+    const sparsity_pattern_t &pattern() const noexcept
+    {
+        return _pattern;
+    }
+
+    const integrator_stats_t &stats() const noexcept
+    {
+        return _sys.stats;
+    }
+
+    me_system_t<model_t> &system() noexcept
+    {
+        return _sys;
+    }
+};
+} // namespace fmilib
@@ -5,10 +5,33 @@
 #endif
 
 #include <filesystem>
+#include <functional>
+#include <memory>
 #include <string>
 
 #include <catch.hpp>
 #include <fmilib.hpp>
+#include <fmilib/bdf.hpp>
+#ifdef FMILIB_WITH_SUNDIALS
+#include <fmilib/cvode.hpp>
+#endif
+#include <fmilib/dopri45.hpp>
+#include <fmilib/ensemble.hpp>
+#include <fmilib/event_driver.hpp>
+#include <fmilib/event_locator.hpp>
+#include <fmilib/integrator.hpp>
+#include <fmilib/jacobian.hpp>
+#include <fmilib/krylov.hpp>
+#include <fmilib/linearize.hpp>
+#include <fmilib/multirate.hpp>
+#include <fmilib/ode_problem.hpp>
+#include <fmilib/output_grid.hpp>
+#include <fmilib/parallel_jacobian.hpp>
+#include <fmilib/parareal.hpp>
+#include <fmilib/qss.hpp>
+#include <fmilib/sensitivity.hpp>
+#include <fmilib/switching.hpp>
+#include <fmilib/trim.hpp>
 
 namespace fs = std::filesystem;
 
@@ -23,6 +46,71 @@ fmi2_callback_functions_t fmu_cb
 jm_callbacks jm_cb
     = {malloc, calloc, realloc, free, jm_default_logger, jm_log_level_debug,
        nullptr};
+
+/* extraction directory of the FMU under test */
+std::string extraction_dir()
+{
+    auto ext_dir = fs::path(temp_dir) / id;
+    fs::create_directory(ext_dir);
+    REQUIRE(fs::exists(fmu_path));
+    return ext_dir.string();
+}
+
+/* how far `instance_t` takes the FMU under test */
+enum class start_t
+{
+    event_mode,     // initialized, before the first event iteration
+    continuous_time // through the event iteration at t = 0
+};
+
+/* model exchange instance of the FMU under test, terminated and freed on
+   scope exit; `configure` runs between instantiation and setup */
+class instance_t : public fmilib::fmi2_me_t
+{
+public:
+    explicit instance_t(
+        start_t start = start_t::continuous_time, fmi2_real_t stop_time = 1.0,
+        const std::function<void(fmilib::fmi2_me_t &)> &configure = {})
+        : fmilib::fmi2_me_t{fmu_path, extraction_dir(), ::fmu_cb, ::jm_cb,
+                            _extracted}
+    {
+        _extracted = true;
+        REQUIRE(jm_status_success
+                == instantiate(id.c_str(), fmi2_model_exchange, "",
+                               fmi2_false));
+        if (configure) {
+            configure(*this);
+        }
+        REQUIRE(fmi2_status_ok
+                == setup_experiment(fmi2_true, 1e-05, 0.0, fmi2_true,
+                                    stop_time));
+        REQUIRE(fmi2_status_ok == enter_initialization_mode());
+        REQUIRE(fmi2_status_ok == exit_initialization_mode());
+        if (start == start_t::event_mode) {
+            return;
+        }
+        fmi2_event_info_t event_info{};
+        event_info.newDiscreteStatesNeeded = fmi2_true;
+        while (event_info.newDiscreteStatesNeeded
+               && !event_info.terminateSimulation) {
+            REQUIRE(fmi2_status_ok == new_discrete_states(&event_info));
+        }
+        REQUIRE(fmi2_status_ok == enter_continuous_time_mode());
+    }
+
+    instance_t(const instance_t &) = delete;
+    instance_t &operator=(const instance_t &) = delete;
+
+    ~instance_t()
+    {
+        terminate();
+        free_instance();
+    }
+
+private:
+    // the first instance extracts the FMU, later ones reuse it
+    inline static bool _extracted = false;
+};
 } // namespace
 
 TEST_CASE("fmu2_me_t ctor", "[.]")
@@ -210,6 +298,942 @@ TEST_CASE("State Machine of Calling Sequence: CoupledClutches",
         m.terminate();
         m.free_instance();
     }
+
+    SECTION("Do euler integration through the direct fast path")
+    {
+        fmilib::fmi2_direct_me_t m{fmu_path, ext_dir.string(), ::fmu_cb,
+                                   ::jm_cb};
+        fmi2_event_info_t event_info{fmi2_true,  fmi2_false, fmi2_false,
+                                     fmi2_false, fmi2_false, -0.0};
+
+        REQUIRE(jm_status_success
+                == m.instantiate(id.c_str(), fmi2_model_exchange, nullptr,
+                                 fmi2_false));
+        REQUIRE(m.component() != nullptr);
+        REQUIRE(fmi2_status_ok
+                == m.setup_experiment(fmi2_true, 1e-05, 0.0, fmi2_true, 1.0));
+        REQUIRE(fmi2_status_ok == m.enter_initialization_mode());
+        REQUIRE(fmi2_status_ok == m.exit_initialization_mode());
+
+        event_info.newDiscreteStatesNeeded = fmi2_true;
+        while (event_info.newDiscreteStatesNeeded
+               && !event_info.terminateSimulation) {
+            CHECK(fmi2_status_ok == m.new_discrete_states(&event_info));
+        }
+        CHECK(0.4 == Approx(event_info.nextEventTime));
+        CHECK(fmi2_status_ok == m.enter_continuous_time_mode());
+
+        const auto h = 0.001;
+        std::vector<double> x(m.number_of_continuous_states());
+        std::vector<double> x_dot(m.number_of_continuous_states());
+        CHECK(fmi2_status_ok == m.get_continuous_states(x));
+        for (int i = 0; i < 400; ++i) {
+            CHECK(fmi2_status_ok == m.set_time(i * h));
+            CHECK(fmi2_status_ok == m.get_derivatives(x_dot));
+            for (decltype(x.size()) j = 0; j < x.size(); ++j) {
+                x[j] += h * x_dot[j];
+            }
+            CHECK(fmi2_status_ok == m.set_continuous_states(x));
+        }
+
+        m.terminate();
+        m.free_instance();
+        CHECK(m.component() == nullptr);
+    }
+
+    SECTION("Strict checking, call counting and throwing policies")
+    {
+        fmilib::fmi2_t<true, fmilib::strict_check_t, fmilib::count_trace_t,
+                       fmilib::name_cache_t, fmilib::throw_on_error_t>
+            m{fmu_path, ext_dir.string(), ::fmu_cb, ::jm_cb};
+
+        REQUIRE(
+            jm_status_success
+            == m.instantiate(id.c_str(), fmi2_model_exchange, "", fmi2_false));
+        REQUIRE(fmi2_status_ok
+                == m.setup_experiment(fmi2_true, 1e-05, 0.0, fmi2_true, 1.0));
+        REQUIRE(fmi2_status_ok == m.enter_initialization_mode());
+        REQUIRE(fmi2_status_ok == m.exit_initialization_mode());
+
+        fmi2_real_t J1 = 0.0;
+        CHECK(fmi2_status_ok == m.get_real("J1.J", J1));
+        CHECK(fmi2_status_ok == m.get_real("J1.J", J1));
+        CHECK_THROWS_AS(m.get_real("not.a.variable", J1),
+                        fmilib::fmi2_error_t);
+
+        std::vector<double> x_dot(m.number_of_continuous_states() + 1);
+        CHECK_THROWS_AS(m.get_derivatives(x_dot), fmilib::fmi2_error_t);
+        CHECK(2 == m.trace().calls(fmilib::fmi2_call_t::get_real));
+        CHECK(0 == m.trace().calls(fmilib::fmi2_call_t::get_derivatives));
+        CHECK(1 == m.trace().calls(fmilib::fmi2_call_t::instantiate));
+
+        m.terminate();
+        m.free_instance();
+    }
+}
+
+TEST_CASE("Fixed-step explicit integrators: CoupledClutches",
+          "[.][CoupledClutches]")
+{
+    const auto h = 0.001;
+    const auto t_end = 0.4;
+
+    // reference: the hand written loop
+    std::vector<double> x, x_dot;
+    {
+        instance_t ref;
+        auto nx = ref.number_of_continuous_states();
+        x.resize(nx);
+        x_dot.resize(nx);
+        for (int i = 0; i < 400; ++i) {
+            REQUIRE(fmi2_status_ok == ref.set_time(i * h));
+            REQUIRE(fmi2_status_ok == ref.get_continuous_states(x));
+            REQUIRE(fmi2_status_ok == ref.get_derivatives(x_dot));
+            for (decltype(x.size()) j = 0; j < x.size(); ++j) {
+                x[j] += h * x_dot[j];
+            }
+            REQUIRE(fmi2_status_ok == ref.set_continuous_states(x));
+        }
+    }
+
+    SECTION("Euler driver reproduces the hand loop")
+    {
+        instance_t m;
+        fmilib::fixed_step_integrator_t<fmilib::fmi2_me_t> euler{
+            m, fmilib::explicit_method_t::euler, h};
+        REQUIRE(fmi2_status_ok == euler.reset(0.0));
+        CHECK(fmi2_status_ok == euler.integrate(t_end));
+
+        CHECK(t_end == Approx(euler.time()));
+        CHECK(400 == euler.stats().steps);
+        CHECK(400 == euler.stats().derivative_evaluations);
+        for (decltype(x.size()) j = 0; j < x.size(); ++j) {
+            CHECK(x[j] == Approx(euler.states()[j]));
+        }
+    }
+
+    SECTION("Heun and RK4 agree with a fine Euler solution")
+    {
+        for (auto method :
+             {fmilib::explicit_method_t::heun, fmilib::explicit_method_t::rk4}) {
+            instance_t m;
+            fmilib::fixed_step_integrator_t<fmilib::fmi2_me_t> rk{m, method,
+                                                                  0.01};
+            fmilib::trajectory_t result;
+            REQUIRE(fmi2_status_ok == rk.reset(0.0));
+            CHECK(fmi2_status_ok == rk.integrate(t_end, result));
+            CHECK(40 == result.size());
+            for (decltype(x.size()) j = 0; j < x.size(); ++j) {
+                CHECK(x[j] == Approx(rk.states()[j]).epsilon(1e-2));
+            }
+        }
+    }
+}
+
+TEST_CASE("Variable-step work-precision: CoupledClutches",
+          "[.][CoupledClutches]")
+{
+    const auto t_end = 0.4;
+
+    // reference: RK4 with a tiny step
+    std::vector<double> x_ref;
+    {
+        instance_t ref;
+        fmilib::fixed_step_integrator_t<fmilib::fmi2_me_t> rk4{
+            ref, fmilib::explicit_method_t::rk4, 1e-5};
+        REQUIRE(fmi2_status_ok == rk4.reset(0.0));
+        REQUIRE(fmi2_status_ok == rk4.integrate(t_end));
+        x_ref = rk4.states();
+    }
+
+    auto error = [&](const std::vector<double> &x) {
+        double e = 0.0;
+        for (decltype(x.size()) j = 0; j < x.size(); ++j) {
+            e = std::max(e, std::abs(x[j] - x_ref[j])
+                                / std::max(1.0, std::abs(x_ref[j])));
+        }
+        return e;
+    };
+
+    // tighter tolerances cost more derivative evaluations
+    size_t work = 0;
+    for (auto tol : {1e-3, 1e-5, 1e-7}) {
+        instance_t m;
+        fmilib::dopri45_integrator_t<fmilib::fmi2_me_t> dp{m, tol};
+        REQUIRE(fmi2_status_ok == dp.reset(0.0));
+        CHECK(fmi2_status_ok == dp.integrate(t_end));
+        CHECK(t_end == Approx(dp.time()));
+        CHECK(error(dp.states()) < 100 * tol);
+        CHECK(dp.stats().rejected_steps < dp.stats().steps);
+        CHECK(dp.stats().derivative_evaluations > work);
+        work = dp.stats().derivative_evaluations;
+    }
+
+    work = 0;
+    for (auto tol : {1e-3, 1e-5, 1e-7}) {
+        instance_t m;
+        fmilib::bdf_integrator_t<fmilib::fmi2_me_t> bdf{m, tol};
+        REQUIRE(fmi2_status_ok == bdf.reset(0.0));
+        CHECK(fmi2_status_ok == bdf.integrate(t_end));
+        CHECK(t_end == Approx(bdf.time()));
+        CHECK(error(bdf.states()) < 1000 * tol);
+        CHECK(bdf.stats().factorizations > 0);
+        CHECK(bdf.stats().steps >= work);
+        work = bdf.stats().steps;
+
+        // a step to the current time is empty and the driver goes on
+        CHECK(fmi2_status_ok == bdf.step(bdf.time()));
+        CHECK(bdf.stats().steps == work);
+        CHECK(fmi2_status_ok == bdf.integrate(t_end + 0.05));
+        CHECK(t_end + 0.05 == Approx(bdf.time()));
+    }
+
+    for (auto tol : {1e-3, 1e-5, 1e-7}) {
+        instance_t m;
+        fmilib::switching_integrator_t<fmilib::fmi2_me_t> sw{m, tol};
+        REQUIRE(fmi2_status_ok == sw.reset(0.0));
+        CHECK(fmi2_status_ok == sw.integrate(t_end));
+        CHECK(t_end == Approx(sw.time()));
+        CHECK(error(sw.states()) < 1000 * tol);
+        CHECK(sw.switch_stats().stiff_steps <= sw.stats().steps);
+        CHECK(sw.switch_stats().to_nonstiff <= sw.switch_stats().to_stiff);
+    }
+
+    for (auto h : {1e-2, 1e-3, 1e-4}) {
+        instance_t m;
+        fmilib::fixed_step_integrator_t<fmilib::fmi2_me_t> fixed{
+            m, fmilib::explicit_method_t::rk4, h};
+        REQUIRE(fmi2_status_ok == fixed.reset(0.0));
+        CHECK(fmi2_status_ok == fixed.integrate(t_end));
+        CHECK(fixed.stats().derivative_evaluations
+              == 4 * fixed.stats().steps);
+    }
+}
+
+TEST_CASE("Sparse LU in the BDF driver: CoupledClutches",
+          "[.][CoupledClutches]")
+{
+    const auto t_end = 0.4;
+    std::vector<std::vector<double>> states;
+    for (auto sparse : {false, true}) {
+        instance_t m;
+        fmilib::bdf_integrator_t<fmilib::fmi2_me_t> bdf{m, 1e-6};
+        bdf.set_sparse_linear_solver(sparse);
+        CHECK(bdf.sparse_linear_solver() == sparse);
+        REQUIRE(fmi2_status_ok == bdf.reset(0.0));
+        CHECK(fmi2_status_ok == bdf.integrate(t_end));
+        CHECK(bdf.jacobian().empty() == sparse);
+        CHECK(bdf.stats().factorizations > 0);
+        states.push_back(bdf.states());
+    }
+    for (decltype(states[0].size()) i = 0; i < states[0].size(); ++i) {
+        CHECK(states[1][i] == Approx(states[0][i]).margin(1e-8));
+    }
+}
+
+TEST_CASE("Newton-Krylov in the BDF driver: CoupledClutches",
+          "[.][CoupledClutches]")
+{
+    using fmilib::krylov_method_t;
+    using fmilib::preconditioner_kind_t;
+    const auto t_end = 0.4;
+    std::vector<std::vector<double>> states;
+    const std::vector<std::pair<krylov_method_t, preconditioner_kind_t>>
+        configurations{
+            {krylov_method_t::none, preconditioner_kind_t::none},
+            {krylov_method_t::gmres, preconditioner_kind_t::none},
+            {krylov_method_t::gmres, preconditioner_kind_t::ilu0},
+            {krylov_method_t::bicgstab, preconditioner_kind_t::jacobi}};
+    for (auto [method, preconditioner] : configurations) {
+        instance_t m;
+        fmilib::bdf_integrator_t<fmilib::fmi2_me_t> bdf{m, 1e-6};
+        bdf.set_krylov_solver(method, preconditioner);
+        CHECK(bdf.krylov_solver() == method);
+        REQUIRE(fmi2_status_ok == bdf.reset(0.0));
+        CHECK(fmi2_status_ok == bdf.integrate(t_end));
+        states.push_back(bdf.states());
+        const auto &stats = bdf.stats();
+        if (method != krylov_method_t::none) {
+            CHECK(stats.krylov_iterations > 0);
+            CHECK(stats.jacobian_vector_products > 0);
+            CHECK(bdf.jacobian().empty());
+        } else {
+            CHECK(stats.krylov_iterations == 0);
+            CHECK(stats.jacobian_vector_products == 0);
+        }
+        if (preconditioner == preconditioner_kind_t::none) {
+            // matrix-free unless the direct solver needs J
+            CHECK((stats.jacobian_evaluations == 0)
+                  == (method != krylov_method_t::none));
+        }
+    }
+    for (size_t k = 1; k < states.size(); ++k) {
+        for (size_t i = 0; i < states[0].size(); ++i) {
+            CHECK(states[k][i] == Approx(states[0][i]).margin(1e-6));
+        }
+    }
+}
+
+TEST_CASE("State event location: CoupledClutches", "[.][CoupledClutches]")
+{
+    const auto t_end = 1.5;
+
+    // event times seen by one driver
+    auto run = [&](auto &driver, fmilib::fmi2_me_t &m) {
+        std::vector<double> events;
+        fmi2_event_info_t event_info{};
+        fmilib::event_locator_t<fmilib::fmi2_me_t> locator{driver.system()};
+        REQUIRE(fmi2_status_ok == driver.reset(0.0));
+        REQUIRE(fmi2_status_ok == locator.start());
+        while (driver.time() < t_end) {
+            REQUIRE(fmi2_status_ok == driver.step(t_end));
+            bool found = false;
+            REQUIRE(fmi2_status_ok == locator.check(driver, found));
+            if (!found) {
+                continue;
+            }
+            CHECK(locator.event_time() <= driver.time());
+            CHECK(locator.event_time() >= driver.previous_time());
+            events.push_back(locator.event_time());
+            REQUIRE(fmi2_status_ok == m.enter_event_mode());
+            event_info.newDiscreteStatesNeeded = fmi2_true;
+            while (event_info.newDiscreteStatesNeeded) {
+                REQUIRE(fmi2_status_ok == m.new_discrete_states(&event_info));
+            }
+            REQUIRE(fmi2_status_ok == m.enter_continuous_time_mode());
+            REQUIRE(fmi2_status_ok == driver.reset(locator.event_time()));
+            REQUIRE(fmi2_status_ok == locator.start());
+        }
+        return events;
+    };
+
+    std::vector<double> dp_events, bdf_events;
+    {
+        instance_t m;
+        fmilib::dopri45_integrator_t<fmilib::fmi2_me_t> dp{m, 1e-7};
+        dp_events = run(dp, m);
+        CHECK(dp.stats().indicator_evaluations >= dp.stats().steps);
+    }
+    {
+        instance_t m;
+        fmilib::bdf_integrator_t<fmilib::fmi2_me_t> bdf{m, 1e-7};
+        bdf_events = run(bdf, m);
+    }
+
+    REQUIRE(!dp_events.empty());
+    REQUIRE(dp_events.size() == bdf_events.size());
+    for (decltype(dp_events.size()) i = 0; i < dp_events.size(); ++i) {
+        CHECK(dp_events[i] == Approx(bdf_events[i]).margin(1e-4));
+    }
+}
+
+TEST_CASE("Event-iteration driver: CoupledClutches", "[.][CoupledClutches]")
+{
+    const auto t_end = 1.5;
+
+    instance_t m1{start_t::event_mode, t_end};
+    fmilib::dopri45_integrator_t<fmilib::fmi2_me_t> dp{m1, 1e-7};
+    fmilib::event_driver_t<decltype(dp)> dp_events{dp};
+    REQUIRE(fmi2_status_ok == dp_events.initialize(0.0));
+    REQUIRE(fmi2_status_ok == dp_events.integrate(t_end));
+    CHECK(t_end == Approx(dp.time()));
+    CHECK(dp.stats().state_events > 0);
+    CHECK(dp.stats().event_iterations >= dp.stats().state_events);
+    CHECK(dp.stats().completed_integrator_steps <= dp.stats().steps);
+
+    instance_t m2{start_t::event_mode, t_end};
+    fmilib::bdf_integrator_t<fmilib::fmi2_me_t> bdf{m2, 1e-7};
+    fmilib::event_driver_t<decltype(bdf)> bdf_events{bdf};
+    REQUIRE(fmi2_status_ok == bdf_events.initialize(0.0));
+    REQUIRE(fmi2_status_ok == bdf_events.integrate(t_end));
+    CHECK(t_end == Approx(bdf.time()));
+    CHECK(bdf.stats().state_events == dp.stats().state_events);
+    for (decltype(dp.states().size()) i = 0; i < dp.states().size(); ++i) {
+        CHECK(dp.states()[i] == Approx(bdf.states()[i]).margin(1e-3));
+    }
+}
+
+TEST_CASE("Colored sparse Jacobian: CoupledClutches", "[.][CoupledClutches]")
+{
+    instance_t m;
+    fmilib::me_system_t<fmilib::fmi2_me_t> sys{m};
+    auto n = sys.size();
+    std::vector<double> x(n);
+    REQUIRE(fmi2_status_ok == sys.read_states(x.data()));
+
+    fmilib::sparse_jacobian_t<fmilib::fmi2_me_t> sparse{sys};
+    fmilib::sparse_jacobian_t<fmilib::fmi2_me_t> dense{sys, true, false};
+    CHECK(sparse.coloring().colors <= n);
+    CHECK(dense.coloring().colors == n);
+    CHECK(sparse.pattern().nnz() <= n * n);
+    REQUIRE(fmi2_status_ok == sparse.evaluate(0.0, x.data()));
+    REQUIRE(fmi2_status_ok == dense.evaluate(0.0, x.data()));
+    std::vector<double> a(n * n), b(n * n);
+    sparse.to_dense(a.data());
+    dense.to_dense(b.data());
+    for (decltype(a.size()) i = 0; i < a.size(); ++i) {
+        CHECK(a[i] == Approx(b[i]).margin(1e-8));
+    }
+}
+
+TEST_CASE("Parallel finite difference Jacobian: CoupledClutches",
+          "[.][CoupledClutches]")
+{
+    instance_t m;
+    if (!m.capability(fmi2_me_canGetAndSetFMUstate)
+        || !m.capability(fmi2_me_canSerializeFMUstate)) {
+        WARN("FMU cannot serialize its state");
+        return;
+    }
+    std::vector<std::unique_ptr<instance_t>> workers;
+    std::vector<fmilib::fmi2_me_t *> worker_ptrs;
+    for (int k = 0; k < 3; ++k) {
+        workers.push_back(std::make_unique<instance_t>());
+        worker_ptrs.push_back(workers.back().get());
+    }
+
+    fmilib::me_system_t<fmilib::fmi2_me_t> sys{m};
+    std::vector<double> x(sys.size());
+    REQUIRE(fmi2_status_ok == sys.read_states(x.data()));
+    for (auto &xi : x) {
+        xi += 0.1;
+    }
+
+    fmilib::sparse_jacobian_t<fmilib::fmi2_me_t> serial{sys, false};
+    fmilib::parallel_fd_jacobian_t<fmilib::fmi2_me_t> parallel{sys,
+                                                               worker_ptrs};
+    CHECK(parallel.lanes() == 4);
+    REQUIRE(fmi2_status_ok == serial.evaluate(0.1, x.data()));
+    REQUIRE(fmi2_status_ok == parallel.evaluate(0.1, x.data()));
+    REQUIRE(serial.values().size() == parallel.values().size());
+    for (decltype(x.size()) i = 0; i < serial.values().size(); ++i) {
+        CHECK(serial.values()[i] == Approx(parallel.values()[i]));
+    }
+}
+
+TEST_CASE("Output grid sampling: CoupledClutches", "[.][CoupledClutches]")
+{
+    const auto t_end = 0.4;
+    const auto dt = 1e-3;
+
+    instance_t m1;
+    auto vrs = m1.state_vrs().value();
+    fmilib::dopri45_integrator_t<fmilib::fmi2_me_t> dp{m1, 1e-7};
+    fmilib::grid_sampler_t<decltype(dp)> dp_grid{dp, vrs, 0.0, dt};
+    for (auto bad : {0.0, -dt}) {
+        CHECK_THROWS(fmilib::grid_sampler_t<decltype(dp)>{dp, vrs, 0.0, bad});
+    }
+    REQUIRE(fmi2_status_ok == dp.reset(0.0));
+    REQUIRE(fmi2_status_ok == dp.integrate(t_end, dp_grid));
+    CHECK(fmi2_status_ok == dp_grid.status());
+
+    instance_t m2;
+    fmilib::fixed_step_integrator_t<fmilib::fmi2_me_t> rk4{
+        m2, fmilib::explicit_method_t::rk4, 1e-4};
+    fmilib::grid_sampler_t<decltype(rk4)> rk4_grid{rk4, vrs, 0.0, dt};
+    REQUIRE(fmi2_status_ok == rk4.reset(0.0));
+    REQUIRE(fmi2_status_ok == rk4.integrate(t_end, rk4_grid));
+
+    // the solver step sequence is not tied to the grid
+    REQUIRE(dp_grid.size() == rk4_grid.size());
+    CHECK(dp_grid.size() > dp.stats().steps);
+    for (size_t i = 0; i < dp_grid.size(); ++i) {
+        CHECK(dp_grid.t[i] == Approx(rk4_grid.t[i]));
+        for (size_t j = 0; j < vrs.size(); ++j) {
+            CHECK(dp_grid.row(i)[j] == Approx(rk4_grid.row(i)[j]).margin(1e-5));
+        }
+    }
+}
+
+TEST_CASE("Lockstep ensemble: CoupledClutches", "[.][CoupledClutches]")
+{
+    const auto t_end = 0.1;
+    const size_t members = 4;
+
+    // member k starts from the initial states scaled by 1 + k / 10
+    auto scale = [](fmilib::fmi2_me_t &m, size_t k) {
+        auto n = m.number_of_continuous_states();
+        std::vector<double> x(n);
+        REQUIRE(fmi2_status_ok == m.get_continuous_states(x.data(), n));
+        for (auto &xi : x) {
+            xi *= 1.0 + 0.1 * k;
+        }
+        REQUIRE(fmi2_status_ok == m.set_continuous_states(x.data(), n));
+    };
+
+    std::vector<std::unique_ptr<instance_t>> instances;
+    std::vector<fmilib::fmi2_me_t *> ptrs;
+    for (size_t k = 0; k < members; ++k) {
+        instances.push_back(std::make_unique<instance_t>());
+        scale(*instances.back(), k);
+        ptrs.push_back(instances.back().get());
+    }
+    fmilib::ensemble_dopri45_t<fmilib::fmi2_me_t> ensemble{ptrs, 1e-7};
+    REQUIRE(ensemble.size() == members);
+    REQUIRE(fmi2_status_ok == ensemble.reset(0.0));
+    REQUIRE(fmi2_status_ok == ensemble.integrate(t_end));
+
+    // every member follows the trajectory of a single driver
+    for (size_t k = 0; k < members; ++k) {
+        instance_t m;
+        scale(m, k);
+        fmilib::dopri45_integrator_t<fmilib::fmi2_me_t> dp{m, 1e-7};
+        REQUIRE(fmi2_status_ok == dp.reset(0.0));
+        REQUIRE(fmi2_status_ok == dp.integrate(t_end));
+        CHECK(ensemble.time(k) == Approx(dp.time()));
+        CHECK(ensemble.stats(k).steps > 0);
+        for (size_t i = 0; i < ensemble.states_size(); ++i) {
+            CHECK(ensemble.state(k, i)
+                  == Approx(dp.states()[i]).margin(1e-5));
+        }
+    }
+}
+
+TEST_CASE("Lockstep ensemble step size underflow: CoupledClutches",
+          "[.][CoupledClutches]")
+{
+    const size_t members = 4;
+
+    // member k starts from the initial states scaled by 1 + k
+    std::vector<std::unique_ptr<instance_t>> instances;
+    std::vector<fmilib::fmi2_me_t *> ptrs;
+    for (size_t k = 0; k < members; ++k) {
+        instances.push_back(std::make_unique<instance_t>());
+        auto &m = *instances.back();
+        auto n = m.number_of_continuous_states();
+        std::vector<double> x(n);
+        REQUIRE(fmi2_status_ok == m.get_continuous_states(x.data(), n));
+        for (auto &xi : x) {
+            xi *= 1.0 + k;
+        }
+        REQUIRE(fmi2_status_ok == m.set_continuous_states(x.data(), n));
+        ptrs.push_back(&m);
+    }
+    fmilib::ensemble_dopri45_t<fmilib::fmi2_me_t> ensemble{ptrs, 1e-7};
+    REQUIRE(fmi2_status_ok == ensemble.reset(0.0));
+    for (int k = 0; k < 50; ++k) {
+        REQUIRE(fmi2_status_ok == ensemble.step(1.0));
+    }
+
+    // twice the smallest step size is too large for that member, its
+    // next rejection underflows while the others keep going
+    auto h_min = ensemble.step_size(0);
+    for (size_t k = 1; k < members; ++k) {
+        h_min = std::min(h_min, ensemble.step_size(k));
+    }
+    ensemble.set_step_limits(2.0 * h_min, 1.0);
+
+    std::vector<double> t(members);
+    std::vector<double> x;
+    auto s = fmi2_status_ok;
+    for (int attempt = 0; attempt < 1000 && s == fmi2_status_ok; ++attempt) {
+        for (size_t k = 0; k < members; ++k) {
+            t[k] = ensemble.time(k);
+        }
+        x = ensemble.states();
+        s = ensemble.step(1.0);
+    }
+    if (s != fmi2_status_error) {
+        WARN("no step size underflow");
+        return;
+    }
+
+    // a member that advanced in the failing attempt committed its states
+    for (size_t k = 0; k < members; ++k) {
+        if (ensemble.time(k) == t[k]) {
+            continue;
+        }
+        auto moved = false;
+        for (size_t i = 0; i < ensemble.states_size(); ++i) {
+            moved = moved || ensemble.state(k, i) != x[i * members + k];
+        }
+        CHECK(moved);
+    }
+}
+
+TEST_CASE("Multirate integration: CoupledClutches", "[.][CoupledClutches]")
+{
+    const auto t_end = 0.1;
+
+    instance_t m1;
+    fmilib::dopri45_integrator_t<fmilib::fmi2_me_t> dp{m1, 1e-9};
+    REQUIRE(fmi2_status_ok == dp.reset(0.0));
+    REQUIRE(fmi2_status_ok == dp.integrate(t_end));
+
+    // the first state alone is refined with micro steps
+    instance_t m2;
+    fmilib::multirate_integrator_t<fmilib::fmi2_me_t> mr{m2, 1e-7, {0}};
+    REQUIRE(mr.fast().size() == 1);
+    REQUIRE(mr.slow().size() + 1 == dp.states().size());
+    REQUIRE(fmi2_status_ok == mr.reset(0.0));
+    REQUIRE(fmi2_status_ok == mr.integrate(t_end));
+    CHECK(mr.time() == Approx(dp.time()));
+    for (size_t i = 0; i < dp.states().size(); ++i) {
+        CHECK(mr.states()[i] == Approx(dp.states()[i]).margin(1e-5));
+    }
+    CHECK(mr.multirate_stats().fast_steps >= mr.stats().steps);
+
+    // automatic partition from the state Jacobian
+    fmilib::me_system_t<fmilib::fmi2_me_t> sys{m1};
+    auto fast = fmilib::fast_states(sys, dp.time(), dp.states().data());
+    for (auto i : fast) {
+        CHECK(i < dp.states().size());
+    }
+}
+
+TEST_CASE("Quantized state system: CoupledClutches", "[.][CoupledClutches]")
+{
+    const auto t_end = 1.5;
+
+    instance_t m1{start_t::event_mode, t_end};
+    fmilib::dopri45_integrator_t<fmilib::fmi2_me_t> dp{m1, 1e-8};
+    fmilib::event_driver_t<decltype(dp)> dp_events{dp};
+    REQUIRE(fmi2_status_ok == dp_events.initialize(0.0));
+    REQUIRE(fmi2_status_ok == dp_events.integrate(t_end));
+
+    for (unsigned order : {2u, 3u}) {
+        instance_t m{start_t::event_mode, t_end};
+        fmilib::qss_integrator_t<fmilib::fmi2_me_t> qss{m, order, 1e-6};
+        fmilib::event_driver_t<decltype(qss)> qss_events{qss};
+        REQUIRE(fmi2_status_ok == qss_events.initialize(0.0));
+        REQUIRE(fmi2_status_ok == qss_events.integrate(t_end));
+        CHECK(t_end == Approx(qss.time()));
+        CHECK(qss.stats().state_events == dp.stats().state_events);
+        CHECK(qss.stats().derivative_evaluations >= qss.stats().steps);
+        for (size_t i = 0; i < dp.states().size(); ++i) {
+            CHECK(qss.states()[i]
+                  == Approx(dp.states()[i]).epsilon(1e-3).margin(1e-3));
+        }
+    }
+}
+
+TEST_CASE("Forward sensitivities: CoupledClutches", "[.][CoupledClutches]")
+{
+    // before the first clutch engages at 0.4
+    const auto t_end = 0.3;
+
+    // states at t_end with J1.J = `value`, and dx/dJ1.J if `sensitivities`
+    auto simulate = [&](fmi2_real_t value, bool sensitivities,
+                        std::vector<fmi2_real_t> &s) {
+        instance_t m{start_t::continuous_time, 1.0,
+                     [&](fmilib::fmi2_me_t &fmu) {
+                         if (value > 0.0) {
+                             REQUIRE(fmi2_status_ok
+                                     == fmu.set_real("J1.J", value));
+                         }
+                     }};
+        auto J1 = m.get_variable_by_name("J1.J");
+        REQUIRE(J1.has_value());
+        std::vector<fmi2_value_reference_t> vrs{J1.value().vr()};
+
+        fmilib::bdf_integrator_t<fmilib::fmi2_me_t> bdf{m, 1e-9};
+        if (sensitivities) {
+            bdf.set_sensitivity_parameters(vrs, true);
+            REQUIRE(bdf.sensitivity_size() == 1);
+        }
+        REQUIRE(fmi2_status_ok == bdf.reset(0.0));
+        REQUIRE(fmi2_status_ok == bdf.integrate(t_end));
+        CHECK(t_end == Approx(bdf.time()));
+        if (sensitivities) {
+            s = bdf.sensitivities(0);
+            CHECK(bdf.stats().sensitivity_evaluations >= bdf.stats().steps);
+        }
+        return bdf.states();
+    };
+
+    std::vector<fmi2_real_t> s, unused;
+    simulate(0.0, true, s);
+
+    // central difference of two perturbed simulations
+    fmi2_real_t J1 = 0.0;
+    {
+        instance_t m;
+        REQUIRE(fmi2_status_ok == m.get_real("J1.J", J1));
+    }
+    auto delta = 1e-4 * J1;
+    auto x_p = simulate(J1 + delta, false, unused);
+    auto x_m = simulate(J1 - delta, false, unused);
+    REQUIRE(s.size() == x_p.size());
+    for (size_t i = 0; i < s.size(); ++i) {
+        CHECK(s[i]
+              == Approx((x_p[i] - x_m[i]) / (2.0 * delta))
+                     .epsilon(1e-3)
+                     .margin(1e-4));
+    }
+}
+
+TEST_CASE("Forward sensitivities across events: CoupledClutches",
+          "[.][CoupledClutches]")
+{
+    // past the clutch events, which the parameter perturbations must not
+    // fire at rejected Newton points
+    const auto t_end = 1.5;
+
+    auto simulate = [&](bool sensitivities, size_t &state_events) {
+        instance_t m{start_t::event_mode, t_end};
+        auto J1 = m.get_variable_by_name("J1.J");
+        REQUIRE(J1.has_value());
+        fmilib::bdf_integrator_t<fmilib::fmi2_me_t> bdf{m, 1e-7};
+        if (sensitivities) {
+            bdf.set_sensitivity_parameters({J1.value().vr()});
+        }
+        fmilib::event_driver_t<decltype(bdf)> events{bdf};
+        REQUIRE(fmi2_status_ok == events.initialize(0.0));
+        REQUIRE(fmi2_status_ok == events.integrate(t_end));
+        CHECK(t_end == Approx(bdf.time()));
+        state_events = bdf.stats().state_events;
+        return bdf.states();
+    };
+
+    size_t plain_events = 0, sens_events = 0;
+    auto x = simulate(false, plain_events);
+    auto x_s = simulate(true, sens_events);
+    CHECK(plain_events > 0);
+    CHECK(sens_events == plain_events);
+    REQUIRE(x_s.size() == x.size());
+    for (size_t i = 0; i < x.size(); ++i) {
+        CHECK(x_s[i] == Approx(x[i]).margin(1e-4));
+    }
+}
+
+TEST_CASE("Trim solver: CoupledClutches", "[.][CoupledClutches]")
+{
+    instance_t m;
+    auto nx = m.number_of_continuous_states();
+
+    fmilib::trim_solver_t<fmilib::fmi2_me_t> trim{m};
+    REQUIRE(fmi2_status_ok == trim.solve(0.0));
+    CHECK(trim.residual_norm() <= 1e-8);
+    CHECK(trim.iterations() > 0);
+    CHECK(trim.pattern().nnz() > 0);
+    REQUIRE(trim.states().size() == nx);
+    std::vector<fmi2_real_t> x_dot(nx);
+    REQUIRE(fmi2_status_ok == m.get_derivatives(x_dot));
+    for (auto d : x_dot) {
+        CHECK(d == Approx(0.0).margin(1e-6));
+    }
+
+    // the FMU holds the equilibrium, a driver starts from it
+    fmilib::bdf_integrator_t<fmilib::fmi2_me_t> bdf{m, 1e-6};
+    REQUIRE(fmi2_status_ok == bdf.reset(0.0));
+    for (size_t i = 0; i < nx; ++i) {
+        CHECK(bdf.states()[i] == Approx(trim.states()[i]));
+    }
+}
+
+TEST_CASE("Sparse linearization: CoupledClutches", "[.][CoupledClutches]")
+{
+    instance_t m;
+    auto nx = m.number_of_continuous_states();
+
+    fmilib::linearizer_t<fmilib::fmi2_me_t> lin{m};
+    fmilib::linear_model_t lm;
+    REQUIRE(fmi2_status_ok == lin.linearize(0.1, lm));
+    auto nu = lin.inputs().size();
+    auto ny = lin.outputs().size();
+    CHECK(lm.A.pattern.rows == nx);
+    CHECK(lm.B.pattern.cols == nu);
+    CHECK(lm.C.pattern.rows == ny);
+    CHECK(lin.coloring().colors <= nx + nu);
+
+    // A agrees with the colored Jacobian of the derivatives
+    fmilib::me_system_t<fmilib::fmi2_me_t> sys{m};
+    std::vector<double> x(nx), a(nx * nx), jac, u(nu);
+    REQUIRE(fmi2_status_ok == sys.read_states(x.data()));
+    fmilib::dense_jacobian_t<fmilib::fmi2_me_t> dense{sys};
+    REQUIRE(fmi2_status_ok == dense.evaluate(0.1, x, jac));
+    lm.A.to_dense(a.data());
+    for (decltype(a.size()) k = 0; k < a.size(); ++k) {
+        CHECK(a[k] == Approx(jac[k]).margin(1e-6));
+    }
+
+    // many operating points on worker instances
+    if (!m.capability(fmi2_me_canGetAndSetFMUstate)
+        || !m.capability(fmi2_me_canSerializeFMUstate)) {
+        WARN("FMU cannot serialize its state");
+        return;
+    }
+    std::vector<std::unique_ptr<instance_t>> workers;
+    std::vector<fmilib::fmi2_me_t *> worker_ptrs;
+    for (int k = 0; k < 3; ++k) {
+        workers.push_back(std::make_unique<instance_t>());
+        worker_ptrs.push_back(workers.back().get());
+    }
+    fmilib::parallel_linearizer_t<fmilib::fmi2_me_t> parallel{
+        m, worker_ptrs, lin.inputs(), lin.outputs()};
+    CHECK(parallel.lanes() == 4);
+    if (nu > 0) {
+        REQUIRE(fmi2_status_ok
+                == m.get_real(lin.inputs().data(), nu, u.data()));
+    }
+    std::vector<fmilib::operating_point_t> points(10);
+    for (decltype(points.size()) k = 0; k < points.size(); ++k) {
+        points[k].t = 0.1;
+        points[k].x = x;
+        points[k].u = u;
+        for (auto &xi : points[k].x) {
+            xi += 0.01 * k;
+        }
+    }
+    std::vector<fmilib::linear_model_t> models;
+    REQUIRE(fmi2_status_ok == parallel.linearize(points, models));
+    REQUIRE(models.size() == points.size());
+    for (decltype(points.size()) k = 0; k < points.size(); ++k) {
+        REQUIRE(fmi2_status_ok == lin.linearize(points[k], lm));
+        REQUIRE(lm.A.values.size() == models[k].A.values.size());
+        for (decltype(lm.A.values.size()) q = 0; q < lm.A.values.size();
+             ++q) {
+            CHECK(lm.A.values[q] == Approx(models[k].A.values[q]));
+        }
+    }
+}
+
+TEST_CASE("ODE problem adapter: CoupledClutches", "[.][CoupledClutches]")
+{
+    instance_t m;
+    auto nx = m.number_of_continuous_states();
+
+    fmilib::ode_problem_t<fmilib::fmi2_me_t> problem{m};
+    REQUIRE(problem.size() == nx);
+    std::vector<double> x(nx), f(nx), f2(nx), v(nx, 0.0), jv(nx);
+    REQUIRE(fmi2_status_ok == problem.initial_states(x));
+
+    // the same point twice costs one evaluation
+    REQUIRE(fmi2_status_ok == problem.rhs(0.1, x, f));
+    REQUIRE(fmi2_status_ok == problem.rhs(0.1, x, f2));
+    CHECK(problem.stats().derivative_evaluations == 1);
+    CHECK(f == f2);
+
+    std::vector<double> g(problem.number_of_events());
+    REQUIRE(fmi2_status_ok == problem.events(0.1, x, g));
+
+    // columns of the Jacobian through Jacobian-vector products
+    fmilib::me_system_t<fmilib::fmi2_me_t> sys{m};
+    fmilib::dense_jacobian_t<fmilib::fmi2_me_t> dense{sys};
+    std::vector<double> jac;
+    REQUIRE(fmi2_status_ok == dense.evaluate(0.1, x, jac));
+    problem.invalidate();
+    for (decltype(nx) j = 0; j < nx; ++j) {
+        std::fill(v.begin(), v.end(), 0.0);
+        v[j] = 1.0;
+        REQUIRE(fmi2_status_ok == problem.jac_vec(0.1, x, v, jv));
+        for (decltype(nx) i = 0; i < nx; ++i) {
+            CHECK(jv[i] == Approx(jac[i * nx + j]).margin(1e-6));
+        }
+    }
+
+    // scaled derivatives are the derivatives of x / nominal
+    problem.set_scaling(true);
+    std::vector<double> z(nx), fz(nx);
+    REQUIRE(fmi2_status_ok == problem.initial_states(z));
+    REQUIRE(fmi2_status_ok == problem.rhs(0.1, z, fz));
+    for (decltype(nx) i = 0; i < nx; ++i) {
+        CHECK(z[i] * problem.nominals()[i] == Approx(x[i]));
+        CHECK(fz[i] * problem.nominals()[i] == Approx(f[i]));
+    }
+
+    // Odeint-style system function against the built-in RK4 driver
+    problem.set_scaling(false);
+    REQUIRE(fmi2_status_ok == problem.initial_states(x));
+    auto x0 = x;
+    std::vector<double> k1, k2, k3, k4, xs(nx);
+    double t = 0.0, h = 1e-3;
+    for (int step = 0; step < 10; ++step) {
+        problem(x, k1, t);
+        for (decltype(nx) i = 0; i < nx; ++i) {
+            xs[i] = x[i] + 0.5 * h * k1[i];
+        }
+        problem(xs, k2, t + 0.5 * h);
+        for (decltype(nx) i = 0; i < nx; ++i) {
+            xs[i] = x[i] + 0.5 * h * k2[i];
+        }
+        problem(xs, k3, t + 0.5 * h);
+        for (decltype(nx) i = 0; i < nx; ++i) {
+            xs[i] = x[i] + h * k3[i];
+        }
+        problem(xs, k4, t + h);
+        for (decltype(nx) i = 0; i < nx; ++i) {
+            x[i] += h / 6.0 * (k1[i] + 2.0 * (k2[i] + k3[i]) + k4[i]);
+        }
+        t += h;
+    }
+    fmilib::fixed_step_integrator_t<fmilib::fmi2_me_t> rk4{
+        m, fmilib::explicit_method_t::rk4, h};
+    REQUIRE(fmi2_status_ok == m.set_continuous_states(x0.data(), nx));
+    REQUIRE(fmi2_status_ok == rk4.reset(0.0));
+    REQUIRE(fmi2_status_ok == rk4.integrate(t));
+    for (decltype(nx) i = 0; i < nx; ++i) {
+        CHECK(x[i] == Approx(rk4.states()[i]));
+    }
+}
+
+#ifdef FMILIB_WITH_SUNDIALS
+TEST_CASE("CVODE driver: CoupledClutches", "[.][CoupledClutches]")
+{
+    const auto t_end = 1.5;
+
+    instance_t m1{start_t::event_mode, t_end};
+    fmilib::cvode_driver_t<fmilib::fmi2_me_t> cvode{m1, 1e-7};
+    fmilib::trajectory_t trajectory;
+    REQUIRE(fmi2_status_ok == cvode.initialize(0.0));
+    REQUIRE(fmi2_status_ok == cvode.integrate(t_end, trajectory));
+    CHECK(t_end == Approx(cvode.time()));
+    CHECK(cvode.stats().state_events > 0);
+    CHECK(cvode.stats().jacobian_evaluations > 0);
+    CHECK(trajectory.size() >= cvode.stats().steps);
+
+    instance_t m2{start_t::event_mode, t_end};
+    fmilib::bdf_integrator_t<fmilib::fmi2_me_t> bdf{m2, 1e-7};
+    fmilib::event_driver_t<decltype(bdf)> bdf_events{bdf};
+    REQUIRE(fmi2_status_ok == bdf_events.initialize(0.0));
+    REQUIRE(fmi2_status_ok == bdf_events.integrate(t_end));
+    CHECK(bdf.stats().state_events == cvode.stats().state_events);
+    for (decltype(bdf.states().size()) i = 0; i < bdf.states().size();
+         ++i) {
+        CHECK(cvode.states()[i] == Approx(bdf.states()[i]).margin(1e-3));
+    }
+}
+#endif
+
+TEST_CASE("Parareal: CoupledClutches", "[.][CoupledClutches]")
+{
+    const auto t_end = 1.5;
+
+    std::vector<double> serial;
+    {
+        instance_t m{start_t::event_mode, t_end};
+        if (!m.capability(fmi2_me_canGetAndSetFMUstate)
+            || !m.capability(fmi2_me_canSerializeFMUstate)) {
+            WARN("FMU cannot serialize its state");
+            return;
+        }
+        fmilib::dopri45_integrator_t<fmilib::fmi2_me_t> dp{m, 1e-7};
+        fmilib::event_driver_t<decltype(dp)> events{dp};
+        REQUIRE(fmi2_status_ok == events.initialize(0.0));
+        REQUIRE(fmi2_status_ok == events.integrate(t_end));
+        serial = dp.states();
+    }
+
+    instance_t m{start_t::event_mode, t_end};
+    std::vector<std::unique_ptr<instance_t>> instances;
+    std::vector<fmilib::fmi2_me_t *> workers;
+    for (int k = 0; k < 3; ++k) {
+        instances.push_back(
+            std::make_unique<instance_t>(start_t::continuous_time, t_end));
+        workers.push_back(instances.back().get());
+    }
+    fmilib::parareal_t<fmilib::fmi2_me_t> parareal{m, workers, 1e-3, 1e-7};
+    CHECK(parareal.lanes() == 4);
+    REQUIRE(fmi2_status_ok == parareal.initialize(0.0));
+    REQUIRE(fmi2_status_ok == parareal.integrate(t_end, 8));
+    CHECK(parareal.time() == Approx(t_end));
+    CHECK(parareal.iterations() <= 8);
+    CHECK(parareal.boundary_states().size() == 9);
+    CHECK(parareal.stats().steps > 0);
+    CHECK(parareal.coarse_stats().steps > 0);
+    for (decltype(serial.size()) i = 0; i < serial.size(); ++i) {
+        CHECK(parareal.states()[i] == Approx(serial[i]).margin(1e-4));
+    }
 }
 
 int main(int argc, char *argv[])
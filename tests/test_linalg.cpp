@@ -0,0 +1,360 @@
+#define CATCH_CONFIG_MAIN
+#ifdef _WIN32
+#define CATCH_CONFIG_WINDOWS_CRTDBG
+#endif
+
+#include <algorithm>
+#include <vector>
+
+#include <catch.hpp>
+#include <fmilib/krylov.hpp>
+#include <fmilib/linalg.hpp>
+#include <fmilib/sparse_lu.hpp>
+#include <fmilib/sparsity.hpp>
+
+TEST_CASE("dense_lu_t", "[linalg]")
+{
+    fmilib::dense_lu_t lu;
+
+    SECTION("Solve with pivoting")
+    {
+        // first pivot is zero
+        std::vector<double> a{0.0, 2.0, 1.0, //
+                              1.0, 1.0, 0.0, //
+                              3.0, 0.0, 4.0};
+        std::vector<double> x{1.0, -2.0, 3.0};
+        std::vector<double> b(3, 0.0);
+        for (size_t i = 0; i < 3; ++i) {
+            for (size_t j = 0; j < 3; ++j) {
+                b[i] += a[i * 3 + j] * x[j];
+            }
+        }
+        REQUIRE(lu.factor(a, 3));
+        lu.solve(b);
+        for (size_t i = 0; i < 3; ++i) {
+            CHECK(x[i] == Approx(b[i]));
+        }
+    }
+
+    SECTION("Singular matrix is reported")
+    {
+        std::vector<double> a{1.0, 2.0, //
+                              2.0, 4.0};
+        CHECK_FALSE(lu.factor(a, 2));
+    }
+}
+
+TEST_CASE("sparsity_pattern_t and column_coloring_t", "[linalg]")
+{
+    // tridiagonal 6 x 6 from 1-based dependency indices, row 2 depends on
+    // everything, variable 9 is not a column
+    const size_t n = 6;
+    std::vector<size_t> start{0};
+    std::vector<size_t> dependency;
+    for (size_t i = 0; i < n; ++i) {
+        if (i == 2) {
+            dependency.push_back(0);
+        } else {
+            for (size_t j = i == 0 ? 0 : i - 1; j <= std::min(i + 1, n - 1);
+                 ++j) {
+                dependency.push_back(j + 1);
+            }
+            dependency.push_back(9);
+        }
+        start.push_back(dependency.size());
+    }
+    std::vector<size_t> indices{1, 2, 3, 4, 5, 6};
+    auto p = fmilib::sparsity_pattern_t::from_dependencies(
+        n, n, start.data(), dependency.data(), fmilib::column_map(indices));
+
+    SECTION("Pattern from dependencies")
+    {
+        CHECK(p.nnz() == 3 * n - 2 + 3);
+        CHECK(p.find(0, 1) == 1);
+        CHECK(p.find(0, 2) == p.nnz());
+        CHECK(p.find(2, 5) != p.nnz());
+        CHECK(fmilib::sparsity_pattern_t::from_dependencies(
+                  n, n, nullptr, nullptr, fmilib::column_map(indices))
+                  .nnz()
+              == n * n);
+    }
+
+    SECTION("Transpose keeps positions")
+    {
+        std::vector<size_t> position;
+        auto t = p.transpose(&position);
+        for (size_t j = 0; j < t.rows; ++j) {
+            for (auto k = t.row_start[j]; k < t.row_start[j + 1]; ++k) {
+                CHECK(p.find(t.columns[k], j) == position[k]);
+            }
+        }
+    }
+
+    SECTION("Columns of one color share no row")
+    {
+        fmilib::sparsity_pattern_t tri;
+        tri.rows = n;
+        tri.cols = n;
+        tri.row_start = {0, 2, 5, 8, 11, 14, 16};
+        tri.columns = {0, 1, 0, 1, 2, 1, 2, 3, 2, 3, 4, 3, 4, 5, 4, 5};
+        auto c = fmilib::column_coloring_t::greedy(tri);
+        CHECK(c.colors == 3);
+        CHECK(fmilib::column_coloring_t::greedy(p).colors == n);
+        for (size_t i = 0; i < tri.rows; ++i) {
+            for (auto a = tri.row_start[i]; a < tri.row_start[i + 1]; ++a) {
+                for (auto b = a + 1; b < tri.row_start[i + 1]; ++b) {
+                    CHECK(c.color[tri.columns[a]] != c.color[tri.columns[b]]);
+                }
+            }
+        }
+        CHECK(c.columns.size() == n);
+        CHECK(c.color_start.back() == n);
+    }
+
+    SECTION("Selecting, stacking and dense columns")
+    {
+        auto rows = p.select_rows({2, 0});
+        CHECK(rows.rows == 2);
+        CHECK(rows.nnz() == n + 2);
+        CHECK(rows.find(0, 5) != rows.nnz());
+        CHECK(rows.find(1, 1) != rows.nnz());
+
+        auto stacked = p.stack(rows);
+        CHECK(stacked.rows == n + 2);
+        CHECK(stacked.nnz() == p.nnz() + rows.nnz());
+        CHECK(stacked.find(n + 1, 1) != stacked.nnz());
+        CHECK(stacked.find(n + 1, 2) == stacked.nnz());
+
+        stacked.add_dense_columns({5});
+        CHECK(stacked.find(0, 5) != stacked.nnz());
+        CHECK(stacked.find(n + 1, 5) != stacked.nnz());
+        CHECK(stacked.nnz() == p.nnz() + rows.nnz() + 4);
+    }
+
+    SECTION("Diagonal added with positions")
+    {
+        fmilib::sparsity_pattern_t q;
+        q.rows = 3;
+        q.cols = 3;
+        q.row_start = {0, 1, 2, 2};
+        q.columns = {1, 0};
+        std::vector<size_t> position;
+        auto d = q.with_diagonal(&position);
+        CHECK(d.nnz() == 5);
+        for (size_t i = 0; i < q.rows; ++i) {
+            CHECK(d.find(i, i) != d.nnz());
+            for (auto k = q.row_start[i]; k < q.row_start[i + 1]; ++k) {
+                CHECK(d.find(i, q.columns[k]) == position[k]);
+            }
+        }
+        CHECK(p.with_diagonal().nnz() == p.nnz());
+    }
+}
+
+TEST_CASE("sparse_lu_t", "[linalg]")
+{
+    // rows of a 2D grid Laplacian plus a one-way coupling, stored with
+    // the columns rotated by one so the diagonal is structurally zero in
+    // places and the transversal has to restore it
+    const size_t m = 8, n = m * m + 3;
+    fmilib::sparsity_pattern_t p;
+    p.rows = n;
+    p.cols = n;
+    std::vector<double> values, dense(n * n, 0.0);
+    auto column = [&](size_t j) {
+        return j < m * m ? j : (j + 1) % 3 + m * m;
+    };
+    for (size_t i = 0; i < n; ++i) {
+        std::vector<std::pair<size_t, double>> row;
+        if (i < m * m) {
+            row.emplace_back(i, 4.5);
+            if (i % m > 0) {
+                row.emplace_back(i - 1, -1.0);
+            }
+            if (i % m + 1 < m) {
+                row.emplace_back(i + 1, -1.0);
+            }
+            if (i >= m) {
+                row.emplace_back(i - m, -1.0);
+            }
+            if (i + m < m * m) {
+                row.emplace_back(i + m, -1.0);
+            }
+        } else {
+            // three decoupled scalar equations fed by the grid
+            row.emplace_back(column(i), 2.0 + static_cast<double>(i % 3));
+            row.emplace_back(i - m * m, 0.5);
+        }
+        std::sort(row.begin(), row.end());
+        for (auto &[j, v] : row) {
+            p.columns.push_back(j);
+            values.push_back(v);
+            dense[i * n + j] = v;
+        }
+        p.row_start.push_back(p.columns.size());
+    }
+    std::vector<double> b(n);
+    for (size_t i = 0; i < n; ++i) {
+        b[i] = 1.0 + 0.1 * static_cast<double>(i % 5);
+    }
+    fmilib::sparse_lu_t lu{p};
+    auto compare = [&]() {
+        fmilib::dense_lu_t d;
+        REQUIRE(d.factor(dense, n));
+        auto x = b, y = b;
+        d.solve(x);
+        lu.solve(y);
+        for (size_t i = 0; i < n; ++i) {
+            CHECK(y[i] == Approx(x[i]));
+        }
+    };
+
+    SECTION("Block triangular form")
+    {
+        CHECK(lu.size() == n);
+        // the grid and one block per scalar equation
+        CHECK(lu.blocks() == 4);
+        CHECK(fmilib::sparse_lu_t::preferred(p));
+    }
+
+    SECTION("Factor and refactor agree with dense_lu_t")
+    {
+        REQUIRE(lu.factor(values));
+        CHECK(lu.nnz_factors() < n * n / 4);
+        compare();
+        for (size_t k = 0; k < values.size(); ++k) {
+            values[k] *= 1.0 + 0.01 * static_cast<double>(k % 7);
+        }
+        for (size_t i = 0; i < n; ++i) {
+            for (auto k = p.row_start[i]; k < p.row_start[i + 1]; ++k) {
+                dense[i * n + p.columns[k]] = values[k];
+            }
+        }
+        REQUIRE(lu.refactor(values));
+        compare();
+    }
+
+    SECTION("Singular matrix is reported")
+    {
+        fmilib::sparsity_pattern_t s;
+        s.rows = 3;
+        s.cols = 3;
+        s.row_start = {0, 2, 4, 4};
+        s.columns = {0, 1, 0, 1};
+        fmilib::sparse_lu_t singular{s};
+        CHECK_FALSE(singular.factor(std::vector<double>{1.0, 2.0, 2.0, 4.0}));
+    }
+}
+
+TEST_CASE("krylov_solver_t and preconditioner_t", "[linalg]")
+{
+    // nonsymmetric convection-diffusion on a 12 x 12 grid
+    const size_t m = 12, n = m * m;
+    fmilib::sparsity_pattern_t p;
+    p.rows = n;
+    p.cols = n;
+    std::vector<double> values;
+    for (size_t i = 0; i < n; ++i) {
+        std::vector<std::pair<size_t, double>> row{{i, 4.2}};
+        if (i % m > 0) {
+            row.emplace_back(i - 1, -1.4);
+        }
+        if (i % m + 1 < m) {
+            row.emplace_back(i + 1, -0.6);
+        }
+        if (i >= m) {
+            row.emplace_back(i - m, -1.0);
+        }
+        if (i + m < n) {
+            row.emplace_back(i + m, -1.0);
+        }
+        std::sort(row.begin(), row.end());
+        for (auto &[j, v] : row) {
+            p.columns.push_back(j);
+            values.push_back(v);
+        }
+        p.row_start.push_back(p.columns.size());
+    }
+    auto multiply = [&](const double v[], double w[]) {
+        for (size_t i = 0; i < n; ++i) {
+            double sum = 0.0;
+            for (auto k = p.row_start[i]; k < p.row_start[i + 1]; ++k) {
+                sum += values[k] * v[p.columns[k]];
+            }
+            w[i] = sum;
+        }
+        return fmi2_status_ok;
+    };
+    std::vector<double> x_ref(n), b(n);
+    for (size_t i = 0; i < n; ++i) {
+        x_ref[i] = 1.0 + 0.1 * static_cast<double>(i % 5);
+    }
+    multiply(x_ref.data(), b.data());
+
+    auto solve = [&](fmilib::krylov_method_t method,
+                     fmilib::preconditioner_kind_t kind) {
+        fmilib::preconditioner_t prec{kind};
+        prec.setup(p, values.data());
+        CHECK(prec.active() == kind);
+        fmilib::krylov_solver_t krylov{method, 20};
+        std::vector<double> x(n, 0.0);
+        REQUIRE(krylov.solve(multiply,
+                             [&](double v[]) { prec.apply(v); },
+                             b.data(), x.data(), n, 1e-10, 500)
+                == fmi2_status_ok);
+        CHECK(krylov.residual_norm() <= 1e-10);
+        for (size_t i = 0; i < n; ++i) {
+            CHECK(x[i] == Approx(x_ref[i]).epsilon(1e-8));
+        }
+        return krylov.iterations();
+    };
+
+    SECTION("GMRES with restarts")
+    {
+        auto none = solve(fmilib::krylov_method_t::gmres,
+                          fmilib::preconditioner_kind_t::none);
+        auto ilu = solve(fmilib::krylov_method_t::gmres,
+                         fmilib::preconditioner_kind_t::ilu0);
+        CHECK(none > 20);
+        CHECK(ilu < none);
+    }
+
+    SECTION("BiCGStab")
+    {
+        auto jacobi = solve(fmilib::krylov_method_t::bicgstab,
+                            fmilib::preconditioner_kind_t::jacobi);
+        auto ilu = solve(fmilib::krylov_method_t::bicgstab,
+                         fmilib::preconditioner_kind_t::ilu0);
+        CHECK(ilu < jacobi);
+    }
+
+    SECTION("ILU(0) is exact on a triangular matrix")
+    {
+        fmilib::sparsity_pattern_t l;
+        l.rows = 3;
+        l.cols = 3;
+        l.row_start = {0, 1, 3, 5};
+        l.columns = {0, 0, 1, 1, 2};
+        std::vector<double> lv{2.0, 1.0, 4.0, -1.0, 0.5};
+        fmilib::preconditioner_t prec{fmilib::preconditioner_kind_t::ilu0};
+        prec.setup(l, lv.data());
+        std::vector<double> v{2.0, 5.0, -0.5};
+        prec.apply(v.data());
+        CHECK(v[0] == Approx(1.0));
+        CHECK(v[1] == Approx(1.0));
+        CHECK(v[2] == Approx(1.0));
+    }
+
+    SECTION("Missing diagonal falls back to Jacobi")
+    {
+        fmilib::sparsity_pattern_t q;
+        q.rows = 2;
+        q.cols = 2;
+        q.row_start = {0, 1, 2};
+        q.columns = {1, 1};
+        std::vector<double> qv{1.0, 2.0};
+        fmilib::preconditioner_t prec{fmilib::preconditioner_kind_t::ilu0};
+        prec.setup(q, qv.data());
+        CHECK(prec.active() == fmilib::preconditioner_kind_t::jacobi);
+    }
+}
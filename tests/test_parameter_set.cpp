@@ -0,0 +1,149 @@
+#define CATCH_CONFIG_MAIN
+#ifdef _WIN32
+#define CATCH_CONFIG_WINDOWS_CRTDBG
+#endif
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+
+#include <catch.hpp>
+#include <fmilib/parameter_set.hpp>
+
+namespace fs = std::filesystem;
+
+namespace
+{
+/** @brief Records the values set by a parameter set */
+struct recorder_t
+{
+    std::string guid = "{8c4e810f-3df3-4a00-8276-176fa3c9f000}";
+    std::map<fmi2_value_reference_t, double> values;
+    const fmi2_real_t *last_real = nullptr;
+
+    fmi2_string_t GUID() const noexcept
+    {
+        return guid.c_str();
+    }
+
+    fmi2_status_t set_real(const fmi2_value_reference_t vrs[], size_t nvr,
+                           const fmi2_real_t value[]) noexcept
+    {
+        last_real = value;
+        for (size_t i = 0; i < nvr; ++i) values[vrs[i]] = value[i];
+        return fmi2_status_ok;
+    }
+
+    fmi2_status_t set_integer(const fmi2_value_reference_t vrs[], size_t nvr,
+                              const fmi2_integer_t value[]) noexcept
+    {
+        for (size_t i = 0; i < nvr; ++i) values[vrs[i]] = value[i];
+        return fmi2_status_ok;
+    }
+
+    fmi2_status_t set_boolean(const fmi2_value_reference_t vrs[], size_t nvr,
+                              const fmi2_boolean_t value[]) noexcept
+    {
+        for (size_t i = 0; i < nvr; ++i) values[vrs[i]] = value[i];
+        return fmi2_status_ok;
+    }
+};
+} // namespace
+
+TEST_CASE("parameter_set_t", "[parameter_set]")
+{
+    recorder_t fmu;
+    auto path = (fs::temp_directory_path() / "fmilib_parameter_set.bin").string();
+
+    fmilib::parameter_set_builder_t builder{fmu.guid};
+    builder.add_real(1);
+    builder.add_real(2);
+    builder.add_integer(10);
+    builder.add_boolean(20);
+    for (int s = 0; s < 3; ++s) {
+        fmi2_real_t reals[] = {1.0 + s, 2.0 * s};
+        fmi2_integer_t integers[] = {s};
+        fmi2_boolean_t booleans[] = {s % 2};
+        builder.add_scenario(reals, integers, booleans);
+    }
+    builder.write(path);
+
+    SECTION("Round trip through the mapped file")
+    {
+        fmilib::parameter_set_t ps{path};
+        CHECK(ps.guid() == fmu.guid);
+        CHECK(ps.scenarios() == 3);
+        CHECK(ps.number_of_reals() == 2);
+        CHECK(ps.number_of_integers() == 1);
+        CHECK(ps.number_of_booleans() == 1);
+        CHECK(ps.real_values(2)[0] == 3.0);
+        CHECK(ps.real_values(2)[1] == 4.0);
+    }
+
+    SECTION("Apply passes the mapped values through")
+    {
+        fmilib::parameter_set_t ps{path};
+        REQUIRE(fmi2_status_ok == ps.apply(fmu, 1));
+        CHECK(fmu.last_real == ps.real_values(1));
+        CHECK(fmu.values[1] == 2.0);
+        CHECK(fmu.values[2] == 2.0);
+        CHECK(fmu.values[10] == 1.0);
+        CHECK(fmu.values[20] == 1.0);
+        CHECK(fmi2_status_error == ps.apply(fmu, 3));
+    }
+
+    SECTION("GUID mismatch is rejected")
+    {
+        fmilib::parameter_set_t ps{path};
+        fmu.guid = "{other}";
+        CHECK_FALSE(ps.matches(fmu));
+        CHECK(fmi2_status_error == ps.apply(fmu, 0));
+    }
+
+    SECTION("Invalid files throw")
+    {
+        CHECK_THROWS(fmilib::parameter_set_t{path + ".missing"});
+        {
+            std::ofstream out{path, std::ios::binary | std::ios::trunc};
+            out << "not a parameter set";
+        }
+        CHECK_THROWS(fmilib::parameter_set_t{path});
+    }
+
+    SECTION("Truncated files throw")
+    {
+        // keeps the magic, cuts into the header
+        fs::resize_file(path, sizeof(fmilib::parameter_set_header_t) - 1);
+        CHECK_THROWS(fmilib::parameter_set_t{path});
+        fs::resize_file(path, 8);
+        CHECK_THROWS(fmilib::parameter_set_t{path});
+    }
+
+    SECTION("Corrupt headers throw")
+    {
+        auto patch = [&](size_t offset, const void *value, size_t size) {
+            std::fstream io{path, std::ios::binary | std::ios::in
+                                      | std::ios::out};
+            io.seekp(static_cast<std::streamoff>(offset));
+            io.write(static_cast<const char *>(value),
+                     static_cast<std::streamsize>(size));
+        };
+        // the GUID size plus its terminator must not wrap around
+        uint32_t guid_size = 0xFFFFFFFF;
+        patch(offsetof(fmilib::parameter_set_header_t, guid_size), &guid_size,
+              sizeof(guid_size));
+        CHECK_THROWS(fmilib::parameter_set_t{path});
+
+        builder.write(path);
+        uint64_t offset = uint64_t{1} << 62;
+        patch(offsetof(fmilib::parameter_set_header_t, real_vr_offset),
+              &offset, sizeof(offset));
+        CHECK_THROWS(fmilib::parameter_set_t{path});
+    }
+
+    fs::remove(path);
+}
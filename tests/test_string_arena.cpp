@@ -0,0 +1,67 @@
+#define CATCH_CONFIG_MAIN
+#ifdef _WIN32
+#define CATCH_CONFIG_WINDOWS_CRTDBG
+#endif
+
+#include <string>
+#include <vector>
+
+#include <catch.hpp>
+#include <fmilib.hpp>
+
+TEST_CASE("string_arena_t", "[string_arena]")
+{
+    fmilib::string_arena_t arena{16};
+
+    SECTION("Views outlive the source strings")
+    {
+        std::string a = "clutch locked";
+        auto v = arena.intern(a.c_str());
+        a.assign("overwritten by the FMU");
+        CHECK(v == "clutch locked");
+        CHECK(v.data()[v.size()] == '\0');
+    }
+
+    SECTION("Equal strings are interned")
+    {
+        std::string a = "free", b = "free";
+        auto va = arena.intern(a.c_str());
+        auto vb = arena.intern(b.c_str());
+        CHECK(va.data() == vb.data());
+        CHECK(arena.size() == 1);
+    }
+
+    SECTION("Null strings map to empty views")
+    {
+        CHECK(arena.intern(nullptr).empty());
+        CHECK(arena.size() == 0);
+    }
+
+    SECTION("Batch capture with strings larger than a block")
+    {
+        std::string big(100, 'x');
+        std::vector<fmi2_string_t> raw{"a", big.c_str(), "a", "b"};
+        std::vector<std::string_view> out(raw.size());
+        arena.capture(raw.data(), raw.size(), out.data());
+        CHECK(out[0] == "a");
+        CHECK(out[1] == big);
+        CHECK(out[2].data() == out[0].data());
+        CHECK(out[3] == "b");
+        CHECK(arena.size() == 3);
+    }
+
+    SECTION("Clear keeps memory for the next frame")
+    {
+        for (int i = 0; i < 100; ++i) {
+            arena.intern(std::to_string(i).c_str());
+        }
+        auto capacity = arena.capacity();
+        arena.clear();
+        CHECK(arena.size() == 0);
+        for (int i = 0; i < 100; ++i) {
+            CHECK(arena.intern(std::to_string(i).c_str())
+                  == std::to_string(i));
+        }
+        CHECK(arena.capacity() == capacity);
+    }
+}
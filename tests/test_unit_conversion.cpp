@@ -0,0 +1,80 @@
+#define CATCH_CONFIG_MAIN
+#ifdef _WIN32
+#define CATCH_CONFIG_WINDOWS_CRTDBG
+#endif
+
+#include <vector>
+
+#include <catch.hpp>
+#include <fmilib.hpp>
+
+TEST_CASE("unit_conversion_t", "[unit_conversion]")
+{
+    fmilib::unit_conversion_t conv;
+    // degC with display unit degF
+    conv.push_back(0, 1.0, 273.15, 1.8, 32.0, false);
+    // temperature difference, relative quantity
+    conv.push_back(1, 1.0, 273.15, 1.8, 32.0, true);
+    // rad/s with display unit rpm
+    conv.push_back(2, 1.0, 0.0, 30.0 / 3.141592653589793, 0.0, false);
+    REQUIRE(conv.size() == 3);
+
+    std::vector<fmi2_real_t> value{100.0, 10.0, 3.141592653589793};
+    std::vector<fmi2_real_t> out(3), back(3);
+
+    SECTION("Display unit round trip")
+    {
+        conv.to_display_unit(value.data(), out.data());
+        CHECK(out[0] == Approx(212.0));
+        CHECK(out[1] == Approx(18.0));
+        CHECK(out[2] == Approx(30.0));
+        conv.from_display_unit(out.data(), back.data());
+        for (size_t i = 0; i < value.size(); ++i) {
+            CHECK(back[i] == Approx(value[i]));
+        }
+    }
+
+    SECTION("SI base unit round trip")
+    {
+        conv.to_SI_base_unit(value.data(), out.data());
+        CHECK(out[0] == Approx(373.15));
+        CHECK(out[1] == Approx(10.0));
+        CHECK(out[2] == Approx(3.141592653589793));
+        conv.from_SI_base_unit(out.data(), back.data());
+        for (size_t i = 0; i < value.size(); ++i) {
+            CHECK(back[i] == Approx(value[i]));
+        }
+    }
+
+    SECTION("In place conversion")
+    {
+        out = value;
+        conv.to_display_unit(out.data(), out.data());
+        CHECK(out[0] == Approx(212.0));
+    }
+
+    SECTION("Failed get_real leaves the values unconverted")
+    {
+        struct failing_fmu_t
+        {
+            fmi2_status_t status;
+
+            fmi2_status_t get_real(const fmi2_value_reference_t[], size_t n,
+                                   fmi2_real_t values[]) const
+            {
+                for (size_t i = 0; i < n; ++i) {
+                    values[i] = 1.0;
+                }
+                return status;
+            }
+        };
+        CHECK(conv.get_display_unit(failing_fmu_t{fmi2_status_error},
+                                    out.data())
+              == fmi2_status_error);
+        CHECK(out[0] == 1.0);
+        CHECK(conv.get_SI_base_unit(failing_fmu_t{fmi2_status_warning},
+                                    out.data())
+              == fmi2_status_warning);
+        CHECK(out[0] == Approx(274.15));
+    }
+}